@@ -531,6 +531,11 @@ static int alloc_refcount_block(BlockDriverState *bs,
         s->set_refcount(new_blocks, block++, 1);
     }
 
+    /* The new blocks and table may lie in the range that the preallocation
+     * zeroes, or will zero, because they don't come from
+     * alloc_clusters_noref(). Start over from the new end of the file. */
+    qcow2_prealloc_reset(bs);
+
     /* Write refcount blocks to disk */
     BLKDBG_EVENT(bs->file, BLKDBG_REFBLOCK_ALLOC_WRITE_BLOCKS);
     ret = bdrv_pwrite_sync(bs->file, meta_offset, new_blocks,
@@ -810,7 +815,95 @@ int qcow2_update_cluster_refcount(BlockDriverState *bs,
 /*********************************************************/
 /* cluster allocation functions */
 
+/*
+ * Preallocation of the image file
+ *
+ * With the prealloc-size option, the image file is grown with write_zeroes
+ * requests (that is, fallocate() for files) ahead of the cluster
+ * allocations, so that allocating writes do not have to wait for the host
+ * to extend the file.  Whenever less than half of the reserve is left, the
+ * next run is preallocated by a background coroutine.
+ *
+ * Clusters at or after prealloc_end may be zeroed by a preallocation run,
+ * so they are only handed out after it has completed.
+ */
+
+static void coroutine_fn prealloc_co_entry(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    BDRVQcow2State *s = bs->opaque;
+    int ret;
+
+    ret = bdrv_co_pwrite_zeroes(bs->file, s->prealloc_end,
+                                s->prealloc_target - s->prealloc_end, 0);
+    if (ret < 0) {
+        /* The image is still fine, but stop trying */
+        s->prealloc_size = 0;
+    }
+
+    s->prealloc_end = s->prealloc_target;
+    qemu_co_queue_restart_all(&s->prealloc_queue);
+}
+
+/* Wait for the background preallocation to complete, if there is one */
+void qcow2_prealloc_drain(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    while (s->prealloc_end != s->prealloc_target) {
+        if (qemu_in_coroutine()) {
+            qemu_co_queue_wait(&s->prealloc_queue);
+        } else {
+            aio_poll(bdrv_get_aio_context(bs), true);
+        }
+    }
+}
 
+/* Forget the preallocated range, e.g. after clusters were allocated without
+ * going through alloc_clusters_noref() */
+void qcow2_prealloc_reset(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    qcow2_prealloc_drain(bs);
+    s->prealloc_end = s->prealloc_target = 0;
+}
+
+/* Called whenever the clusters up to @end have been handed out */
+static void prealloc_ahead(BlockDriverState *bs, uint64_t end)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Coroutine *co;
+
+    if (!s->prealloc_size) {
+        return;
+    }
+
+    if (!s->prealloc_end) {
+        int64_t file_length = bdrv_getlength(bs->file->bs);
+        if (file_length < 0) {
+            s->prealloc_size = 0;
+            return;
+        }
+        s->prealloc_end = ROUND_UP(file_length, s->cluster_size);
+        s->prealloc_target = s->prealloc_end;
+    }
+
+    if (end > s->prealloc_end) {
+        qcow2_prealloc_drain(bs);
+
+        /* If the allocations overtook the reserve, the clusters that they
+         * got will be written (and the file extended) by the caller anyway */
+        s->prealloc_end = s->prealloc_target = MAX(s->prealloc_end, end);
+    }
+
+    if (s->prealloc_size && s->prealloc_end == s->prealloc_target &&
+        s->prealloc_end - end < s->prealloc_size / 2) {
+        s->prealloc_target = s->prealloc_end + s->prealloc_size;
+        co = qemu_coroutine_create(prealloc_co_entry, bs);
+        qemu_coroutine_enter(co);
+    }
+}
 
 /* return < 0 if error */
 static int64_t alloc_clusters_noref(BlockDriverState *bs, uint64_t size)
@@ -850,6 +943,7 @@ retry:
             size,
             (s->free_cluster_index - nb_clusters) << s->cluster_bits);
 #endif
+    prealloc_ahead(bs, s->free_cluster_index << s->cluster_bits);
     return (s->free_cluster_index - nb_clusters) << s->cluster_bits;
 }
 
@@ -909,6 +1003,7 @@ int64_t qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offset,
         return ret;
     }
 
+    prealloc_ahead(bs, offset + (i << s->cluster_bits));
     return i;
 }
 
@@ -1000,7 +1095,7 @@ void qcow2_free_any_clusters(BlockDriverState *bs, uint64_t l2_entry,
 {
     BDRVQcow2State *s = bs->opaque;
 
-    switch (qcow2_get_cluster_type(l2_entry)) {
+    switch (qcow2_get_cluster_type(bs, l2_entry)) {
     case QCOW2_CLUSTER_COMPRESSED:
         {
             int nb_csectors;
@@ -1095,20 +1190,28 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
                 goto fail;
             }
 
-            ret = qcow2_cache_get(bs, s->l2_table_cache, l2_offset,
-                (void**) &l2_table);
-            if (ret < 0) {
-                goto fail;
-            }
-
             for(j = 0; j < s->l2_size; j++) {
                 uint64_t cluster_index;
+                int slice_index = j & (s->l2_slice_size - 1);
+
+                if (slice_index == 0) {
+                    /* The L2 cache holds the table one slice at a time */
+                    if (l2_table) {
+                        qcow2_cache_put(bs, s->l2_table_cache,
+                                        (void **) &l2_table);
+                    }
+                    ret = qcow2_cache_get(bs, s->l2_table_cache,
+                        l2_offset + j * l2_entry_size(s), (void **) &l2_table);
+                    if (ret < 0) {
+                        goto fail;
+                    }
+                }
 
-                offset = be64_to_cpu(l2_table[j]);
+                offset = get_l2_entry(s, l2_table, slice_index);
                 old_offset = offset;
                 offset &= ~QCOW_OFLAG_COPIED;
 
-                switch (qcow2_get_cluster_type(offset)) {
+                switch (qcow2_get_cluster_type(bs, offset)) {
                     case QCOW2_CLUSTER_COMPRESSED:
                         nb_csectors = ((offset >> s->csize_shift) &
                                        s->csize_mask) + 1;
@@ -1175,7 +1278,7 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
                         qcow2_cache_set_dependency(bs, s->l2_table_cache,
                             s->refcount_block_cache);
                     }
-                    l2_table[j] = cpu_to_be64(offset);
+                    set_l2_entry(s, l2_table, slice_index, offset);
                     qcow2_cache_entry_mark_dirty(bs, s->l2_table_cache,
                                                  l2_table);
                 }
@@ -1356,6 +1459,7 @@ static int inc_refcounts(BlockDriverState *bs,
 /* Flags for check_refcounts_l1() and check_refcounts_l2() */
 enum {
     CHECK_FRAG_INFO = 0x2,      /* update BlockFragInfo counters */
+    CHECK_FIX_SUBCLUSTERS = 0x4, /* repair subcluster bitmaps */
 };
 
 /*
@@ -1374,13 +1478,13 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
     BDRVQcow2State *s = bs->opaque;
     uint64_t *l2_table, l2_entry;
     uint64_t next_contiguous_offset = 0;
-    int i, l2_size, nb_csectors, ret;
+    bool l2_dirty = false;
+    int i, nb_csectors, ret;
 
     /* Read L2 table from disk */
-    l2_size = s->l2_size * sizeof(uint64_t);
-    l2_table = g_malloc(l2_size);
+    l2_table = g_malloc(s->cluster_size);
 
-    ret = bdrv_pread(bs->file, l2_offset, l2_table, l2_size);
+    ret = bdrv_pread(bs->file, l2_offset, l2_table, s->cluster_size);
     if (ret < 0) {
         fprintf(stderr, "ERROR: I/O error in check_refcounts_l2\n");
         res->check_errors++;
@@ -1389,9 +1493,47 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
 
     /* Do the actual checks */
     for(i = 0; i < s->l2_size; i++) {
-        l2_entry = be64_to_cpu(l2_table[i]);
+        l2_entry = get_l2_entry(s, l2_table, i);
+
+        if (has_subclusters(s)) {
+            uint64_t l2_bitmap = get_l2_bitmap(s, l2_table, i);
+            uint64_t both = l2_bitmap & (l2_bitmap >> 32) &
+                            QCOW_L2_BITMAP_ALL_ALLOC;
+            int type = qcow2_get_cluster_type(bs, l2_entry);
+            uint64_t new_bitmap = l2_bitmap;
+            const char *what = NULL;
+
+            /* The repairs keep the data that is in the image: subclusters
+             * marked both allocated and zero keep their data, and those of
+             * unallocated clusters read from the backing file again.  */
+            if (type == QCOW2_CLUSTER_COMPRESSED && l2_bitmap) {
+                what = "compressed cluster with a subcluster bitmap";
+                new_bitmap = 0;
+            } else if (type == QCOW2_CLUSTER_UNALLOCATED &&
+                       (l2_bitmap & QCOW_L2_BITMAP_ALL_ALLOC)) {
+                what = "unallocated cluster with allocated subclusters";
+                new_bitmap &= ~QCOW_L2_BITMAP_ALL_ALLOC;
+            } else if (both) {
+                what = "subclusters both allocated and zero";
+                new_bitmap &= ~(both << 32);
+            }
 
-        switch (qcow2_get_cluster_type(l2_entry)) {
+            if (what) {
+                fprintf(stderr, "%s L2 table %#" PRIx64 ", index %d: "
+                        "%s %#" PRIx64 "\n",
+                        flags & CHECK_FIX_SUBCLUSTERS ? "Repairing" : "ERROR:",
+                        l2_offset, i, what, l2_bitmap);
+                if (flags & CHECK_FIX_SUBCLUSTERS) {
+                    set_l2_bitmap(s, l2_table, i, new_bitmap);
+                    l2_dirty = true;
+                    res->corruptions_fixed++;
+                } else {
+                    res->corruptions++;
+                }
+            }
+        }
+
+        switch (qcow2_get_cluster_type(bs, l2_entry)) {
         case QCOW2_CLUSTER_COMPRESSED:
             /* Compressed clusters don't have QCOW_OFLAG_COPIED */
             if (l2_entry & QCOW_OFLAG_COPIED) {
@@ -1468,6 +1610,28 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
         }
     }
 
+    if (l2_dirty) {
+        /* The table may be shared between the active L1 table and
+         * snapshots */
+        ret = qcow2_pre_write_overlap_check(bs, QCOW2_OL_ACTIVE_L2 |
+                                            QCOW2_OL_INACTIVE_L2,
+                                            l2_offset, s->cluster_size);
+        if (ret < 0) {
+            fprintf(stderr, "ERROR: Could not write L2 table; metadata "
+                    "overlap check failed: %s\n", strerror(-ret));
+            res->check_errors++;
+            goto fail;
+        }
+
+        ret = bdrv_pwrite(bs->file, l2_offset, l2_table, s->cluster_size);
+        if (ret < 0) {
+            fprintf(stderr, "ERROR: Could not write L2 table: %s\n",
+                    strerror(-ret));
+            res->check_errors++;
+            goto fail;
+        }
+    }
+
     g_free(l2_table);
     return 0;
 
@@ -1610,8 +1774,7 @@ static int check_oflag_copied(BlockDriverState *bs, BdrvCheckResult *res,
             }
         }
 
-        ret = bdrv_pread(bs->file, l2_offset, l2_table,
-                         s->l2_size * sizeof(uint64_t));
+        ret = bdrv_pread(bs->file, l2_offset, l2_table, s->cluster_size);
         if (ret < 0) {
             fprintf(stderr, "ERROR: Could not read L2 table: %s\n",
                     strerror(-ret));
@@ -1620,9 +1783,9 @@ static int check_oflag_copied(BlockDriverState *bs, BdrvCheckResult *res,
         }
 
         for (j = 0; j < s->l2_size; j++) {
-            uint64_t l2_entry = be64_to_cpu(l2_table[j]);
+            uint64_t l2_entry = get_l2_entry(s, l2_table, j);
             uint64_t data_offset = l2_entry & L2E_OFFSET_MASK;
-            int cluster_type = qcow2_get_cluster_type(l2_entry);
+            int cluster_type = qcow2_get_cluster_type(bs, l2_entry);
 
             if ((cluster_type == QCOW2_CLUSTER_NORMAL) ||
                 ((cluster_type == QCOW2_CLUSTER_ZERO) && (data_offset != 0))) {
@@ -1640,9 +1803,9 @@ static int check_oflag_copied(BlockDriverState *bs, BdrvCheckResult *res,
                                                     "ERROR",
                             l2_entry, refcount);
                     if (fix & BDRV_FIX_ERRORS) {
-                        l2_table[j] = cpu_to_be64(refcount == 1
-                                    ? l2_entry |  QCOW_OFLAG_COPIED
-                                    : l2_entry & ~QCOW_OFLAG_COPIED);
+                        set_l2_entry(s, l2_table, j, refcount == 1
+                                     ? l2_entry |  QCOW_OFLAG_COPIED
+                                     : l2_entry & ~QCOW_OFLAG_COPIED);
                         l2_dirty = true;
                         res->corruptions_fixed++;
                     } else {
@@ -1794,6 +1957,7 @@ static int calculate_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
     BDRVQcow2State *s = bs->opaque;
     int64_t i;
     QCowSnapshot *sn;
+    int flags = fix & BDRV_FIX_ERRORS ? CHECK_FIX_SUBCLUSTERS : 0;
     int ret;
 
     if (!*refcount_table) {
@@ -1815,7 +1979,8 @@ static int calculate_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
 
     /* current L1 table */
     ret = check_refcounts_l1(bs, res, refcount_table, nb_clusters,
-                             s->l1_table_offset, s->l1_size, CHECK_FRAG_INFO);
+                             s->l1_table_offset, s->l1_size,
+                             flags | CHECK_FRAG_INFO);
     if (ret < 0) {
         return ret;
     }
@@ -1824,7 +1989,7 @@ static int calculate_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
     for (i = 0; i < s->nb_snapshots; i++) {
         sn = s->snapshots + i;
         ret = check_refcounts_l1(bs, res, refcount_table, nb_clusters,
-                                 sn->l1_table_offset, sn->l1_size, 0);
+                                 sn->l1_table_offset, sn->l1_size, flags);
         if (ret < 0) {
             return ret;
         }
@@ -29,6 +29,7 @@
 #include "qemu/rcu.h"
 #include "exec/tb-hash.h"
 #include "exec/log.h"
+#include "qemu/main-loop.h"
 #if defined(TARGET_I386) && !defined(CONFIG_USER_ONLY)
 #include "hw/i386/apic.h"
 #endif
@@ -204,15 +205,21 @@ static void cpu_exec_nocache(CPUState *cpu, int max_cycles,
     if (max_cycles > CF_COUNT_MASK)
         max_cycles = CF_COUNT_MASK;
 
+    tb_lock();
     tb = tb_gen_code(cpu, orig_tb->pc, orig_tb->cs_base, orig_tb->flags,
                      max_cycles | CF_NOCACHE
                          | (ignore_icount ? CF_IGNORE_ICOUNT : 0));
     tb->orig_tb = orig_tb;
+    tb_unlock();
+
     /* execute the generated code */
     trace_exec_tb_nocache(tb, tb->pc);
     cpu_tb_exec(cpu, tb);
+
+    tb_lock();
     tb_phys_invalidate(tb, -1);
     tb_free(tb);
+    tb_unlock();
 }
 #endif
 
@@ -224,14 +231,18 @@ static void cpu_exec_step(CPUState *cpu)
     uint32_t flags;
 
     cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    tb_lock();
     tb = tb_gen_code(cpu, pc, cs_base, flags,
                      1 | CF_NOCACHE | CF_IGNORE_ICOUNT);
     tb->orig_tb = NULL;
+    tb_unlock();
     /* execute the generated code */
     trace_exec_tb_nocache(tb, pc);
     cpu_tb_exec(cpu, tb);
+    tb_lock();
     tb_phys_invalidate(tb, -1);
     tb_free(tb);
+    tb_unlock();
 }
 
 void cpu_exec_step_atomic(CPUState *cpu)
@@ -281,10 +292,8 @@ static bool tb_cmp(const void *p, const void *d)
     return false;
 }
 
-static TranslationBlock *tb_htable_lookup(CPUState *cpu,
-                                          target_ulong pc,
-                                          target_ulong cs_base,
-                                          uint32_t flags)
+TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
+                                   target_ulong cs_base, uint32_t flags)
 {
     tb_page_addr_t phys_pc;
     struct tb_desc desc;
@@ -297,7 +306,46 @@ static TranslationBlock *tb_htable_lookup(CPUState *cpu,
     phys_pc = get_page_addr_code(desc.env, pc);
     desc.phys_page1 = phys_pc & TARGET_PAGE_MASK;
     h = tb_hash_func(phys_pc, pc, flags);
-    return qht_lookup(&tcg_ctx.tb_ctx.htable, tb_cmp, &desc, h);
+    return qht_lookup(&tb_ctx.htable, tb_cmp, &desc, h);
+}
+
+static inline bool tb_is_hot(TranslationBlock *tb)
+{
+    return superblock_threshold && !(tb->cflags & CF_SUPERBLOCK) &&
+           atomic_read(&tb->exec_count) >= superblock_threshold;
+}
+
+/* Retranslate the hot block TB as a superblock and invalidate it.  The
+   old block is still valid during translation so that the translator
+   can use its execution count.  */
+static TranslationBlock *tb_gen_superblock(CPUState *cpu,
+                                           TranslationBlock *tb)
+{
+    TranslationBlock *sb;
+    mmap_lock();
+    tb_lock();
+    if (tb->invalid) {
+        /* Another CPU got here first.  */
+        sb = tb_htable_lookup(cpu, tb->pc, tb->cs_base, tb->flags);
+        if (!sb) {
+            sb = tb_gen_code(cpu, tb->pc, tb->cs_base, tb->flags,
+                             tb->cflags | CF_SUPERBLOCK);
+        }
+    } else {
+        sb = tb_gen_code(cpu, tb->pc, tb->cs_base, tb->flags,
+                         tb->cflags | CF_SUPERBLOCK);
+        /* Superblocks do not count their executions, but the counts are
+           still used when translating other superblocks.  */
+        atomic_set(&sb->exec_count, atomic_read(&tb->exec_count));
+        atomic_set(&sb->taken_count, atomic_read(&tb->taken_count));
+        tb_phys_invalidate(tb, -1);
+        qemu_log_mask_and_addr(CPU_LOG_EXEC, sb->pc,
+                               "Superblock %p [" TARGET_FMT_lx "] %s\n",
+                               sb->tc_ptr, sb->pc, lookup_symbol(sb->pc));
+    }
+    tb_unlock();
+    mmap_unlock();
+    return sb;
 }
 
 static inline TranslationBlock *tb_find(CPUState *cpu,
@@ -314,26 +362,37 @@ static inline TranslationBlock *tb_find(CPUState *cpu,
        always be the same before a given translated block
        is executed. */
     cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    /* Another thread can invalidate a TB just after we found it in
+       tb_htable_lookup, and before we store it in tb_jmp_cache; so check
+       for that on hits too.  */
     tb = atomic_rcu_read(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)]);
     if (unlikely(!tb || tb->pc != pc || tb->cs_base != cs_base ||
-                 tb->flags != flags)) {
+                 tb->flags != flags || atomic_read(&tb->invalid))) {
         tb = tb_htable_lookup(cpu, pc, cs_base, flags);
         if (!tb) {
 
             /* mmap_lock is needed by tb_gen_code, and mmap_lock must be
-             * taken outside tb_lock. As system emulation is currently
-             * single threaded the locks are NOPs.
+             * taken outside tb_lock.  mmap_lock is a NOP in system
+             * emulation.
              */
             mmap_lock();
+#ifndef TARGET_SUPPORTS_MTTCG
+            /* The translators that are not converted to MTTCG keep state
+             * in static variables, so they must run under tb_lock.
+             */
             tb_lock();
             have_tb_lock = true;
+#endif
 
             /* There's a chance that our desired tb has been translated while
-             * taking the locks so we check again inside the lock.
+             * taking the lock so we check again inside the lock.
              */
             tb = tb_htable_lookup(cpu, pc, cs_base, flags);
             if (!tb) {
-                /* if no translated code available, then translate it now */
+                /* if no translated code available, then translate it now.
+                 * Unless we hold tb_lock, tb_gen_code only takes it to link
+                 * the new TB, so other vCPUs can translate at the same time.
+                 */
                 tb = tb_gen_code(cpu, pc, cs_base, flags, 0);
             }
 
@@ -343,6 +402,14 @@ static inline TranslationBlock *tb_find(CPUState *cpu,
         /* We add the TB in the virtual pc hash table for the fast lookup */
         atomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)], tb);
     }
+    if (unlikely(tb_is_hot(tb))) {
+        if (have_tb_lock) {
+            tb_unlock();
+            have_tb_lock = false;
+        }
+        tb = tb_gen_superblock(cpu, tb);
+        atomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)], tb);
+    }
 #ifndef CONFIG_USER_ONLY
     /* We don't take care of direct jumps when address mapping changes in
      * system emulation. So it's not safe to make a direct jump to a TB
@@ -375,8 +442,10 @@ static inline bool cpu_handle_halt(CPUState *cpu)
         if ((cpu->interrupt_request & CPU_INTERRUPT_POLL)
             && replay_interrupt()) {
             X86CPU *x86_cpu = X86_CPU(cpu);
+            qemu_mutex_lock_iothread();
             apic_poll_irq(x86_cpu->apic_state);
             cpu_reset_interrupt(cpu, CPU_INTERRUPT_POLL);
+            qemu_mutex_unlock_iothread();
         }
 #endif
         if (!cpu_has_work(cpu)) {
@@ -430,7 +499,9 @@ static inline bool cpu_handle_exception(CPUState *cpu, int *ret)
 #else
             if (replay_exception()) {
                 CPUClass *cc = CPU_GET_CLASS(cpu);
+                qemu_mutex_lock_iothread();
                 cc->do_interrupt(cpu);
+                qemu_mutex_unlock_iothread();
                 cpu->exception_index = -1;
             } else if (!replay_has_interrupt()) {
                 /* give a chance to iothread in replay mode */
@@ -456,9 +527,16 @@ static inline void cpu_handle_interrupt(CPUState *cpu,
                                         TranslationBlock **last_tb)
 {
     CPUClass *cc = CPU_GET_CLASS(cpu);
-    int interrupt_request = cpu->interrupt_request;
 
-    if (unlikely(interrupt_request)) {
+    if (unlikely(atomic_read(&cpu->interrupt_request))) {
+        int interrupt_request;
+
+        /* Interrupt delivery touches device state, so it runs under the
+         * BQL.  If any of the paths below leaves via cpu_loop_exit, the
+         * lock is released again in cpu_exec.
+         */
+        qemu_mutex_lock_iothread();
+        interrupt_request = cpu->interrupt_request;
         if (unlikely(cpu->singlestep_enabled & SSTEP_NOIRQ)) {
             /* Mask out external interrupts for this step. */
             interrupt_request &= ~CPU_INTERRUPT_SSTEP_MASK;
@@ -513,6 +591,8 @@ static inline void cpu_handle_interrupt(CPUState *cpu,
                the program flow was changed */
             *last_tb = NULL;
         }
+
+        qemu_mutex_unlock_iothread();
     }
     if (unlikely(atomic_read(&cpu->exit_request) || replay_has_interrupt())) {
         atomic_set(&cpu->exit_request, 0);
@@ -646,6 +726,10 @@ int cpu_exec(CPUState *cpu)
 #endif /* buggy compiler */
             cpu->can_do_io = 1;
             tb_lock_reset();
+            mmap_lock_reset();
+            if (qemu_mutex_iothread_locked()) {
+                qemu_mutex_unlock_iothread();
+            }
         }
     } /* for(;;) */
 
@@ -27,11 +27,14 @@
 #include "exec/memory-internal.h"
 #include "exec/ram_addr.h"
 #include "exec/exec-all.h"
+#include "exec/tb-hash.h"
 #include "tcg/tcg.h"
 #include "qemu/error-report.h"
 #include "exec/log.h"
 #include "exec/helper-proto.h"
 #include "qemu/atomic.h"
+#include "qemu/main-loop.h"
+#include "qemu/timer.h"
 
 /* DEBUG defines, enable DEBUG_TLB_LOG to log to the CPU_LOG_MMU target */
 /* #define DEBUG_TLB */
@@ -66,34 +69,205 @@ int tlb_flush_count;
  * If flush_global is false, flush (at least) all tlb entries not
  * marked global.
  *
- * Since QEMU doesn't currently implement a global/not-global flag
- * for tlb entries, at the moment tlb_flush() will also flush all
- * tlb entries in the flush_global == false case. This is OK because
- * CPU architectures generally permit an implementation to drop
- * entries from the TLB at any time, so flushing more entries than
- * required is only an efficiency issue, not a correctness issue.
+ * tlb_flush() ignores flush_global and always flushes everything.
+ * This is OK because CPU architectures generally permit an
+ * implementation to drop entries from the TLB at any time, so
+ * flushing more entries than required is only an efficiency issue,
+ * not a correctness issue.  Targets that want to keep global entries
+ * tag the others with an ASID through tlb_set_page_with_asid(), and
+ * drop them with tlb_flush_asid_by_mmuidx().
+ *
+ * A vCPU's TLB may only be modified by the thread running that vCPU.
+ * When another thread asks for a flush, the work is queued with
+ * async_run_on_cpu and happens before the target vCPU next runs
+ * guest code.
  */
-void tlb_flush(CPUState *cpu, int flush_global)
+
+/* Used to pass a page flush request to another vCPU.  */
+typedef struct TLBFlushPageData {
+    target_ulong addr;
+    uint16_t idxmap;
+} TLBFlushPageData;
+
+/* Likewise for range and ASID flushes.  */
+typedef struct TLBFlushRangeData {
+    target_ulong addr;
+    target_ulong len;
+    uint16_t idxmap;
+} TLBFlushRangeData;
+
+typedef struct TLBFlushASIDData {
+    uint32_t asid;
+    uint16_t idxmap;
+} TLBFlushASIDData;
+
+#define ALL_MMUIDX_BITS ((1 << NB_MMU_MODES) - 1)
+
+static inline size_t sizeof_tlb(CPUArchState *env, int mmu_idx)
 {
-    CPUArchState *env = cpu->env_ptr;
+    return tlb_n_entries(env, mmu_idx) * sizeof(CPUTLBEntry);
+}
 
-    tlb_debug("(%d)\n", flush_global);
+static inline bool tlb_entry_is_empty(const CPUTLBEntry *te)
+{
+    return te->addr_read == -1 && te->addr_write == -1 &&
+           te->addr_code == -1;
+}
 
-    memset(env->tlb_table, -1, sizeof(env->tlb_table));
-    memset(env->tlb_v_table, -1, sizeof(env->tlb_v_table));
-    memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+static void tlb_window_reset(CPUTLBDesc *desc, int64_t ns,
+                             size_t max_entries)
+{
+    desc->window_begin_ns = ns;
+    desc->window_max_entries = max_entries;
+}
 
-    env->vtlb_index = 0;
-    env->tlb_flush_addr = -1;
-    env->tlb_flush_mask = 0;
-    tlb_flush_count++;
+/* Allocate the TLB of @mmu_idx with @n_entries entries, or fewer if the
+ * allocation fails.
+ */
+static void tlb_dyn_alloc(CPUArchState *env, int mmu_idx, size_t n_entries)
+{
+    for (;;) {
+        env->tlb_table[mmu_idx] = g_try_new(CPUTLBEntry, n_entries);
+        env->iotlb[mmu_idx] = g_try_new(CPUIOTLBEntry, n_entries);
+        if (env->tlb_table[mmu_idx] && env->iotlb[mmu_idx]) {
+            break;
+        }
+        if (n_entries == 1 << CPU_TLB_DYN_MIN_BITS) {
+            error_report("%s: %s", __func__, strerror(errno));
+            abort();
+        }
+        g_free(env->tlb_table[mmu_idx]);
+        g_free(env->iotlb[mmu_idx]);
+        n_entries >>= 1;
+    }
+    env->tlb_mask[mmu_idx] = (n_entries - 1) << CPU_TLB_ENTRY_BITS;
+}
+
+/* Resize the TLB of @mmu_idx, if needed, before it is flushed.
+ *
+ * The use rate is the highest number of entries that were in use at a
+ * flush during the current window, relative to the size of the TLB.
+ * Above 70% the TLB is doubled straight away.  Below 30% it is only
+ * shrunk once the window (100ms) has expired, so that a burst of
+ * flushes, e.g. on guest context switches, does not throw away a TLB
+ * that is about to be refilled; the new size is the smallest that keeps
+ * the use rate under 70%.
+ *
+ * Called with tlb_lock held.
+ */
+static void tlb_mmu_resize_locked(CPUArchState *env, int mmu_idx)
+{
+    CPUTLBDesc *desc = &env->tlb_desc[mmu_idx];
+    size_t old_size = tlb_n_entries(env, mmu_idx);
+    size_t new_size = old_size;
+    int64_t now = get_clock_realtime();
+    int64_t window_len_ns = 100 * 1000 * 1000;
+    bool window_expired = now > desc->window_begin_ns + window_len_ns;
+    size_t rate;
+
+    if (desc->n_used_entries > desc->window_max_entries) {
+        desc->window_max_entries = desc->n_used_entries;
+    }
+    rate = desc->window_max_entries * 100 / old_size;
+
+    if (rate > 70) {
+        new_size = MIN(old_size << 1, 1 << CPU_TLB_DYN_MAX_BITS);
+    } else if (rate < 30 && window_expired) {
+        size_t ceil = pow2ceil(desc->window_max_entries);
+        size_t expected_rate = desc->window_max_entries * 100 / ceil;
+
+        if (expected_rate > 70) {
+            ceil *= 2;
+        }
+        new_size = MAX(ceil, 1 << CPU_TLB_DYN_MIN_BITS);
+    }
+
+    if (new_size == old_size) {
+        if (window_expired) {
+            tlb_window_reset(desc, now, desc->n_used_entries);
+        }
+        return;
+    }
+
+    tlb_debug("mmu_idx %d: %zu -> %zu entries\n", mmu_idx, old_size, new_size);
+
+    g_free(env->tlb_table[mmu_idx]);
+    g_free(env->iotlb[mmu_idx]);
+    tlb_window_reset(desc, now, 0);
+    tlb_dyn_alloc(env, mmu_idx, new_size);
+}
+#endif /* TCG_TARGET_IMPLEMENTS_DYN_TLB */
+
+static inline void tlb_n_used_entries_inc(CPUArchState *env, int mmu_idx)
+{
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+    env->tlb_desc[mmu_idx].n_used_entries++;
+#endif
 }
 
-static inline void v_tlb_flush_by_mmuidx(CPUState *cpu, va_list argp)
+static inline void tlb_n_used_entries_dec(CPUArchState *env, int mmu_idx)
+{
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+    env->tlb_desc[mmu_idx].n_used_entries--;
+#endif
+}
+
+void tlb_init(CPUState *cpu)
 {
     CPUArchState *env = cpu->env_ptr;
+    int mmu_idx;
 
-    tlb_debug("start\n");
+    qemu_spin_init(&env->tlb_lock);
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        tlb_window_reset(&env->tlb_desc[mmu_idx], get_clock_realtime(), 0);
+        env->tlb_desc[mmu_idx].n_used_entries = 0;
+        tlb_dyn_alloc(env, mmu_idx, 1 << CPU_TLB_DYN_DEFAULT_BITS);
+    }
+#endif
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        memset(env->tlb_table[mmu_idx], -1, sizeof_tlb(env, mmu_idx));
+        memset(env->tlb_v_table[mmu_idx], -1, sizeof(env->tlb_v_table[0]));
+    }
+}
+
+void tlb_destroy(CPUState *cpu)
+{
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+    CPUArchState *env = cpu->env_ptr;
+    int mmu_idx;
+
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        g_free(env->tlb_table[mmu_idx]);
+        g_free(env->iotlb[mmu_idx]);
+        env->tlb_table[mmu_idx] = NULL;
+        env->iotlb[mmu_idx] = NULL;
+    }
+#endif
+}
+
+/* Called with tlb_lock held.  */
+static void tlb_flush_one_mmuidx_locked(CPUArchState *env, int mmu_idx)
+{
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+    tlb_mmu_resize_locked(env, mmu_idx);
+    env->tlb_desc[mmu_idx].n_used_entries = 0;
+#endif
+    memset(env->tlb_table[mmu_idx], -1, sizeof_tlb(env, mmu_idx));
+    memset(env->tlb_v_table[mmu_idx], -1, sizeof(env->tlb_v_table[0]));
+}
+
+QEMU_BUILD_BUG_ON(NB_MMU_MODES > 16);
+
+static inline bool tlb_flush_is_remote(CPUState *cpu)
+{
+    return cpu->created && !qemu_cpu_is_self(cpu);
+}
+
+static uint16_t tlb_mmuidx_bitmap(va_list argp)
+{
+    uint16_t idxmap = 0;
 
     for (;;) {
         int mmu_idx = va_arg(argp, int);
@@ -101,25 +275,109 @@ static inline void v_tlb_flush_by_mmuidx(CPUState *cpu, va_list argp)
         if (mmu_idx < 0) {
             break;
         }
+        idxmap |= 1 << mmu_idx;
+    }
 
-        tlb_debug("%d\n", mmu_idx);
+    return idxmap;
+}
 
-        memset(env->tlb_table[mmu_idx], -1, sizeof(env->tlb_table[0]));
-        memset(env->tlb_v_table[mmu_idx], -1, sizeof(env->tlb_v_table[0]));
+static void tlb_flush_nocheck(CPUState *cpu, int flush_global)
+{
+    CPUArchState *env = cpu->env_ptr;
+    int mmu_idx;
+
+    tlb_debug("(%d)\n", flush_global);
+
+    qemu_spin_lock(&env->tlb_lock);
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        tlb_flush_one_mmuidx_locked(env, mmu_idx);
     }
+    qemu_spin_unlock(&env->tlb_lock);
 
     memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
+
+    env->vtlb_index = 0;
+    env->tlb_flush_addr = -1;
+    env->tlb_flush_mask = 0;
+    atomic_inc(&tlb_flush_count);
+}
+
+static void tlb_flush_global_async_work(CPUState *cpu, void *data)
+{
+    tlb_flush_nocheck(cpu, GPOINTER_TO_INT(data));
+}
+
+void tlb_flush(CPUState *cpu, int flush_global)
+{
+    if (tlb_flush_is_remote(cpu)) {
+        async_run_on_cpu(cpu, tlb_flush_global_async_work,
+                         GINT_TO_POINTER(flush_global));
+    } else {
+        tlb_flush_nocheck(cpu, flush_global);
+    }
+}
+
+static void tlb_flush_by_mmuidx_nocheck(CPUState *cpu, uint16_t idxmap)
+{
+    CPUArchState *env = cpu->env_ptr;
+    int mmu_idx;
+
+    tlb_debug("start: idxmap 0x%" PRIx16 "\n", idxmap);
+
+    qemu_spin_lock(&env->tlb_lock);
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        if (idxmap & (1 << mmu_idx)) {
+            tlb_debug("%d\n", mmu_idx);
+
+            tlb_flush_one_mmuidx_locked(env, mmu_idx);
+        }
+    }
+    qemu_spin_unlock(&env->tlb_lock);
+
+    memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
+}
+
+static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, void *data)
+{
+    tlb_flush_by_mmuidx_nocheck(cpu, GPOINTER_TO_UINT(data));
+}
+
+static void tlb_flush_by_mmuidx_idxmap(CPUState *cpu, uint16_t idxmap)
+{
+    if (tlb_flush_is_remote(cpu)) {
+        async_run_on_cpu(cpu, tlb_flush_by_mmuidx_async_work,
+                         GUINT_TO_POINTER(idxmap));
+    } else {
+        tlb_flush_by_mmuidx_nocheck(cpu, idxmap);
+    }
 }
 
 void tlb_flush_by_mmuidx(CPUState *cpu, ...)
 {
     va_list argp;
+    uint16_t idxmap;
+
     va_start(argp, cpu);
-    v_tlb_flush_by_mmuidx(cpu, argp);
+    idxmap = tlb_mmuidx_bitmap(argp);
     va_end(argp);
+
+    tlb_flush_by_mmuidx_idxmap(cpu, idxmap);
 }
 
-static inline void tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
+/* Flush every entry of the MMU indexes in @idxmap; when that is all of
+ * them, this also forgets the large pages.
+ */
+static void tlb_flush_idxmap_nocheck(CPUState *cpu, uint16_t idxmap)
+{
+    if (idxmap == ALL_MMUIDX_BITS) {
+        tlb_flush_nocheck(cpu, 1);
+    } else {
+        tlb_flush_by_mmuidx_nocheck(cpu, idxmap);
+    }
+}
+
+/* Invalidate @tlb_entry if it maps @addr.  Return true if it did.  */
+static inline bool tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
 {
     if (addr == (tlb_entry->addr_read &
                  (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
@@ -128,87 +386,405 @@ static inline void tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
         addr == (tlb_entry->addr_code &
                  (TARGET_PAGE_MASK | TLB_INVALID_MASK))) {
         memset(tlb_entry, -1, sizeof(*tlb_entry));
+        return true;
     }
+    return false;
 }
 
-void tlb_flush_page(CPUState *cpu, target_ulong addr)
+static inline bool tlb_hit_page_range(target_ulong tlb_addr,
+                                      target_ulong addr, target_ulong last)
+{
+    target_ulong page = tlb_addr & TARGET_PAGE_MASK;
+
+    return !(tlb_addr & TLB_INVALID_MASK) && page >= addr && page <= last;
+}
+
+/* Invalidate @tlb_entry if it maps any page in [@addr, @last].  */
+static inline void tlb_flush_entry_range(CPUTLBEntry *tlb_entry,
+                                         target_ulong addr, target_ulong last)
+{
+    if (tlb_hit_page_range(tlb_entry->addr_read, addr, last) ||
+        tlb_hit_page_range(tlb_entry->addr_write, addr, last) ||
+        tlb_hit_page_range(tlb_entry->addr_code, addr, last)) {
+        memset(tlb_entry, -1, sizeof(*tlb_entry));
+    }
+}
+
+/* Flush the pages in [@addr, @addr + @len) from the MMU indexes in
+ * @idxmap.  The pages are looked up one at a time, unless there are
+ * more of them than an MMU index has TLB entries; then that index is
+ * flushed in full, which is cheaper.
+ */
+static void tlb_flush_range_by_mmuidx_nocheck(CPUState *cpu, target_ulong addr,
+                                              target_ulong len,
+                                              uint16_t idxmap)
 {
     CPUArchState *env = cpu->env_ptr;
-    int i;
+    target_ulong last, region_last, npages, i;
     int mmu_idx;
+    int k;
 
-    tlb_debug("page :" TARGET_FMT_lx "\n", addr);
+    tlb_debug("addr "TARGET_FMT_lx" len "TARGET_FMT_lx" idxmap 0x%" PRIx16
+              "\n", addr, len, idxmap);
 
-    /* Check if we need to flush due to large pages.  */
-    if ((addr & env->tlb_flush_mask) == env->tlb_flush_addr) {
-        tlb_debug("forcing full flush ("
+    if (len == 0) {
+        return;
+    }
+    last = addr + len - 1;
+    if (last < addr) {
+        /* The range wraps around the end of the address space.  */
+        tlb_flush_idxmap_nocheck(cpu, idxmap);
+        return;
+    }
+    addr &= TARGET_PAGE_MASK;
+    last |= ~TARGET_PAGE_MASK;
+
+    /* A large page overlapping the range may have entries anywhere in
+     * the region we track for large pages, so flush all of it.
+     */
+    region_last = env->tlb_flush_addr | ~env->tlb_flush_mask;
+    if (env->tlb_flush_addr != (target_ulong)-1 &&
+        addr <= region_last && last >= env->tlb_flush_addr) {
+        tlb_debug("extended to large pages ("
                   TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
                   env->tlb_flush_addr, env->tlb_flush_mask);
+        addr = MIN(addr, env->tlb_flush_addr);
+        last = MAX(last, region_last);
+        if (idxmap == ALL_MMUIDX_BITS) {
+            env->tlb_flush_addr = -1;
+            env->tlb_flush_mask = 0;
+        }
+    }
+    npages = ((last - addr) >> TARGET_PAGE_BITS) + 1;
+
+    qemu_spin_lock(&env->tlb_lock);
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        if (!(idxmap & (1 << mmu_idx))) {
+            continue;
+        }
+
+        if (npages > tlb_n_entries(env, mmu_idx)) {
+            tlb_flush_one_mmuidx_locked(env, mmu_idx);
+            continue;
+        }
+
+        for (i = 0; i < npages; i++) {
+            target_ulong page = addr + (i << TARGET_PAGE_BITS);
+
+            if (tlb_flush_entry(tlb_entry(env, mmu_idx, page), page)) {
+                tlb_n_used_entries_dec(env, mmu_idx);
+            }
+        }
+        for (k = 0; k < CPU_VTLB_SIZE; k++) {
+            tlb_flush_entry_range(&env->tlb_v_table[mmu_idx][k], addr, last);
+        }
+    }
+    qemu_spin_unlock(&env->tlb_lock);
+
+    if (npages < (TB_JMP_CACHE_SIZE >> TB_JMP_PAGE_BITS)) {
+        for (i = 0; i < npages; i++) {
+            tb_flush_jmp_cache(cpu, addr + (i << TARGET_PAGE_BITS));
+        }
+    } else {
+        memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
+    }
+}
 
-        tlb_flush(cpu, 1);
+static void tlb_flush_page_by_mmuidx_nocheck(CPUState *cpu, target_ulong addr,
+                                             uint16_t idxmap)
+{
+    CPUArchState *env = cpu->env_ptr;
+    int k;
+    int mmu_idx;
+
+    tlb_debug("addr "TARGET_FMT_lx" idxmap 0x%" PRIx16 "\n", addr, idxmap);
+
+    /* The page may belong to a large page, whose entries can be
+     * anywhere in the region we track for large pages.
+     */
+    if ((addr & env->tlb_flush_mask) == env->tlb_flush_addr) {
+        tlb_flush_range_by_mmuidx_nocheck(cpu, addr, TARGET_PAGE_SIZE, idxmap);
         return;
     }
 
     addr &= TARGET_PAGE_MASK;
-    i = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
-    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        tlb_flush_entry(&env->tlb_table[mmu_idx][i], addr);
-    }
 
-    /* check whether there are entries that need to be flushed in the vtlb */
+    qemu_spin_lock(&env->tlb_lock);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        int k;
+        if (!(idxmap & (1 << mmu_idx))) {
+            continue;
+        }
+
+        if (tlb_flush_entry(tlb_entry(env, mmu_idx, addr), addr)) {
+            tlb_n_used_entries_dec(env, mmu_idx);
+        }
+
+        /* check whether there are vltb entries that need to be flushed */
         for (k = 0; k < CPU_VTLB_SIZE; k++) {
             tlb_flush_entry(&env->tlb_v_table[mmu_idx][k], addr);
         }
     }
+    qemu_spin_unlock(&env->tlb_lock);
 
     tb_flush_jmp_cache(cpu, addr);
 }
 
+static void tlb_flush_page_async_work(CPUState *cpu, void *data)
+{
+    TLBFlushPageData *d = data;
+
+    tlb_flush_page_by_mmuidx_nocheck(cpu, d->addr, d->idxmap);
+    g_free(d);
+}
+
+static void tlb_flush_page_by_mmuidx_idxmap(CPUState *cpu, target_ulong addr,
+                                            uint16_t idxmap)
+{
+    if (tlb_flush_is_remote(cpu)) {
+        TLBFlushPageData *d = g_new(TLBFlushPageData, 1);
+
+        d->addr = addr;
+        d->idxmap = idxmap;
+        async_run_on_cpu(cpu, tlb_flush_page_async_work, d);
+    } else {
+        tlb_flush_page_by_mmuidx_nocheck(cpu, addr, idxmap);
+    }
+}
+
+void tlb_flush_page(CPUState *cpu, target_ulong addr)
+{
+    tlb_flush_page_by_mmuidx_idxmap(cpu, addr, ALL_MMUIDX_BITS);
+}
+
 void tlb_flush_page_by_mmuidx(CPUState *cpu, target_ulong addr, ...)
 {
-    CPUArchState *env = cpu->env_ptr;
-    int i, k;
     va_list argp;
+    uint16_t idxmap;
 
     va_start(argp, addr);
+    idxmap = tlb_mmuidx_bitmap(argp);
+    va_end(argp);
 
-    tlb_debug("addr "TARGET_FMT_lx"\n", addr);
+    tlb_flush_page_by_mmuidx_idxmap(cpu, addr, idxmap);
+}
 
-    /* Check if we need to flush due to large pages.  */
-    if ((addr & env->tlb_flush_mask) == env->tlb_flush_addr) {
-        tlb_debug("forced full flush ("
-                  TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
-                  env->tlb_flush_addr, env->tlb_flush_mask);
+static void tlb_flush_range_async_work(CPUState *cpu, void *data)
+{
+    TLBFlushRangeData *d = data;
 
-        v_tlb_flush_by_mmuidx(cpu, argp);
-        va_end(argp);
-        return;
+    tlb_flush_range_by_mmuidx_nocheck(cpu, d->addr, d->len, d->idxmap);
+    g_free(d);
+}
+
+static void tlb_flush_range_by_mmuidx_idxmap(CPUState *cpu, target_ulong addr,
+                                             target_ulong len, uint16_t idxmap)
+{
+    if (tlb_flush_is_remote(cpu)) {
+        TLBFlushRangeData *d = g_new(TLBFlushRangeData, 1);
+
+        d->addr = addr;
+        d->len = len;
+        d->idxmap = idxmap;
+        async_run_on_cpu(cpu, tlb_flush_range_async_work, d);
+    } else {
+        tlb_flush_range_by_mmuidx_nocheck(cpu, addr, len, idxmap);
     }
+}
 
-    addr &= TARGET_PAGE_MASK;
-    i = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+void tlb_flush_range(CPUState *cpu, target_ulong addr, target_ulong len)
+{
+    tlb_flush_range_by_mmuidx_idxmap(cpu, addr, len, ALL_MMUIDX_BITS);
+}
 
-    for (;;) {
-        int mmu_idx = va_arg(argp, int);
+void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
+                               target_ulong len, ...)
+{
+    va_list argp;
+    uint16_t idxmap;
 
-        if (mmu_idx < 0) {
-            break;
-        }
+    va_start(argp, len);
+    idxmap = tlb_mmuidx_bitmap(argp);
+    va_end(argp);
 
-        tlb_debug("idx %d\n", mmu_idx);
+    tlb_flush_range_by_mmuidx_idxmap(cpu, addr, len, idxmap);
+}
 
-        tlb_flush_entry(&env->tlb_table[mmu_idx][i], addr);
+/* Flush the entries of the MMU indexes in @idxmap that were added with
+ * @asid.  Entries added without an ASID (TLB_ASID_GLOBAL) are kept.
+ */
+static void tlb_flush_asid_by_mmuidx_nocheck(CPUState *cpu, uint32_t asid,
+                                             uint16_t idxmap)
+{
+    CPUArchState *env = cpu->env_ptr;
+    int mmu_idx;
+    size_t i, n;
+    int k;
 
-        /* check whether there are vltb entries that need to be flushed */
+    tlb_debug("asid 0x%" PRIx32 " idxmap 0x%" PRIx16 "\n", asid, idxmap);
+
+    qemu_spin_lock(&env->tlb_lock);
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        if (!(idxmap & (1 << mmu_idx))) {
+            continue;
+        }
+
+        n = tlb_n_entries(env, mmu_idx);
+        for (i = 0; i < n; i++) {
+            CPUTLBEntry *te = &env->tlb_table[mmu_idx][i];
+
+            if (!tlb_entry_is_empty(te) &&
+                env->iotlb[mmu_idx][i].asid == asid) {
+                memset(te, -1, sizeof(*te));
+                tlb_n_used_entries_dec(env, mmu_idx);
+            }
+        }
         for (k = 0; k < CPU_VTLB_SIZE; k++) {
-            tlb_flush_entry(&env->tlb_v_table[mmu_idx][k], addr);
+            CPUTLBEntry *te = &env->tlb_v_table[mmu_idx][k];
+
+            if (!tlb_entry_is_empty(te) &&
+                env->iotlb_v[mmu_idx][k].asid == asid) {
+                memset(te, -1, sizeof(*te));
+            }
         }
     }
+    qemu_spin_unlock(&env->tlb_lock);
+
+    memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
+}
+
+static void tlb_flush_asid_async_work(CPUState *cpu, void *data)
+{
+    TLBFlushASIDData *d = data;
+
+    tlb_flush_asid_by_mmuidx_nocheck(cpu, d->asid, d->idxmap);
+    g_free(d);
+}
+
+static void tlb_flush_asid_by_mmuidx_idxmap(CPUState *cpu, uint32_t asid,
+                                            uint16_t idxmap)
+{
+    if (tlb_flush_is_remote(cpu)) {
+        TLBFlushASIDData *d = g_new(TLBFlushASIDData, 1);
+
+        d->asid = asid;
+        d->idxmap = idxmap;
+        async_run_on_cpu(cpu, tlb_flush_asid_async_work, d);
+    } else {
+        tlb_flush_asid_by_mmuidx_nocheck(cpu, asid, idxmap);
+    }
+}
+
+void tlb_flush_asid_by_mmuidx(CPUState *cpu, uint32_t asid, ...)
+{
+    va_list argp;
+    uint16_t idxmap;
+
+    va_start(argp, asid);
+    idxmap = tlb_mmuidx_bitmap(argp);
     va_end(argp);
 
-    tb_flush_jmp_cache(cpu, addr);
+    tlb_flush_asid_by_mmuidx_idxmap(cpu, asid, idxmap);
+}
+
+/* Flush every vCPU.  @src_cpu is the caller's own vCPU and is flushed
+ * directly; the others are flushed by their own threads.
+ */
+void tlb_flush_all_cpus(CPUState *src_cpu, int flush_global)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        if (cpu != src_cpu) {
+            tlb_flush(cpu, flush_global);
+        }
+    }
+    tlb_flush_nocheck(src_cpu, flush_global);
+}
+
+void tlb_flush_page_all_cpus(CPUState *src_cpu, target_ulong addr)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        if (cpu != src_cpu) {
+            tlb_flush_page(cpu, addr);
+        }
+    }
+    tlb_flush_page_by_mmuidx_nocheck(src_cpu, addr, ALL_MMUIDX_BITS);
+}
+
+void tlb_flush_by_mmuidx_all_cpus(CPUState *src_cpu, ...)
+{
+    CPUState *cpu;
+    va_list argp;
+    uint16_t idxmap;
+
+    va_start(argp, src_cpu);
+    idxmap = tlb_mmuidx_bitmap(argp);
+    va_end(argp);
+
+    CPU_FOREACH(cpu) {
+        if (cpu != src_cpu) {
+            tlb_flush_by_mmuidx_idxmap(cpu, idxmap);
+        }
+    }
+    tlb_flush_by_mmuidx_nocheck(src_cpu, idxmap);
+}
+
+void tlb_flush_page_by_mmuidx_all_cpus(CPUState *src_cpu, target_ulong addr,
+                                       ...)
+{
+    CPUState *cpu;
+    va_list argp;
+    uint16_t idxmap;
+
+    va_start(argp, addr);
+    idxmap = tlb_mmuidx_bitmap(argp);
+    va_end(argp);
+
+    CPU_FOREACH(cpu) {
+        if (cpu != src_cpu) {
+            tlb_flush_page_by_mmuidx_idxmap(cpu, addr, idxmap);
+        }
+    }
+    tlb_flush_page_by_mmuidx_nocheck(src_cpu, addr, idxmap);
+}
+
+void tlb_flush_range_by_mmuidx_all_cpus(CPUState *src_cpu, target_ulong addr,
+                                        target_ulong len, ...)
+{
+    CPUState *cpu;
+    va_list argp;
+    uint16_t idxmap;
+
+    va_start(argp, len);
+    idxmap = tlb_mmuidx_bitmap(argp);
+    va_end(argp);
+
+    CPU_FOREACH(cpu) {
+        if (cpu != src_cpu) {
+            tlb_flush_range_by_mmuidx_idxmap(cpu, addr, len, idxmap);
+        }
+    }
+    tlb_flush_range_by_mmuidx_nocheck(src_cpu, addr, len, idxmap);
+}
+
+void tlb_flush_asid_by_mmuidx_all_cpus(CPUState *src_cpu, uint32_t asid, ...)
+{
+    CPUState *cpu;
+    va_list argp;
+    uint16_t idxmap;
+
+    va_start(argp, asid);
+    idxmap = tlb_mmuidx_bitmap(argp);
+    va_end(argp);
+
+    CPU_FOREACH(cpu) {
+        if (cpu != src_cpu) {
+            tlb_flush_asid_by_mmuidx_idxmap(cpu, asid, idxmap);
+        }
+    }
+    tlb_flush_asid_by_mmuidx_nocheck(src_cpu, asid, idxmap);
 }
 
 /* update the TLBs so that writes to code in the virtual page 'addr'
@@ -239,7 +815,15 @@ void tlb_reset_dirty_range(CPUTLBEntry *tlb_entry, uintptr_t start,
     if (tlb_is_dirty_ram(tlb_entry)) {
         addr = (tlb_entry->addr_write & TARGET_PAGE_MASK) + tlb_entry->addend;
         if ((addr - start) < length) {
+            /* Called from other threads as well as the owning vCPU, so
+             * do not let the store tear.
+             */
+#if TCG_OVERSIZED_GUEST
             tlb_entry->addr_write |= TLB_NOTDIRTY;
+#else
+            atomic_set(&tlb_entry->addr_write,
+                       tlb_entry->addr_write | TLB_NOTDIRTY);
+#endif
         }
     }
 }
@@ -263,10 +847,12 @@ void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
     int mmu_idx;
 
     env = cpu->env_ptr;
+    qemu_spin_lock(&env->tlb_lock);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
         unsigned int i;
+        unsigned int n = tlb_n_entries(env, mmu_idx);
 
-        for (i = 0; i < CPU_TLB_SIZE; i++) {
+        for (i = 0; i < n; i++) {
             tlb_reset_dirty_range(&env->tlb_table[mmu_idx][i],
                                   start1, length);
         }
@@ -276,6 +862,7 @@ void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
                                   start1, length);
         }
     }
+    qemu_spin_unlock(&env->tlb_lock);
 }
 
 static inline void tlb_set_dirty1(CPUTLBEntry *tlb_entry, target_ulong vaddr)
@@ -290,13 +877,12 @@ static inline void tlb_set_dirty1(CPUTLBEntry *tlb_entry, target_ulong vaddr)
 void tlb_set_dirty(CPUState *cpu, target_ulong vaddr)
 {
     CPUArchState *env = cpu->env_ptr;
-    int i;
     int mmu_idx;
 
     vaddr &= TARGET_PAGE_MASK;
-    i = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    qemu_spin_lock(&env->tlb_lock);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        tlb_set_dirty1(&env->tlb_table[mmu_idx][i], vaddr);
+        tlb_set_dirty1(tlb_entry(env, mmu_idx, vaddr), vaddr);
     }
 
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
@@ -305,6 +891,7 @@ void tlb_set_dirty(CPUState *cpu, target_ulong vaddr)
             tlb_set_dirty1(&env->tlb_v_table[mmu_idx][k], vaddr);
         }
     }
+    qemu_spin_unlock(&env->tlb_lock);
 }
 
 /* Our TLB does not support large pages, so remember the area covered by
@@ -337,9 +924,9 @@ static void tlb_add_large_page(CPUArchState *env, target_ulong vaddr,
  * Called from TCG-generated code, which is under an RCU read-side
  * critical section.
  */
-void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
-                             hwaddr paddr, MemTxAttrs attrs, int prot,
-                             int mmu_idx, target_ulong size)
+void tlb_set_page_with_asid(CPUState *cpu, target_ulong vaddr,
+                            hwaddr paddr, MemTxAttrs attrs, int prot,
+                            int mmu_idx, target_ulong size, uint32_t asid)
 {
     CPUArchState *env = cpu->env_ptr;
     MemoryRegionSection *section;
@@ -362,8 +949,8 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     assert(sz >= TARGET_PAGE_SIZE);
 
     tlb_debug("vaddr=" TARGET_FMT_lx " paddr=0x" TARGET_FMT_plx
-              " prot=%x idx=%d\n",
-              vaddr, paddr, prot, mmu_idx);
+              " prot=%x idx=%d asid=0x%" PRIx32 "\n",
+              vaddr, paddr, prot, mmu_idx, asid);
 
     address = vaddr;
     if (!memory_region_is_ram(section->mr) && !memory_region_is_romd(section->mr)) {
@@ -376,19 +963,26 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     }
 
     code_address = address;
-    iotlb = memory_region_section_get_iotlb(cpu, section, vaddr, paddr, xlat,
-                                            prot, &address);
+    iotlb = memory_region_section_get_iotlb(cpu, asidx, section, vaddr,
+                                            paddr, xlat, prot, &address);
 
-    index = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    index = tlb_index(env, mmu_idx, vaddr);
     te = &env->tlb_table[mmu_idx][index];
 
+    qemu_spin_lock(&env->tlb_lock);
+
     /* do not discard the translation in te, evict it into a victim tlb */
     env->tlb_v_table[mmu_idx][vidx] = *te;
     env->iotlb_v[mmu_idx][vidx] = env->iotlb[mmu_idx][index];
+    if (tlb_entry_is_empty(te)) {
+        tlb_n_used_entries_inc(env, mmu_idx);
+    }
 
     /* refill the tlb */
     env->iotlb[mmu_idx][index].addr = iotlb - vaddr;
+    env->iotlb[mmu_idx][index].mr = iotlb_to_region(cpu, iotlb, attrs);
     env->iotlb[mmu_idx][index].attrs = attrs;
+    env->iotlb[mmu_idx][index].asid = asid;
     te->addend = addend - vaddr;
     if (prot & PAGE_READ) {
         te->addr_read = address;
@@ -416,6 +1010,16 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     } else {
         te->addr_write = -1;
     }
+
+    qemu_spin_unlock(&env->tlb_lock);
+}
+
+void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
+                             hwaddr paddr, MemTxAttrs attrs, int prot,
+                             int mmu_idx, target_ulong size)
+{
+    tlb_set_page_with_asid(cpu, vaddr, paddr, attrs, prot, mmu_idx, size,
+                           TLB_ASID_GLOBAL);
 }
 
 /* Add a new TLB entry, but without specifying the memory
@@ -469,21 +1073,21 @@ static void report_bad_exec(CPUState *cpu, target_ulong addr)
  */
 tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong addr)
 {
-    int mmu_idx, page_index, pd;
+    int mmu_idx, page_index;
     void *p;
     MemoryRegion *mr;
     CPUState *cpu = ENV_GET_CPU(env1);
     CPUIOTLBEntry *iotlbentry;
 
-    page_index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     mmu_idx = cpu_mmu_index(env1, true);
+    page_index = tlb_index(env1, mmu_idx, addr);
     if (unlikely(env1->tlb_table[mmu_idx][page_index].addr_code !=
                  (addr & TARGET_PAGE_MASK))) {
         cpu_ldub_code(env1, addr);
+        page_index = tlb_index(env1, mmu_idx, addr);
     }
     iotlbentry = &env1->iotlb[mmu_idx][page_index];
-    pd = iotlbentry->addr & ~TARGET_PAGE_MASK;
-    mr = iotlb_to_region(cpu, pd, iotlbentry->attrs);
+    mr = iotlbentry->mr;
     if (memory_region_is_unassigned(mr)) {
         CPUClass *cc = CPU_GET_CLASS(cpu);
 
@@ -503,8 +1107,9 @@ static uint64_t io_readx(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
 {
     CPUState *cpu = ENV_GET_CPU(env);
     hwaddr physaddr = iotlbentry->addr;
-    MemoryRegion *mr = iotlb_to_region(cpu, physaddr, iotlbentry->attrs);
+    MemoryRegion *mr = iotlbentry->mr;
     uint64_t val;
+    bool locked = false;
 
     physaddr = (physaddr & TARGET_PAGE_MASK) + addr;
     cpu->mem_io_pc = retaddr;
@@ -513,7 +1118,19 @@ static uint64_t io_readx(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
     }
 
     cpu->mem_io_vaddr = addr;
-    memory_region_dispatch_read(mr, physaddr, &val, size, iotlbentry->attrs);
+
+    if (mr->global_locking && !qemu_mutex_iothread_locked()) {
+        qemu_mutex_lock_iothread();
+        locked = true;
+    }
+    if (!memory_region_dispatch_read_direct(mr, physaddr, &val, size)) {
+        memory_region_dispatch_read(mr, physaddr, &val, size,
+                                    iotlbentry->attrs);
+    }
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
+
     return val;
 }
 
@@ -523,7 +1140,8 @@ static void io_writex(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
 {
     CPUState *cpu = ENV_GET_CPU(env);
     hwaddr physaddr = iotlbentry->addr;
-    MemoryRegion *mr = iotlb_to_region(cpu, physaddr, iotlbentry->attrs);
+    MemoryRegion *mr = iotlbentry->mr;
+    bool locked = false;
 
     physaddr = (physaddr & TARGET_PAGE_MASK) + addr;
     if (mr != &io_mem_rom && mr != &io_mem_notdirty && !cpu->can_do_io) {
@@ -532,7 +1150,18 @@ static void io_writex(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
 
     cpu->mem_io_vaddr = addr;
     cpu->mem_io_pc = retaddr;
-    memory_region_dispatch_write(mr, physaddr, val, size, iotlbentry->attrs);
+
+    if (mr->global_locking && !qemu_mutex_iothread_locked()) {
+        qemu_mutex_lock_iothread();
+        locked = true;
+    }
+    if (!memory_region_dispatch_write_direct(mr, physaddr, val, size)) {
+        memory_region_dispatch_write(mr, physaddr, val, size,
+                                     iotlbentry->attrs);
+    }
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
 }
 
 /* Return true if ADDR is present in the victim tlb, and has been copied
@@ -551,8 +1180,13 @@ static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
             CPUIOTLBEntry tmpio, *io = &env->iotlb[mmu_idx][index];
             CPUIOTLBEntry *vio = &env->iotlb_v[mmu_idx][vidx];
 
+            qemu_spin_lock(&env->tlb_lock);
+            if (tlb_entry_is_empty(tlb)) {
+                tlb_n_used_entries_inc(env, mmu_idx);
+            }
             tmptlb = *tlb; *tlb = *vtlb; *vtlb = tmptlb;
             tmpio = *io; *io = *vio; *vio = tmpio;
+            qemu_spin_unlock(&env->tlb_lock);
             return true;
         }
     }
@@ -573,7 +1207,7 @@ static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
 void probe_write(CPUArchState *env, target_ulong addr, int mmu_idx,
                  uintptr_t retaddr)
 {
-    int index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    int index = tlb_index(env, mmu_idx, addr);
     target_ulong tlb_addr = env->tlb_table[mmu_idx][index].addr_write;
 
     if ((addr & TARGET_PAGE_MASK)
@@ -591,7 +1225,7 @@ static void *atomic_mmu_lookup(CPUArchState *env, target_ulong addr,
                                TCGMemOpIdx oi, uintptr_t retaddr)
 {
     size_t mmu_idx = get_mmuidx(oi);
-    size_t index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    size_t index = tlb_index(env, mmu_idx, addr);
     CPUTLBEntry *tlbe = &env->tlb_table[mmu_idx][index];
     target_ulong tlb_addr = tlbe->addr_write;
     TCGMemOp mop = get_memop(oi);
@@ -622,6 +1256,8 @@ static void *atomic_mmu_lookup(CPUArchState *env, target_ulong addr,
         != (tlb_addr & (TARGET_PAGE_MASK | TLB_INVALID_MASK))) {
         if (!VICTIM_TLB_HIT(addr_write, addr)) {
             tlb_fill(ENV_GET_CPU(env), addr, MMU_DATA_STORE, mmu_idx, retaddr);
+            index = tlb_index(env, mmu_idx, addr);
+            tlbe = &env->tlb_table[mmu_idx][index];
         }
         tlb_addr = tlbe->addr_write;
     }
@@ -179,13 +179,12 @@ struct AddressSpaceDispatch {
      */
     PhysPageEntry phys_map;
     PhysPageMap map;
-    AddressSpace *as;
 };
 
 #define SUBPAGE_IDX(addr) ((addr) & ~TARGET_PAGE_MASK)
 typedef struct subpage_t {
     MemoryRegion iomem;
-    AddressSpace *as;
+    AddressSpaceDispatch *d;
     hwaddr base;
     uint16_t sub_section[];
 } subpage_t;
@@ -449,16 +448,17 @@ address_space_translate_internal(AddressSpaceDispatch *d, hwaddr addr, hwaddr *x
 }
 
 /* Called from RCU critical section */
-MemoryRegion *address_space_translate(AddressSpace *as, hwaddr addr,
-                                      hwaddr *xlat, hwaddr *plen,
-                                      bool is_write)
+static MemoryRegion *address_space_dispatch_translate(AddressSpaceDispatch *d,
+                                                      hwaddr addr,
+                                                      hwaddr *xlat,
+                                                      hwaddr *plen,
+                                                      bool is_write)
 {
     IOMMUTLBEntry iotlb;
     MemoryRegionSection *section;
     MemoryRegion *mr;
 
     for (;;) {
-        AddressSpaceDispatch *d = atomic_rcu_read(&as->dispatch);
         section = address_space_translate_internal(d, addr, &addr, plen, true);
         mr = section->mr;
 
@@ -475,7 +475,7 @@ MemoryRegion *address_space_translate(AddressSpace *as, hwaddr addr,
             break;
         }
 
-        as = iotlb.target_as;
+        d = atomic_rcu_read(&iotlb.target_as->dispatch);
     }
 
     if (xen_enabled() && memory_access_is_direct(mr, is_write)) {
@@ -487,6 +487,15 @@ MemoryRegion *address_space_translate(AddressSpace *as, hwaddr addr,
     return mr;
 }
 
+/* Called from RCU critical section */
+MemoryRegion *address_space_translate(AddressSpace *as, hwaddr addr,
+                                      hwaddr *xlat, hwaddr *plen,
+                                      bool is_write)
+{
+    return address_space_dispatch_translate(atomic_rcu_read(&as->dispatch),
+                                            addr, xlat, plen, is_write);
+}
+
 /* Called from RCU critical section */
 MemoryRegionSection *
 address_space_translate_for_iotlb(CPUState *cpu, int asidx, hwaddr addr,
@@ -635,6 +644,7 @@ void cpu_exec_unrealizefn(CPUState *cpu)
     CPUClass *cc = CPU_GET_CLASS(cpu);
 
     cpu_list_remove(cpu);
+    tlb_destroy(cpu);
 
     if (cc->vmsd != NULL) {
         vmstate_unregister(NULL, cc->vmsd, cpu);
@@ -673,6 +683,7 @@ void cpu_exec_realizefn(CPUState *cpu, Error **errp)
     CPUClass *cc ATTRIBUTE_UNUSED = CPU_GET_CLASS(cpu);
 
     cpu_list_add(cpu);
+    tlb_init(cpu);
 
 #ifndef CONFIG_USER_ONLY
     if (qdev_get_vmsd(DEVICE(cpu)) == NULL) {
@@ -1026,8 +1037,86 @@ bool cpu_physical_memory_test_and_clear_dirty(ram_addr_t start,
     return dirty;
 }
 
+/* Set the bits of @src, a run of @n <= BITS_PER_LONG pages, in @dest
+ * starting at page @nr.  Returns the number of bits that were clear.
+ */
+static uint64_t bitmap_or_word(unsigned long *dest, unsigned long nr,
+                               unsigned long src, unsigned long n)
+{
+    unsigned long *p = dest + BIT_WORD(nr);
+    unsigned long shift = nr % BITS_PER_LONG;
+    unsigned long bits = src << shift;
+    uint64_t num_dirty = ctpopl(bits & ~*p);
+
+    *p |= bits;
+    if (shift + n > BITS_PER_LONG) {
+        bits = src >> (BITS_PER_LONG - shift);
+        num_dirty += ctpopl(bits & ~p[1]);
+        p[1] |= bits;
+    }
+    return num_dirty;
+}
+
+uint64_t cpu_physical_memory_sync_dirty_bitmap(RAMBlock *rb,
+                                               ram_addr_t start,
+                                               ram_addr_t length)
+{
+    unsigned long * const *src;
+    unsigned long page = (rb->offset + start) >> TARGET_PAGE_BITS;
+    unsigned long end = page + (length >> TARGET_PAGE_BITS);
+    unsigned long nr = start >> TARGET_PAGE_BITS;
+    uint64_t num_dirty = 0;
+    bool cleared = false;
+
+    rcu_read_lock();
+
+    src = atomic_rcu_read(
+            &ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION])->blocks;
+
+    /* Words never straddle two DirtyMemoryBlocks; rb->offset need not be
+     * word aligned, so a word of @src can cover part of two words of
+     * rb->bmap.
+     */
+    while (page < end) {
+        unsigned long idx = page / DIRTY_MEMORY_BLOCK_SIZE;
+        unsigned long offset = page % DIRTY_MEMORY_BLOCK_SIZE;
+        unsigned long *word = &src[idx][BIT_WORD(offset)];
+        unsigned long shift = offset % BITS_PER_LONG;
+        unsigned long n = MIN(BITS_PER_LONG - shift, end - page);
+        unsigned long mask = BITMAP_LAST_WORD_MASK(n) << shift;
+        unsigned long bits;
+
+        if (atomic_read(word) & mask) {
+            if (mask == ~0UL) {
+                bits = atomic_xchg(word, 0);
+            } else {
+                bits = atomic_fetch_and(word, ~mask) & mask;
+            }
+            if (bits) {
+                num_dirty += bitmap_or_word(rb->bmap, nr, bits >> shift, n);
+                cleared = true;
+            }
+        }
+        page += n;
+        nr += n;
+    }
+
+    rcu_read_unlock();
+
+    /* Writes through TLB entries that are already dirty would not set the
+     * bits again.  One flush covers the whole range.
+     */
+    if (cleared && tcg_enabled()) {
+        cpu_list_lock();
+        tlb_reset_dirty_range_all(rb->offset + start, length);
+        cpu_list_unlock();
+    }
+
+    return num_dirty;
+}
+
 /* Called from RCU critical section */
-hwaddr memory_region_section_get_iotlb(CPUState *cpu,
+hwaddr memory_region_section_get_iotlb(CPUState *cpu, int asidx,
                                        MemoryRegionSection *section,
                                        target_ulong vaddr,
                                        hwaddr paddr, hwaddr xlat,
@@ -1046,9 +1135,8 @@ hwaddr memory_region_section_get_iotlb(CPUState *cpu,
             iotlb |= PHYS_SECTION_ROM;
         }
     } else {
-        AddressSpaceDispatch *d;
+        AddressSpaceDispatch *d = cpu->cpu_ases[asidx].memory_dispatch;
 
-        d = atomic_rcu_read(&section->address_space->dispatch);
         iotlb = section - d->map.sections;
         iotlb += xlat;
     }
@@ -1074,7 +1162,7 @@ hwaddr memory_region_section_get_iotlb(CPUState *cpu,
 
 static int subpage_register (subpage_t *mmio, uint32_t start, uint32_t end,
                              uint16_t section);
-static subpage_t *subpage_init(AddressSpace *as, hwaddr base);
+static subpage_t *subpage_init(AddressSpaceDispatch *d, hwaddr base);
 
 static void *(*phys_mem_alloc)(size_t size, uint64_t *align) =
                                qemu_anon_ram_alloc;
@@ -1147,8 +1235,7 @@ static void register_subpage(AddressSpaceDispatch *d, MemoryRegionSection *secti
     assert(existing->mr->subpage || existing->mr == &io_mem_unassigned);
 
     if (!(existing->mr->subpage)) {
-        subpage = subpage_init(d->as, base);
-        subsection.address_space = d->as;
+        subpage = subpage_init(d, base);
         subsection.mr = &subpage->iomem;
         phys_page_set(d, base >> TARGET_PAGE_BITS, 1,
                       phys_section_add(&d->map, &subsection));
@@ -1174,10 +1261,9 @@ static void register_multipage(AddressSpaceDispatch *d,
     phys_page_set(d, start_addr >> TARGET_PAGE_BITS, num_pages, section_index);
 }
 
-static void mem_add(MemoryListener *listener, MemoryRegionSection *section)
+void address_space_dispatch_add(AddressSpaceDispatch *d,
+                                MemoryRegionSection *section)
 {
-    AddressSpace *as = container_of(listener, AddressSpace, dispatch_listener);
-    AddressSpaceDispatch *d = as->next_dispatch;
     MemoryRegionSection now = *section, remain = *section;
     Int128 page_size = int128_make64(TARGET_PAGE_SIZE);
 
@@ -1597,7 +1683,6 @@ static void ram_block_add(RAMBlock *new_block, Error **errp)
     new_ram_size = MAX(old_ram_size,
               (new_block->offset + new_block->max_length) >> TARGET_PAGE_BITS);
     if (new_ram_size > old_ram_size) {
-        migration_bitmap_extend(old_ram_size, new_ram_size);
         dirty_memory_extend(old_ram_size, new_ram_size);
     }
     /* Keep the list sorted from biggest to smallest block.  Unlike QTAILQ,
@@ -1754,6 +1839,8 @@ static void reclaim_ramblock(RAMBlock *block)
     } else {
         qemu_anon_ram_free(block->host, block->max_length);
     }
+    g_free(block->bmap);
+    g_free(block->unsentmap);
     g_free(block);
 }
 
@@ -1988,7 +2075,11 @@ ram_addr_t qemu_ram_addr_from_host(void *ptr)
 static void notdirty_mem_write(void *opaque, hwaddr ram_addr,
                                uint64_t val, unsigned size)
 {
+    bool locked = false;
+
     if (!cpu_physical_memory_get_dirty_flag(ram_addr, DIRTY_MEMORY_CODE)) {
+        locked = true;
+        tb_lock();
         tb_invalidate_phys_page_fast(ram_addr, size);
     }
     switch (size) {
@@ -2004,6 +2095,11 @@ static void notdirty_mem_write(void *opaque, hwaddr ram_addr,
     default:
         abort();
     }
+
+    if (locked) {
+        tb_unlock();
+    }
+
     /* Set both VGA and migration bits for simplicity and to remove
      * the notdirty callback faster.
      */
@@ -2064,6 +2160,12 @@ static void check_watchpoint(int offset, int len, MemTxAttrs attrs, int flags)
                     continue;
                 }
                 cpu->watchpoint_hit = wp;
+
+                /* The tb_lock will be reset when cpu_loop_exit or
+                 * cpu_loop_exit_noexc longjmp back into the cpu_exec
+                 * main loop.
+                 */
+                tb_lock();
                 tb_check_watchpoint(cpu);
                 if (wp->flags & BP_STOP_BEFORE_ACCESS) {
                     cpu->exception_index = EXCP_DEBUG;
@@ -2138,6 +2240,16 @@ static const MemoryRegionOps watch_mem_ops = {
     .endianness = DEVICE_NATIVE_ENDIAN,
 };
 
+static MemTxResult address_space_dispatch_read(AddressSpaceDispatch *d,
+                                               hwaddr addr, MemTxAttrs attrs,
+                                               uint8_t *buf, int len);
+static MemTxResult address_space_dispatch_write(AddressSpaceDispatch *d,
+                                                hwaddr addr, MemTxAttrs attrs,
+                                                const uint8_t *buf, int len);
+static bool address_space_dispatch_access_valid(AddressSpaceDispatch *d,
+                                                hwaddr addr, int len,
+                                                bool is_write);
+
 static MemTxResult subpage_read(void *opaque, hwaddr addr, uint64_t *data,
                                 unsigned len, MemTxAttrs attrs)
 {
@@ -2149,8 +2261,8 @@ static MemTxResult subpage_read(void *opaque, hwaddr addr, uint64_t *data,
     printf("%s: subpage %p len %u addr " TARGET_FMT_plx "\n", __func__,
            subpage, len, addr);
 #endif
-    res = address_space_read(subpage->as, addr + subpage->base,
-                             attrs, buf, len);
+    res = address_space_dispatch_read(subpage->d, addr + subpage->base,
+                                      attrs, buf, len);
     if (res) {
         return res;
     }
@@ -2199,8 +2311,8 @@ static MemTxResult subpage_write(void *opaque, hwaddr addr,
     default:
         abort();
     }
-    return address_space_write(subpage->as, addr + subpage->base,
-                               attrs, buf, len);
+    return address_space_dispatch_write(subpage->d, addr + subpage->base,
+                                        attrs, buf, len);
 }
 
 static bool subpage_accepts(void *opaque, hwaddr addr,
@@ -2212,8 +2324,9 @@ static bool subpage_accepts(void *opaque, hwaddr addr,
            __func__, subpage, is_write ? 'w' : 'r', len, addr);
 #endif
 
-    return address_space_access_valid(subpage->as, addr + subpage->base,
-                                      len, is_write);
+    return address_space_dispatch_access_valid(subpage->d,
+                                               addr + subpage->base,
+                                               len, is_write);
 }
 
 static const MemoryRegionOps subpage_ops = {
@@ -2247,12 +2360,12 @@ static int subpage_register (subpage_t *mmio, uint32_t start, uint32_t end,
     return 0;
 }
 
-static subpage_t *subpage_init(AddressSpace *as, hwaddr base)
+static subpage_t *subpage_init(AddressSpaceDispatch *d, hwaddr base)
 {
     subpage_t *mmio;
 
     mmio = g_malloc0(sizeof(subpage_t) + TARGET_PAGE_SIZE * sizeof(uint16_t));
-    mmio->as = as;
+    mmio->d = d;
     mmio->base = base;
     memory_region_init_io(&mmio->iomem, NULL, &subpage_ops, mmio,
                           NULL, TARGET_PAGE_SIZE);
@@ -2266,12 +2379,9 @@ static subpage_t *subpage_init(AddressSpace *as, hwaddr base)
     return mmio;
 }
 
-static uint16_t dummy_section(PhysPageMap *map, AddressSpace *as,
-                              MemoryRegion *mr)
+static uint16_t dummy_section(PhysPageMap *map, MemoryRegion *mr)
 {
-    assert(as);
     MemoryRegionSection section = {
-        .address_space = as,
         .mr = mr,
         .offset_within_address_space = 0,
         .offset_within_region = 0,
@@ -2298,48 +2408,47 @@ static void io_mem_init(void)
                           NULL, UINT64_MAX);
     memory_region_init_io(&io_mem_notdirty, NULL, &notdirty_mem_ops, NULL,
                           NULL, UINT64_MAX);
+    /* io_mem_notdirty calls tb_invalidate_phys_page_fast,
+     * which can be called without the iothread mutex.
+     */
+    memory_region_clear_global_locking(&io_mem_notdirty);
     memory_region_init_io(&io_mem_watch, NULL, &watch_mem_ops, NULL,
                           NULL, UINT64_MAX);
 }
 
-static void mem_begin(MemoryListener *listener)
+AddressSpaceDispatch *address_space_dispatch_new(void)
 {
-    AddressSpace *as = container_of(listener, AddressSpace, dispatch_listener);
     AddressSpaceDispatch *d = g_new0(AddressSpaceDispatch, 1);
     uint16_t n;
 
-    n = dummy_section(&d->map, as, &io_mem_unassigned);
+    n = dummy_section(&d->map, &io_mem_unassigned);
     assert(n == PHYS_SECTION_UNASSIGNED);
-    n = dummy_section(&d->map, as, &io_mem_notdirty);
+    n = dummy_section(&d->map, &io_mem_notdirty);
     assert(n == PHYS_SECTION_NOTDIRTY);
-    n = dummy_section(&d->map, as, &io_mem_rom);
+    n = dummy_section(&d->map, &io_mem_rom);
     assert(n == PHYS_SECTION_ROM);
-    n = dummy_section(&d->map, as, &io_mem_watch);
+    n = dummy_section(&d->map, &io_mem_watch);
     assert(n == PHYS_SECTION_WATCH);
 
     d->phys_map  = (PhysPageEntry) { .ptr = PHYS_MAP_NODE_NIL, .skip = 1 };
-    d->as = as;
-    as->next_dispatch = d;
+    return d;
+}
+
+void address_space_dispatch_compact(AddressSpaceDispatch *d)
+{
+    phys_page_compact_all(d, d->map.nodes_nb);
 }
 
-static void address_space_dispatch_free(AddressSpaceDispatch *d)
+void address_space_dispatch_free(AddressSpaceDispatch *d)
 {
     phys_sections_free(&d->map);
     g_free(d);
 }
 
-static void mem_commit(MemoryListener *listener)
+size_t address_space_dispatch_size(AddressSpaceDispatch *d)
 {
-    AddressSpace *as = container_of(listener, AddressSpace, dispatch_listener);
-    AddressSpaceDispatch *cur = as->dispatch;
-    AddressSpaceDispatch *next = as->next_dispatch;
-
-    phys_page_compact_all(next, next->map.nodes_nb);
-
-    atomic_rcu_set(&as->dispatch, next);
-    if (cur) {
-        call_rcu(cur, address_space_dispatch_free, rcu);
-    }
+    return sizeof(*d) + d->map.nodes_nb_alloc * sizeof(Node)
+        + d->map.sections_nb_alloc * sizeof(MemoryRegionSection);
 }
 
 static void tcg_commit(MemoryListener *listener)
@@ -2360,34 +2469,6 @@ static void tcg_commit(MemoryListener *listener)
     tlb_flush(cpuas->cpu, 1);
 }
 
-void address_space_init_dispatch(AddressSpace *as)
-{
-    as->dispatch = NULL;
-    as->dispatch_listener = (MemoryListener) {
-        .begin = mem_begin,
-        .commit = mem_commit,
-        .region_add = mem_add,
-        .region_nop = mem_add,
-        .priority = 0,
-    };
-    memory_listener_register(&as->dispatch_listener, as);
-}
-
-void address_space_unregister(AddressSpace *as)
-{
-    memory_listener_unregister(&as->dispatch_listener);
-}
-
-void address_space_destroy_dispatch(AddressSpace *as)
-{
-    AddressSpaceDispatch *d = as->dispatch;
-
-    atomic_rcu_set(&as->dispatch, NULL);
-    if (d) {
-        call_rcu(d, address_space_dispatch_free, rcu);
-    }
-}
-
 static void memory_map_init(void)
 {
     system_memory = g_malloc(sizeof(*system_memory));
@@ -2471,7 +2552,9 @@ static void invalidate_and_set_dirty(MemoryRegion *mr, hwaddr addr,
             cpu_physical_memory_range_includes_clean(addr, length, dirty_log_mask);
     }
     if (dirty_log_mask & (1 << DIRTY_MEMORY_CODE)) {
+        tb_lock();
         tb_invalidate_phys_range(addr, addr + length);
+        tb_unlock();
         dirty_log_mask &= ~(1 << DIRTY_MEMORY_CODE);
     }
     cpu_physical_memory_set_dirty_range(addr, length, dirty_log_mask);
@@ -2528,11 +2611,13 @@ static bool prepare_mmio_access(MemoryRegion *mr)
 }
 
 /* Called within RCU critical section.  */
-static MemTxResult address_space_write_continue(AddressSpace *as, hwaddr addr,
-                                                MemTxAttrs attrs,
-                                                const uint8_t *buf,
-                                                int len, hwaddr addr1,
-                                                hwaddr l, MemoryRegion *mr)
+static MemTxResult address_space_dispatch_write_continue(AddressSpaceDispatch *d,
+                                                         hwaddr addr,
+                                                         MemTxAttrs attrs,
+                                                         const uint8_t *buf,
+                                                         int len, hwaddr addr1,
+                                                         hwaddr l,
+                                                         MemoryRegion *mr)
 {
     uint8_t *ptr;
     uint64_t val;
@@ -2594,14 +2679,16 @@ static MemTxResult address_space_write_continue(AddressSpace *as, hwaddr addr,
         }
 
         l = len;
-        mr = address_space_translate(as, addr, &addr1, &l, true);
+        mr = address_space_dispatch_translate(d, addr, &addr1, &l, true);
     }
 
     return result;
 }
 
-MemTxResult address_space_write(AddressSpace *as, hwaddr addr, MemTxAttrs attrs,
-                                const uint8_t *buf, int len)
+/* Called within RCU critical section.  */
+static MemTxResult address_space_dispatch_write(AddressSpaceDispatch *d,
+                                                hwaddr addr, MemTxAttrs attrs,
+                                                const uint8_t *buf, int len)
 {
     hwaddr l;
     hwaddr addr1;
@@ -2609,22 +2696,34 @@ MemTxResult address_space_write(AddressSpace *as, hwaddr addr, MemTxAttrs attrs,
     MemTxResult result = MEMTX_OK;
 
     if (len > 0) {
-        rcu_read_lock();
         l = len;
-        mr = address_space_translate(as, addr, &addr1, &l, true);
-        result = address_space_write_continue(as, addr, attrs, buf, len,
-                                              addr1, l, mr);
-        rcu_read_unlock();
+        mr = address_space_dispatch_translate(d, addr, &addr1, &l, true);
+        result = address_space_dispatch_write_continue(d, addr, attrs, buf,
+                                                       len, addr1, l, mr);
     }
 
     return result;
 }
 
+MemTxResult address_space_write(AddressSpace *as, hwaddr addr, MemTxAttrs attrs,
+                                const uint8_t *buf, int len)
+{
+    MemTxResult result;
+
+    rcu_read_lock();
+    result = address_space_dispatch_write(atomic_rcu_read(&as->dispatch),
+                                          addr, attrs, buf, len);
+    rcu_read_unlock();
+    return result;
+}
+
 /* Called within RCU critical section.  */
-MemTxResult address_space_read_continue(AddressSpace *as, hwaddr addr,
-                                        MemTxAttrs attrs, uint8_t *buf,
-                                        int len, hwaddr addr1, hwaddr l,
-                                        MemoryRegion *mr)
+static MemTxResult address_space_dispatch_read_continue(AddressSpaceDispatch *d,
+                                                        hwaddr addr,
+                                                        MemTxAttrs attrs,
+                                                        uint8_t *buf, int len,
+                                                        hwaddr addr1, hwaddr l,
+                                                        MemoryRegion *mr)
 {
     uint8_t *ptr;
     uint64_t val;
@@ -2684,14 +2783,27 @@ MemTxResult address_space_read_continue(AddressSpace *as, hwaddr addr,
         }
 
         l = len;
-        mr = address_space_translate(as, addr, &addr1, &l, false);
+        mr = address_space_dispatch_translate(d, addr, &addr1, &l, false);
     }
 
     return result;
 }
 
-MemTxResult address_space_read_full(AddressSpace *as, hwaddr addr,
-                                    MemTxAttrs attrs, uint8_t *buf, int len)
+/* Called within RCU critical section.  */
+MemTxResult address_space_read_continue(AddressSpace *as, hwaddr addr,
+                                        MemTxAttrs attrs, uint8_t *buf,
+                                        int len, hwaddr addr1, hwaddr l,
+                                        MemoryRegion *mr)
+{
+    return address_space_dispatch_read_continue(atomic_rcu_read(&as->dispatch),
+                                                addr, attrs, buf, len,
+                                                addr1, l, mr);
+}
+
+/* Called within RCU critical section.  */
+static MemTxResult address_space_dispatch_read(AddressSpaceDispatch *d,
+                                               hwaddr addr, MemTxAttrs attrs,
+                                               uint8_t *buf, int len)
 {
     hwaddr l;
     hwaddr addr1;
@@ -2699,17 +2811,27 @@ MemTxResult address_space_read_full(AddressSpace *as, hwaddr addr,
     MemTxResult result = MEMTX_OK;
 
     if (len > 0) {
-        rcu_read_lock();
         l = len;
-        mr = address_space_translate(as, addr, &addr1, &l, false);
-        result = address_space_read_continue(as, addr, attrs, buf, len,
-                                             addr1, l, mr);
-        rcu_read_unlock();
+        mr = address_space_dispatch_translate(d, addr, &addr1, &l, false);
+        result = address_space_dispatch_read_continue(d, addr, attrs, buf,
+                                                      len, addr1, l, mr);
     }
 
     return result;
 }
 
+MemTxResult address_space_read_full(AddressSpace *as, hwaddr addr,
+                                    MemTxAttrs attrs, uint8_t *buf, int len)
+{
+    MemTxResult result;
+
+    rcu_read_lock();
+    result = address_space_dispatch_read(atomic_rcu_read(&as->dispatch),
+                                         addr, attrs, buf, len);
+    rcu_read_unlock();
+    return result;
+}
+
 MemTxResult address_space_rw(AddressSpace *as, hwaddr addr, MemTxAttrs attrs,
                              uint8_t *buf, int len, bool is_write)
 {
@@ -2877,15 +2999,17 @@ static void cpu_notify_map_clients(void)
     qemu_mutex_unlock(&map_client_list_lock);
 }
 
-bool address_space_access_valid(AddressSpace *as, hwaddr addr, int len, bool is_write)
+/* Called within RCU critical section.  */
+static bool address_space_dispatch_access_valid(AddressSpaceDispatch *d,
+                                                hwaddr addr, int len,
+                                                bool is_write)
 {
     MemoryRegion *mr;
     hwaddr l, xlat;
 
-    rcu_read_lock();
     while (len > 0) {
         l = len;
-        mr = address_space_translate(as, addr, &xlat, &l, is_write);
+        mr = address_space_dispatch_translate(d, addr, &xlat, &l, is_write);
         if (!memory_access_is_direct(mr, is_write)) {
             l = memory_access_size(mr, l, addr);
             if (!memory_region_access_valid(mr, xlat, l, is_write)) {
@@ -2896,10 +3020,20 @@ bool address_space_access_valid(AddressSpace *as, hwaddr addr, int len, bool is_
         len -= l;
         addr += l;
     }
-    rcu_read_unlock();
     return true;
 }
 
+bool address_space_access_valid(AddressSpace *as, hwaddr addr, int len, bool is_write)
+{
+    bool result;
+
+    rcu_read_lock();
+    result = address_space_dispatch_access_valid(atomic_rcu_read(&as->dispatch),
+                                                 addr, len, is_write);
+    rcu_read_unlock();
+    return result;
+}
+
 /* Map a physical memory region into a host virtual address.
  * May map a subset of the requested range, given by and returned in *plen.
  * May return NULL if resources needed to perform the mapping are exhausted.
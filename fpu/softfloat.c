@@ -83,6 +83,8 @@ this code that are retained.
  * target-dependent and needs the TARGET_* macros.
  */
 #include "qemu/osdep.h"
+#include <float.h>
+#include <math.h>
 
 #include "fpu/softfloat.h"
 
@@ -540,6 +542,85 @@ float64 float64_squash_input_denormal(float64 a, float_status *status)
     return a;
 }
 
+/*----------------------------------------------------------------------------
+| The basic operations below first try the host FPU, and only fall back to
+| the software implementation when the host might not produce the same
+| result and flags.  This requires the rounding mode to be nearest-even and
+| the inexact flag to be already set, so that whether the operation is exact
+| does not matter; guests accumulate flags, so after the first inexact
+| operation this is the common case.  The inputs must be zeros or normal
+| numbers, and the result must be neither tiny nor zero, which leaves NaNs,
+| denormals, underflow and the signs of zero results to the software code.
+| Hosts that evaluate floating-point expressions in extended precision would
+| round twice, so they always use the software implementation.
+*----------------------------------------------------------------------------*/
+
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0 && !defined(__FAST_MATH__)
+#define QEMU_HARDFLOAT 1
+#else
+#define QEMU_HARDFLOAT 0
+#endif
+
+typedef union {
+    float32 s;
+    float h;
+} union_float32;
+
+typedef union {
+    float64 s;
+    double h;
+} union_float64;
+
+static inline bool can_use_hardfloat(float_status *status)
+{
+    return QEMU_HARDFLOAT &&
+        likely((status->float_exception_flags & float_flag_inexact) &&
+               status->float_rounding_mode == float_round_nearest_even);
+}
+
+static inline bool float32_is_normal(float32 a)
+{
+    return ((extractFloat32Exp(a) + 1) & 0xFF) > 1;
+}
+
+static inline bool float32_is_zero_or_normal(float32 a)
+{
+    return float32_is_normal(a) || float32_is_zero(a);
+}
+
+static inline bool float64_is_normal(float64 a)
+{
+    return ((extractFloat64Exp(a) + 1) & 0x7FF) > 1;
+}
+
+static inline bool float64_is_zero_or_normal(float64 a)
+{
+    return float64_is_normal(a) || float64_is_zero(a);
+}
+
+/*----------------------------------------------------------------------------
+| Returns true if the result `r' of a host operation can be returned as is.
+| An infinite result of finite inputs overflowed, which is flagged here.
+*----------------------------------------------------------------------------*/
+
+static inline bool float32_hard_result_ok(float r, float_status *status)
+{
+    if (unlikely(isinf(r))) {
+        float_raise(float_flag_overflow, status);
+        return true;
+    }
+    return fabsf(r) > FLT_MIN;
+}
+
+static inline bool float64_hard_result_ok(double r, float_status *status)
+{
+    if (unlikely(isinf(r))) {
+        float_raise(float_flag_overflow, status);
+        return true;
+    }
+    return fabs(r) > DBL_MIN;
+}
+
 /*----------------------------------------------------------------------------
 | Normalizes the subnormal double-precision floating-point value represented
 | by the denormalized significand `aSig'.  The normalized exponent and
@@ -2167,6 +2248,17 @@ static float32 subFloat32Sigs(float32 a, float32 b, flag zSign,
 float32 float32_add(float32 a, float32 b, float_status *status)
 {
     flag aSign, bSign;
+
+    if (can_use_hardfloat(status) &&
+        float32_is_zero_or_normal(a) && float32_is_zero_or_normal(b)) {
+        union_float32 ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h + ub.h;
+        if (float32_hard_result_ok(ur.h, status)) {
+            return ur.s;
+        }
+    }
+
     a = float32_squash_input_denormal(a, status);
     b = float32_squash_input_denormal(b, status);
 
@@ -2190,6 +2282,17 @@ float32 float32_add(float32 a, float32 b, float_status *status)
 float32 float32_sub(float32 a, float32 b, float_status *status)
 {
     flag aSign, bSign;
+
+    if (can_use_hardfloat(status) &&
+        float32_is_zero_or_normal(a) && float32_is_zero_or_normal(b)) {
+        union_float32 ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h - ub.h;
+        if (float32_hard_result_ok(ur.h, status)) {
+            return ur.s;
+        }
+    }
+
     a = float32_squash_input_denormal(a, status);
     b = float32_squash_input_denormal(b, status);
 
@@ -2218,6 +2321,16 @@ float32 float32_mul(float32 a, float32 b, float_status *status)
     uint64_t zSig64;
     uint32_t zSig;
 
+    if (can_use_hardfloat(status) &&
+        float32_is_zero_or_normal(a) && float32_is_zero_or_normal(b)) {
+        union_float32 ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h * ub.h;
+        if (float32_hard_result_ok(ur.h, status)) {
+            return ur.s;
+        }
+    }
+
     a = float32_squash_input_denormal(a, status);
     b = float32_squash_input_denormal(b, status);
 
@@ -2280,6 +2393,17 @@ float32 float32_div(float32 a, float32 b, float_status *status)
     flag aSign, bSign, zSign;
     int aExp, bExp, zExp;
     uint32_t aSig, bSig, zSig;
+
+    if (can_use_hardfloat(status) &&
+        float32_is_zero_or_normal(a) && float32_is_normal(b)) {
+        union_float32 ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h / ub.h;
+        if (float32_hard_result_ok(ur.h, status)) {
+            return ur.s;
+        }
+    }
+
     a = float32_squash_input_denormal(a, status);
     b = float32_squash_input_denormal(b, status);
 
@@ -2679,6 +2803,16 @@ float32 float32_sqrt(float32 a, float_status *status)
     int aExp, zExp;
     uint32_t aSig, zSig;
     uint64_t rem, term;
+
+    if (can_use_hardfloat(status) &&
+        float32_is_zero_or_normal(a) && !float32_is_neg(a)) {
+        union_float32 ua = { .s = a }, ur;
+
+        /* The root of a positive normal number is normal.  */
+        ur.h = sqrtf(ua.h);
+        return ur.s;
+    }
+
     a = float32_squash_input_denormal(a, status);
 
     aSig = extractFloat32Frac( a );
@@ -3962,6 +4096,17 @@ static float64 subFloat64Sigs(float64 a, float64 b, flag zSign,
 float64 float64_add(float64 a, float64 b, float_status *status)
 {
     flag aSign, bSign;
+
+    if (can_use_hardfloat(status) &&
+        float64_is_zero_or_normal(a) && float64_is_zero_or_normal(b)) {
+        union_float64 ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h + ub.h;
+        if (float64_hard_result_ok(ur.h, status)) {
+            return ur.s;
+        }
+    }
+
     a = float64_squash_input_denormal(a, status);
     b = float64_squash_input_denormal(b, status);
 
@@ -3985,6 +4130,17 @@ float64 float64_add(float64 a, float64 b, float_status *status)
 float64 float64_sub(float64 a, float64 b, float_status *status)
 {
     flag aSign, bSign;
+
+    if (can_use_hardfloat(status) &&
+        float64_is_zero_or_normal(a) && float64_is_zero_or_normal(b)) {
+        union_float64 ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h - ub.h;
+        if (float64_hard_result_ok(ur.h, status)) {
+            return ur.s;
+        }
+    }
+
     a = float64_squash_input_denormal(a, status);
     b = float64_squash_input_denormal(b, status);
 
@@ -4011,6 +4167,16 @@ float64 float64_mul(float64 a, float64 b, float_status *status)
     int aExp, bExp, zExp;
     uint64_t aSig, bSig, zSig0, zSig1;
 
+    if (can_use_hardfloat(status) &&
+        float64_is_zero_or_normal(a) && float64_is_zero_or_normal(b)) {
+        union_float64 ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h * ub.h;
+        if (float64_hard_result_ok(ur.h, status)) {
+            return ur.s;
+        }
+    }
+
     a = float64_squash_input_denormal(a, status);
     b = float64_squash_input_denormal(b, status);
 
@@ -4075,6 +4241,17 @@ float64 float64_div(float64 a, float64 b, float_status *status)
     uint64_t aSig, bSig, zSig;
     uint64_t rem0, rem1;
     uint64_t term0, term1;
+
+    if (can_use_hardfloat(status) &&
+        float64_is_zero_or_normal(a) && float64_is_normal(b)) {
+        union_float64 ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h / ub.h;
+        if (float64_hard_result_ok(ur.h, status)) {
+            return ur.s;
+        }
+    }
+
     a = float64_squash_input_denormal(a, status);
     b = float64_squash_input_denormal(b, status);
 
@@ -4487,6 +4664,16 @@ float64 float64_sqrt(float64 a, float_status *status)
     int aExp, zExp;
     uint64_t aSig, zSig, doubleZSig;
     uint64_t rem0, rem1, term0, term1;
+
+    if (can_use_hardfloat(status) &&
+        float64_is_zero_or_normal(a) && !float64_is_neg(a)) {
+        union_float64 ua = { .s = a }, ur;
+
+        /* The root of a positive normal number is normal.  */
+        ur.h = sqrt(ua.h);
+        return ur.s;
+    }
+
     a = float64_squash_input_denormal(a, status);
 
     aSig = extractFloat64Frac( a );
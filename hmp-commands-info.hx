@@ -249,16 +249,18 @@ ETEXI
 
     {
         .name       = "mtree",
-        .args_type  = "",
-        .params     = "",
-        .help       = "show memory tree",
+        .args_type  = "flatview:-f",
+        .params     = "[-f]",
+        .help       = "show memory tree (-f: dump flat view for address spaces)",
         .cmd        = hmp_info_mtree,
     },
 
 STEXI
-@item info mtree
+@item info mtree [-f]
 @findex mtree
-Show memory tree.
+Show memory tree.  With @option{-f}, show the flat view of each address
+space instead, together with the memory used by the view and its dispatch
+tree.  Address spaces that share a view are listed under the same view.
 ETEXI
 
     {
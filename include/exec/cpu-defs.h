@@ -28,6 +28,7 @@
 #include "tcg-target.h"
 #ifndef CONFIG_USER_ONLY
 #include "exec/hwaddr.h"
+#include "qemu/thread.h"
 #endif
 #include "exec/memattrs.h"
 
@@ -64,6 +65,26 @@ typedef uint64_t target_ulong;
 #define CPU_TLB_ENTRY_BITS 5
 #endif
 
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+/* The TLB of each MMU mode is allocated separately and resized when it is
+ * flushed, between CPU_TLB_DYN_MIN_BITS and CPU_TLB_DYN_MAX_BITS entries,
+ * depending on how much of it was in use; see tlb_mmu_resize_locked.
+ * The TCG backend loads tlb_mask[mmu_idx] and tlb_table[mmu_idx] from env
+ * instead of using a constant mask and offset.
+ */
+#define CPU_TLB_DYN_MIN_BITS 6
+#define CPU_TLB_DYN_DEFAULT_BITS 8
+
+# if HOST_LONG_BITS == 32
+/* Make sure we do not require a double-word shift for the TLB load */
+#  define CPU_TLB_DYN_MAX_BITS (32 - TARGET_PAGE_BITS)
+# else
+#  define CPU_TLB_DYN_MAX_BITS \
+    MIN(22, TARGET_VIRT_ADDR_SPACE_BITS - TARGET_PAGE_BITS)
+# endif
+
+#else /* !TCG_TARGET_IMPLEMENTS_DYN_TLB */
+
 /* TCG_TARGET_TLB_DISPLACEMENT_BITS is used in CPU_TLB_BITS to ensure that
  * the TLB is not unnecessarily small, but still small enough for the
  * TLB lookup instruction sequence used by the TCG target.
@@ -96,6 +117,8 @@ typedef uint64_t target_ulong;
 
 #define CPU_TLB_SIZE (1 << CPU_TLB_BITS)
 
+#endif /* TCG_TARGET_IMPLEMENTS_DYN_TLB */
+
 typedef struct CPUTLBEntry {
     /* bit TARGET_LONG_BITS to TARGET_PAGE_BITS : virtual address
        bit TARGET_PAGE_BITS-1..4  : Nonzero for accesses that should not
@@ -126,15 +149,59 @@ QEMU_BUILD_BUG_ON(sizeof(CPUTLBEntry) != (1 << CPU_TLB_ENTRY_BITS));
  */
 typedef struct CPUIOTLBEntry {
     hwaddr addr;
+    /* The region that addr's section index resolved to when the entry was
+     * filled, so that MMIO accesses need not look it up again.
+     */
+    MemoryRegion *mr;
     MemTxAttrs attrs;
+    /* Address space identifier the entry was added with, or
+     * TLB_ASID_GLOBAL; see tlb_flush_asid_by_mmuidx.
+     */
+    uint32_t asid;
 } CPUIOTLBEntry;
 
+#define TLB_ASID_GLOBAL ((uint32_t)-1)
+
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+typedef struct CPUTLBDesc {
+    /* Start of the current use-rate window, from get_clock_realtime() */
+    int64_t window_begin_ns;
+    /* Highest number of entries in use during the current window */
+    size_t window_max_entries;
+    /* Number of entries in use since the last flush */
+    size_t n_used_entries;
+} CPUTLBDesc;
+
+/* tlb_mask[i] is (number of entries - 1) << CPU_TLB_ENTRY_BITS, i.e. the
+ * mask to apply to the page number shifted into a byte offset into
+ * tlb_table[i].  Both come first so that they are as close as possible
+ * to the start of CPU_COMMON_TLB.
+ */
+#define CPU_COMMON_TLB_TABLES                                           \
+    uintptr_t tlb_mask[NB_MMU_MODES];                                   \
+    CPUTLBEntry *tlb_table[NB_MMU_MODES];                               \
+    CPUIOTLBEntry *iotlb[NB_MMU_MODES];                                 \
+    CPUTLBDesc tlb_desc[NB_MMU_MODES];
+#else
+#define CPU_COMMON_TLB_TABLES                                           \
+    CPUTLBEntry tlb_table[NB_MMU_MODES][CPU_TLB_SIZE];                  \
+    CPUIOTLBEntry iotlb[NB_MMU_MODES][CPU_TLB_SIZE];
+#endif
+
+/* The TLB tables are only modified by the thread running the vCPU, but
+ * tlb_reset_dirty may be called from any thread.  tlb_lock serialises it
+ * against the owner replacing, flushing or resizing the tables; the owner
+ * does not need it to read them.
+ *
+ * CPU_COMMON_TLB is preserved across CPU reset (the tables are flushed
+ * instead), so targets must place it after their reset fields.
+ */
 #define CPU_COMMON_TLB \
     /* The meaning of the MMU modes is defined in the target code. */   \
-    CPUTLBEntry tlb_table[NB_MMU_MODES][CPU_TLB_SIZE];                  \
+    CPU_COMMON_TLB_TABLES                                               \
     CPUTLBEntry tlb_v_table[NB_MMU_MODES][CPU_VTLB_SIZE];               \
-    CPUIOTLBEntry iotlb[NB_MMU_MODES][CPU_TLB_SIZE];                    \
     CPUIOTLBEntry iotlb_v[NB_MMU_MODES][CPU_VTLB_SIZE];                 \
+    QemuSpin tlb_lock;                                                  \
     target_ulong tlb_flush_addr;                                        \
     target_ulong tlb_flush_mask;                                        \
     target_ulong vtlb_index;                                            \
@@ -83,6 +83,18 @@ void cpu_reloading_memory_map(void);
  */
 void cpu_address_space_init(CPUState *cpu, AddressSpace *as, int asidx);
 /* cputlb.c */
+/**
+ * tlb_init:
+ * @cpu: CPU whose TLB should be initialized
+ *
+ * Allocate the TLB of @cpu and mark every entry invalid.
+ */
+void tlb_init(CPUState *cpu);
+/**
+ * tlb_destroy:
+ * @cpu: CPU whose TLB should be freed
+ */
+void tlb_destroy(CPUState *cpu);
 /**
  * tlb_flush_page:
  * @cpu: CPU whose TLB should be flushed
@@ -100,8 +112,8 @@ void tlb_flush_page(CPUState *cpu, target_ulong addr);
  * Flush the entire TLB for the specified CPU.
  * The flush_global flag is in theory an indicator of whether the whole
  * TLB should be flushed, or only those entries not marked global.
- * In practice QEMU does not implement any global/not global flag for
- * TLB entries, and the argument is ignored.
+ * In practice the argument is ignored; targets that track global
+ * mappings use tlb_flush_asid_by_mmuidx() instead.
  */
 void tlb_flush(CPUState *cpu, int flush_global);
 /**
@@ -123,6 +135,99 @@ void tlb_flush_page_by_mmuidx(CPUState *cpu, target_ulong addr, ...);
  * MMU indexes.
  */
 void tlb_flush_by_mmuidx(CPUState *cpu, ...);
+/**
+ * tlb_flush_all_cpus:
+ * @src_cpu: the calling vCPU
+ * @flush_global: ignored
+ *
+ * Flush the entire TLB of every CPU.  @src_cpu is flushed immediately;
+ * other vCPUs running in their own threads are flushed before they next
+ * execute guest code.
+ */
+void tlb_flush_all_cpus(CPUState *src_cpu, int flush_global);
+/**
+ * tlb_flush_page_all_cpus:
+ * @src_cpu: the calling vCPU
+ * @addr: virtual address of page to be flushed
+ *
+ * Like tlb_flush_page, but for every CPU.  See tlb_flush_all_cpus.
+ */
+void tlb_flush_page_all_cpus(CPUState *src_cpu, target_ulong addr);
+/**
+ * tlb_flush_by_mmuidx_all_cpus:
+ * @src_cpu: the calling vCPU
+ * @...: list of MMU indexes to flush, terminated by a negative value
+ *
+ * Like tlb_flush_by_mmuidx, but for every CPU.  See tlb_flush_all_cpus.
+ */
+void tlb_flush_by_mmuidx_all_cpus(CPUState *src_cpu, ...);
+/**
+ * tlb_flush_page_by_mmuidx_all_cpus:
+ * @src_cpu: the calling vCPU
+ * @addr: virtual address of page to be flushed
+ * @...: list of MMU indexes to flush, terminated by a negative value
+ *
+ * Like tlb_flush_page_by_mmuidx, but for every CPU.  See
+ * tlb_flush_all_cpus.
+ */
+void tlb_flush_page_by_mmuidx_all_cpus(CPUState *src_cpu, target_ulong addr,
+                                       ...);
+/**
+ * tlb_flush_range:
+ * @cpu: CPU whose TLB should be flushed
+ * @addr: virtual address of the start of the range
+ * @len: length of the range in bytes
+ *
+ * Flush every page overlapping [@addr, @addr + @len) from the TLB of
+ * the specified CPU, for all MMU indexes.  This is cheaper than calling
+ * tlb_flush_page for each page, and falls back to flushing everything
+ * when the range is larger than the TLB.
+ */
+void tlb_flush_range(CPUState *cpu, target_ulong addr, target_ulong len);
+/**
+ * tlb_flush_range_by_mmuidx:
+ * @cpu: CPU whose TLB should be flushed
+ * @addr: virtual address of the start of the range
+ * @len: length of the range in bytes
+ * @...: list of MMU indexes to flush, terminated by a negative value
+ *
+ * Like tlb_flush_range, but only for the specified MMU indexes.
+ */
+void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
+                               target_ulong len, ...);
+/**
+ * tlb_flush_range_by_mmuidx_all_cpus:
+ * @src_cpu: the calling vCPU
+ * @addr: virtual address of the start of the range
+ * @len: length of the range in bytes
+ * @...: list of MMU indexes to flush, terminated by a negative value
+ *
+ * Like tlb_flush_range_by_mmuidx, but for every CPU.  See
+ * tlb_flush_all_cpus.
+ */
+void tlb_flush_range_by_mmuidx_all_cpus(CPUState *src_cpu, target_ulong addr,
+                                        target_ulong len, ...);
+/**
+ * tlb_flush_asid_by_mmuidx:
+ * @cpu: CPU whose TLB should be flushed
+ * @asid: address space identifier to flush
+ * @...: list of MMU indexes to flush, terminated by a negative value
+ *
+ * Flush the entries that were added to the specified MMU indexes with
+ * tlb_set_page_with_asid() and @asid.  Global entries, i.e. those added
+ * with TLB_ASID_GLOBAL or through tlb_set_page_with_attrs(), are kept.
+ */
+void tlb_flush_asid_by_mmuidx(CPUState *cpu, uint32_t asid, ...);
+/**
+ * tlb_flush_asid_by_mmuidx_all_cpus:
+ * @src_cpu: the calling vCPU
+ * @asid: address space identifier to flush
+ * @...: list of MMU indexes to flush, terminated by a negative value
+ *
+ * Like tlb_flush_asid_by_mmuidx, but for every CPU.  See
+ * tlb_flush_all_cpus.
+ */
+void tlb_flush_asid_by_mmuidx_all_cpus(CPUState *src_cpu, uint32_t asid, ...);
 /**
  * tlb_set_page_with_attrs:
  * @cpu: CPU to add this TLB entry for
@@ -148,6 +253,27 @@ void tlb_flush_by_mmuidx(CPUState *cpu, ...);
 void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
                              hwaddr paddr, MemTxAttrs attrs,
                              int prot, int mmu_idx, target_ulong size);
+/**
+ * tlb_set_page_with_asid:
+ * @cpu: CPU to add this TLB entry for
+ * @vaddr: virtual address of page to add entry for
+ * @paddr: physical address of the page
+ * @attrs: memory transaction attributes
+ * @prot: access permissions (PAGE_READ/PAGE_WRITE/PAGE_EXEC bits)
+ * @mmu_idx: MMU index to insert TLB entry for
+ * @size: size of the page in bytes
+ * @asid: address space identifier of a non-global mapping, or
+ *        TLB_ASID_GLOBAL
+ *
+ * Like tlb_set_page_with_attrs, but tag the entry with @asid so that
+ * tlb_flush_asid_by_mmuidx() can remove it without touching global
+ * mappings.  The ASID is not checked on lookup, so the target must
+ * still flush the entries of the old ASID when it changes.
+ */
+void tlb_set_page_with_asid(CPUState *cpu, target_ulong vaddr,
+                            hwaddr paddr, MemTxAttrs attrs,
+                            int prot, int mmu_idx, target_ulong size,
+                            uint32_t asid);
 /* tlb_set_page:
  *
  * This function is equivalent to calling tlb_set_page_with_attrs()
@@ -161,6 +287,14 @@ void tb_invalidate_phys_addr(AddressSpace *as, hwaddr addr);
 void probe_write(CPUArchState *env, target_ulong addr, int mmu_idx,
                  uintptr_t retaddr);
 #else
+static inline void tlb_init(CPUState *cpu)
+{
+}
+
+static inline void tlb_destroy(CPUState *cpu)
+{
+}
+
 static inline void tlb_flush_page(CPUState *cpu, target_ulong addr)
 {
 }
@@ -177,6 +311,49 @@ static inline void tlb_flush_page_by_mmuidx(CPUState *cpu,
 static inline void tlb_flush_by_mmuidx(CPUState *cpu, ...)
 {
 }
+
+static inline void tlb_flush_all_cpus(CPUState *src_cpu, int flush_global)
+{
+}
+
+static inline void tlb_flush_page_all_cpus(CPUState *src_cpu,
+                                           target_ulong addr)
+{
+}
+
+static inline void tlb_flush_by_mmuidx_all_cpus(CPUState *src_cpu, ...)
+{
+}
+
+static inline void tlb_flush_page_by_mmuidx_all_cpus(CPUState *src_cpu,
+                                                     target_ulong addr, ...)
+{
+}
+
+static inline void tlb_flush_range(CPUState *cpu, target_ulong addr,
+                                   target_ulong len)
+{
+}
+
+static inline void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
+                                             target_ulong len, ...)
+{
+}
+
+static inline void tlb_flush_range_by_mmuidx_all_cpus(CPUState *src_cpu,
+                                                      target_ulong addr,
+                                                      target_ulong len, ...)
+{
+}
+
+static inline void tlb_flush_asid_by_mmuidx(CPUState *cpu, uint32_t asid, ...)
+{
+}
+
+static inline void tlb_flush_asid_by_mmuidx_all_cpus(CPUState *src_cpu,
+                                                     uint32_t asid, ...)
+{
+}
 #endif
 
 #define CODE_GEN_ALIGN           16 /* must be >= of the size of a icache line */
@@ -213,9 +390,17 @@ struct TranslationBlock {
 #define CF_NOCACHE     0x10000 /* To be freed after execution */
 #define CF_USE_ICOUNT  0x20000
 #define CF_IGNORE_ICOUNT 0x40000 /* Do not generate icount code */
+#define CF_SUPERBLOCK  0x80000 /* Retranslated with its likely successors */
 
     uint16_t invalid;
 
+    /* Number of executions, counted while the TB is not a superblock
+       and superblock_threshold is nonzero, and number of times the
+       conditional jump that ends the TB was taken.  A superblock keeps
+       the counts of the TB it replaced.  */
+    uint32_t exec_count;
+    uint32_t taken_count;
+
     void *tc_ptr;    /* pointer to the translated code */
     uint8_t *tc_search;  /* pointer to search data */
     /* original tb when cflags has CF_NOCACHE */
@@ -258,6 +443,8 @@ struct TranslationBlock {
 void tb_free(TranslationBlock *tb);
 void tb_flush(CPUState *cpu);
 void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr);
+TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
+                                   target_ulong cs_base, uint32_t flags);
 
 #if defined(USE_DIRECT_JUMP)
 
@@ -369,6 +556,7 @@ void tlb_fill(CPUState *cpu, target_ulong addr, MMUAccessType access_type,
 #if defined(CONFIG_USER_ONLY)
 void mmap_lock(void);
 void mmap_unlock(void);
+void mmap_lock_reset(void);
 
 static inline tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong addr)
 {
@@ -377,6 +565,7 @@ static inline tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong
 #else
 static inline void mmap_lock(void) {}
 static inline void mmap_unlock(void) {}
+static inline void mmap_lock_reset(void) {}
 
 /* cputlb.c */
 tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong addr);
@@ -390,7 +579,7 @@ void tb_flush_jmp_cache(CPUState *cpu, target_ulong addr);
 MemoryRegionSection *
 address_space_translate_for_iotlb(CPUState *cpu, int asidx, hwaddr addr,
                                   hwaddr *xlat, hwaddr *plen);
-hwaddr memory_region_section_get_iotlb(CPUState *cpu,
+hwaddr memory_region_section_get_iotlb(CPUState *cpu, int asidx,
                                        MemoryRegionSection *section,
                                        target_ulong vaddr,
                                        hwaddr paddr, hwaddr xlat,
@@ -403,6 +592,9 @@ bool memory_region_is_unassigned(MemoryRegion *mr);
 /* vl.c */
 extern int singlestep;
 
+/* translate-all.c */
+extern unsigned int superblock_threshold;
+
 /* cpu-exec.c, accessed with atomic_mb_read/atomic_mb_set */
 extern CPUState *tcg_current_cpu;
 extern bool exit_request;
@@ -5,26 +5,54 @@
 
 /* Helpers for instruction counting code generation.  */
 
-static int icount_start_insn_idx;
-static TCGLabel *icount_label;
-static TCGLabel *exitreq_label;
+#ifdef TARGET_SUPPORTS_SUPERBLOCKS
+/* Increment *COUNTER and return its new value.  */
+static inline TCGv_i32 gen_tb_count(uint32_t *counter)
+{
+    TCGv_ptr ptr = tcg_const_ptr(counter);
+    TCGv_i32 count = tcg_temp_new_i32();
+
+    tcg_gen_ld_i32(count, ptr, 0);
+    tcg_gen_addi_i32(count, count, 1);
+    tcg_gen_st_i32(count, ptr, 0);
+    tcg_temp_free_ptr(ptr);
+    return count;
+}
+#endif
 
 static inline void gen_tb_start(TranslationBlock *tb)
 {
     TCGv_i32 count, flag, imm;
 
-    exitreq_label = gen_new_label();
+    tcg_ctx->exitreq_label = gen_new_label();
     flag = tcg_temp_new_i32();
     tcg_gen_ld_i32(flag, cpu_env,
                    offsetof(CPUState, tcg_exit_req) - ENV_OFFSET);
-    tcg_gen_brcondi_i32(TCG_COND_NE, flag, 0, exitreq_label);
+    tcg_gen_brcondi_i32(TCG_COND_NE, flag, 0, tcg_ctx->exitreq_label);
     tcg_temp_free_i32(flag);
 
+#ifdef TARGET_SUPPORTS_SUPERBLOCKS
+    tcg_ctx->superblock_candidate = false;
+    tcg_ctx->exec_count_start_idx = tcg_op_buf_count();
+    tcg_ctx->exec_count_end_idx = tcg_ctx->exec_count_start_idx;
+    if (superblock_threshold &&
+        !(tb->cflags & (CF_SUPERBLOCK | CF_NOCACHE | CF_USE_ICOUNT))) {
+        /* Count the executions of the block.  When it becomes hot, return
+           to the main loop before executing it, so that tb_find can
+           retranslate it as a superblock.  */
+        count = gen_tb_count(&tb->exec_count);
+        tcg_gen_brcondi_i32(TCG_COND_EQ, count, superblock_threshold,
+                            tcg_ctx->exitreq_label);
+        tcg_temp_free_i32(count);
+        tcg_ctx->exec_count_end_idx = tcg_op_buf_count();
+    }
+#endif
+
     if (!(tb->cflags & CF_USE_ICOUNT)) {
         return;
     }
 
-    icount_label = gen_new_label();
+    tcg_ctx->icount_label = gen_new_label();
     count = tcg_temp_local_new_i32();
     tcg_gen_ld_i32(count, cpu_env,
                    -ENV_OFFSET + offsetof(CPUState, icount_decr.u32));
@@ -33,33 +61,63 @@ static inline void gen_tb_start(TranslationBlock *tb)
     /* We emit a movi with a dummy immediate argument. Keep the insn index
      * of the movi so that we later (when we know the actual insn count)
      * can update the immediate argument with the actual insn count.  */
-    icount_start_insn_idx = tcg_op_buf_count();
+    tcg_ctx->icount_start_insn_idx = tcg_op_buf_count();
     tcg_gen_movi_i32(imm, 0xdeadbeef);
 
     tcg_gen_sub_i32(count, count, imm);
     tcg_temp_free_i32(imm);
 
-    tcg_gen_brcondi_i32(TCG_COND_LT, count, 0, icount_label);
+    tcg_gen_brcondi_i32(TCG_COND_LT, count, 0, tcg_ctx->icount_label);
     tcg_gen_st16_i32(count, cpu_env,
                      -ENV_OFFSET + offsetof(CPUState, icount_decr.u16.low));
     tcg_temp_free_i32(count);
 }
 
+#ifdef TARGET_SUPPORTS_SUPERBLOCKS
+/* Called by the translator when a superblock formed from the current
+   block could go on past its end, so that its executions are counted.  */
+static inline void gen_tb_superblock_candidate(void)
+{
+    tcg_ctx->superblock_candidate = true;
+}
+
+/* Called by the translator on the taken side of the conditional jump
+   that ends a superblock candidate.  */
+static inline void gen_tb_count_taken(TranslationBlock *tb)
+{
+    if (tcg_ctx->superblock_candidate &&
+        tcg_ctx->exec_count_end_idx != tcg_ctx->exec_count_start_idx) {
+        tcg_temp_free_i32(gen_tb_count(&tb->taken_count));
+    }
+}
+#endif
+
 static void gen_tb_end(TranslationBlock *tb, int num_insns)
 {
-    gen_set_label(exitreq_label);
+#ifdef TARGET_SUPPORTS_SUPERBLOCKS
+    if (!tcg_ctx->superblock_candidate) {
+        int i;
+
+        for (i = tcg_ctx->exec_count_start_idx;
+             i < tcg_ctx->exec_count_end_idx; i++) {
+            tcg_op_remove(tcg_ctx, &tcg_ctx->gen_op_buf[i]);
+        }
+    }
+#endif
+
+    gen_set_label(tcg_ctx->exitreq_label);
     tcg_gen_exit_tb((uintptr_t)tb + TB_EXIT_REQUESTED);
 
     if (tb->cflags & CF_USE_ICOUNT) {
         /* Update the num_insn immediate parameter now that we know
          * the actual insn count.  */
-        tcg_set_insn_param(icount_start_insn_idx, 1, num_insns);
-        gen_set_label(icount_label);
+        tcg_set_insn_param(tcg_ctx->icount_start_insn_idx, 1, num_insns);
+        gen_set_label(tcg_ctx->icount_label);
         tcg_gen_exit_tb((uintptr_t)tb + TB_EXIT_ICOUNT_EXPIRED);
     }
 
     /* Terminate the linked list.  */
-    tcg_ctx.gen_op_buf[tcg_ctx.gen_op_buf[0].prev].next = 0;
+    tcg_ctx->gen_op_buf[tcg_ctx->gen_op_buf[0].prev].next = 0;
 }
 
 static inline void gen_io_start(void)
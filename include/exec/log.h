@@ -48,6 +48,26 @@ static inline void log_disas(void *code, unsigned long size)
     disas(qemu_logfile, code, size);
 }
 
+/* Like log_disas(), for generated code whose constant pool starts at
+ * @data; the pool is dumped as data rather than disassembled.  @data is
+ * NULL if there is no pool.
+ */
+static inline void log_disas_code_and_data(void *code, unsigned long size,
+                                           void *data)
+{
+    uintptr_t *p;
+
+    if (!data) {
+        log_disas(code, size);
+        return;
+    }
+    log_disas(code, data - code);
+    for (p = data; (void *)p < code + size; p++) {
+        qemu_log("0x%08" PRIxPTR ":  .data  0x%0*" PRIxPTR "\n",
+                 (uintptr_t)p, (int)sizeof(*p) * 2, *p);
+    }
+}
+
 #if defined(CONFIG_USER_ONLY)
 /* page_dump() output to the log file: */
 static inline void log_page_dump(void)
@@ -197,6 +197,12 @@ struct MemoryRegion {
     bool flush_coalesced_mmio;
     bool global_locking;
     uint8_t dirty_log_mask;
+    /* Access sizes, as a mask of 1, 2, 4 and 8, that
+     * memory_region_dispatch_{read,write}_direct pass straight to ops
+     */
+    uint8_t direct_read_sizes;
+    uint8_t direct_write_sizes;
+    bool direct_bswap;
     RAMBlock *ram_block;
     Object *owner;
     const MemoryRegionIOMMUOps *iommu_ops;
@@ -218,6 +224,8 @@ struct MemoryRegion {
     int32_t priority;
     QTAILQ_HEAD(subregions, MemoryRegion) subregions;
     QTAILQ_ENTRY(MemoryRegion) subregions_link;
+    QTAILQ_HEAD(, MemoryRegion) aliases;
+    QTAILQ_ENTRY(MemoryRegion) aliases_link;
     QTAILQ_HEAD(coalesced_ranges, CoalescedMemoryRange) coalesced;
     const char *name;
     unsigned ioeventfd_nb;
@@ -273,12 +281,13 @@ struct AddressSpace {
 
     /* Accessed via RCU.  */
     struct FlatView *current_map;
+    /* The dispatch tree of current_map, which owns it */
+    struct AddressSpaceDispatch *dispatch;
+    /* The view being installed by the current transaction, if it changed */
+    struct FlatView *next_map;
 
     int ioeventfd_nb;
     struct MemoryRegionIoeventfd *ioeventfds;
-    struct AddressSpaceDispatch *dispatch;
-    struct AddressSpaceDispatch *next_dispatch;
-    MemoryListener dispatch_listener;
     QTAILQ_HEAD(memory_listeners_as, MemoryListener) listeners;
     QTAILQ_ENTRY(AddressSpace) address_spaces_link;
 };
@@ -1236,7 +1245,54 @@ void memory_global_dirty_log_start(void);
  */
 void memory_global_dirty_log_stop(void);
 
-void mtree_info(fprintf_function mon_printf, void *f);
+void mtree_info(fprintf_function mon_printf, void *f, bool flatview);
+
+/**
+ * memory_check_flatviews: check the flat view of each address space
+ *
+ * Render the memory regions of each address space from scratch, and
+ * compare the result with the flat view that was updated incrementally.
+ * The address spaces that differ are reported with error_report().
+ *
+ * Returns: the number of address spaces whose flat view is out of date.
+ */
+int memory_check_flatviews(void);
+
+/**
+ * memory_region_dispatch_read_direct: try to perform a read directly to
+ * the specified MemoryRegion, with a single call to its read callback.
+ *
+ * Returns false, without side effects, if the access needs the checks or
+ * the size adjustment of memory_region_dispatch_read(), which must then be
+ * used instead.  The sizes and the endianness that allow the direct call
+ * are resolved when the region's ops are set.
+ *
+ * @mr: #MemoryRegion to access
+ * @addr: address within that region
+ * @pval: pointer to uint64_t which the data is written to
+ * @size: size of the access in bytes
+ */
+bool memory_region_dispatch_read_direct(MemoryRegion *mr,
+                                        hwaddr addr,
+                                        uint64_t *pval,
+                                        unsigned size);
+
+/**
+ * memory_region_dispatch_write_direct: try to perform a write directly to
+ * the specified MemoryRegion, with a single call to its write callback.
+ *
+ * Returns false, without side effects, if memory_region_dispatch_write()
+ * must be used instead.
+ *
+ * @mr: #MemoryRegion to access
+ * @addr: address within that region
+ * @data: data to write
+ * @size: size of the access in bytes
+ */
+bool memory_region_dispatch_write_direct(MemoryRegion *mr,
+                                         hwaddr addr,
+                                         uint64_t data,
+                                         unsigned size);
 
 /**
  * memory_region_dispatch_read: perform a read directly to the specified
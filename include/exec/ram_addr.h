@@ -37,6 +37,16 @@ struct RAMBlock {
     QLIST_ENTRY(RAMBlock) next;
     int fd;
     size_t page_size;
+    /* Outgoing migration bitmaps, one bit per target page of the block.
+     * Only accessed by the migration thread while a migration runs.
+     *
+     * bmap: pages that are dirty and have to be sent.
+     * unsentmap: pages that haven't been sent even once; only maintained
+     * and used in postcopy, where it's used to send the dirtymap at the
+     * start of the postcopy phase.
+     */
+    unsigned long *bmap;
+    unsigned long *unsentmap;
 };
 
 static inline bool offset_in_ramblock(RAMBlock *b, ram_addr_t offset)
@@ -393,63 +403,15 @@ static inline void cpu_physical_memory_clear_dirty_range(ram_addr_t start,
 }
 
 
-static inline
-uint64_t cpu_physical_memory_sync_dirty_bitmap(unsigned long *dest,
+/* Move the DIRTY_MEMORY_MIGRATION bits for the byte range
+ * [start, start + length) of @rb to rb->bmap.  The range must be
+ * target page aligned.  Each word of the dirty bitmap is fetched and
+ * cleared atomically, so neither the iothread lock nor exclusion of the
+ * vCPUs is needed.  Returns the number of pages that became dirty in
+ * rb->bmap.
+ */
+uint64_t cpu_physical_memory_sync_dirty_bitmap(RAMBlock *rb,
                                                ram_addr_t start,
-                                               ram_addr_t length)
-{
-    ram_addr_t addr;
-    unsigned long page = BIT_WORD(start >> TARGET_PAGE_BITS);
-    uint64_t num_dirty = 0;
-
-    /* start address is aligned at the start of a word? */
-    if (((page * BITS_PER_LONG) << TARGET_PAGE_BITS) == start) {
-        int k;
-        int nr = BITS_TO_LONGS(length >> TARGET_PAGE_BITS);
-        unsigned long * const *src;
-        unsigned long idx = (page * BITS_PER_LONG) / DIRTY_MEMORY_BLOCK_SIZE;
-        unsigned long offset = BIT_WORD((page * BITS_PER_LONG) %
-                                        DIRTY_MEMORY_BLOCK_SIZE);
-
-        rcu_read_lock();
-
-        src = atomic_rcu_read(
-                &ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION])->blocks;
-
-        for (k = page; k < page + nr; k++) {
-            if (src[idx][offset]) {
-                unsigned long bits = atomic_xchg(&src[idx][offset], 0);
-                unsigned long new_dirty;
-                new_dirty = ~dest[k];
-                dest[k] |= bits;
-                new_dirty &= bits;
-                num_dirty += ctpopl(new_dirty);
-            }
-
-            if (++offset >= BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE)) {
-                offset = 0;
-                idx++;
-            }
-        }
-
-        rcu_read_unlock();
-    } else {
-        for (addr = 0; addr < length; addr += TARGET_PAGE_SIZE) {
-            if (cpu_physical_memory_test_and_clear_dirty(
-                        start + addr,
-                        TARGET_PAGE_SIZE,
-                        DIRTY_MEMORY_MIGRATION)) {
-                long k = (start + addr) >> TARGET_PAGE_BITS;
-                if (!test_and_set_bit(k, dest)) {
-                    num_dirty++;
-                }
-            }
-        }
-    }
-
-    return num_dirty;
-}
-
-void migration_bitmap_extend(ram_addr_t old, ram_addr_t new);
+                                               ram_addr_t length);
 #endif
 #endif
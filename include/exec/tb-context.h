@@ -39,7 +39,10 @@ struct TBContext {
 
     /* statistics */
     unsigned tb_flush_count;
+    unsigned region_reclaim_count;
     int tb_phys_invalidate_count;
 };
 
+extern TBContext tb_ctx;
+
 #endif
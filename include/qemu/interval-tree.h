@@ -0,0 +1,99 @@
+/*
+ * Interval tree of disjoint ranges, for read-mostly workloads.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#ifndef QEMU_INTERVAL_TREE_H
+#define QEMU_INTERVAL_TREE_H
+
+/*
+ * The tree holds nodes covering closed ranges [start, last], which must
+ * not overlap.  It does no memory management and no locking: nodes are
+ * embedded in the caller's structures, and updates must be serialized
+ * by the caller.
+ *
+ * Lookups and iterations may run concurrently with updates, provided
+ * that they run inside an RCU read-critical section and that removed
+ * nodes are only freed after a grace period.  They never crash nor loop
+ * forever, but their result is unreliable if an update was in progress;
+ * such readers must detect that, for example with a seqlock around the
+ * updates, and retry.
+ */
+
+typedef struct IntervalTreeNode {
+    struct IntervalTreeNode *left;
+    struct IntervalTreeNode *right;
+    uint64_t start;
+    uint64_t last;
+    uint32_t priority;
+} IntervalTreeNode;
+
+typedef struct IntervalTree {
+    IntervalTreeNode *root;
+} IntervalTree;
+
+/**
+ * interval_tree_init - Initialize an empty interval tree
+ * @tree: tree to be initialized
+ *
+ * A zero-initialized IntervalTree is empty as well.
+ */
+void interval_tree_init(IntervalTree *tree);
+
+/**
+ * interval_tree_insert - Insert a node into the tree
+ * @tree: tree to insert to
+ * @node: node to be inserted, with @start and @last filled in
+ *
+ * The range of @node must not overlap with any node of the tree, and
+ * must not change while @node is in the tree.
+ */
+void interval_tree_insert(IntervalTree *tree, IntervalTreeNode *node);
+
+/**
+ * interval_tree_remove - Remove a node from the tree
+ * @tree: tree to remove from
+ * @node: node of @tree to be removed
+ *
+ * Concurrent readers may still be looking at @node, so it can only be
+ * freed after a grace period.
+ */
+void interval_tree_remove(IntervalTree *tree, IntervalTreeNode *node);
+
+/**
+ * interval_tree_lookup - Find the node containing an address
+ * @tree: tree to search
+ * @addr: address to look for
+ *
+ * Returns the node whose range contains @addr, or NULL if there is none.
+ */
+IntervalTreeNode *interval_tree_lookup(IntervalTree *tree, uint64_t addr);
+
+/**
+ * interval_tree_iter_first - Find the first node overlapping a range
+ * @tree: tree to search
+ * @start: first address of the range
+ * @last: last address of the range
+ *
+ * Returns the node with the lowest addresses among those overlapping
+ * [@start, @last], or NULL if there is none.
+ */
+IntervalTreeNode *interval_tree_iter_first(IntervalTree *tree,
+                                           uint64_t start, uint64_t last);
+
+/**
+ * interval_tree_iter_next - Find the next node overlapping a range
+ * @tree: tree to search
+ * @node: node returned by the previous iteration step
+ * @last: last address of the range
+ *
+ * Returns the node following @node, if it starts at or before @last;
+ * otherwise NULL.  @node need not be in the tree anymore, so that the
+ * nodes can be removed as they are visited.
+ */
+IntervalTreeNode *interval_tree_iter_next(IntervalTree *tree,
+                                          IntervalTreeNode *node,
+                                          uint64_t last);
+
+#endif /* QEMU_INTERVAL_TREE_H */
@@ -7,6 +7,7 @@
 #include "qemu.h"
 #include "disas/disas.h"
 #include "qemu/path.h"
+#include "perf.h"
 
 #ifdef _ARCH_PPC64
 #undef ARCH_DLINFO
@@ -1998,7 +1999,8 @@ static void load_elf_image(const char *image_name, int image_fd,
         info->brk = info->end_code;
     }
 
-    if (qemu_log_enabled()) {
+    /* The symbols are also used to name translated code for perf.  */
+    if (qemu_log_enabled() || perf_enabled()) {
         load_symbols(ehdr, image_fd, load_bias);
     }
 
@@ -30,6 +30,7 @@
 #include "cpu.h"
 #include "exec/exec-all.h"
 #include "tcg.h"
+#include "perf.h"
 #include "qemu/timer.h"
 #include "qemu/envlist.h"
 #include "elf.h"
@@ -45,6 +46,7 @@ static const char *argv0;
 static int gdbstub_port;
 static envlist_t *envlist;
 static const char *cpu_model;
+static const char *tb_cache_path;
 unsigned long mmap_min_addr;
 unsigned long guest_base;
 int have_guest_base;
@@ -111,7 +113,7 @@ int cpu_get_pic_interrupt(CPUX86State *env)
 void fork_start(void)
 {
     cpu_list_lock();
-    qemu_mutex_lock(&tcg_ctx.tb_ctx.tb_lock);
+    qemu_mutex_lock(&tb_ctx.tb_lock);
     mmap_fork_start();
 }
 
@@ -127,11 +129,11 @@ void fork_end(int child)
                 QTAILQ_REMOVE(&cpus, cpu, node);
             }
         }
-        qemu_mutex_init(&tcg_ctx.tb_ctx.tb_lock);
+        qemu_mutex_init(&tb_ctx.tb_lock);
         qemu_init_cpu_list();
         gdbserver_fork(thread_cpu);
     } else {
-        qemu_mutex_unlock(&tcg_ctx.tb_ctx.tb_lock);
+        qemu_mutex_unlock(&tb_ctx.tb_lock);
         cpu_list_unlock();
     }
 }
@@ -3729,6 +3731,43 @@ static void handle_arg_singlestep(const char *arg)
     singlestep = 1;
 }
 
+static void handle_arg_superblock(const char *arg)
+{
+    char *p;
+
+    superblock_threshold = strtoul(arg, &p, 0);
+    if (*p) {
+        fprintf(stderr, "Invalid superblock threshold '%s'\n", arg);
+        exit(EXIT_FAILURE);
+    }
+#ifndef TARGET_SUPPORTS_SUPERBLOCKS
+    if (superblock_threshold) {
+        fprintf(stderr, "Superblocks are not supported for this guest\n");
+        superblock_threshold = 0;
+    }
+#endif
+}
+
+static void handle_arg_no_host_vector(const char *arg)
+{
+    tcg_host_vectors = false;
+}
+
+static void handle_arg_tb_cache(const char *arg)
+{
+    tb_cache_path = arg;
+}
+
+static void handle_arg_perfmap(const char *arg)
+{
+    perf_enable_perfmap();
+}
+
+static void handle_arg_jitdump(const char *arg)
+{
+    perf_enable_jitdump();
+}
+
 static void handle_arg_strace(const char *arg)
 {
     do_strace = 1;
@@ -3791,6 +3830,16 @@ static const struct qemu_argument arg_table[] = {
      "pagesize",   "set the host page size to 'pagesize'"},
     {"singlestep", "QEMU_SINGLESTEP",  false, handle_arg_singlestep,
      "",           "run in singlestep mode"},
+    {"superblock", "QEMU_SUPERBLOCK",  true,  handle_arg_superblock,
+     "count",      "form superblocks from blocks executed 'count' times"},
+    {"no-host-vector", "QEMU_NO_HOST_VECTOR", false, handle_arg_no_host_vector,
+     "",           "expand guest vector operations to integer operations"},
+    {"tb-cache",   "QEMU_TB_CACHE",    true,  handle_arg_tb_cache,
+     "dir",        "reuse translated code saved in 'dir' across runs"},
+    {"perfmap",    "QEMU_PERFMAP",     false, handle_arg_perfmap,
+     "",           "write a perf map of translated code to /tmp"},
+    {"jitdump",    "QEMU_JITDUMP",     false, handle_arg_jitdump,
+     "",           "write a jitdump of translated code for perf inject"},
     {"strace",     "QEMU_STRACE",      false, handle_arg_strace,
      "",           "log system calls"},
     {"seed",       "QEMU_RAND_SEED",   true,  handle_arg_randseed,
@@ -4144,6 +4193,10 @@ int main(int argc, char **argv, char **envp)
     cpu->opaque = ts;
     task_settid(ts);
 
+    if (tb_cache_path) {
+        tb_cache_init(tb_cache_path, cpu_model);
+    }
+
     execfd = qemu_getauxval(AT_EXECFD);
     if (execfd == 0) {
         execfd = open(filename, O_RDONLY);
@@ -4190,7 +4243,9 @@ int main(int argc, char **argv, char **envp)
     /* Now that we've loaded the binary, GUEST_BASE is fixed.  Delay
        generating the prologue until now so that the prologue can take
        the real value of GUEST_BASE into account.  */
-    tcg_prologue_init(&tcg_ctx);
+    tcg_prologue_init(tcg_ctx);
+    perf_report_prologue(tcg_ctx->code_gen_prologue,
+                         tcg_ctx->code_gen_buffer - tcg_ctx->code_gen_prologue);
 
 #if defined(TARGET_I386)
     env->cr[0] = CR0_PG_MASK | CR0_WP_MASK | CR0_PE_MASK;
@@ -27,6 +27,21 @@
 static pthread_mutex_t mmap_mutex = PTHREAD_MUTEX_INITIALIZER;
 static __thread int mmap_lock_count;
 
+/* target_munmap drops mmap_lock while the host unmaps a range whose page
+   flags it has already cleared.  Until then nothing may be mapped there
+   at a fixed address, or the host munmap would take it away; see
+   mmap_wait_unmaps.  The list is protected by mmap_lock, its entries
+   live on the stack of the unmapping threads.  */
+typedef struct MmapUnmap {
+    abi_ulong start;
+    abi_ulong end;
+    QLIST_ENTRY(MmapUnmap) next;
+} MmapUnmap;
+
+static QLIST_HEAD(, MmapUnmap) mmap_unmaps =
+    QLIST_HEAD_INITIALIZER(mmap_unmaps);
+static pthread_cond_t mmap_unmap_cond = PTHREAD_COND_INITIALIZER;
+
 void mmap_lock(void)
 {
     if (mmap_lock_count++ == 0) {
@@ -41,6 +56,15 @@ void mmap_unlock(void)
     }
 }
 
+/* Release the lock if a host fault while translating left it taken.  */
+void mmap_lock_reset(void)
+{
+    if (mmap_lock_count) {
+        mmap_lock_count = 0;
+        pthread_mutex_unlock(&mmap_mutex);
+    }
+}
+
 /* Grab lock to make sure things are in a consistent state after fork().  */
 void mmap_fork_start(void)
 {
@@ -51,10 +75,30 @@ void mmap_fork_start(void)
 
 void mmap_fork_end(int child)
 {
-    if (child)
+    if (child) {
+        /* The threads that were unmapping do not exist in the child.  */
+        QLIST_INIT(&mmap_unmaps);
+        pthread_cond_init(&mmap_unmap_cond, NULL);
         pthread_mutex_init(&mmap_mutex, NULL);
-    else
+    } else {
         pthread_mutex_unlock(&mmap_mutex);
+    }
+}
+
+/* Wait until no other thread is unmapping anything in [start, start+len).
+   Called with mmap_lock held, which is dropped while waiting; so call
+   it before looking at the page flags.  */
+void mmap_wait_unmaps(abi_ulong start, abi_ulong len)
+{
+    MmapUnmap *u;
+
+again:
+    QLIST_FOREACH(u, &mmap_unmaps, next) {
+        if (u->start < start + len && start < u->end) {
+            pthread_cond_wait(&mmap_unmap_cond, &mmap_mutex);
+            goto again;
+        }
+    }
 }
 
 /* NOTE: all the constants are the HOST ones, but addresses are target. */
@@ -248,18 +292,21 @@ static abi_ulong mmap_find_vma_reserved(abi_ulong start, abi_ulong size)
 /*
  * Find and reserve a free memory area of size 'size'. The search
  * starts at 'start'.
- * It must be called with mmap_lock() held.
+ * It must be called with mmap_lock() held if reserved_va is set.
+ * Otherwise the area is reserved in the host, so that no other thread
+ * can get it, and the lock is not needed.
  * Return -1 if error.
  */
 abi_ulong mmap_find_vma(abi_ulong start, abi_ulong size)
 {
     void *ptr, *prev;
-    abi_ulong addr;
+    abi_ulong addr, next_start;
     int wrapped, repeat;
 
     /* If 'start' == 0, then a default start address is used. */
+    next_start = atomic_read(&mmap_next_start);
     if (start == 0) {
-        start = mmap_next_start;
+        start = next_start;
     } else {
         start &= qemu_host_page_mask;
     }
@@ -299,8 +346,8 @@ abi_ulong mmap_find_vma(abi_ulong start, abi_ulong size)
 
             if ((addr & ~TARGET_PAGE_MASK) == 0) {
                 /* Success.  */
-                if (start == mmap_next_start && addr >= TASK_UNMAPPED_BASE) {
-                    mmap_next_start = addr + size;
+                if (start == next_start && addr >= TASK_UNMAPPED_BASE) {
+                    atomic_cmpxchg(&mmap_next_start, next_start, addr + size);
                 }
                 return addr;
             }
@@ -360,6 +407,7 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int prot,
                      int flags, int fd, abi_ulong offset)
 {
     abi_ulong ret, end, real_start, real_end, retaddr, host_offset, host_len;
+    bool locked = true;
 
     mmap_lock();
 #ifdef DEBUG_MMAP
@@ -405,6 +453,13 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int prot,
     if (!(flags & MAP_FIXED)) {
         host_len = len + offset - host_offset;
         host_len = HOST_PAGE_ALIGN(host_len);
+        if (!reserved_va) {
+            /* mmap_find_vma reserves the area in the host, so the mapping
+               can be set up without the lock; it is only needed again to
+               publish the page flags.  */
+            mmap_unlock();
+            locked = false;
+        }
         start = mmap_find_vma(real_start, host_len);
         if (start == (abi_ulong)-1) {
             errno = ENOMEM;
@@ -471,6 +526,7 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int prot,
             errno = EINVAL;
             goto fail;
         }
+        mmap_wait_unmaps(start, len);
         end = start + len;
         real_end = HOST_PAGE_ALIGN(end);
 
@@ -551,6 +607,9 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int prot,
         }
     }
  the_end1:
+    if (!locked) {
+        mmap_lock();
+    }
     page_set_flags(start, start + len, prot | PAGE_VALID);
  the_end:
 #ifdef DEBUG_MMAP
@@ -559,10 +618,13 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int prot,
     printf("\n");
 #endif
     tb_invalidate_phys_range(start, start + len);
+    tb_cache_map(start, len, prot, flags, fd, offset);
     mmap_unlock();
     return start;
 fail:
-    mmap_unlock();
+    if (locked) {
+        mmap_unlock();
+    }
     return -1;
 }
 
@@ -610,7 +672,8 @@ static void mmap_reserve(abi_ulong start, abi_ulong size)
 int target_munmap(abi_ulong start, abi_ulong len)
 {
     abi_ulong end, real_start, real_end, addr;
-    int prot, ret;
+    MmapUnmap unmap;
+    int prot, ret, flags;
 
 #ifdef DEBUG_MMAP
     printf("munmap: start=0x" TARGET_ABI_FMT_lx " len=0x"
@@ -654,8 +717,33 @@ int target_munmap(abi_ulong start, abi_ulong len)
     ret = 0;
     /* unmap what we can */
     if (real_start < real_end) {
+        flags = page_get_range_flags(start, start + len);
         if (reserved_va) {
             mmap_reserve(real_start, real_end - real_start);
+        } else if (flags >= 0) {
+            /* Tearing down a large mapping can take a while, so do it
+               without the lock.  The guest loses the range first, and
+               gets it back if munmap fails, which is easy when all the
+               pages had the same flags.  */
+            page_set_flags(start, start + len, 0);
+            tb_invalidate_phys_range(start, start + len);
+            unmap.start = real_start;
+            unmap.end = real_end;
+            QLIST_INSERT_HEAD(&mmap_unmaps, &unmap, next);
+            mmap_unlock();
+
+            ret = munmap(g2h(real_start), real_end - real_start);
+
+            mmap_lock();
+            QLIST_REMOVE(&unmap, next);
+            pthread_cond_broadcast(&mmap_unmap_cond);
+            if (ret == 0) {
+                tb_cache_unmap(start, len);
+            } else if (flags) {
+                page_set_flags(start, start + len, flags);
+            }
+            mmap_unlock();
+            return ret;
         } else {
             ret = munmap(g2h(real_start), real_end - real_start);
         }
@@ -664,6 +752,7 @@ int target_munmap(abi_ulong start, abi_ulong len)
     if (ret == 0) {
         page_set_flags(start, start + len, 0);
         tb_invalidate_phys_range(start, start + len);
+        tb_cache_unmap(start, len);
     }
     mmap_unlock();
     return ret;
@@ -679,6 +768,7 @@ abi_long target_mremap(abi_ulong old_addr, abi_ulong old_size,
     mmap_lock();
 
     if (flags & MREMAP_FIXED) {
+        mmap_wait_unmaps(new_addr, new_size);
         host_addr = mremap(g2h(old_addr), old_size, new_size,
                            flags, g2h(new_addr));
 
@@ -737,6 +827,8 @@ abi_long target_mremap(abi_ulong old_addr, abi_ulong old_size,
         prot = page_get_flags(old_addr);
         page_set_flags(old_addr, old_addr + old_size, 0);
         page_set_flags(new_addr, new_addr + new_size, prot | PAGE_VALID);
+        tb_cache_unmap(old_addr, old_size);
+        tb_cache_unmap(new_addr, new_size);
     }
     tb_invalidate_phys_range(new_addr, new_addr + new_size);
     mmap_unlock();
@@ -430,9 +430,22 @@ int target_msync(abi_ulong start, abi_ulong len, int flags);
 extern unsigned long last_brk;
 extern abi_ulong mmap_next_start;
 abi_ulong mmap_find_vma(abi_ulong, abi_ulong);
+void mmap_wait_unmaps(abi_ulong start, abi_ulong len);
 void mmap_fork_start(void);
 void mmap_fork_end(int child);
 
+/* tbcache.c */
+void tb_cache_init(const char *dir, const char *cpu_model);
+void tb_cache_map(abi_ulong start, abi_ulong len, int prot, int flags,
+                  int fd, abi_ulong offset);
+void tb_cache_unmap(abi_ulong start, abi_ulong len);
+bool tb_cache_wanted(CPUState *cpu, TranslationBlock *tb);
+int tb_cache_load(CPUState *cpu, TranslationBlock *tb, intptr_t avail,
+                  int *search_size);
+void tb_cache_store(CPUState *cpu, TranslationBlock *tb, int code_size,
+                    int search_size);
+void tb_cache_save(void);
+
 /* main.c */
 extern unsigned long guest_stack_size;
 
@@ -113,6 +113,8 @@ int __clone2(int (*fn)(void *), void *child_stack_base,
 #include "uname.h"
 
 #include "qemu.h"
+#include "perf.h"
+#include "tcg.h"
 
 #ifndef CLONE_IO
 #define CLONE_IO                0x80000000      /* Clone io context */
@@ -3196,8 +3198,19 @@ static abi_long do_getsockopt(int sockfd, int level, int optname,
     return ret;
 }
 
+#ifndef UIO_FASTIOV
+#define UIO_FASTIOV 8
+#endif
+
+/* Translate the guest iovec at TARGET_ADDR.  Like the kernel does, short
+ * vectors are built in FAST_VEC, an array of UIO_FASTIOV elements that
+ * the caller usually has on the stack, so that the common case does not
+ * need an allocation.  The buffers are locked with lock_user, which
+ * returns a pointer into guest memory unless DEBUG_REMAP is defined.
+ */
 static struct iovec *lock_iovec(int type, abi_ulong target_addr,
-                                abi_ulong count, int copy)
+                                abi_ulong count, int copy,
+                                struct iovec *fast_vec)
 {
     struct target_iovec *target_vec;
     struct iovec *vec;
@@ -3215,10 +3228,14 @@ static struct iovec *lock_iovec(int type, abi_ulong target_addr,
         return NULL;
     }
 
-    vec = g_try_new0(struct iovec, count);
-    if (vec == NULL) {
-        errno = ENOMEM;
-        return NULL;
+    if (count <= UIO_FASTIOV) {
+        vec = fast_vec;
+    } else {
+        vec = g_try_new(struct iovec, count);
+        if (vec == NULL) {
+            errno = ENOMEM;
+            return NULL;
+        }
     }
 
     target_vec = lock_user(VERIFY_READ, target_addr,
@@ -3279,7 +3296,9 @@ static struct iovec *lock_iovec(int type, abi_ulong target_addr,
     }
     unlock_user(target_vec, target_addr, 0);
  fail2:
-    g_free(vec);
+    if (vec != fast_vec) {
+        g_free(vec);
+    }
     errno = err;
     return NULL;
 }
@@ -3287,6 +3306,9 @@ static struct iovec *lock_iovec(int type, abi_ulong target_addr,
 static void unlock_iovec(struct iovec *vec, abi_ulong target_addr,
                          abi_ulong count, int copy)
 {
+#ifdef DEBUG_REMAP
+    /* Otherwise unlock_user does nothing, and there is no need to read
+       the guest iovec again.  */
     struct target_iovec *target_vec;
     int i;
 
@@ -3303,8 +3325,11 @@ static void unlock_iovec(struct iovec *vec, abi_ulong target_addr,
         }
         unlock_user(target_vec, target_addr, 0);
     }
+#endif
 
-    g_free(vec);
+    if (count > UIO_FASTIOV) {
+        g_free(vec);
+    }
 }
 
 static inline int target_to_host_sock_type(int *type)
@@ -3542,6 +3567,7 @@ static abi_long do_sendrecvmsg_locked(int fd, struct target_msghdr *msgp,
     struct msghdr msg;
     abi_ulong count;
     struct iovec *vec;
+    struct iovec fast_vec[UIO_FASTIOV];
     abi_ulong target_vec;
 
     if (msgp->msg_name) {
@@ -3580,7 +3606,7 @@ static abi_long do_sendrecvmsg_locked(int fd, struct target_msghdr *msgp,
     }
 
     vec = lock_iovec(send ? VERIFY_READ : VERIFY_WRITE,
-                     target_vec, count, send);
+                     target_vec, count, send, fast_vec);
     if (vec == NULL) {
         ret = -host_to_target_errno(errno);
         goto out2;
@@ -4715,9 +4741,10 @@ static inline abi_ulong do_shmat(CPUArchState *cpu_env,
 
     mmap_lock();
 
-    if (shmaddr)
+    if (shmaddr) {
+        mmap_wait_unmaps(shmaddr, shm_info.shm_segsz);
         host_raddr = shmat(shmid, (void *)g2h(shmaddr), shmflg);
-    else {
+    } else {
         abi_ulong mmap_start;
 
         mmap_start = mmap_find_vma(0, shm_info.shm_segsz);
@@ -6067,6 +6094,7 @@ static void *clone_func(void *arg)
     TaskState *ts;
 
     rcu_register_thread();
+    tcg_register_thread();
     env = info->env;
     cpu = ENV_GET_CPU(env);
     thread_cpu = cpu;
@@ -7602,6 +7630,8 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
 #ifdef TARGET_GPROF
         _mcleanup();
 #endif
+        tb_cache_save();
+        perf_exit();
         gdb_exit(cpu_env, arg1);
         _exit(arg1);
         ret = 0; /* avoid warning */
@@ -7821,6 +7851,8 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
              * before the execve completes and makes it the other
              * program's problem.
              */
+            tb_cache_save();
+            perf_flush();
             ret = get_errno(safe_execve(p, argp, envp));
             unlock_user(p, arg1, 0);
 
@@ -9641,6 +9673,8 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
 #ifdef TARGET_GPROF
         _mcleanup();
 #endif
+        tb_cache_save();
+        perf_exit();
         gdb_exit(cpu_env, arg1);
         ret = get_errno(exit_group(arg1));
         break;
@@ -10051,7 +10085,9 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
         break;
     case TARGET_NR_readv:
         {
-            struct iovec *vec = lock_iovec(VERIFY_WRITE, arg2, arg3, 0);
+            struct iovec fast_vec[UIO_FASTIOV];
+            struct iovec *vec = lock_iovec(VERIFY_WRITE, arg2, arg3, 0,
+                                           fast_vec);
             if (vec != NULL) {
                 ret = get_errno(safe_readv(arg1, vec, arg3));
                 unlock_iovec(vec, arg2, arg3, 1);
@@ -10062,7 +10098,9 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
         break;
     case TARGET_NR_writev:
         {
-            struct iovec *vec = lock_iovec(VERIFY_READ, arg2, arg3, 1);
+            struct iovec fast_vec[UIO_FASTIOV];
+            struct iovec *vec = lock_iovec(VERIFY_READ, arg2, arg3, 1,
+                                           fast_vec);
             if (vec != NULL) {
                 ret = get_errno(safe_writev(arg1, vec, arg3));
                 unlock_iovec(vec, arg2, arg3, 0);
@@ -10074,7 +10112,9 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
 #if defined(TARGET_NR_preadv)
     case TARGET_NR_preadv:
         {
-            struct iovec *vec = lock_iovec(VERIFY_WRITE, arg2, arg3, 0);
+            struct iovec fast_vec[UIO_FASTIOV];
+            struct iovec *vec = lock_iovec(VERIFY_WRITE, arg2, arg3, 0,
+                                           fast_vec);
             if (vec != NULL) {
                 ret = get_errno(safe_preadv(arg1, vec, arg3, arg4, arg5));
                 unlock_iovec(vec, arg2, arg3, 1);
@@ -10087,7 +10127,9 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
 #if defined(TARGET_NR_pwritev)
     case TARGET_NR_pwritev:
         {
-            struct iovec *vec = lock_iovec(VERIFY_READ, arg2, arg3, 1);
+            struct iovec fast_vec[UIO_FASTIOV];
+            struct iovec *vec = lock_iovec(VERIFY_READ, arg2, arg3, 1,
+                                           fast_vec);
             if (vec != NULL) {
                 ret = get_errno(safe_pwritev(arg1, vec, arg3, arg4, arg5));
                 unlock_iovec(vec, arg2, arg3, 0);
@@ -11696,7 +11738,9 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
 #ifdef TARGET_NR_vmsplice
 	case TARGET_NR_vmsplice:
         {
-            struct iovec *vec = lock_iovec(VERIFY_READ, arg2, arg3, 1);
+            struct iovec fast_vec[UIO_FASTIOV];
+            struct iovec *vec = lock_iovec(VERIFY_READ, arg2, arg3, 1,
+                                           fast_vec);
             if (vec != NULL) {
                 ret = get_errno(vmsplice(arg1, vec, arg3, arg4));
                 unlock_iovec(vec, arg2, arg3, 0);
@@ -0,0 +1,562 @@
+/*
+ * Persistent cache of translated code
+ *
+ * The code translated from executable file mappings is saved to a cache
+ * directory when the process exits, and reused by later runs of programs
+ * that map the same files.  There is one cache file per guest file,
+ * keyed by the identity of the QEMU binary, of its settings and of the
+ * guest file.  Each entry is keyed by the offset of the guest code in the
+ * file, and keeps a copy of the guest code so that it can be checked
+ * against guest memory before use.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <sys/mman.h>
+
+#include "qemu.h"
+#include "exec/exec-all.h"
+#include "tcg.h"
+
+#if TCG_TARGET_IMPLEMENTS_CODE_RELOCS && defined(USE_DIRECT_JUMP) && \
+    defined(TARGET_SUPPORTS_TB_CACHE)
+# define TB_CACHE_SUPPORTED 1
+#else
+# define TB_CACHE_SUPPORTED 0
+#endif
+
+#define TB_CACHE_MAGIC       "QEMUTBC"
+#define TB_CACHE_VERSION     3
+#define TB_CACHE_MAX_ENTRIES 65536
+
+typedef struct TBCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nb_entries;
+    uint64_t key;
+    uint64_t guest_base;
+} TBCacheHeader;
+
+/* What a relocation is relative to.  */
+enum {
+    TB_CACHE_RELOC_TB,
+    TB_CACHE_RELOC_PROLOGUE,
+    TB_CACHE_RELOC_IMAGE,
+};
+
+typedef struct TBCacheReloc {
+    uint32_t offset;
+    uint8_t kind;               /* TCGCodeRelocKind */
+    uint8_t base;
+    uint16_t unused;
+    int64_t addend;
+} TBCacheReloc;
+
+/* An entry is followed by its relocations, by the guest code that was
+   translated and by the host code and its search data.  */
+typedef struct TBCacheEntry {
+    uint64_t offset;            /* of pc in the guest file */
+    uint64_t pc;
+    uint64_t cs_base;
+    uint32_t flags;
+    uint32_t cflags;
+    uint32_t size;
+    uint32_t code_size;         /* without the search data */
+    uint32_t search_size;
+    uint16_t icount;
+    uint16_t jmp_reset_offset[2];
+    uint16_t jmp_insn_offset[2];
+    uint16_t nb_relocs;
+    uint8_t parallel;
+    uint8_t unused[3];
+    uint32_t entry_size;        /* including what follows, 8-byte aligned */
+} TBCacheEntry;
+
+typedef struct TBCacheFile {
+    uint64_t key;
+    char *path;
+    /* The cache file as it was when the guest file was first mapped.  */
+    void *map;
+    size_t map_size;
+    /* Entries in MAP and in NEW_ENTRIES, the ones to be saved.  */
+    GHashTable *entries;
+    GPtrArray *new_entries;
+    bool dirty;
+    QLIST_ENTRY(TBCacheFile) next;
+} TBCacheFile;
+
+typedef struct TBCacheMapping {
+    abi_ulong start;
+    abi_ulong end;
+    uint64_t offset;
+    TBCacheFile *file;
+    QLIST_ENTRY(TBCacheMapping) next;
+} TBCacheMapping;
+
+/* All protected by mmap_lock.  */
+static char *tb_cache_dir;
+static uint64_t tb_cache_key;
+static unsigned tb_cache_nb_loaded;
+static unsigned tb_cache_nb_stored;
+static QLIST_HEAD(, TBCacheFile) tb_cache_files;
+static QLIST_HEAD(, TBCacheMapping) tb_cache_mappings;
+
+extern const char __executable_start[], _end[];
+
+/* FNV-1a */
+static uint64_t tb_cache_hash(uint64_t h, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        h = (h ^ p[i]) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+static guint tb_cache_entry_hash(gconstpointer p)
+{
+    const TBCacheEntry *e = p;
+
+    return e->offset ^ (e->offset >> 32) ^ e->flags ^ e->cflags;
+}
+
+static gboolean tb_cache_entry_equal(gconstpointer a, gconstpointer b)
+{
+    const TBCacheEntry *x = a, *y = b;
+
+    return x->offset == y->offset && x->pc == y->pc &&
+           x->cs_base == y->cs_base && x->flags == y->flags &&
+           x->cflags == y->cflags && x->parallel == y->parallel;
+}
+
+static inline TBCacheReloc *tb_cache_entry_relocs(TBCacheEntry *e)
+{
+    return (TBCacheReloc *)(e + 1);
+}
+
+static inline uint8_t *tb_cache_entry_guest_code(TBCacheEntry *e)
+{
+    return (uint8_t *)(tb_cache_entry_relocs(e) + e->nb_relocs);
+}
+
+static inline uint8_t *tb_cache_entry_code(TBCacheEntry *e)
+{
+    return tb_cache_entry_guest_code(e) + e->size;
+}
+
+/* The relocations and jumps are patched into code_gen_buffer, so check
+   that they stay inside the code of the entry.  */
+static bool tb_cache_entry_valid(TBCacheEntry *e)
+{
+    TBCacheReloc *r = tb_cache_entry_relocs(e);
+    unsigned width;
+    int i;
+
+    for (i = 0; i < e->nb_relocs; i++, r++) {
+        switch (r->kind) {
+        case TCG_CODE_RELOC_ABS64:
+            width = 8;
+            break;
+        case TCG_CODE_RELOC_PCREL32:
+            width = 4;
+            break;
+        default:
+            return false;
+        }
+        if (r->base > TB_CACHE_RELOC_IMAGE ||
+            r->offset > e->code_size || e->code_size - r->offset < width) {
+            return false;
+        }
+    }
+    for (i = 0; i < 2; i++) {
+        if (e->jmp_reset_offset[i] != TB_JMP_RESET_OFFSET_INVALID &&
+            (e->jmp_reset_offset[i] > e->code_size ||
+             e->jmp_insn_offset[i] + 4 > e->code_size)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void tb_cache_read(TBCacheFile *file)
+{
+    TBCacheHeader *hdr;
+    struct stat st;
+    size_t pos;
+    uint32_t i;
+    void *map;
+    int fd;
+
+    fd = open(file->path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < sizeof(*hdr)) {
+        close(fd);
+        return;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return;
+    }
+
+    hdr = map;
+    if (memcmp(hdr->magic, TB_CACHE_MAGIC, sizeof(TB_CACHE_MAGIC)) ||
+        hdr->version != TB_CACHE_VERSION || hdr->key != file->key ||
+        hdr->guest_base != guest_base) {
+        munmap(map, st.st_size);
+        return;
+    }
+    file->map = map;
+    file->map_size = st.st_size;
+
+    /* Stop at the first entry that does not fit, the file is only a
+       cache.  */
+    pos = sizeof(*hdr);
+    for (i = 0; i < hdr->nb_entries; i++) {
+        TBCacheEntry *e = map + pos;
+
+        if (st.st_size - pos < sizeof(*e) ||
+            st.st_size - pos < e->entry_size ||
+            e->entry_size < sizeof(*e) + e->nb_relocs * sizeof(TBCacheReloc)
+                            + (uint64_t)e->size + e->code_size
+                            + e->search_size) {
+            break;
+        }
+        if (tb_cache_entry_valid(e)) {
+            g_hash_table_replace(file->entries, e, e);
+        }
+        pos += e->entry_size;
+    }
+}
+
+static TBCacheFile *tb_cache_file(uint64_t key)
+{
+    TBCacheFile *file;
+
+    QLIST_FOREACH(file, &tb_cache_files, next) {
+        if (file->key == key) {
+            return file;
+        }
+    }
+
+    file = g_new0(TBCacheFile, 1);
+    file->key = key;
+    file->path = g_strdup_printf("%s/%016" PRIx64 ".tbc", tb_cache_dir, key);
+    file->entries = g_hash_table_new(tb_cache_entry_hash,
+                                     tb_cache_entry_equal);
+    file->new_entries = g_ptr_array_new_with_free_func(g_free);
+    tb_cache_read(file);
+    QLIST_INSERT_HEAD(&tb_cache_files, file, next);
+    return file;
+}
+
+void tb_cache_init(const char *dir, const char *cpu_model)
+{
+    struct stat st;
+    uint64_t h;
+    bool nochain;
+
+    if (!TB_CACHE_SUPPORTED) {
+        fprintf(stderr, "The translation cache is not supported for this "
+                "guest and host\n");
+        return;
+    }
+    if (stat("/proc/self/exe", &st) < 0) {
+        fprintf(stderr, "Cannot identify the QEMU binary, not using the "
+                "translation cache\n");
+        return;
+    }
+    if (g_mkdir_with_parents(dir, 0755) < 0) {
+        fprintf(stderr, "Cannot create translation cache directory '%s': %s\n",
+                dir, strerror(errno));
+        return;
+    }
+
+    /* The code depends on the binary, on the host and guest CPU models
+       and on the options that change code generation.  */
+    h = tb_cache_hash(0xcbf29ce484222325ull, &st.st_dev, sizeof(st.st_dev));
+    h = tb_cache_hash(h, &st.st_ino, sizeof(st.st_ino));
+    h = tb_cache_hash(h, &st.st_size, sizeof(st.st_size));
+    h = tb_cache_hash(h, &st.st_mtim, sizeof(st.st_mtim));
+    h = tb_cache_hash(h, &tcg_target_features, sizeof(tcg_target_features));
+    h = tb_cache_hash(h, &tcg_host_vectors, sizeof(tcg_host_vectors));
+    h = tb_cache_hash(h, cpu_model, strlen(cpu_model));
+    h = tb_cache_hash(h, &singlestep, sizeof(singlestep));
+    nochain = qemu_loglevel_mask(CPU_LOG_TB_NOCHAIN);
+    h = tb_cache_hash(h, &nochain, sizeof(nochain));
+    tb_cache_key = h;
+    tb_cache_dir = g_strdup(dir);
+}
+
+void tb_cache_unmap(abi_ulong start, abi_ulong len)
+{
+    TBCacheMapping *m, *next_m;
+
+    QLIST_FOREACH_SAFE(m, &tb_cache_mappings, next, next_m) {
+        if (m->start < start + len && start < m->end) {
+            QLIST_REMOVE(m, next);
+            g_free(m);
+        }
+    }
+}
+
+void tb_cache_map(abi_ulong start, abi_ulong len, int prot, int flags,
+                  int fd, abi_ulong offset)
+{
+    TBCacheMapping *m;
+    struct stat st;
+    uint64_t key;
+
+    if (!tb_cache_dir) {
+        return;
+    }
+    tb_cache_unmap(start, len);
+    if (!(prot & PROT_EXEC) || (flags & MAP_ANONYMOUS) ||
+        fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        return;
+    }
+
+    key = tb_cache_hash(tb_cache_key, &st.st_dev, sizeof(st.st_dev));
+    key = tb_cache_hash(key, &st.st_ino, sizeof(st.st_ino));
+    key = tb_cache_hash(key, &st.st_size, sizeof(st.st_size));
+    key = tb_cache_hash(key, &st.st_mtim, sizeof(st.st_mtim));
+
+    m = g_new(TBCacheMapping, 1);
+    m->start = start;
+    m->end = start + len;
+    m->offset = offset;
+    m->file = tb_cache_file(key);
+    QLIST_INSERT_HEAD(&tb_cache_mappings, m, next);
+}
+
+static TBCacheMapping *tb_cache_mapping(CPUState *cpu, TranslationBlock *tb)
+{
+    TBCacheMapping *m;
+
+    if (!tb_cache_dir || superblock_threshold ||
+        (tb->cflags & CF_NOCACHE) || cpu->singlestep_enabled ||
+        !QTAILQ_EMPTY(&cpu->breakpoints)) {
+        return NULL;
+    }
+    QLIST_FOREACH(m, &tb_cache_mappings, next) {
+        if (tb->pc >= m->start && tb->pc < m->end) {
+            return m;
+        }
+    }
+    return NULL;
+}
+
+bool tb_cache_wanted(CPUState *cpu, TranslationBlock *tb)
+{
+    return tb_cache_mapping(cpu, tb) != NULL;
+}
+
+static TBCacheEntry *tb_cache_lookup(TBCacheMapping *m, TranslationBlock *tb)
+{
+    TBCacheEntry key = {
+        .offset = tb->pc - m->start + m->offset,
+        .pc = tb->pc,
+        .cs_base = tb->cs_base,
+        .flags = tb->flags,
+        .cflags = tb->cflags,
+        .parallel = parallel_cpus,
+    };
+
+    return g_hash_table_lookup(m->file->entries, &key);
+}
+
+int tb_cache_load(CPUState *cpu, TranslationBlock *tb, intptr_t avail,
+                  int *search_size)
+{
+    TBCacheMapping *m = tb_cache_mapping(cpu, tb);
+    void *buf = tb->tc_ptr;
+    TBCacheReloc *r;
+    TBCacheEntry *e;
+    int i;
+
+    if (!m) {
+        return 0;
+    }
+    e = tb_cache_lookup(m, tb);
+    if (!e || (intptr_t)e->code_size + e->search_size > avail ||
+        page_check_range(tb->pc, e->size, PAGE_READ) < 0 ||
+        memcmp(g2h(tb->pc), tb_cache_entry_guest_code(e), e->size)) {
+        return 0;
+    }
+
+    memcpy(buf, tb_cache_entry_code(e), e->code_size + e->search_size);
+    r = tb_cache_entry_relocs(e);
+    for (i = 0; i < e->nb_relocs; i++, r++) {
+        uintptr_t target = r->addend;
+        void *field = buf + r->offset;
+        intptr_t disp;
+
+        switch (r->base) {
+        case TB_CACHE_RELOC_TB:
+            target += (uintptr_t)tb;
+            break;
+        case TB_CACHE_RELOC_PROLOGUE:
+            target += (uintptr_t)tcg_ctx->code_gen_prologue;
+            break;
+        case TB_CACHE_RELOC_IMAGE:
+            target += (uintptr_t)__executable_start;
+            break;
+        }
+        if (r->kind == TCG_CODE_RELOC_ABS64) {
+            stq_he_p(field, target);
+        } else {
+            disp = target - (uintptr_t)(field + 4);
+            if (disp != (int32_t)disp) {
+                return 0;
+            }
+            stl_he_p(field, disp);
+        }
+    }
+    flush_icache_range((uintptr_t)buf, (uintptr_t)buf + e->code_size);
+
+    tb->size = e->size;
+    tb->icount = e->icount;
+    tb->tc_search = buf + e->code_size;
+    tb->jmp_reset_offset[0] = e->jmp_reset_offset[0];
+    tb->jmp_reset_offset[1] = e->jmp_reset_offset[1];
+#ifdef USE_DIRECT_JUMP
+    tb->jmp_insn_offset[0] = e->jmp_insn_offset[0];
+    tb->jmp_insn_offset[1] = e->jmp_insn_offset[1];
+#endif
+    *search_size = e->search_size;
+    tb_cache_nb_loaded++;
+    return e->code_size;
+}
+
+void tb_cache_store(CPUState *cpu, TranslationBlock *tb, int code_size,
+                    int search_size)
+{
+    TBCacheMapping *m = tb_cache_mapping(cpu, tb);
+    int nb_relocs = tcg_ctx->nb_code_relocs;
+    TBCacheReloc *r;
+    TBCacheEntry *e;
+    size_t entry_size;
+    int i;
+
+    if (!m || nb_relocs < 0 ||
+        g_hash_table_size(m->file->entries) >= TB_CACHE_MAX_ENTRIES) {
+        return;
+    }
+
+    entry_size = ROUND_UP(sizeof(*e) + nb_relocs * sizeof(*r) + tb->size
+                          + code_size + search_size, 8);
+    e = g_malloc0(entry_size);
+    e->offset = tb->pc - m->start + m->offset;
+    e->pc = tb->pc;
+    e->cs_base = tb->cs_base;
+    e->flags = tb->flags;
+    e->cflags = tb->cflags;
+    e->size = tb->size;
+    e->code_size = code_size;
+    e->search_size = search_size;
+    e->icount = tb->icount;
+    e->jmp_reset_offset[0] = tb->jmp_reset_offset[0];
+    e->jmp_reset_offset[1] = tb->jmp_reset_offset[1];
+#ifdef USE_DIRECT_JUMP
+    e->jmp_insn_offset[0] = tb->jmp_insn_offset[0];
+    e->jmp_insn_offset[1] = tb->jmp_insn_offset[1];
+#endif
+    e->nb_relocs = nb_relocs;
+    e->parallel = parallel_cpus;
+    e->entry_size = entry_size;
+
+    r = tb_cache_entry_relocs(e);
+    for (i = 0; i < nb_relocs; i++, r++) {
+        TCGCodeReloc *cr = &tcg_ctx->code_relocs[i];
+        uintptr_t prologue = (uintptr_t)tcg_ctx->code_gen_prologue;
+
+        r->offset = cr->offset;
+        r->kind = cr->kind;
+        if (cr->target - (uintptr_t)tb <= TB_EXIT_MASK) {
+            r->base = TB_CACHE_RELOC_TB;
+            r->addend = cr->target - (uintptr_t)tb;
+        } else if (cr->target - prologue <
+                   tcg_ctx->code_gen_buffer - tcg_ctx->code_gen_prologue) {
+            /* The prologue is just before code_gen_buffer.  */
+            r->base = TB_CACHE_RELOC_PROLOGUE;
+            r->addend = cr->target - prologue;
+        } else if (cr->target - (uintptr_t)__executable_start <
+                   _end - __executable_start) {
+            r->base = TB_CACHE_RELOC_IMAGE;
+            r->addend = cr->target - (uintptr_t)__executable_start;
+        } else {
+            g_free(e);
+            return;
+        }
+    }
+    memcpy(tb_cache_entry_guest_code(e), g2h(tb->pc), tb->size);
+    memcpy(tb_cache_entry_code(e), tb->tc_ptr, code_size + search_size);
+
+    g_hash_table_replace(m->file->entries, e, e);
+    g_ptr_array_add(m->file->new_entries, e);
+    m->file->dirty = true;
+    tb_cache_nb_stored++;
+}
+
+static void tb_cache_write(TBCacheFile *file)
+{
+    TBCacheHeader hdr = {
+        .magic = TB_CACHE_MAGIC,
+        .version = TB_CACHE_VERSION,
+        .nb_entries = g_hash_table_size(file->entries),
+        .key = file->key,
+        .guest_base = guest_base,
+    };
+    GHashTableIter iter;
+    TBCacheEntry *e;
+    char *tmp;
+    FILE *f;
+    bool ok;
+
+    /* Write to a temporary file first, so that other processes only ever
+       see complete cache files.  */
+    tmp = g_strdup_printf("%s.%d", file->path, getpid());
+    f = fopen(tmp, "wb");
+    if (!f) {
+        g_free(tmp);
+        return;
+    }
+    ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+    g_hash_table_iter_init(&iter, file->entries);
+    while (ok && g_hash_table_iter_next(&iter, (gpointer *)&e, NULL)) {
+        ok = fwrite(e, e->entry_size, 1, f) == 1;
+    }
+    if (fclose(f) == 0 && ok && rename(tmp, file->path) == 0) {
+        file->dirty = false;
+    } else {
+        unlink(tmp);
+    }
+    g_free(tmp);
+}
+
+void tb_cache_save(void)
+{
+    TBCacheFile *file;
+
+    if (!tb_cache_dir) {
+        return;
+    }
+    mmap_lock();
+    tb_lock();
+    qemu_log_mask(CPU_LOG_TB_CACHE,
+                  "tb-cache: %u blocks loaded, %u blocks stored\n",
+                  tb_cache_nb_loaded, tb_cache_nb_stored);
+    QLIST_FOREACH(file, &tb_cache_files, next) {
+        if (file->dirty) {
+            tb_cache_write(file);
+        }
+    }
+    tb_unlock();
+    mmap_unlock();
+}
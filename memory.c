@@ -122,6 +122,23 @@ enum ListenerDirection { Forward, Reverse };
         }                                                               \
     } while (0)
 
+/* Like MEMORY_LISTENER_CALL_GLOBAL(_callback, Forward), but skip the
+ * listeners of address spaces whose view the current transaction does
+ * not change.
+ */
+#define MEMORY_LISTENER_CALL_UPDATED(_callback)                         \
+    do {                                                                \
+        MemoryListener *_listener;                                      \
+                                                                        \
+        QTAILQ_FOREACH(_listener, &memory_listeners, link) {            \
+            if (_listener->_callback &&                                 \
+                (!_listener->address_space ||                           \
+                 _listener->address_space->next_map)) {                 \
+                _listener->_callback(_listener);                        \
+            }                                                           \
+        }                                                               \
+    } while (0)
+
 #define MEMORY_LISTENER_CALL(_as, _callback, _direction, _section, _args...) \
     do {                                                                \
         MemoryListener *_listener;                                      \
@@ -226,6 +243,8 @@ struct FlatView {
     FlatRange *ranges;
     unsigned nr;
     unsigned nr_allocated;
+    MemoryRegion *root;
+    struct AddressSpaceDispatch *dispatch;
 };
 
 typedef struct AddressSpaceOps AddressSpaceOps;
@@ -261,6 +280,8 @@ static void flatview_init(FlatView *view)
     view->ranges = NULL;
     view->nr = 0;
     view->nr_allocated = 0;
+    view->root = NULL;
+    view->dispatch = NULL;
 }
 
 /* Insert a range into a given position.  Caller is responsible for maintaining
@@ -284,6 +305,9 @@ static void flatview_destroy(FlatView *view)
 {
     int i;
 
+    if (view->dispatch) {
+        address_space_dispatch_free(view->dispatch);
+    }
     for (i = 0; i < view->nr; i++) {
         memory_region_unref(view->ranges[i].mr);
     }
@@ -296,10 +320,32 @@ static void flatview_ref(FlatView *view)
     atomic_inc(&view->ref);
 }
 
+/* Take a reference to a view read under RCU, whose last reference may
+ * have been dropped concurrently.
+ */
+static bool flatview_tryref(FlatView *view)
+{
+    unsigned ref = atomic_read(&view->ref);
+
+    while (ref) {
+        unsigned old = atomic_cmpxchg(&view->ref, ref, ref + 1);
+
+        if (old == ref) {
+            return true;
+        }
+        ref = old;
+    }
+    return false;
+}
+
+/* Views are shared by the address spaces with the same root, so the
+ * last reference can be dropped by any of them.  RCU readers do not
+ * hold a reference; the view is freed once they are done.
+ */
 static void flatview_unref(FlatView *view)
 {
     if (atomic_fetch_dec(&view->ref) == 1) {
-        flatview_destroy(view);
+        call_rcu(view, flatview_destroy, rcu);
     }
 }
 
@@ -353,6 +399,37 @@ static bool memory_region_wrong_endianness(MemoryRegion *mr)
 #endif
 }
 
+/* Work out which accesses can skip memory_region_access_valid and
+ * access_with_adjusted_size: aligned ones, of a size that the ops both
+ * accept and implement natively, on a region without an accepts callback.
+ * Regions whose callbacks take attributes keep the full path, so that
+ * their MemTxResult is not lost.
+ */
+static void memory_region_update_direct_access(MemoryRegion *mr)
+{
+    const MemoryRegionOps *ops = mr->ops;
+    unsigned min = ops->impl.min_access_size ? ops->impl.min_access_size : 1;
+    unsigned max = ops->impl.max_access_size ? ops->impl.max_access_size : 4;
+    uint8_t sizes = 0;
+    unsigned size;
+
+    if (ops->valid.min_access_size) {
+        min = MAX(min, ops->valid.min_access_size);
+    }
+    if (ops->valid.max_access_size) {
+        max = MIN(max, ops->valid.max_access_size);
+    }
+
+    if (!ops->valid.accepts) {
+        for (size = min; size <= max; size <<= 1) {
+            sizes |= size;
+        }
+    }
+    mr->direct_read_sizes = ops->read ? sizes : 0;
+    mr->direct_write_sizes = ops->write ? sizes : 0;
+    mr->direct_bswap = memory_region_wrong_endianness(mr);
+}
+
 static void adjust_endianness(MemoryRegion *mr, uint64_t *data, unsigned size)
 {
     if (memory_region_wrong_endianness(mr)) {
@@ -611,6 +688,23 @@ static AddressSpace *memory_region_to_address_space(MemoryRegion *mr)
     return NULL;
 }
 
+/* Return the index of the first range in @view that ends after @addr. */
+static unsigned flatview_first_after(FlatView *view, Int128 addr)
+{
+    unsigned lo = 0, hi = view->nr;
+
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+
+        if (int128_ge(addr, addrrange_end(view->ranges[mid].addr))) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
 /* Render a memory region into the global view.  Ranges in @view obscure
  * ranges in @mr.
  */
@@ -669,7 +763,8 @@ static void render_memory_region(FlatView *view,
     fr.readonly = readonly;
 
     /* Render the region itself into any gaps left by the current view. */
-    for (i = 0; i < view->nr && int128_nz(remain); ++i) {
+    for (i = flatview_first_after(view, base);
+         i < view->nr && int128_nz(remain); ++i) {
         if (int128_ge(base, addrrange_end(view->ranges[i].addr))) {
             continue;
         }
@@ -698,23 +793,131 @@ static void render_memory_region(FlatView *view,
     }
 }
 
-/* Render a memory topology into a list of disjoint absolute ranges. */
-static FlatView *generate_memory_topology(MemoryRegion *mr)
+/* Copy the parts of @old that lie outside @dirty, a sorted array of
+ * disjoint ranges, into @view.
+ */
+static void flatview_copy_clean(FlatView *view, FlatView *old, GArray *dirty)
+{
+    FlatRange *fr;
+    unsigned j = 0;
+
+    FOR_EACH_FLAT_RANGE(fr, old) {
+        Int128 start = fr->addr.start;
+        Int128 end = addrrange_end(fr->addr);
+
+        while (int128_lt(start, end)) {
+            AddrRange *d;
+            FlatRange piece = *fr;
+            Int128 piece_end = end;
+
+            while (j < dirty->len &&
+                   int128_le(addrrange_end(g_array_index(dirty, AddrRange, j)),
+                             start)) {
+                j++;
+            }
+            d = j < dirty->len ? &g_array_index(dirty, AddrRange, j) : NULL;
+            if (d && int128_le(d->start, start)) {
+                /* Skip the part that will be rendered again.  */
+                start = addrrange_end(*d);
+                continue;
+            }
+            if (d && int128_lt(d->start, end)) {
+                piece_end = d->start;
+            }
+            piece.offset_in_region +=
+                int128_get64(int128_sub(start, fr->addr.start));
+            piece.addr = addrrange_make(start, int128_sub(piece_end, start));
+            flatview_insert(view, view->nr, &piece);
+            start = piece_end;
+        }
+    }
+}
+
+/* Render a memory topology into a list of disjoint absolute ranges.  If
+ * @old is given, only the ranges in @dirty are rendered again and the rest
+ * is taken from @old.
+ */
+static FlatView *generate_memory_topology(MemoryRegion *mr, FlatView *old,
+                                          GArray *dirty)
 {
     FlatView *view;
+    unsigned i;
 
     view = g_new(FlatView, 1);
     flatview_init(view);
+    view->root = mr;
 
-    if (mr) {
-        render_memory_region(view, mr, int128_zero(),
-                             addrrange_make(int128_zero(), int128_2_64()), false);
+    if (!old) {
+        if (mr) {
+            render_memory_region(view, mr, int128_zero(),
+                                 addrrange_make(int128_zero(), int128_2_64()),
+                                 false);
+        }
+    } else {
+        flatview_copy_clean(view, old, dirty);
+        for (i = 0; mr && i < dirty->len; i++) {
+            render_memory_region(view, mr, int128_zero(),
+                                 g_array_index(dirty, AddrRange, i), false);
+        }
     }
     flatview_simplify(view);
 
     return view;
 }
 
+static void flatview_build_dispatch(FlatView *view)
+{
+    FlatRange *fr;
+
+    view->dispatch = address_space_dispatch_new();
+    FOR_EACH_FLAT_RANGE(fr, view) {
+        MemoryRegionSection section = section_from_flat_range(fr, NULL);
+
+        address_space_dispatch_add(view->dispatch, &section);
+    }
+    address_space_dispatch_compact(view->dispatch);
+}
+
+/* Find the region that renders to the same view as @mr, looking through
+ * containers with a single enabled child at offset 0 and through aliases
+ * of a whole region that is itself at offset 0.  The bus master address
+ * spaces of PCI devices, for example, all end up at the same root as the
+ * address space they do DMA to, and can share its view.  NULL stands for
+ * an empty view.  The address of @mr offsets its whole view, so @mr must
+ * be at offset 0 too.
+ */
+static MemoryRegion *memory_region_get_flatview_root(MemoryRegion *mr)
+{
+    while (mr && mr->enabled && !mr->readonly && !mr->addr) {
+        if (mr->alias) {
+            if (!mr->alias_offset && !mr->alias->addr &&
+                int128_ge(mr->size, mr->alias->size)) {
+                mr = mr->alias;
+                continue;
+            }
+        } else if (!mr->terminates) {
+            MemoryRegion *child, *next = NULL;
+            unsigned found = 0;
+
+            QTAILQ_FOREACH(child, &mr->subregions, subregions_link) {
+                if (child->enabled && ++found == 1 && !child->addr &&
+                    int128_ge(mr->size, child->size)) {
+                    next = child;
+                }
+            }
+            if (!found) {
+                return NULL;
+            }
+            if (found == 1 && next) {
+                mr = next;
+                continue;
+            }
+        }
+        return mr;
+    }
+    return mr && mr->enabled ? mr : NULL;
+}
+
 static void address_space_add_del_ioeventfds(AddressSpace *as,
                                              MemoryRegionIoeventfd *fds_new,
                                              unsigned fds_new_nb,
@@ -769,8 +972,9 @@ static FlatView *address_space_get_flatview(AddressSpace *as)
     FlatView *view;
 
     rcu_read_lock();
-    view = atomic_rcu_read(&as->current_map);
-    flatview_ref(view);
+    do {
+        view = atomic_rcu_read(&as->current_map);
+    } while (!flatview_tryref(view));
     rcu_read_unlock();
     return view;
 }
@@ -879,27 +1083,236 @@ static void address_space_update_topology_pass(AddressSpace *as,
 
 static void address_space_update_topology(AddressSpace *as)
 {
-    FlatView *old_view = address_space_get_flatview(as);
-    FlatView *new_view = generate_memory_topology(as->root);
+    FlatView *old_view = as->current_map;
+    FlatView *new_view = as->next_map;
 
     address_space_update_topology_pass(as, old_view, new_view, false);
     address_space_update_topology_pass(as, old_view, new_view, true);
 
     /* Writes are protected by the BQL.  */
+    flatview_ref(new_view);
     atomic_rcu_set(&as->current_map, new_view);
-    call_rcu(old_view, flatview_unref, rcu);
+    atomic_rcu_set(&as->dispatch, new_view->dispatch);
 
     /* Note that all the old MemoryRegions are still alive up to this
-     * point.  This relieves most MemoryListeners from the need to
-     * ref/unref the MemoryRegions they get---unless they use them
-     * outside the iothread mutex, in which case precise reference
-     * counting is necessary.
+     * point, and until the RCU readers are done with the old view.
+     * This relieves most MemoryListeners from the need to ref/unref
+     * the MemoryRegions they get---unless they use them outside the
+     * iothread mutex, in which case precise reference counting is
+     * necessary.
      */
     flatview_unref(old_view);
 
     address_space_update_ioeventfds(as);
 }
 
+/* Changes are tracked as ranges that have to be rendered again, keyed by
+ * MemoryRegion and relative to its start.  A change is recorded for the
+ * region itself and propagated to its containers and to the aliases that
+ * point into it, so that it reaches every address space root that can
+ * see it.  Disabled regions hide the changes below them.
+ */
+static GHashTable *memory_region_dirty;
+static bool memory_region_dirty_all;
+
+static void memory_region_dirty_free(gpointer data)
+{
+    g_array_free(data, true);
+}
+
+static void memory_region_record_dirty(MemoryRegion *mr, AddrRange range)
+{
+    GArray *ranges;
+
+    if (!memory_region_dirty) {
+        memory_region_dirty = g_hash_table_new_full(NULL, NULL, NULL,
+                                                    memory_region_dirty_free);
+    }
+    ranges = g_hash_table_lookup(memory_region_dirty, mr);
+    if (!ranges) {
+        ranges = g_array_new(false, false, sizeof(AddrRange));
+        g_hash_table_insert(memory_region_dirty, mr, ranges);
+    }
+    g_array_append_val(ranges, range);
+}
+
+static void memory_region_update_range(MemoryRegion *mr, AddrRange range)
+{
+    MemoryRegion *alias;
+
+    memory_region_update_pending = true;
+    for (;;) {
+        memory_region_record_dirty(mr, range);
+
+        QTAILQ_FOREACH(alias, &mr->aliases, aliases_link) {
+            Int128 offset = int128_make64(alias->alias_offset);
+            AddrRange seen = addrrange_make(offset, alias->size);
+
+            if (alias->enabled && addrrange_intersects(seen, range)) {
+                seen = addrrange_intersection(seen, range);
+                memory_region_update_range(alias,
+                                           addrrange_shift(seen,
+                                                           int128_neg(offset)));
+            }
+        }
+
+        if (!mr->container || !mr->container->enabled) {
+            break;
+        }
+        range = addrrange_shift(range, int128_make64(mr->addr));
+        mr = mr->container;
+    }
+}
+
+/* Record a change to everything that @mr covers.  */
+static void memory_region_update_whole(MemoryRegion *mr)
+{
+    memory_region_update_range(mr, addrrange_make(int128_zero(), mr->size));
+}
+
+/* Record a change that can affect any address space.  */
+static void memory_region_update_all(void)
+{
+    memory_region_update_pending = true;
+    memory_region_dirty_all = true;
+}
+
+static gint addrrange_compare(gconstpointer a, gconstpointer b)
+{
+    const AddrRange *r1 = a, *r2 = b;
+
+    if (int128_lt(r1->start, r2->start)) {
+        return -1;
+    }
+    return int128_gt(r1->start, r2->start);
+}
+
+/* Sort the ranges and merge overlapping or adjacent ones.  */
+static void addrrange_array_normalize(GArray *ranges)
+{
+    unsigned i, j;
+
+    g_array_sort(ranges, addrrange_compare);
+    for (i = 0, j = 1; j < ranges->len; j++) {
+        AddrRange *cur = &g_array_index(ranges, AddrRange, i);
+        AddrRange *next = &g_array_index(ranges, AddrRange, j);
+
+        if (int128_le(next->start, addrrange_end(*cur))) {
+            Int128 end = int128_max(addrrange_end(*cur), addrrange_end(*next));
+            cur->size = int128_sub(end, cur->start);
+        } else {
+            g_array_index(ranges, AddrRange, ++i) = *next;
+        }
+    }
+    g_array_set_size(ranges, MIN(ranges->len, i + 1));
+}
+
+static bool flatview_equal(FlatView *a, FlatView *b)
+{
+    unsigned i;
+
+    if (a->nr != b->nr) {
+        return false;
+    }
+    for (i = 0; i < a->nr; i++) {
+        if (!flatrange_equal(&a->ranges[i], &b->ranges[i]) ||
+            a->ranges[i].dirty_log_mask != b->ranges[i].dirty_log_mask) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Return the current view of another address space with @root, if any.
+ * All of them are up to date as of the previous transaction.
+ */
+static FlatView *address_space_find_flatview(MemoryRegion *root)
+{
+    AddressSpace *as;
+
+    QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+        if (as->current_map->root == root) {
+            return as->current_map;
+        }
+    }
+    return NULL;
+}
+
+/* Check that the view of @as is the same as a full render of its root.  */
+static bool address_space_check_flatview(AddressSpace *as)
+{
+    FlatView *view = address_space_get_flatview(as);
+    FlatView *full = generate_memory_topology(as->root, NULL, NULL);
+    bool ok = flatview_equal(view, full);
+
+    flatview_unref(full);
+    flatview_unref(view);
+    return ok;
+}
+
+int memory_check_flatviews(void)
+{
+    AddressSpace *as;
+    int n = 0;
+
+    QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+        if (!address_space_check_flatview(as)) {
+            error_report("flat view of address space %s is out of date",
+                         as->name);
+            n++;
+        }
+    }
+    return n;
+}
+
+/* Compute the view of @as after the pending changes, or NULL if it does not
+ * change.  Address spaces with the same flatview root share their views;
+ * @views caches the new view of each root computed in this transaction.
+ */
+static FlatView *address_space_next_flatview(AddressSpace *as,
+                                             GHashTable *views)
+{
+    MemoryRegion *root = memory_region_get_flatview_root(as->root);
+    FlatView *old_view = as->current_map;
+    FlatView *base, *new_view;
+    GArray *dirty = NULL;
+
+    if (g_hash_table_lookup_extended(views, root, NULL, (gpointer *)&new_view)) {
+        return new_view == old_view ? NULL : new_view;
+    }
+
+    base = old_view->root == root ? old_view : address_space_find_flatview(root);
+    if (memory_region_dirty && root) {
+        dirty = g_hash_table_lookup(memory_region_dirty, root);
+    }
+    if (!base || memory_region_dirty_all ||
+        (root && (root->container || root->addr))) {
+        /* The view is offset by the address of the root, which moves with
+         * its container and stays behind when it is removed from it, but
+         * the dirty ranges are relative to the root; render it from scratch.
+         */
+        new_view = generate_memory_topology(root, NULL, NULL);
+    } else if (dirty) {
+        addrrange_array_normalize(dirty);
+        new_view = generate_memory_topology(root, base, dirty);
+    } else {
+        new_view = base;
+    }
+
+    if (base && new_view != base && flatview_equal(new_view, base)) {
+        flatview_unref(new_view);
+        new_view = base;
+    }
+    if (new_view == base) {
+        flatview_ref(new_view);
+    } else {
+        flatview_build_dispatch(new_view);
+    }
+    /* @views holds a reference to each view until the end of the commit.  */
+    g_hash_table_insert(views, root, new_view);
+    return new_view == old_view ? NULL : new_view;
+}
+
 void memory_region_transaction_begin(void)
 {
     qemu_flush_coalesced_mmio_buffer();
@@ -910,6 +1323,17 @@ static void memory_region_clear_pending(void)
 {
     memory_region_update_pending = false;
     ioeventfd_update_pending = false;
+    memory_region_dirty_all = false;
+    if (memory_region_dirty) {
+        g_hash_table_remove_all(memory_region_dirty);
+    }
+}
+
+static void flatview_unref_cb(gpointer key, gpointer value, gpointer opaque)
+{
+    FlatView *view = value;
+
+    flatview_unref(view);
 }
 
 void memory_region_transaction_commit(void)
@@ -920,13 +1344,29 @@ void memory_region_transaction_commit(void)
     --memory_region_transaction_depth;
     if (!memory_region_transaction_depth) {
         if (memory_region_update_pending) {
-            MEMORY_LISTENER_CALL_GLOBAL(begin, Forward);
+            GHashTable *views = g_hash_table_new(NULL, NULL);
 
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
-                address_space_update_topology(as);
+                as->next_map = address_space_next_flatview(as, views);
             }
 
-            MEMORY_LISTENER_CALL_GLOBAL(commit, Forward);
+            MEMORY_LISTENER_CALL_UPDATED(begin);
+
+            QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+                if (as->next_map) {
+                    address_space_update_topology(as);
+                } else if (ioeventfd_update_pending) {
+                    address_space_update_ioeventfds(as);
+                }
+            }
+
+            MEMORY_LISTENER_CALL_UPDATED(commit);
+
+            QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+                as->next_map = NULL;
+            }
+            g_hash_table_foreach(views, flatview_unref_cb, NULL);
+            g_hash_table_destroy(views);
         } else if (ioeventfd_update_pending) {
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
                 address_space_update_ioeventfds(as);
@@ -1072,6 +1512,7 @@ static void memory_region_initfn(Object *obj)
     mr->destructor = memory_region_destructor_none;
     QTAILQ_INIT(&mr->subregions);
     QTAILQ_INIT(&mr->coalesced);
+    QTAILQ_INIT(&mr->aliases);
 
     op = object_property_add(OBJECT(mr), "container",
                              "link<" TYPE_MEMORY_REGION ">",
@@ -1192,6 +1633,52 @@ static MemTxResult memory_region_dispatch_read1(MemoryRegion *mr,
     }
 }
 
+bool memory_region_dispatch_read_direct(MemoryRegion *mr,
+                                        hwaddr addr,
+                                        uint64_t *pval,
+                                        unsigned size)
+{
+    uint64_t val;
+
+    if (!(mr->direct_read_sizes & size) || (addr & (size - 1))) {
+        return false;
+    }
+
+    val = mr->ops->read(mr->opaque, addr, size) & (-1ULL >> (64 - size * 8));
+    if (trace_event_get_state(TRACE_MEMORY_REGION_OPS_READ)) {
+        hwaddr abs_addr = memory_region_to_absolute_addr(mr, addr);
+        trace_memory_region_ops_read(get_cpu_index(), mr, abs_addr, val, size);
+    }
+    if (mr->direct_bswap) {
+        adjust_endianness(mr, &val, size);
+    }
+    *pval = val;
+    return true;
+}
+
+bool memory_region_dispatch_write_direct(MemoryRegion *mr,
+                                         hwaddr addr,
+                                         uint64_t data,
+                                         unsigned size)
+{
+    if (!(mr->direct_write_sizes & size) || (addr & (size - 1)) ||
+        mr->ioeventfd_nb) {
+        return false;
+    }
+
+    if (mr->direct_bswap) {
+        adjust_endianness(mr, &data, size);
+    }
+    data &= -1ULL >> (64 - size * 8);
+    if (trace_event_get_state(TRACE_MEMORY_REGION_OPS_WRITE)) {
+        hwaddr abs_addr = memory_region_to_absolute_addr(mr, addr);
+        trace_memory_region_ops_write(get_cpu_index(), mr, abs_addr, data,
+                                      size);
+    }
+    mr->ops->write(mr->opaque, addr, data, size);
+    return true;
+}
+
 MemTxResult memory_region_dispatch_read(MemoryRegion *mr,
                                         hwaddr addr,
                                         uint64_t *pval,
@@ -1285,6 +1772,7 @@ void memory_region_init_io(MemoryRegion *mr,
     mr->ops = ops ? ops : &unassigned_mem_ops;
     mr->opaque = opaque;
     mr->terminates = true;
+    memory_region_update_direct_access(mr);
 }
 
 void memory_region_init_ram(MemoryRegion *mr,
@@ -1370,6 +1858,7 @@ void memory_region_init_alias(MemoryRegion *mr,
     memory_region_init(mr, owner, name, size);
     mr->alias = orig;
     mr->alias_offset = offset;
+    QTAILQ_INSERT_TAIL(&orig->aliases, mr, aliases_link);
 }
 
 void memory_region_init_rom(MemoryRegion *mr,
@@ -1401,6 +1890,7 @@ void memory_region_init_rom_device(MemoryRegion *mr,
     mr->opaque = opaque;
     mr->terminates = true;
     mr->rom_device = true;
+    memory_region_update_direct_access(mr);
     mr->destructor = memory_region_destructor_ram;
     mr->ram_block = qemu_ram_alloc(size, mr, errp);
 }
@@ -1438,6 +1928,14 @@ static void memory_region_finalize(Object *obj)
     }
     memory_region_transaction_commit();
 
+    if (mr->alias && QTAILQ_IN_USE(mr, aliases_link)) {
+        QTAILQ_REMOVE(&mr->alias->aliases, mr, aliases_link);
+    }
+    while (!QTAILQ_EMPTY(&mr->aliases)) {
+        MemoryRegion *alias = QTAILQ_FIRST(&mr->aliases);
+        QTAILQ_REMOVE(&mr->aliases, alias, aliases_link);
+    }
+
     mr->destructor(mr);
     memory_region_clear_coalescing(mr);
     g_free((char *)mr->name);
@@ -1610,7 +2108,9 @@ void memory_region_set_log(MemoryRegion *mr, bool log, unsigned client)
 
     memory_region_transaction_begin();
     mr->dirty_log_mask = (mr->dirty_log_mask & ~mask) | (log * mask);
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_update_whole(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -1673,7 +2173,9 @@ void memory_region_set_readonly(MemoryRegion *mr, bool readonly)
     if (mr->readonly != readonly) {
         memory_region_transaction_begin();
         mr->readonly = readonly;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_update_whole(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -1683,7 +2185,9 @@ void memory_region_rom_device_set_romd(MemoryRegion *mr, bool romd_mode)
     if (mr->romd_mode != romd_mode) {
         memory_region_transaction_begin();
         mr->romd_mode = romd_mode;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_update_whole(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -1963,7 +2467,9 @@ static void memory_region_update_container_subregions(MemoryRegion *subregion)
     }
     QTAILQ_INSERT_TAIL(&mr->subregions, subregion, subregions_link);
 done:
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    if (mr->enabled && subregion->enabled) {
+        memory_region_update_whole(subregion);
+    }
     memory_region_transaction_commit();
 }
 
@@ -1999,10 +2505,12 @@ void memory_region_del_subregion(MemoryRegion *mr,
 {
     memory_region_transaction_begin();
     assert(subregion->container == mr);
+    if (mr->enabled && subregion->enabled) {
+        memory_region_update_whole(subregion);
+    }
     subregion->container = NULL;
     QTAILQ_REMOVE(&mr->subregions, subregion, subregions_link);
     memory_region_unref(subregion);
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
     memory_region_transaction_commit();
 }
 
@@ -2013,7 +2521,7 @@ void memory_region_set_enabled(MemoryRegion *mr, bool enabled)
     }
     memory_region_transaction_begin();
     mr->enabled = enabled;
-    memory_region_update_pending = true;
+    memory_region_update_whole(mr);
     memory_region_transaction_commit();
 }
 
@@ -2028,8 +2536,9 @@ void memory_region_set_size(MemoryRegion *mr, uint64_t size)
         return;
     }
     memory_region_transaction_begin();
+    memory_region_update_whole(mr);
     mr->size = s;
-    memory_region_update_pending = true;
+    memory_region_update_whole(mr);
     memory_region_transaction_commit();
 }
 
@@ -2051,8 +2560,14 @@ static void memory_region_readd_subregion(MemoryRegion *mr)
 void memory_region_set_address(MemoryRegion *mr, hwaddr addr)
 {
     if (addr != mr->addr) {
+        memory_region_transaction_begin();
+        /* The old location is left behind by the move.  */
+        if (mr->container && mr->container->enabled && mr->enabled) {
+            memory_region_update_whole(mr);
+        }
         mr->addr = addr;
         memory_region_readd_subregion(mr);
+        memory_region_transaction_commit();
     }
 }
 
@@ -2066,7 +2581,9 @@ void memory_region_set_alias_offset(MemoryRegion *mr, hwaddr offset)
 
     memory_region_transaction_begin();
     mr->alias_offset = offset;
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_update_whole(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2200,7 +2717,7 @@ void memory_global_dirty_log_start(void)
 
     /* Refresh DIRTY_LOG_MIGRATION bit.  */
     memory_region_transaction_begin();
-    memory_region_update_pending = true;
+    memory_region_update_all();
     memory_region_transaction_commit();
 }
 
@@ -2210,7 +2727,7 @@ void memory_global_dirty_log_stop(void)
 
     /* Refresh DIRTY_LOG_MIGRATION bit.  */
     memory_region_transaction_begin();
-    memory_region_update_pending = true;
+    memory_region_update_all();
     memory_region_transaction_commit();
 
     MEMORY_LISTENER_CALL_GLOBAL(log_global_stop, Reverse);
@@ -2301,15 +2818,15 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
     as->ref_count = 1;
     as->root = root;
     as->malloced = false;
-    as->current_map = g_new(FlatView, 1);
-    flatview_init(as->current_map);
+    as->current_map = generate_memory_topology(NULL, NULL, NULL);
+    flatview_build_dispatch(as->current_map);
+    as->dispatch = as->current_map->dispatch;
     as->ioeventfd_nb = 0;
     as->ioeventfds = NULL;
     QTAILQ_INIT(&as->listeners);
     QTAILQ_INSERT_TAIL(&address_spaces, as, address_spaces_link);
     as->name = g_strdup(name ? name : "anonymous");
-    address_space_init_dispatch(as);
-    memory_region_update_pending |= root->enabled;
+    memory_region_update_whole(root);
     memory_region_transaction_commit();
 }
 
@@ -2317,7 +2834,6 @@ static void do_address_space_destroy(AddressSpace *as)
 {
     bool do_free = as->malloced;
 
-    address_space_destroy_dispatch(as);
     assert(QTAILQ_EMPTY(&as->listeners));
 
     flatview_unref(as->current_map);
@@ -2359,7 +2875,6 @@ void address_space_destroy(AddressSpace *as)
     as->root = NULL;
     memory_region_transaction_commit();
     QTAILQ_REMOVE(&address_spaces, as, address_spaces_link);
-    address_space_unregister(as);
 
     /* At this point, as->dispatch and as->current_map are dummy
      * entries that the guest should never use.  Wait for the old
@@ -2477,12 +2992,83 @@ static void mtree_print_mr(fprintf_function mon_printf, void *f,
     }
 }
 
-void mtree_info(fprintf_function mon_printf, void *f)
+static size_t mtree_print_flatview(fprintf_function mon_printf, void *f,
+                                   FlatView *view, unsigned int index)
+{
+    size_t view_size, dispatch_size;
+    AddressSpace *as;
+    FlatRange *fr;
+
+    view_size = sizeof(*view) + view->nr_allocated * sizeof(FlatRange);
+    dispatch_size = address_space_dispatch_size(view->dispatch);
+
+    mon_printf(f, "FlatView #%u\n", index);
+    QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+        if (as->current_map == view) {
+            mon_printf(f, "  AS \"%s\", root: %s\n", as->name,
+                       memory_region_name(as->root));
+        }
+    }
+    mon_printf(f, "  Root memory region: %s\n",
+               view->root ? memory_region_name(view->root) : "(none)");
+    mon_printf(f, "  Memory: %zu bytes for %u ranges, %zu bytes for dispatch\n",
+               view_size, view->nr, dispatch_size);
+
+    FOR_EACH_FLAT_RANGE(fr, view) {
+        mon_printf(f, "    " TARGET_FMT_plx "-" TARGET_FMT_plx
+                   " (prio %d, %c%c): %s",
+                   (hwaddr)int128_get64(fr->addr.start),
+                   (hwaddr)int128_get64(fr->addr.start) +
+                   (hwaddr)int128_get64(int128_sub(fr->addr.size,
+                                                   int128_one())),
+                   fr->mr->priority,
+                   fr->romd_mode ? 'R' : '-',
+                   !fr->readonly && !(fr->mr->rom_device && fr->romd_mode)
+                   ? 'W' : '-',
+                   memory_region_name(fr->mr));
+        if (fr->offset_in_region) {
+            mon_printf(f, " @" TARGET_FMT_plx, fr->offset_in_region);
+        }
+        mon_printf(f, "\n");
+    }
+    mon_printf(f, "\n");
+    return view_size + dispatch_size;
+}
+
+/* Print each view once, with the address spaces that share it.  */
+static void mtree_info_flatview(fprintf_function mon_printf, void *f)
+{
+    GHashTable *seen = g_hash_table_new(NULL, NULL);
+    unsigned int n_as = 0, n_views = 0;
+    size_t total = 0;
+    AddressSpace *as;
+
+    QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+        n_as++;
+        if (!g_hash_table_lookup(seen, as->current_map)) {
+            g_hash_table_add(seen, as->current_map);
+            total += mtree_print_flatview(mon_printf, f, as->current_map,
+                                          n_views++);
+        }
+    }
+    g_hash_table_destroy(seen);
+
+    mon_printf(f, "%u address spaces share %u FlatViews, "
+               "%zu bytes in total, %zu bytes per address space\n",
+               n_as, n_views, total, n_as ? total / n_as : 0);
+}
+
+void mtree_info(fprintf_function mon_printf, void *f, bool flatview)
 {
     MemoryRegionListHead ml_head;
     MemoryRegionList *ml, *ml2;
     AddressSpace *as;
 
+    if (flatview) {
+        mtree_info_flatview(mon_printf, f);
+        return;
+    }
+
     QTAILQ_INIT(&ml_head);
 
     QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
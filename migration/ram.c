@@ -224,8 +224,9 @@ static RAMBlock *last_seen_block;
 /* This is the last block from where we have sent data */
 static RAMBlock *last_sent_block;
 static ram_addr_t last_offset;
-static QemuMutex migration_bitmap_mutex;
 static uint64_t migration_dirty_pages;
+/* Set while the dirty log is on and the RAMBlocks have migration bitmaps */
+static bool migration_dirty_log;
 static uint32_t last_version;
 static bool ram_bulk_stage;
 
@@ -240,18 +241,6 @@ struct PageSearchStatus {
 };
 typedef struct PageSearchStatus PageSearchStatus;
 
-static struct BitmapRcu {
-    struct rcu_head rcu;
-    /* Main migration bitmap */
-    unsigned long *bmap;
-    /* bitmap of pages that haven't been sent even once
-     * only maintained and used in postcopy at the moment
-     * where it's used to send the dirtymap at the start
-     * of the postcopy phase
-     */
-    unsigned long *unsentmap;
-} *migration_bitmap_rcu;
-
 struct CompressParam {
     bool done;
     bool quit;
@@ -537,45 +526,39 @@ static int save_xbzrle_page(QEMUFile *f, uint8_t **current_data,
     return 1;
 }
 
-/* Called with rcu_read_lock() to protect migration_bitmap
+/* Called with rcu_read_lock() to protect the RAMBlock
  * rb: The RAMBlock  to search for dirty pages in
  * start: Start address (typically so we can continue from previous page)
- * ram_addr_abs: Pointer into which to store the address of the dirty page
- *               within the global ram_addr space
  *
  * Returns: byte offset within memory region of the start of a dirty page
  */
 static inline
 ram_addr_t migration_bitmap_find_dirty(RAMBlock *rb,
-                                       ram_addr_t start,
-                                       ram_addr_t *ram_addr_abs)
+                                       ram_addr_t start)
 {
-    unsigned long base = rb->offset >> TARGET_PAGE_BITS;
-    unsigned long nr = base + (start >> TARGET_PAGE_BITS);
-    uint64_t rb_size = rb->used_length;
-    unsigned long size = base + (rb_size >> TARGET_PAGE_BITS);
-    unsigned long *bitmap;
-
+    unsigned long nr = start >> TARGET_PAGE_BITS;
+    unsigned long size = rb->used_length >> TARGET_PAGE_BITS;
     unsigned long next;
 
-    bitmap = atomic_rcu_read(&migration_bitmap_rcu)->bmap;
-    if (ram_bulk_stage && nr > base) {
+    if (!rb->bmap) {
+        /* Added after the last sync, nothing to send yet */
+        return rb->used_length;
+    }
+    if (ram_bulk_stage && nr > 0) {
         next = nr + 1;
     } else {
-        next = find_next_bit(bitmap, size, nr);
+        next = find_next_bit(rb->bmap, size, nr);
     }
 
-    *ram_addr_abs = next << TARGET_PAGE_BITS;
-    return (next - base) << TARGET_PAGE_BITS;
+    return next << TARGET_PAGE_BITS;
 }
 
-static inline bool migration_bitmap_clear_dirty(ram_addr_t addr)
+static inline bool migration_bitmap_clear_dirty(RAMBlock *rb,
+                                                ram_addr_t offset)
 {
     bool ret;
-    int nr = addr >> TARGET_PAGE_BITS;
-    unsigned long *bitmap = atomic_rcu_read(&migration_bitmap_rcu)->bmap;
 
-    ret = test_and_clear_bit(nr, bitmap);
+    ret = test_and_clear_bit(offset >> TARGET_PAGE_BITS, rb->bmap);
 
     if (ret) {
         migration_dirty_pages--;
@@ -583,12 +566,22 @@ static inline bool migration_bitmap_clear_dirty(ram_addr_t addr)
     return ret;
 }
 
-static void migration_bitmap_sync_range(ram_addr_t start, ram_addr_t length)
+/* Called with rcu_read_lock() to protect the RAMBlock */
+static void migration_bitmap_sync_range(RAMBlock *rb, ram_addr_t start,
+                                        ram_addr_t length)
 {
-    unsigned long *bitmap;
-    bitmap = atomic_rcu_read(&migration_bitmap_rcu)->bmap;
+    if (!rb->bmap) {
+        /* The block was added during the migration: send all of it.
+         * Without an unsentmap, entry to postcopy will fail.
+         */
+        unsigned long pages = rb->max_length >> TARGET_PAGE_BITS;
+
+        rb->bmap = bitmap_new(pages);
+        bitmap_set(rb->bmap, 0, rb->used_length >> TARGET_PAGE_BITS);
+        migration_dirty_pages += rb->used_length >> TARGET_PAGE_BITS;
+    }
     migration_dirty_pages +=
-        cpu_physical_memory_sync_dirty_bitmap(bitmap, start, length);
+        cpu_physical_memory_sync_dirty_bitmap(rb, start, length);
 }
 
 /* Fix me: there are too many global variables used in migration process. */
@@ -626,15 +619,24 @@ static void migration_bitmap_sync(void)
     }
 
     trace_migration_bitmap_sync_start();
-    memory_global_dirty_log_sync();
 
-    qemu_mutex_lock(&migration_bitmap_mutex);
+    /* Only the accelerator's dirty log needs the iothread lock.  The
+     * blocks are walked without it, so that the vCPUs and the monitor
+     * keep running while the bitmaps of a large guest are synced.
+     */
+    if (qemu_mutex_iothread_locked()) {
+        memory_global_dirty_log_sync();
+    } else {
+        qemu_mutex_lock_iothread();
+        memory_global_dirty_log_sync();
+        qemu_mutex_unlock_iothread();
+    }
+
     rcu_read_lock();
     QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
-        migration_bitmap_sync_range(block->offset, block->used_length);
+        migration_bitmap_sync_range(block, 0, block->used_length);
     }
     rcu_read_unlock();
-    qemu_mutex_unlock(&migration_bitmap_mutex);
 
     trace_migration_bitmap_sync_end(migration_dirty_pages
                                     - num_dirty_pages_init);
@@ -980,14 +982,11 @@ static int ram_save_compressed_page(QEMUFile *f, PageSearchStatus *pss,
  * @f: Current migration stream.
  * @pss: Data about the state of the current dirty page scan.
  * @*again: Set to false if the search has scanned the whole of RAM
- * *ram_addr_abs: Pointer into which to store the address of the dirty page
- *               within the global ram_addr space
  */
 static bool find_dirty_block(QEMUFile *f, PageSearchStatus *pss,
-                             bool *again, ram_addr_t *ram_addr_abs)
+                             bool *again)
 {
-    pss->offset = migration_bitmap_find_dirty(pss->block, pss->offset,
-                                              ram_addr_abs);
+    pss->offset = migration_bitmap_find_dirty(pss->block, pss->offset);
     if (pss->complete_round && pss->block == last_seen_block &&
         pss->offset >= last_offset) {
         /*
@@ -1030,12 +1029,10 @@ static bool find_dirty_block(QEMUFile *f, PageSearchStatus *pss,
  * Helper for 'get_queued_page' - gets a page off the queue
  *      ms:      MigrationState in
  * *offset:      Used to return the offset within the RAMBlock
- * ram_addr_abs: global offset in the dirty/sent bitmaps
  *
  * Returns:      block (or NULL if none available)
  */
-static RAMBlock *unqueue_page(MigrationState *ms, ram_addr_t *offset,
-                              ram_addr_t *ram_addr_abs)
+static RAMBlock *unqueue_page(MigrationState *ms, ram_addr_t *offset)
 {
     RAMBlock *block = NULL;
 
@@ -1045,8 +1042,6 @@ static RAMBlock *unqueue_page(MigrationState *ms, ram_addr_t *offset,
                                 QSIMPLEQ_FIRST(&ms->src_page_requests);
         block = entry->rb;
         *offset = entry->offset;
-        *ram_addr_abs = (entry->offset + entry->rb->offset) &
-                        TARGET_PAGE_MASK;
 
         if (entry->len > TARGET_PAGE_SIZE) {
             entry->len -= TARGET_PAGE_SIZE;
@@ -1068,19 +1063,17 @@ static RAMBlock *unqueue_page(MigrationState *ms, ram_addr_t *offset,
  *
  *      ms:      MigrationState in
  *     pss:      PageSearchStatus structure updated with found block/offset
- * ram_addr_abs: global offset in the dirty/sent bitmaps
  *
  * Returns:      true if a queued page is found
  */
-static bool get_queued_page(MigrationState *ms, PageSearchStatus *pss,
-                            ram_addr_t *ram_addr_abs)
+static bool get_queued_page(MigrationState *ms, PageSearchStatus *pss)
 {
     RAMBlock  *block;
     ram_addr_t offset;
     bool dirty;
 
     do {
-        block = unqueue_page(ms, &offset, ram_addr_abs);
+        block = unqueue_page(ms, &offset);
         /*
          * We're sending this page, and since it's postcopy nothing else
          * will dirty it, and we must make sure it doesn't get sent again
@@ -1088,19 +1081,18 @@ static bool get_queued_page(MigrationState *ms, PageSearchStatus *pss,
          * search already sent it.
          */
         if (block) {
-            unsigned long *bitmap;
-            bitmap = atomic_rcu_read(&migration_bitmap_rcu)->bmap;
-            dirty = test_bit(*ram_addr_abs >> TARGET_PAGE_BITS, bitmap);
+            unsigned long page = offset >> TARGET_PAGE_BITS;
+
+            dirty = block->bmap && test_bit(page, block->bmap);
             if (!dirty) {
                 trace_get_queued_page_not_dirty(
                     block->idstr, (uint64_t)offset,
-                    (uint64_t)*ram_addr_abs,
-                    test_bit(*ram_addr_abs >> TARGET_PAGE_BITS,
-                         atomic_rcu_read(&migration_bitmap_rcu)->unsentmap));
+                    (uint64_t)(block->offset + offset),
+                    block->unsentmap && test_bit(page, block->unsentmap));
             } else {
                 trace_get_queued_page(block->idstr,
                                       (uint64_t)offset,
-                                      (uint64_t)*ram_addr_abs);
+                                      (uint64_t)(block->offset + offset));
             }
         }
 
@@ -1222,20 +1214,18 @@ err:
  * @offset: offset inside the block for the page;
  * @last_stage: if we are at the completion stage
  * @bytes_transferred: increase it with the number of transferred bytes
- * @dirty_ram_abs: Address of the start of the dirty page in ram_addr_t space
  *
  * Returns: Number of pages written.
  */
 static int ram_save_target_page(MigrationState *ms, QEMUFile *f,
                                 PageSearchStatus *pss,
                                 bool last_stage,
-                                uint64_t *bytes_transferred,
-                                ram_addr_t dirty_ram_abs)
+                                uint64_t *bytes_transferred)
 {
     int res = 0;
 
     /* Check the pages is dirty and if it is send it */
-    if (migration_bitmap_clear_dirty(dirty_ram_abs)) {
+    if (migration_bitmap_clear_dirty(pss->block, pss->offset)) {
         unsigned long *unsentmap;
         if (compression_switch && migrate_use_compression()) {
             res = ram_save_compressed_page(f, pss,
@@ -1249,9 +1239,9 @@ static int ram_save_target_page(MigrationState *ms, QEMUFile *f,
         if (res < 0) {
             return res;
         }
-        unsentmap = atomic_rcu_read(&migration_bitmap_rcu)->unsentmap;
+        unsentmap = pss->block->unsentmap;
         if (unsentmap) {
-            clear_bit(dirty_ram_abs >> TARGET_PAGE_BITS, unsentmap);
+            clear_bit(pss->offset >> TARGET_PAGE_BITS, unsentmap);
         }
         /* Only update last_sent_block if a block was actually sent; xbzrle
          * might have decided the page was identical so didn't bother writing
@@ -1280,25 +1270,22 @@ static int ram_save_target_page(MigrationState *ms, QEMUFile *f,
  *          sent
  * @last_stage: if we are at the completion stage
  * @bytes_transferred: increase it with the number of transferred bytes
- * @dirty_ram_abs: Address of the start of the dirty page in ram_addr_t space
  */
 static int ram_save_host_page(MigrationState *ms, QEMUFile *f,
                               PageSearchStatus *pss,
                               bool last_stage,
-                              uint64_t *bytes_transferred,
-                              ram_addr_t dirty_ram_abs)
+                              uint64_t *bytes_transferred)
 {
     int tmppages, pages = 0;
     do {
         tmppages = ram_save_target_page(ms, f, pss, last_stage,
-                                        bytes_transferred, dirty_ram_abs);
+                                        bytes_transferred);
         if (tmppages < 0) {
             return tmppages;
         }
 
         pages += tmppages;
         pss->offset += TARGET_PAGE_SIZE;
-        dirty_ram_abs += TARGET_PAGE_SIZE;
     } while (pss->offset & (qemu_host_page_size - 1));
 
     /* The offset we leave with is the last one we looked at */
@@ -1329,8 +1316,6 @@ static int ram_find_and_save_block(QEMUFile *f, bool last_stage,
     MigrationState *ms = migrate_get_current();
     int pages = 0;
     bool again, found;
-    ram_addr_t dirty_ram_abs; /* Address of the start of the dirty page in
-                                 ram_addr_t space */
 
     pss.block = last_seen_block;
     pss.offset = last_offset;
@@ -1342,17 +1327,16 @@ static int ram_find_and_save_block(QEMUFile *f, bool last_stage,
 
     do {
         again = true;
-        found = get_queued_page(ms, &pss, &dirty_ram_abs);
+        found = get_queued_page(ms, &pss);
 
         if (!found) {
             /* priority queue empty, so just search for something dirty */
-            found = find_dirty_block(f, &pss, &again, &dirty_ram_abs);
+            found = find_dirty_block(f, &pss, &again);
         }
 
         if (found) {
             pages = ram_save_host_page(ms, f, &pss,
-                                       last_stage, bytes_transferred,
-                                       dirty_ram_abs);
+                                       last_stage, bytes_transferred);
         }
     } while (!pages && again);
 
@@ -1407,23 +1391,25 @@ void free_xbzrle_decoded_buf(void)
     xbzrle_decoded_buf = NULL;
 }
 
-static void migration_bitmap_free(struct BitmapRcu *bmap)
-{
-    g_free(bmap->bmap);
-    g_free(bmap->unsentmap);
-    g_free(bmap);
-}
-
 static void ram_migration_cleanup(void *opaque)
 {
-    /* caller have hold iothread lock or is in a bh, so there is
-     * no writing race against this migration_bitmap
+    RAMBlock *block;
+
+    /* caller have hold iothread lock or is in a bh, and the migration
+     * thread is gone, so there is no race against the migration bitmaps
      */
-    struct BitmapRcu *bitmap = migration_bitmap_rcu;
-    atomic_rcu_set(&migration_bitmap_rcu, NULL);
-    if (bitmap) {
+    if (migration_dirty_log) {
+        migration_dirty_log = false;
         memory_global_dirty_log_stop();
-        call_rcu(bitmap, migration_bitmap_free, rcu);
+
+        rcu_read_lock();
+        QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
+            g_free(block->bmap);
+            block->bmap = NULL;
+            g_free(block->unsentmap);
+            block->unsentmap = NULL;
+        }
+        rcu_read_unlock();
     }
 
     XBZRLE_cache_lock();
@@ -1450,55 +1436,20 @@ static void reset_ram_globals(void)
 
 #define MAX_WAIT 50 /* ms, half buffered_file limit */
 
-void migration_bitmap_extend(ram_addr_t old, ram_addr_t new)
-{
-    /* called in qemu main thread, so there is
-     * no writing race against this migration_bitmap
-     */
-    if (migration_bitmap_rcu) {
-        struct BitmapRcu *old_bitmap = migration_bitmap_rcu, *bitmap;
-        bitmap = g_new(struct BitmapRcu, 1);
-        bitmap->bmap = bitmap_new(new);
-
-        /* prevent migration_bitmap content from being set bit
-         * by migration_bitmap_sync_range() at the same time.
-         * it is safe to migration if migration_bitmap is cleared bit
-         * at the same time.
-         */
-        qemu_mutex_lock(&migration_bitmap_mutex);
-        bitmap_copy(bitmap->bmap, old_bitmap->bmap, old);
-        bitmap_set(bitmap->bmap, old, new - old);
-
-        /* We don't have a way to safely extend the sentmap
-         * with RCU; so mark it as missing, entry to postcopy
-         * will fail.
-         */
-        bitmap->unsentmap = NULL;
-
-        atomic_rcu_set(&migration_bitmap_rcu, bitmap);
-        qemu_mutex_unlock(&migration_bitmap_mutex);
-        migration_dirty_pages += new - old;
-        call_rcu(old_bitmap, migration_bitmap_free, rcu);
-    }
-}
-
 /*
  * 'expected' is the value you expect the bitmap mostly to be full
  * of; it won't bother printing lines that are all this value.
- * If 'todump' is null the migration bitmap is dumped.
+ * 'pages' is the size of 'todump' in bits, e.g. of a RAMBlock's bmap.
  */
-void ram_debug_dump_bitmap(unsigned long *todump, bool expected)
+void ram_debug_dump_bitmap(unsigned long *todump, bool expected,
+                           unsigned long pages)
 {
-    int64_t ram_pages = last_ram_offset() >> TARGET_PAGE_BITS;
+    int64_t ram_pages = pages;
 
     int64_t cur;
     int64_t linelen = 128;
     char linebuf[129];
 
-    if (!todump) {
-        todump = atomic_rcu_read(&migration_bitmap_rcu)->bmap;
-    }
-
     for (cur = 0; cur < ram_pages; cur += linelen) {
         int64_t curb;
         bool found = false;
@@ -1527,20 +1478,17 @@ void ram_debug_dump_bitmap(unsigned long *todump, bool expected)
  * Callback from postcopy_each_ram_send_discard for each RAMBlock
  * Note: At this point the 'unsentmap' is the processed bitmap combined
  *       with the dirtymap; so a '1' means it's either dirty or unsent.
- * start,length: Indexes into the bitmap for the first bit
- *            representing the named block and length in target-pages
+ * block: The RAMBlock whose unsentmap is sent
  */
 static int postcopy_send_discard_bm_ram(MigrationState *ms,
                                         PostcopyDiscardState *pds,
-                                        unsigned long start,
-                                        unsigned long length)
+                                        RAMBlock *block)
 {
-    unsigned long end = start + length; /* one after the end */
+    unsigned long end = block->used_length >> TARGET_PAGE_BITS;
     unsigned long current;
-    unsigned long *unsentmap;
+    unsigned long *unsentmap = block->unsentmap;
 
-    unsentmap = atomic_rcu_read(&migration_bitmap_rcu)->unsentmap;
-    for (current = start; current < end; ) {
+    for (current = 0; current < end; ) {
         unsigned long one = find_next_bit(unsentmap, end, current);
 
         if (one <= end) {
@@ -1566,8 +1514,7 @@ static int postcopy_send_discard_bm_ram(MigrationState *ms,
 
 /*
  * Utility for the outgoing postcopy code.
- *   Calls postcopy_send_discard_bm_ram for each RAMBlock
- *   passing it bitmap indexes and name.
+ *   Calls postcopy_send_discard_bm_ram for each RAMBlock.
  * Returns: 0 on success
  * (qemu_ram_foreach_block ends up passing unscaled lengths
  *  which would mean postcopy code would have to deal with target page)
@@ -1578,9 +1525,8 @@ static int postcopy_each_ram_send_discard(MigrationState *ms)
     int ret;
 
     QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
-        unsigned long first = block->offset >> TARGET_PAGE_BITS;
-        PostcopyDiscardState *pds = postcopy_discard_send_init(ms,
-                                                               first,
+        /* The bitmaps are indexed from the start of the block */
+        PostcopyDiscardState *pds = postcopy_discard_send_init(ms, 0,
                                                                block->idstr);
 
         /*
@@ -1588,8 +1534,7 @@ static int postcopy_each_ram_send_discard(MigrationState *ms)
          * just needs indexes at this point, avoids it having
          * target page specific code.
          */
-        ret = postcopy_send_discard_bm_ram(ms, pds, first,
-                                    block->used_length >> TARGET_PAGE_BITS);
+        ret = postcopy_send_discard_bm_ram(ms, pds, block);
         postcopy_discard_send_finish(ms, pds);
         if (ret) {
             return ret;
@@ -1615,23 +1560,19 @@ static void postcopy_chunk_hostpages_pass(MigrationState *ms, bool unsent_pass,
                                           RAMBlock *block,
                                           PostcopyDiscardState *pds)
 {
-    unsigned long *bitmap;
-    unsigned long *unsentmap;
+    unsigned long *bitmap = block->bmap;
+    unsigned long *unsentmap = block->unsentmap;
     unsigned int host_ratio = qemu_host_page_size / TARGET_PAGE_SIZE;
-    unsigned long first = block->offset >> TARGET_PAGE_BITS;
     unsigned long len = block->used_length >> TARGET_PAGE_BITS;
-    unsigned long last = first + (len - 1);
+    unsigned long last = len - 1;
     unsigned long run_start;
 
-    bitmap = atomic_rcu_read(&migration_bitmap_rcu)->bmap;
-    unsentmap = atomic_rcu_read(&migration_bitmap_rcu)->unsentmap;
-
     if (unsent_pass) {
         /* Find a sent page */
-        run_start = find_next_zero_bit(unsentmap, last + 1, first);
+        run_start = find_next_zero_bit(unsentmap, last + 1, 0);
     } else {
         /* Find a dirty page */
-        run_start = find_next_bit(bitmap, last + 1, first);
+        run_start = find_next_bit(bitmap, last + 1, 0);
     }
 
     while (run_start <= last) {
@@ -1745,10 +1686,8 @@ static int postcopy_chunk_hostpages(MigrationState *ms)
     last_offset     = 0;
 
     QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
-        unsigned long first = block->offset >> TARGET_PAGE_BITS;
-
         PostcopyDiscardState *pds =
-                         postcopy_discard_send_init(ms, first, block->idstr);
+                         postcopy_discard_send_init(ms, 0, block->idstr);
 
         /* First pass: Discard all partially sent host pages */
         postcopy_chunk_hostpages_pass(ms, true, block, pds);
@@ -1776,22 +1715,20 @@ static int postcopy_chunk_hostpages(MigrationState *ms)
 int ram_postcopy_send_discard_bitmap(MigrationState *ms)
 {
     int ret;
-    unsigned long *bitmap, *unsentmap;
+    RAMBlock *block;
 
     rcu_read_lock();
 
     /* This should be our last sync, the src is now paused */
     migration_bitmap_sync();
 
-    unsentmap = atomic_rcu_read(&migration_bitmap_rcu)->unsentmap;
-    if (!unsentmap) {
-        /* We don't have a safe way to resize the sentmap, so
-         * if the bitmap was resized it will be NULL at this
-         * point.
-         */
-        error_report("migration ram resized during precopy phase");
-        rcu_read_unlock();
-        return -EINVAL;
+    QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
+        if (!block->unsentmap) {
+            /* Blocks added during precopy have no sentmap */
+            error_report("migration ram resized during precopy phase");
+            rcu_read_unlock();
+            return -EINVAL;
+        }
     }
 
     /* Deal with TPS != HPS */
@@ -1804,15 +1741,16 @@ int ram_postcopy_send_discard_bitmap(MigrationState *ms)
     /*
      * Update the unsentmap to be unsentmap = unsentmap | dirty
      */
-    bitmap = atomic_rcu_read(&migration_bitmap_rcu)->bmap;
-    bitmap_or(unsentmap, unsentmap, bitmap,
-               last_ram_offset() >> TARGET_PAGE_BITS);
-
+    QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
+        unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
 
-    trace_ram_postcopy_send_discard_bitmap();
+        bitmap_or(block->unsentmap, block->unsentmap, block->bmap, pages);
 #ifdef DEBUG_POSTCOPY
-    ram_debug_dump_bitmap(unsentmap, true);
+        ram_debug_dump_bitmap(block->unsentmap, true, pages);
 #endif
+    }
+
+    trace_ram_postcopy_send_discard_bitmap();
 
     ret = postcopy_each_ram_send_discard(ms);
     rcu_read_unlock();
@@ -1881,12 +1819,10 @@ err:
 static int ram_save_setup(QEMUFile *f, void *opaque)
 {
     RAMBlock *block;
-    int64_t ram_bitmap_pages; /* Size of bitmap in pages, including gaps */
 
     dirty_rate_high_cnt = 0;
     bitmap_sync_count = 0;
     migration_bitmap_sync_init();
-    qemu_mutex_init(&migration_bitmap_mutex);
 
     if (migrate_use_xbzrle()) {
         XBZRLE_cache_lock();
@@ -1927,14 +1863,19 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
     bytes_transferred = 0;
     reset_ram_globals();
 
-    ram_bitmap_pages = last_ram_offset() >> TARGET_PAGE_BITS;
-    migration_bitmap_rcu = g_new0(struct BitmapRcu, 1);
-    migration_bitmap_rcu->bmap = bitmap_new(ram_bitmap_pages);
-    bitmap_set(migration_bitmap_rcu->bmap, 0, ram_bitmap_pages);
-
-    if (migrate_postcopy_ram()) {
-        migration_bitmap_rcu->unsentmap = bitmap_new(ram_bitmap_pages);
-        bitmap_set(migration_bitmap_rcu->unsentmap, 0, ram_bitmap_pages);
+    /* The bitmaps cover max_length, so that resizing a block does not
+     * need to reallocate them.
+     */
+    QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
+        unsigned long pages = block->max_length >> TARGET_PAGE_BITS;
+        unsigned long used = block->used_length >> TARGET_PAGE_BITS;
+
+        block->bmap = bitmap_new(pages);
+        bitmap_set(block->bmap, 0, used);
+        if (migrate_postcopy_ram()) {
+            block->unsentmap = bitmap_new(pages);
+            bitmap_set(block->unsentmap, 0, used);
+        }
     }
 
     /*
@@ -1943,6 +1884,7 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
      */
     migration_dirty_pages = ram_bytes_total() >> TARGET_PAGE_BITS;
 
+    migration_dirty_log = true;
     memory_global_dirty_log_start();
     migration_bitmap_sync();
     qemu_mutex_unlock_ramlist();
@@ -2075,11 +2017,9 @@ static void ram_save_pending(QEMUFile *f, void *opaque, uint64_t max_size,
 
     if (!migration_in_postcopy(migrate_get_current()) &&
         remaining_size < max_size) {
-        qemu_mutex_lock_iothread();
         rcu_read_lock();
         migration_bitmap_sync();
         rcu_read_unlock();
-        qemu_mutex_unlock_iothread();
         remaining_size = ram_save_remaining() * TARGET_PAGE_SIZE;
     }
 
@@ -0,0 +1,290 @@
+/*
+ * Linux perf support for translated code
+ *
+ * perf cannot find symbols for the code in code_gen_buffer on its own.
+ * Two of its interfaces for JIT compilers are supported: a perf map
+ * (/tmp/perf-<pid>.map), which perf reads directly, and a jitdump file
+ * (jit-<pid>.dump), which "perf inject --jit" turns into ELF images so
+ * that the generated code can also be annotated.  Each TB is named after
+ * its guest PC and, if known, the guest symbol containing it.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <sys/mman.h>
+
+#include "qemu-common.h"
+#include "cpu.h"
+#include "disas/disas.h"
+#include "exec/exec-all.h"
+#include "qemu/timer.h"
+#include "elf.h"
+#include "tcg.h"
+#include "perf.h"
+
+#if defined(__x86_64__)
+# define PERF_ELF_MACHINE EM_X86_64
+#elif defined(__i386__)
+# define PERF_ELF_MACHINE EM_386
+#elif defined(__aarch64__)
+# define PERF_ELF_MACHINE EM_AARCH64
+#elif defined(__arm__)
+# define PERF_ELF_MACHINE EM_ARM
+#elif defined(__powerpc64__)
+# define PERF_ELF_MACHINE EM_PPC64
+#elif defined(__powerpc__)
+# define PERF_ELF_MACHINE EM_PPC
+#elif defined(__s390x__)
+# define PERF_ELF_MACHINE EM_S390
+#elif defined(__mips__)
+# define PERF_ELF_MACHINE EM_MIPS
+#elif defined(__sparc__)
+# define PERF_ELF_MACHINE EM_SPARCV9
+#else
+# define PERF_ELF_MACHINE EM_NONE
+#endif
+
+/* The jitdump format, see tools/perf/util/jitdump.h in Linux.  */
+#define JITDUMP_MAGIC   0x4A695444
+#define JITDUMP_VERSION 1
+#define JIT_CODE_LOAD   0
+#define JIT_CODE_CLOSE  3
+
+typedef struct JitHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+} JitHeader;
+
+typedef struct JitRecord {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+} JitRecord;
+
+typedef struct JitCodeLoad {
+    JitRecord p;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+    /* followed by the name and the code */
+} JitCodeLoad;
+
+/* Protected by tb_lock once code is generated.  */
+static FILE *perfmap;
+static FILE *jitdump;
+static void *jitdump_marker;
+static uint64_t jitdump_index;
+static const void *prologue_start;
+static size_t prologue_size;
+
+static void write_perfmap_entry(const void *start, size_t size,
+                                const char *name)
+{
+    fprintf(perfmap, "%" PRIxPTR " %zx %s\n", (uintptr_t)start, size, name);
+}
+
+static void write_jitdump_entry(const void *start, size_t size,
+                                const char *name)
+{
+    JitCodeLoad load = {
+        .p.id = JIT_CODE_LOAD,
+        .p.total_size = sizeof(load) + strlen(name) + 1 + size,
+        .p.timestamp = get_clock(),
+        .pid = getpid(),
+        .tid = qemu_get_thread_id(),
+        .vma = (uintptr_t)start,
+        .code_addr = (uintptr_t)start,
+        .code_size = size,
+        .code_index = jitdump_index++,
+    };
+
+    fwrite(&load, sizeof(load), 1, jitdump);
+    fwrite(name, strlen(name) + 1, 1, jitdump);
+    fwrite(start, size, 1, jitdump);
+}
+
+static void perf_atexit(void)
+{
+    static bool registered;
+
+    if (!registered) {
+        atexit(perf_exit);
+        registered = true;
+    }
+}
+
+void perf_enable_perfmap(void)
+{
+    char name[32];
+
+    snprintf(name, sizeof(name), "/tmp/perf-%d.map", getpid());
+    perfmap = fopen(name, "w+");
+    if (!perfmap) {
+        fprintf(stderr, "Could not open %s: %s, proceeding without perfmap\n",
+                name, strerror(errno));
+        return;
+    }
+    if (prologue_start) {
+        write_perfmap_entry(prologue_start, prologue_size, "tcg-prologue");
+    }
+    perf_atexit();
+}
+
+void perf_enable_jitdump(void)
+{
+    JitHeader header = {
+        .magic = JITDUMP_MAGIC,
+        .version = JITDUMP_VERSION,
+        .total_size = sizeof(header),
+        .elf_mach = PERF_ELF_MACHINE,
+        .pid = getpid(),
+        .timestamp = get_clock(),
+    };
+    char name[32];
+
+    snprintf(name, sizeof(name), "jit-%d.dump", getpid());
+    jitdump = fopen(name, "w+");
+    if (!jitdump) {
+        fprintf(stderr, "Could not open %s: %s, proceeding without jitdump\n",
+                name, strerror(errno));
+        return;
+    }
+
+    /* perf finds the file through an executable mapping of it.  */
+    jitdump_marker = mmap(NULL, getpagesize(), PROT_READ | PROT_EXEC,
+                          MAP_PRIVATE, fileno(jitdump), 0);
+    if (jitdump_marker == MAP_FAILED) {
+        fprintf(stderr, "Could not map %s: %s, proceeding without jitdump\n",
+                name, strerror(errno));
+        fclose(jitdump);
+        jitdump = NULL;
+        return;
+    }
+    fwrite(&header, sizeof(header), 1, jitdump);
+    if (prologue_start) {
+        write_jitdump_entry(prologue_start, prologue_size, "tcg-prologue");
+    }
+    perf_atexit();
+}
+
+bool perf_enabled(void)
+{
+    return perfmap || jitdump;
+}
+
+static void perf_report(const void *start, size_t size, const char *name)
+{
+    if (perfmap) {
+        write_perfmap_entry(start, size, name);
+    }
+    if (jitdump) {
+        write_jitdump_entry(start, size, name);
+    }
+}
+
+void perf_report_prologue(const void *start, size_t size)
+{
+    prologue_start = start;
+    prologue_size = size;
+    perf_report(start, size, "tcg-prologue");
+}
+
+static char *perf_tb_name(TranslationBlock *tb)
+{
+    const char *symbol = lookup_symbol(tb->pc);
+
+    if (symbol[0]) {
+        return g_strdup_printf("guest-0x" TARGET_FMT_lx " %s", tb->pc,
+                               symbol);
+    }
+    return g_strdup_printf("guest-0x" TARGET_FMT_lx, tb->pc);
+}
+
+void perf_report_code(TranslationBlock *tb, size_t size)
+{
+    char *name;
+
+    if (!perf_enabled()) {
+        return;
+    }
+    name = perf_tb_name(tb);
+    perf_report(tb->tc_ptr, size, name);
+    g_free(name);
+}
+
+void perf_report_retire(void)
+{
+    size_t i;
+    int j;
+
+    /* perf has no way to remove perf map entries, and it would attribute
+       samples in reused code to whichever entry it finds first.  Write
+       the map again with the TBs that are left.  jitdump records carry
+       a timestamp, so perf already knows which code was there when.  */
+    if (!perfmap) {
+        return;
+    }
+    rewind(perfmap);
+    if (ftruncate(fileno(perfmap), 0) < 0) {
+        return;
+    }
+    write_perfmap_entry(prologue_start, prologue_size, "tcg-prologue");
+
+    for (i = 0; i < tcg_regions.n; i++) {
+        TCGRegion *r = &tcg_regions.regions[i];
+
+        for (j = 0; j < r->nb_tbs; j++) {
+            TranslationBlock *tb = &r->tbs[j];
+            void *end = j + 1 < r->nb_tbs ? r->tbs[j + 1].tc_ptr : r->ptr;
+            char *name;
+
+            if (atomic_read(&tb->invalid)) {
+                continue;
+            }
+            name = perf_tb_name(tb);
+            write_perfmap_entry(tb->tc_ptr, end - tb->tc_ptr, name);
+            g_free(name);
+        }
+    }
+}
+
+void perf_flush(void)
+{
+    if (perfmap) {
+        fflush(perfmap);
+    }
+    if (jitdump) {
+        fflush(jitdump);
+    }
+}
+
+void perf_exit(void)
+{
+    if (perfmap) {
+        fclose(perfmap);
+        perfmap = NULL;
+    }
+    if (jitdump) {
+        JitRecord close = {
+            .id = JIT_CODE_CLOSE,
+            .total_size = sizeof(close),
+            .timestamp = get_clock(),
+        };
+
+        fwrite(&close, sizeof(close), 1, jitdump);
+        munmap(jitdump_marker, getpagesize());
+        fclose(jitdump);
+        jitdump = NULL;
+    }
+}
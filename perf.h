@@ -0,0 +1,49 @@
+/*
+ * Linux perf support for translated code
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+#ifndef QEMU_PERF_H
+#define QEMU_PERF_H
+
+#include "exec/exec-all.h"
+
+#ifdef CONFIG_LINUX
+/* perf.c */
+void perf_enable_perfmap(void);
+void perf_enable_jitdump(void);
+bool perf_enabled(void);
+void perf_report_prologue(const void *start, size_t size);
+void perf_report_code(TranslationBlock *tb, size_t size);
+void perf_report_retire(void);
+void perf_flush(void);
+void perf_exit(void);
+#else
+static inline bool perf_enabled(void)
+{
+    return false;
+}
+
+static inline void perf_report_prologue(const void *start, size_t size)
+{
+}
+
+static inline void perf_report_code(TranslationBlock *tb, size_t size)
+{
+}
+
+static inline void perf_report_retire(void)
+{
+}
+
+static inline void perf_flush(void)
+{
+}
+
+static inline void perf_exit(void)
+{
+}
+#endif
+
+#endif /* QEMU_PERF_H */
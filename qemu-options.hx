@@ -88,6 +88,48 @@ ETEXI
 HXCOMM Deprecated by -machine
 DEF("M", HAS_ARG, QEMU_OPTION_M, "", QEMU_ARCH_ALL)
 
+DEF("accel", HAS_ARG, QEMU_OPTION_accel,
+    "-accel [accel=]accelerator[,thread=single|multi][,superblock=n]\n"
+    "                [,host-vector=on|off][,perf=map|jitdump]\n"
+    "                select accelerator (kvm, xen or tcg)\n"
+    "                thread=single|multi (enable multi-threaded TCG)\n"
+    "                superblock=n (retranslate blocks executed n times as superblocks)\n"
+    "                host-vector=on|off (use host vector instructions)\n"
+    "                perf=map|jitdump (describe translated code to perf)\n", QEMU_ARCH_ALL)
+STEXI
+@item -accel @var{name}[,prop=@var{value}[,...]]
+@findex -accel
+This is used to enable an accelerator. Depending on the target architecture,
+kvm, xen, or tcg can be available. By default, tcg is used. If there is more
+than one accelerator specified, the next one is used if the previous one fails
+to initialize.
+@table @option
+@item thread=single|multi
+Controls the number of TCG threads. When TCG is multi-threaded there is one
+host thread per vCPU, taking advantage of additional host cores. The default
+is to enable multi-threading where both the back-end and front-end support it
+and no incompatible TCG features have been enabled (e.g. icount/replay).
+@item superblock=@var{n}
+Once a translated block has been executed @var{n} times, translate it again
+together with the blocks that most often follow it, so that the code
+generator can optimize across them. The default is 0, which disables
+superblocks. Superblocks are only formed for x86 guests, and not when
+icount is enabled.
+@item host-vector=on|off
+Controls whether the guest vector operations that TCG knows about are
+translated to host vector instructions, on hosts that have them. The
+default is @option{on}. With @option{off} they are expanded to 64-bit
+integer operations, which is only useful to compare the two.
+@item perf=map|jitdump
+Tell the Linux perf tool about the code generated by TCG, naming each
+translated block after its guest address and guest symbol. @option{map}
+writes @file{/tmp/perf-@var{pid}.map}, which @command{perf report} picks up
+directly. @option{jitdump} writes @file{jit-@var{pid}.dump} in the current
+directory, including the generated code, for use with
+@command{perf record -k 1} and @command{perf inject --jit}.
+@end table
+ETEXI
+
 DEF("cpu", HAS_ARG, QEMU_OPTION_cpu,
     "-cpu cpu        select CPU ('-cpu help' for list)\n", QEMU_ARCH_ALL)
 STEXI
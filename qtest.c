@@ -146,6 +146,15 @@ static bool qtest_opened;
  * B64_DATA is an arbitrarily long base64 encoded string.
  * If the sizes do not match, the data will be truncated.
  *
+ * Memory topology:
+ *
+ *  > flatview_check
+ *  < OK COUNT
+ *
+ *     Render the memory regions of each address space from scratch and
+ *     compare the result with its current flat view.  COUNT is the number
+ *     of address spaces whose view is out of date.
+ *
  * IRQ management:
  *
  *  > irq_intercept_in QOM-PATH
@@ -537,6 +546,11 @@ static void qtest_process_command(CharBackend *chr, gchar **words)
 
         qtest_send_prefix(chr);
         qtest_send(chr, "OK\n");
+    } else if (strcmp(words[0], "flatview_check") == 0) {
+        int n = memory_check_flatviews();
+
+        qtest_send_prefix(chr);
+        qtest_sendf(chr, "OK %d\n", n);
     } else if (strcmp(words[0], "endianness") == 0) {
         qtest_send_prefix(chr);
 #if defined(TARGET_WORDS_BIGENDIAN)
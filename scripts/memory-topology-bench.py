@@ -0,0 +1,87 @@
+#!/usr/bin/env python
+#
+# Time the firmware boot of a q35 machine with many PCI devices
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or
+# later.  See the COPYING file in the top-level directory.
+#
+# While the firmware enumerates the PCI devices, every BAR and bridge
+# window that it programs is a memory transaction, so the time spent
+# until the boot fails is dominated by updates to the memory topology.
+# The devices sit behind PCI bridges, 30 per bridge.  The machine exits
+# when no boot device is found, thanks to "-no-reboot -boot
+# reboot-timeout=0".
+#
+# Usage: memory-topology-bench.py [-n DEVICES] [-r RUNS] [-b BASELINE]
+#                                  QEMU [ARGS...]
+# where QEMU is a qemu-system-x86_64 binary; ARGS are passed to it, for
+# example "-L pc-bios" when running from a build tree.  With -b, the same
+# machine is also booted with the BASELINE binary, for example one built
+# from the parent commit, and both times are reported.
+
+import optparse
+import subprocess
+import sys
+import time
+
+DEVICES_PER_BRIDGE = 30
+
+def device_args(n):
+    args = []
+    bridge = 0
+    for i in range(n):
+        slot = i % DEVICES_PER_BRIDGE
+        if slot == 0:
+            bridge += 1
+            args += ['-device', 'pci-bridge,id=br%d,chassis_nr=%d,bus=pcie.0'
+                     % (bridge, bridge)]
+        args += ['-device', 'virtio-rng-pci,bus=br%d,addr=0x%x'
+                 % (bridge, slot + 1)]
+    return args
+
+def main():
+    parser = optparse.OptionParser(usage='%prog [options] QEMU [ARGS...]')
+    parser.disable_interspersed_args()
+    parser.add_option('-n', '--devices', type='int', default=120,
+                      help='number of PCI devices (default 120)')
+    parser.add_option('-r', '--runs', type='int', default=3,
+                      help='number of runs; the best one is reported')
+    parser.add_option('-b', '--baseline', metavar='QEMU',
+                      help='also time this binary and compare')
+    opts, args = parser.parse_args()
+    if not args:
+        parser.error('missing QEMU binary')
+
+    best = time_boot(args[0], args[1:], opts)
+    if best is None:
+        return 1
+    if opts.baseline:
+        base = time_boot(opts.baseline, args[1:], opts)
+        if base is None:
+            return 1
+        sys.stdout.write('%d devices: baseline %.3f s, %.3f s (%.2fx)\n'
+                         % (opts.devices, base, best, base / best))
+    return 0
+
+def time_boot(qemu, extra_args, opts):
+    cmd = [qemu, '-M', 'q35', '-display', 'none', '-nodefaults',
+           '-no-reboot', '-boot', 'reboot-timeout=0']
+    cmd += device_args(opts.devices) + extra_args
+
+    best = None
+    for i in range(opts.runs):
+        start = time.time()
+        ret = subprocess.call(cmd)
+        elapsed = time.time() - start
+        if ret < 0:
+            sys.stderr.write('QEMU killed by signal %d\n' % -ret)
+            return None
+        sys.stdout.write('%s run %d: %.3f s\n' % (qemu, i + 1, elapsed))
+        if best is None or elapsed < best:
+            best = elapsed
+    sys.stdout.write('%s, %d devices: best %.3f s\n'
+                     % (qemu, opts.devices, best))
+    return best
+
+if __name__ == '__main__':
+    sys.exit(main())
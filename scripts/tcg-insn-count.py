@@ -0,0 +1,90 @@
+#!/usr/bin/env python
+#
+# Summarize the host code generated by TCG from a QEMU log
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or
+# later.  See the COPYING file in the top-level directory.
+#
+# The log must be produced with "-d nochain,exec,out_asm".  For every
+# translation block the "OUT:" section gives the size and the number of
+# host instructions, and with chaining disabled every execution of a
+# block is logged by a "Trace" line.  The dynamic count multiplies the
+# two, so it also counts out-of-line slow paths and instructions after
+# an early exit; it is meant for comparing two builds of QEMU running
+# the same workload, not as an exact figure.
+
+import re
+import sys
+
+out_re = re.compile(r'^OUT: \[size=(\d+)\]')
+insn_re = re.compile(r'^0x([0-9a-fA-F]+):')
+exec_re = re.compile(r'^(?:Trace|Chain) (?:0x)?([0-9a-fA-F]+) \[')
+
+def analyze(f):
+    blocks = {}
+    nb_tb = nb_bytes = nb_insns = 0
+    nb_exec = dyn_insns = 0
+    unknown = 0
+
+    size = None
+    start = None
+    count = 0
+    for line in f:
+        if size is not None:
+            m = insn_re.match(line)
+            if m:
+                if start is None:
+                    start = int(m.group(1), 16)
+                count += 1
+                continue
+            # end of the disassembly
+            if start is not None:
+                blocks[start] = count
+                nb_tb += 1
+                nb_bytes += size
+                nb_insns += count
+            size = None
+        m = out_re.match(line)
+        if m:
+            size = int(m.group(1))
+            start = None
+            count = 0
+            continue
+        m = exec_re.match(line)
+        if m:
+            nb_exec += 1
+            n = blocks.get(int(m.group(1), 16))
+            if n is None:
+                unknown += 1
+            else:
+                dyn_insns += n
+
+    if size is not None and start is not None:
+        blocks[start] = count
+        nb_tb += 1
+        nb_bytes += size
+        nb_insns += count
+
+    print('translated blocks      %d' % nb_tb)
+    print('host code bytes        %d (%.1f per block)' %
+          (nb_bytes, float(nb_bytes) / max(nb_tb, 1)))
+    print('host instructions      %d (%.1f per block)' %
+          (nb_insns, float(nb_insns) / max(nb_tb, 1)))
+    print('executed blocks        %d' % nb_exec)
+    print('dynamic host insns     %d' % dyn_insns)
+    if unknown:
+        print('blocks without code    %d (log incomplete?)' % unknown)
+
+def main(args):
+    if len(args) > 2 or (len(args) == 2 and args[1] in ('-h', '--help')):
+        sys.stderr.write('usage: %s [LOGFILE]\n' % args[0])
+        return 1
+    if len(args) == 2:
+        with open(args[1]) as f:
+            analyze(f)
+    else:
+        analyze(sys.stdin)
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -21,6 +21,7 @@
 #include "cpu.h"
 #include "exec/exec-all.h"
 #include "tcg-op.h"
+#include "tcg-op-gvec.h"
 #include "qemu/log.h"
 #include "arm_ldst.h"
 #include "translate.h"
@@ -373,7 +374,7 @@ static inline void gen_goto_tb(DisasContext *s, int n, uint64_t dest)
         } else if (s->singlestep_enabled) {
             gen_exception_internal(EXCP_DEBUG);
         } else {
-            tcg_gen_exit_tb(0);
+            tcg_gen_lookup_and_goto_ptr();
             s->is_jmp = DISAS_TB_JUMP;
         }
     }
@@ -520,6 +521,15 @@ static inline void assert_fp_access_checked(DisasContext *s)
 #endif
 }
 
+/* Return the offset into CPUARMState of the whole of vector register Qn,
+ * for use with the tcg_gen_gvec_* expanders.
+ */
+static inline int vec_full_reg_offset(DisasContext *s, int regno)
+{
+    assert_fp_access_checked(s);
+    return offsetof(CPUARMState, vfp.regs[regno * 2]);
+}
+
 /* Return the offset into CPUARMState of an element of specified
  * size, 'element' places in from the least significant end of
  * the FP/vector register Qn.
@@ -1789,7 +1799,8 @@ static void disas_uncond_b_reg(DisasContext *s, uint32_t insn)
             return;
         }
         gen_helper_exception_return(cpu_env);
-        s->is_jmp = DISAS_JUMP;
+        /* Must exit to the main loop to check for unmasked interrupts */
+        s->is_jmp = DISAS_EXIT;
         return;
     case 5: /* DRPS */
         if (rn != 0x1f) {
@@ -9064,12 +9075,37 @@ static void disas_simd_3same_logic(DisasContext *s, uint32_t insn)
     bool is_u = extract32(insn, 29, 1);
     bool is_q = extract32(insn, 30, 1);
     TCGv_i64 tcg_op1, tcg_op2, tcg_res[2];
+    void (*gvec_fn)(unsigned, uint32_t, uint32_t, uint32_t,
+                    uint32_t, uint32_t) = NULL;
     int pass;
 
     if (!fp_access_check(s)) {
         return;
     }
 
+    /* The simple bitwise operations are expanded as whole vectors;
+     * a 64-bit operation clears the high half of the destination.
+     */
+    switch (size + 4 * is_u) {
+    case 0: /* AND */
+        gvec_fn = tcg_gen_gvec_and;
+        break;
+    case 1: /* BIC */
+        gvec_fn = tcg_gen_gvec_andc;
+        break;
+    case 2: /* ORR */
+        gvec_fn = tcg_gen_gvec_or;
+        break;
+    case 4: /* EOR */
+        gvec_fn = tcg_gen_gvec_xor;
+        break;
+    }
+    if (gvec_fn) {
+        gvec_fn(MO_64, vec_full_reg_offset(s, rd), vec_full_reg_offset(s, rn),
+                vec_full_reg_offset(s, rm), is_q ? 16 : 8, 16);
+        return;
+    }
+
     tcg_op1 = tcg_temp_new_i64();
     tcg_op2 = tcg_temp_new_i64();
     tcg_res[0] = tcg_temp_new_i64();
@@ -9432,6 +9468,30 @@ static void disas_simd_3same_int(DisasContext *s, uint32_t insn)
         return;
     }
 
+    switch (opcode) {
+    case 0x10: /* ADD, SUB */
+        (u ? tcg_gen_gvec_sub : tcg_gen_gvec_add)
+            (size, vec_full_reg_offset(s, rd), vec_full_reg_offset(s, rn),
+             vec_full_reg_offset(s, rm), is_q ? 16 : 8, 16);
+        return;
+    case 0x6: /* CMGT, CMHI */
+    case 0x7: /* CMGE, CMHS */
+    case 0x11: /* CMTST, CMEQ */
+        if (opcode != 0x11 || u) {
+            static const TCGCond conds[2][2] = {
+                { TCG_COND_GT, TCG_COND_GE },
+                { TCG_COND_GTU, TCG_COND_GEU },
+            };
+            TCGCond cond = opcode == 0x11 ? TCG_COND_EQ : conds[u][opcode & 1];
+
+            tcg_gen_gvec_cmp(cond, size, vec_full_reg_offset(s, rd),
+                             vec_full_reg_offset(s, rn),
+                             vec_full_reg_offset(s, rm), is_q ? 16 : 8, 16);
+            return;
+        }
+        break;
+    }
+
     if (size == 3) {
         assert(is_q);
         for (pass = 0; pass < 2; pass++) {
@@ -11367,7 +11427,7 @@ void gen_intermediate_code_a64(ARMCPU *cpu, TranslationBlock *tb)
          * (and thus a tb-jump is not possible when singlestepping).
          */
         assert(dc->is_jmp != DISAS_TB_JUMP);
-        if (dc->is_jmp != DISAS_JUMP) {
+        if (dc->is_jmp != DISAS_JUMP && dc->is_jmp != DISAS_EXIT) {
             gen_a64_set_pc_im(dc->pc);
         }
         if (cs->singlestep_enabled) {
@@ -11384,10 +11444,16 @@ void gen_intermediate_code_a64(ARMCPU *cpu, TranslationBlock *tb)
         case DISAS_UPDATE:
             gen_a64_set_pc_im(dc->pc);
             /* fall through */
-        case DISAS_JUMP:
+        case DISAS_EXIT:
             /* indicate that the hash table must be used to find the next TB */
             tcg_gen_exit_tb(0);
             break;
+        case DISAS_JUMP:
+            /* look up the next TB and jump to it without leaving the
+             * generated code, if possible
+             */
+            tcg_gen_lookup_and_goto_ptr();
+            break;
         case DISAS_TB_JUMP:
         case DISAS_EXC:
         case DISAS_SWI:
@@ -120,6 +120,11 @@ static inline int default_exception_el(DisasContext *s)
 #define DISAS_HVC 8
 #define DISAS_SMC 9
 #define DISAS_YIELD 10
+/* Exit the TB and return to the main loop rather than looking up the
+ * next TB, e.g. after a change to the interrupt masks.  The PC has
+ * already been written.
+ */
+#define DISAS_EXIT 11
 
 #ifdef TARGET_AARCH64
 void a64_translate_init(void);
@@ -411,23 +411,11 @@ void helper_idivq_EAX(CPUX86State *env, target_ulong t0)
 
 #if TARGET_LONG_BITS == 32
 # define ctztl  ctz32
-# define clztl  clz32
 #else
 # define ctztl  ctz64
-# define clztl  clz64
 #endif
 
 /* bit operations */
-target_ulong helper_ctz(target_ulong t0)
-{
-    return ctztl(t0);
-}
-
-target_ulong helper_clz(target_ulong t0)
-{
-    return clztl(t0);
-}
-
 target_ulong helper_pdep(target_ulong src, target_ulong mask)
 {
     target_ulong dest = 0;
@@ -23,6 +23,7 @@
 #include "exec/exec-all.h"
 #include "exec/cpu_ldst.h"
 #include "exec/address-spaces.h"
+#include "qemu/main-loop.h"
 
 void helper_outb(CPUX86State *env, uint32_t port, uint32_t data)
 {
@@ -132,7 +133,9 @@ target_ulong helper_read_crN(CPUX86State *env, int reg)
         break;
     case 8:
         if (!(env->hflags2 & HF2_VINTR_MASK)) {
+            qemu_mutex_lock_iothread();
             val = cpu_get_apic_tpr(x86_env_get_cpu(env)->apic_state);
+            qemu_mutex_unlock_iothread();
         } else {
             val = env->v_tpr;
         }
@@ -156,7 +159,9 @@ void helper_write_crN(CPUX86State *env, int reg, target_ulong t0)
         break;
     case 8:
         if (!(env->hflags2 & HF2_VINTR_MASK)) {
+            qemu_mutex_lock_iothread();
             cpu_set_apic_tpr(x86_env_get_cpu(env)->apic_state, t0);
+            qemu_mutex_unlock_iothread();
         }
         env->v_tpr = t0 & 0x0f;
         break;
@@ -244,7 +249,9 @@ void helper_wrmsr(CPUX86State *env)
         env->sysenter_eip = val;
         break;
     case MSR_IA32_APICBASE:
+        qemu_mutex_lock_iothread();
         cpu_set_apic_base(x86_env_get_cpu(env)->apic_state, val);
+        qemu_mutex_unlock_iothread();
         break;
     case MSR_EFER:
         {
@@ -401,7 +408,9 @@ void helper_rdmsr(CPUX86State *env)
         val = env->sysenter_eip;
         break;
     case MSR_IA32_APICBASE:
+        qemu_mutex_lock_iothread();
         val = cpu_get_apic_base(x86_env_get_cpu(env)->apic_state);
+        qemu_mutex_unlock_iothread();
         break;
     case MSR_EFER:
         val = env->efer;
@@ -39,7 +39,7 @@ static void mmu_flush_idx(CPUMBState *env, unsigned int idx)
     CPUState *cs = CPU(mb_env_get_cpu(env));
     struct microblaze_mmu *mmu = &env->mmu;
     unsigned int tlb_size;
-    uint32_t tlb_tag, end, t;
+    uint32_t tlb_tag, t;
 
     t = mmu->rams[RAM_TAG][idx];
     if (!(t & TLB_VALID))
@@ -47,12 +47,8 @@ static void mmu_flush_idx(CPUMBState *env, unsigned int idx)
 
     tlb_tag = t & TLB_EPN_MASK;
     tlb_size = tlb_decode_size((t & TLB_PAGESZ_MASK) >> 7);
-    end = tlb_tag + tlb_size;
 
-    while (tlb_tag < end) {
-        tlb_flush_page(cs, tlb_tag);
-        tlb_tag += TARGET_PAGE_SIZE;
-    }
+    tlb_flush_range(cs, tlb_tag, tlb_size);
 }
 
 static void mmu_change_pid(CPUMBState *env, unsigned int newpid) 
@@ -929,10 +929,7 @@ void r4k_invalidate_tlb (CPUMIPSState *env, int idx, int use_extra)
         }
 #endif
         end = addr | (mask >> 1);
-        while (addr < end) {
-            tlb_flush_page(cs, addr);
-            addr += TARGET_PAGE_SIZE;
-        }
+        tlb_flush_range(cs, addr, end - addr + 1);
     }
     if (tlb->V1) {
         cs = CPU(cpu);
@@ -943,10 +940,7 @@ void r4k_invalidate_tlb (CPUMIPSState *env, int idx, int use_extra)
         }
 #endif
         end = addr | mask;
-        while (addr - 1 < end) {
-            tlb_flush_page(cs, addr);
-            addr += TARGET_PAGE_SIZE;
-        }
+        tlb_flush_range(cs, addr, end - addr + 1);
     }
 }
 #endif
@@ -44,11 +44,7 @@ static void openrisc_cpu_reset(CPUState *s)
 
     occ->parent_reset(s);
 
-#ifndef CONFIG_USER_ONLY
-    memset(&cpu->env, 0, offsetof(CPUOpenRISCState, tlb));
-#else
-    memset(&cpu->env, 0, offsetof(CPUOpenRISCState, irq));
-#endif
+    memset(&cpu->env, 0, offsetof(CPUOpenRISCState, end_reset_fields));
 
     tlb_flush(s, 1);
     /*tb_flush(&cpu->env);    FIXME: Do we need it?  */
@@ -27,6 +27,10 @@
 #include "exec/helper-proto.h"
 #include "exec/cpu_ldst.h"
 #include "exec/exec-all.h"
+#include "exec/tb-hash.h"
+#include "disas/disas.h"
+#include "exec/log.h"
+#include "tcg.h"
 
 /* 32-bit helpers */
 
@@ -50,6 +54,21 @@ uint32_t HELPER(remu_i32)(uint32_t arg1, uint32_t arg2)
     return arg1 % arg2;
 }
 
+uint32_t HELPER(clz_i32)(uint32_t arg, uint32_t zero_val)
+{
+    return arg ? clz32(arg) : zero_val;
+}
+
+uint32_t HELPER(ctz_i32)(uint32_t arg, uint32_t zero_val)
+{
+    return arg ? ctz32(arg) : zero_val;
+}
+
+uint32_t HELPER(ctpop_i32)(uint32_t arg)
+{
+    return ctpop32(arg);
+}
+
 /* 64-bit helpers */
 
 uint64_t HELPER(shl_i64)(uint64_t arg1, uint64_t arg2)
@@ -101,6 +120,21 @@ int64_t HELPER(mulsh_i64)(int64_t arg1, int64_t arg2)
     return h;
 }
 
+uint64_t HELPER(clz_i64)(uint64_t arg, uint64_t zero_val)
+{
+    return arg ? clz64(arg) : zero_val;
+}
+
+uint64_t HELPER(ctz_i64)(uint64_t arg, uint64_t zero_val)
+{
+    return arg ? ctz64(arg) : zero_val;
+}
+
+uint64_t HELPER(ctpop_i64)(uint64_t arg)
+{
+    return ctpop64(arg);
+}
+
 void HELPER(exit_atomic)(CPUArchState *env)
 {
     cpu_loop_exit_atomic(ENV_GET_CPU(env), GETPC());
@@ -159,3 +193,36 @@ static void *atomic_mmu_lookup(CPUArchState *env, target_ulong addr,
 #endif /* CONFIG_ATOMIC128 */
 
 #endif /* !CONFIG_SOFTMMU */
+
+/* Look up the TB for the current CPU state, for goto_ptr.  Only TBs that
+ * are already in the hash table are used; anything else, including a TB
+ * that still has to be translated, goes back to the main loop.
+ */
+void *HELPER(lookup_tb_ptr)(CPUArchState *env)
+{
+    CPUState *cpu = ENV_GET_CPU(env);
+    TranslationBlock *tb;
+    target_ulong cs_base, pc;
+    uint32_t flags, addr_hash;
+
+    cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    addr_hash = tb_jmp_cache_hash_func(pc);
+    tb = atomic_rcu_read(&cpu->tb_jmp_cache[addr_hash]);
+
+    if (unlikely(!(tb
+                   && tb->pc == pc
+                   && tb->cs_base == cs_base
+                   && tb->flags == flags
+                   && !atomic_read(&tb->invalid)))) {
+        tb = tb_htable_lookup(cpu, pc, cs_base, flags);
+        if (!tb) {
+            return tcg_ctx->code_gen_epilogue;
+        }
+        atomic_set(&cpu->tb_jmp_cache[addr_hash], tb);
+    }
+
+    qemu_log_mask_and_addr(CPU_LOG_EXEC, pc,
+                           "Chain %p [" TARGET_FMT_lx "] %s\n",
+                           tb->tc_ptr, pc, lookup_symbol(pc));
+    return tb->tc_ptr;
+}
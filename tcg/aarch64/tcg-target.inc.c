@@ -11,6 +11,7 @@
  */
 
 #include "tcg-be-ldst.h"
+#include "tcg-be-pool.h"
 #include "qemu/bitops.h"
 
 /* We're going to re-use TCGType in setting of the SF bit, which controls
@@ -24,6 +25,10 @@ static const char * const tcg_target_reg_names[TCG_TARGET_NB_REGS] = {
     "%x8", "%x9", "%x10", "%x11", "%x12", "%x13", "%x14", "%x15",
     "%x16", "%x17", "%x18", "%x19", "%x20", "%x21", "%x22", "%x23",
     "%x24", "%x25", "%x26", "%x27", "%x28", "%fp", "%x30", "%sp",
+    "%v0", "%v1", "%v2", "%v3", "%v4", "%v5", "%v6", "%v7",
+    "%v8", "%v9", "%v10", "%v11", "%v12", "%v13", "%v14", "%v15",
+    "%v16", "%v17", "%v18", "%v19", "%v20", "%v21", "%v22", "%v23",
+    "%v24", "%v25", "%v26", "%v27", "%v28", "%v29", "%v30", "%v31",
 };
 #endif /* CONFIG_DEBUG_TCG */
 
@@ -39,10 +44,19 @@ static const int tcg_target_reg_alloc_order[] = {
     TCG_REG_X0, TCG_REG_X1, TCG_REG_X2, TCG_REG_X3,
     TCG_REG_X4, TCG_REG_X5, TCG_REG_X6, TCG_REG_X7,
 
+    TCG_REG_V16, TCG_REG_V17, TCG_REG_V18, TCG_REG_V19,
+    TCG_REG_V20, TCG_REG_V21, TCG_REG_V22, TCG_REG_V23,
+    TCG_REG_V24, TCG_REG_V25, TCG_REG_V26, TCG_REG_V27,
+    TCG_REG_V28, TCG_REG_V29, TCG_REG_V30, TCG_REG_V31,
+    TCG_REG_V0, TCG_REG_V1, TCG_REG_V2, TCG_REG_V3,
+    TCG_REG_V4, TCG_REG_V5, TCG_REG_V6, TCG_REG_V7,
+
     /* X18 reserved by system */
     /* X19 reserved for AREG0 */
     /* X29 reserved as fp */
     /* X30 reserved as temporary */
+    /* V8-V15 not used: the ABI preserves their low halves, which the
+       prologue does not save */
 };
 
 static const int tcg_target_call_iarg_regs[8] = {
@@ -102,6 +116,7 @@ static inline void patch_reloc(tcg_insn_unit *code_ptr, int type,
         reloc_pc26(code_ptr, (tcg_insn_unit *)value);
         break;
     case R_AARCH64_CONDBR19:
+    case R_AARCH64_LD_PREL_LO19:
         reloc_pc19(code_ptr, (tcg_insn_unit *)value);
         break;
     default:
@@ -114,6 +129,10 @@ static inline void patch_reloc(tcg_insn_unit *code_ptr, int type,
 #define TCG_CT_CONST_ZERO 0x400
 #define TCG_CT_CONST_MONE 0x800
 
+#define ALL_GENERAL_REGS  0xffffffffu
+/* V0-V7 and V16-V31, see tcg_target_reg_alloc_order.  */
+#define ALL_VECTOR_REGS   0xffff00ffull
+
 /* parse target specific constraints */
 static int target_parse_constraint(TCGArgConstraint *ct,
                                    const char **pct_str)
@@ -123,11 +142,15 @@ static int target_parse_constraint(TCGArgConstraint *ct,
     switch (ct_str[0]) {
     case 'r':
         ct->ct |= TCG_CT_REG;
-        tcg_regset_set32(ct->u.regs, 0, (1ULL << TCG_TARGET_NB_REGS) - 1);
+        tcg_regset_set32(ct->u.regs, 0, ALL_GENERAL_REGS);
+        break;
+    case 'w':
+        ct->ct |= TCG_CT_REG;
+        tcg_regset_set32(ct->u.regs, TCG_REG_V0, ALL_VECTOR_REGS);
         break;
     case 'l': /* qemu_ld / qemu_st address, data_reg */
         ct->ct |= TCG_CT_REG;
-        tcg_regset_set32(ct->u.regs, 0, (1ULL << TCG_TARGET_NB_REGS) - 1);
+        tcg_regset_set32(ct->u.regs, 0, ALL_GENERAL_REGS);
 #ifdef CONFIG_SOFTMMU
         /* x0 and x1 will be overwritten when reading the tlb entry,
            and x2, and x3 for helper args, better to avoid using them. */
@@ -274,6 +297,9 @@ typedef enum {
     I3207_BLR       = 0xd63f0000,
     I3207_RET       = 0xd65f0000,
 
+    /* Load literal.  */
+    I3305_LDR       = 0x58000000,
+
     /* Load/store register.  Described here as 3.3.12, but the helper
        that emits them can transform to 3.3.10 or 3.3.13.  */
     I3312_STRB      = 0x38000000 | LDST_ST << 22 | MO_8 << 30,
@@ -293,6 +319,13 @@ typedef enum {
     I3312_LDRSHX    = 0x38000000 | LDST_LD_S_X << 22 | MO_16 << 30,
     I3312_LDRSWX    = 0x38000000 | LDST_LD_S_X << 22 | MO_32 << 30,
 
+    /* The SIMD&FP variants set bit 26; 128-bit accesses use size 0 and
+       the two upper opc values.  */
+    I3312_LDRVD     = 0x3c000000 | LDST_LD << 22 | MO_64 << 30,
+    I3312_STRVD     = 0x3c000000 | LDST_ST << 22 | MO_64 << 30,
+    I3312_LDRVQ     = 0x3c000000 | 3 << 22 | 0 << 30,
+    I3312_STRVQ     = 0x3c000000 | 2 << 22 | 0 << 30,
+
     I3312_TO_I3310  = 0x00200800,
     I3312_TO_I3313  = 0x01000000,
 
@@ -373,7 +406,29 @@ typedef enum {
     I3510_EON       = 0x4a200000,
     I3510_ANDS      = 0x6a000000,
 
+    /* Logical shifted register instructions (with a shift).  */
+    I3502S_AND_LSR  = I3510_AND | (1 << 22),
+
+    /* AdvSIMD three same.  */
+    I3616_ADD       = 0x0e208400,
+    I3616_AND       = 0x0e201c00,
+    I3616_BIC       = 0x0e601c00,
+    I3616_EOR       = 0x2e201c00,
+    I3616_ORR       = 0x0ea01c00,
+    I3616_SUB       = 0x2e208400,
+    I3616_CMEQ      = 0x2e208c00,
+    I3616_CMGT      = 0x0e203400,
+
+    /* AdvSIMD shift by immediate.  */
+    I3614_SHL       = 0x0f005400,
+    I3614_SSHR      = 0x0f000400,
+    I3614_USHR      = 0x2f000400,
+
+    /* AdvSIMD copy.  */
+    I3605_DUP       = 0x0e000c00,
+
     /* System instructions.  */
+    NOP             = 0xd503201f,
     DMB_ISH         = 0xd50338bf,
     DMB_LD          = 0x00000100,
     DMB_ST          = 0x00000200,
@@ -411,6 +466,12 @@ static void tcg_out_insn_3207(TCGContext *s, AArch64Insn insn, TCGReg rn)
     tcg_out32(s, insn | rn << 5);
 }
 
+static void tcg_out_insn_3305(TCGContext *s, AArch64Insn insn,
+                              int imm19, TCGReg rt)
+{
+    tcg_out32(s, insn | (imm19 & 0x7ffff) << 5 | rt);
+}
+
 static void tcg_out_insn_3314(TCGContext *s, AArch64Insn insn,
                               TCGReg r1, TCGReg r2, TCGReg rn,
                               tcg_target_long ofs, bool pre, bool w)
@@ -513,26 +574,51 @@ static void tcg_out_insn_3509(TCGContext *s, AArch64Insn insn, TCGType ext,
     tcg_out32(s, insn | ext << 31 | rm << 16 | ra << 10 | rn << 5 | rd);
 }
 
+/* RD may be a vector register in the load/store formats, hence the
+   masking.  */
 static void tcg_out_insn_3310(TCGContext *s, AArch64Insn insn,
                               TCGReg rd, TCGReg base, TCGType ext,
                               TCGReg regoff)
 {
     /* Note the AArch64Insn constants above are for C3.3.12.  Adjust.  */
     tcg_out32(s, insn | I3312_TO_I3310 | regoff << 16 |
-              0x4000 | ext << 13 | base << 5 | rd);
+              0x4000 | ext << 13 | base << 5 | (rd & 31));
 }
 
 static void tcg_out_insn_3312(TCGContext *s, AArch64Insn insn,
                               TCGReg rd, TCGReg rn, intptr_t offset)
 {
-    tcg_out32(s, insn | (offset & 0x1ff) << 12 | rn << 5 | rd);
+    tcg_out32(s, insn | (offset & 0x1ff) << 12 | rn << 5 | (rd & 31));
 }
 
 static void tcg_out_insn_3313(TCGContext *s, AArch64Insn insn,
                               TCGReg rd, TCGReg rn, uintptr_t scaled_uimm)
 {
     /* Note the AArch64Insn constants above are for C3.3.12.  Adjust.  */
-    tcg_out32(s, insn | I3312_TO_I3313 | scaled_uimm << 10 | rn << 5 | rd);
+    tcg_out32(s, insn | I3312_TO_I3313 | scaled_uimm << 10 | rn << 5
+              | (rd & 31));
+}
+
+static void tcg_out_insn_3605(TCGContext *s, AArch64Insn insn, bool q,
+                              TCGReg rd, TCGReg rn, unsigned vece)
+{
+    /* imm5 encodes the element size as its lowest set bit.  */
+    tcg_out32(s, insn | q << 30 | (1 << vece) << 16
+              | (rn & 31) << 5 | (rd & 31));
+}
+
+static void tcg_out_insn_3614(TCGContext *s, AArch64Insn insn, bool q,
+                              TCGReg rd, TCGReg rn, unsigned immhb)
+{
+    tcg_out32(s, insn | q << 30 | immhb << 16
+              | (rn & 31) << 5 | (rd & 31));
+}
+
+static void tcg_out_insn_3616(TCGContext *s, AArch64Insn insn, bool q,
+                              unsigned size, TCGReg rd, TCGReg rn, TCGReg rm)
+{
+    tcg_out32(s, insn | q << 30 | size << 22 | (rm & 31) << 16
+              | (rn & 31) << 5 | (rd & 31));
 }
 
 /* Register to register move using ORR (shifted register with no shift). */
@@ -582,7 +668,7 @@ static void tcg_out_movi(TCGContext *s, TCGType type, TCGReg rd,
                          tcg_target_long value)
 {
     AArch64Insn insn;
-    int i, wantinv, shift;
+    int i, zeros, ones, wantinv, shift;
     tcg_target_long svalue = value;
     tcg_target_long ivalue = ~value;
     tcg_target_long imask;
@@ -631,16 +717,26 @@ static void tcg_out_movi(TCGContext *s, TCGType type, TCGReg rd,
 
     /* Would it take fewer insns to begin with MOVN?  For the value and its
        inverse, count the number of 16-bit lanes that are 0.  */
-    for (i = wantinv = imask = 0; i < 64; i += 16) {
+    for (i = zeros = ones = imask = 0; i < 64; i += 16) {
         tcg_target_long mask = 0xffffull << i;
         if ((value & mask) == 0) {
-            wantinv -= 1;
+            zeros++;
         }
         if ((ivalue & mask) == 0) {
-            wantinv += 1;
+            ones++;
             imask |= mask;
         }
     }
+    wantinv = ones - zeros;
+
+    /* A sequence of more than two insns is both larger and slower than
+       a load from the constant pool, which also shares the value between
+       all its uses in the TB.  */
+    if (type == TCG_TYPE_I64 && MAX(zeros, ones) < 2) {
+        new_pool_label(s, value, R_AARCH64_LD_PREL_LO19, s->code_ptr, 0);
+        tcg_out_insn(s, 3305, LDR, 0, rd);
+        return;
+    }
 
     /* If we had more 0xffff than 0x0000, invert VALUE and use MOVN.  */
     insn = I3405_MOVZ;
@@ -670,6 +766,14 @@ static void tcg_out_movi(TCGContext *s, TCGType type, TCGReg rd,
     }
 }
 
+static void tcg_out_nop_fill(tcg_insn_unit *p, int count)
+{
+    int i;
+    for (i = 0; i < count; ++i) {
+        p[i] = NOP;
+    }
+}
+
 /* Define something more legible for general use.  */
 #define tcg_out_ldst_r  tcg_out_insn_3310
 
@@ -678,6 +782,10 @@ static void tcg_out_ldst(TCGContext *s, AArch64Insn insn,
 {
     TCGMemOp size = (uint32_t)insn >> 30;
 
+    if (insn == I3312_LDRVQ || insn == I3312_STRVQ) {
+        size = 4;
+    }
+
     /* If the offset is naturally aligned and in range, then we can
        use the scaled uimm12 encoding */
     if (offset >= 0 && !(offset & ((1 << size) - 1))) {
@@ -702,23 +810,63 @@ static void tcg_out_ldst(TCGContext *s, AArch64Insn insn,
 static inline void tcg_out_mov(TCGContext *s,
                                TCGType type, TCGReg ret, TCGReg arg)
 {
-    if (ret != arg) {
+    if (ret == arg) {
+        return;
+    }
+    switch (type) {
+    case TCG_TYPE_V64:
+    case TCG_TYPE_V128:
+        /* MOV Vd.16B, Vn.16B is an alias of ORR.  */
+        tcg_out_insn(s, 3616, ORR, true, 0, ret, arg, arg);
+        break;
+    default:
         tcg_out_movr(s, type, ret, arg);
+        break;
     }
 }
 
 static inline void tcg_out_ld(TCGContext *s, TCGType type, TCGReg arg,
                               TCGReg arg1, intptr_t arg2)
 {
-    tcg_out_ldst(s, type == TCG_TYPE_I32 ? I3312_LDRW : I3312_LDRX,
-                 arg, arg1, arg2);
+    AArch64Insn insn;
+
+    switch (type) {
+    case TCG_TYPE_I32:
+        insn = I3312_LDRW;
+        break;
+    case TCG_TYPE_V64:
+        insn = I3312_LDRVD;
+        break;
+    case TCG_TYPE_V128:
+        insn = I3312_LDRVQ;
+        break;
+    default:
+        insn = I3312_LDRX;
+        break;
+    }
+    tcg_out_ldst(s, insn, arg, arg1, arg2);
 }
 
 static inline void tcg_out_st(TCGContext *s, TCGType type, TCGReg arg,
                               TCGReg arg1, intptr_t arg2)
 {
-    tcg_out_ldst(s, type == TCG_TYPE_I32 ? I3312_STRW : I3312_STRX,
-                 arg, arg1, arg2);
+    AArch64Insn insn;
+
+    switch (type) {
+    case TCG_TYPE_I32:
+        insn = I3312_STRW;
+        break;
+    case TCG_TYPE_V64:
+        insn = I3312_STRVD;
+        break;
+    case TCG_TYPE_V128:
+        insn = I3312_STRVQ;
+        break;
+    default:
+        insn = I3312_STRX;
+        break;
+    }
+    tcg_out_ldst(s, insn, arg, arg1, arg2);
 }
 
 static inline bool tcg_out_sti(TCGContext *s, TCGType type, TCGArg val,
@@ -1090,21 +1238,47 @@ static void add_qemu_ldst_label(TCGContext *s, bool is_ld, TCGMemOpIdx oi,
 /* Load and compare a TLB entry, emitting the conditional jump to the
    slow path for the failure case, which will be patched later when finalizing
    the slow path. Generated code returns the host addend in X1,
-   clobbers X0,X2,X3,TMP. */
+   clobbers X0,X3,TMP. */
 static void tcg_out_tlb_read(TCGContext *s, TCGReg addr_reg, TCGMemOp opc,
                              tcg_insn_unit **label_ptr, int mem_index,
                              bool is_read)
 {
-    int tlb_offset = is_read ?
-        offsetof(CPUArchState, tlb_table[mem_index][0].addr_read)
-        : offsetof(CPUArchState, tlb_table[mem_index][0].addr_write);
+    int mask_ofs = offsetof(CPUArchState, tlb_mask[mem_index]);
+    int table_ofs = offsetof(CPUArchState, tlb_table[mem_index]);
     unsigned a_bits = get_alignment_bits(opc);
     unsigned s_bits = opc & MO_SIZE;
     unsigned a_mask = (1u << a_bits) - 1;
     unsigned s_mask = (1u << s_bits) - 1;
-    TCGReg base = TCG_AREG0, x3;
+    TCGType mask_type;
+    TCGReg x3;
     uint64_t tlb_mask;
 
+    mask_type = (TARGET_PAGE_BITS + CPU_TLB_DYN_MAX_BITS > 32
+                 ? TCG_TYPE_I64 : TCG_TYPE_I32);
+
+    /* Load tlb_mask[mem_index] into X0 and tlb_table[mem_index] into X1.  */
+    tcg_out_ldst(s, I3312_LDRX, TCG_REG_X0, TCG_AREG0, mask_ofs);
+    tcg_out_ldst(s, I3312_LDRX, TCG_REG_X1, TCG_AREG0, table_ofs);
+
+    /* Extract the TLB index from the address into X0, already scaled
+       to a byte offset.
+       X0 = (addr_reg >> (TARGET_PAGE_BITS - CPU_TLB_ENTRY_BITS)) & X0 */
+    tcg_out_insn(s, 3502S, AND_LSR, mask_type == TCG_TYPE_I64,
+                 TCG_REG_X0, TCG_REG_X0, addr_reg,
+                 TARGET_PAGE_BITS - CPU_TLB_ENTRY_BITS);
+
+    /* Add the tlb_table pointer, creating the CPUTLBEntry address in X1.  */
+    tcg_out_insn(s, 3502, ADD, TCG_TYPE_I64, TCG_REG_X1, TCG_REG_X1,
+                 TCG_REG_X0);
+
+    /* Load the tlb comparator into X0, and the fast path addend into X1.  */
+    tcg_out_ldst(s, TARGET_LONG_BITS == 32 ? I3312_LDRW : I3312_LDRX,
+                 TCG_REG_X0, TCG_REG_X1,
+                 is_read ? offsetof(CPUTLBEntry, addr_read)
+                 : offsetof(CPUTLBEntry, addr_write));
+    tcg_out_ldst(s, I3312_LDRX, TCG_REG_X1, TCG_REG_X1,
+                 offsetof(CPUTLBEntry, addend));
+
     /* For aligned accesses, we check the first byte and include the alignment
        bits within the address.  For unaligned access, we check that we don't
        cross pages using the address of the last byte of the access.  */
@@ -1117,42 +1291,10 @@ static void tcg_out_tlb_read(TCGContext *s, TCGReg addr_reg, TCGMemOp opc,
     }
     tlb_mask = (uint64_t)TARGET_PAGE_MASK | a_mask;
 
-    /* Extract the TLB index from the address into X0.
-       X0<CPU_TLB_BITS:0> =
-       addr_reg<TARGET_PAGE_BITS+CPU_TLB_BITS:TARGET_PAGE_BITS> */
-    tcg_out_ubfm(s, TARGET_LONG_BITS == 64, TCG_REG_X0, addr_reg,
-                 TARGET_PAGE_BITS, TARGET_PAGE_BITS + CPU_TLB_BITS);
-
     /* Store the page mask part of the address into X3.  */
     tcg_out_logicali(s, I3404_ANDI, TARGET_LONG_BITS == 64,
                      TCG_REG_X3, x3, tlb_mask);
 
-    /* Add any "high bits" from the tlb offset to the env address into X2,
-       to take advantage of the LSL12 form of the ADDI instruction.
-       X2 = env + (tlb_offset & 0xfff000) */
-    if (tlb_offset & 0xfff000) {
-        tcg_out_insn(s, 3401, ADDI, TCG_TYPE_I64, TCG_REG_X2, base,
-                     tlb_offset & 0xfff000);
-        base = TCG_REG_X2;
-    }
-
-    /* Merge the tlb index contribution into X2.
-       X2 = X2 + (X0 << CPU_TLB_ENTRY_BITS) */
-    tcg_out_insn(s, 3502S, ADD_LSL, TCG_TYPE_I64, TCG_REG_X2, base,
-                 TCG_REG_X0, CPU_TLB_ENTRY_BITS);
-
-    /* Merge "low bits" from tlb offset, load the tlb comparator into X0.
-       X0 = load [X2 + (tlb_offset & 0x000fff)] */
-    tcg_out_ldst(s, TARGET_LONG_BITS == 32 ? I3312_LDRW : I3312_LDRX,
-                 TCG_REG_X0, TCG_REG_X2, tlb_offset & 0xfff);
-
-    /* Load the tlb addend. Do that early to avoid stalling.
-       X1 = load [X2 + (tlb_offset & 0xfff) + offsetof(addend)] */
-    tcg_out_ldst(s, I3312_LDRX, TCG_REG_X1, TCG_REG_X2,
-                 (tlb_offset & 0xfff) + (offsetof(CPUTLBEntry, addend)) -
-                 (is_read ? offsetof(CPUTLBEntry, addr_read)
-                  : offsetof(CPUTLBEntry, addr_write)));
-
     /* Perform the address comparison. */
     tcg_out_cmp(s, (TARGET_LONG_BITS == 64), TCG_REG_X0, TCG_REG_X3, 0);
 
@@ -1307,6 +1449,106 @@ static void tcg_out_qemu_st(TCGContext *s, TCGReg data_reg, TCGReg addr_reg,
 
 static tcg_insn_unit *tb_ret_addr;
 
+bool tcg_can_emit_vec_op(TCGOpcode opc, TCGType type, unsigned vece)
+{
+    switch (opc) {
+    case INDEX_op_ld_vec:
+    case INDEX_op_st_vec:
+    case INDEX_op_and_vec:
+    case INDEX_op_or_vec:
+    case INDEX_op_xor_vec:
+    case INDEX_op_andc_vec:
+        return true;
+    case INDEX_op_dup_vec:
+    case INDEX_op_add_vec:
+    case INDEX_op_sub_vec:
+    case INDEX_op_shli_vec:
+    case INDEX_op_shri_vec:
+    case INDEX_op_sari_vec:
+    case INDEX_op_cmp_vec:
+        /* The 1D arrangement is reserved.  */
+        return type == TCG_TYPE_V128 || vece != MO_64;
+    default:
+        return false;
+    }
+}
+
+static void tcg_out_vec_op(TCGContext *s, TCGOpcode opc,
+                           const TCGArg *args)
+{
+    /* Most operations have the vector length and element size as their
+       two last arguments, after two inputs.  */
+    TCGReg a0 = args[0];
+    TCGReg a1 = args[1];
+    TCGReg a2 = args[2];
+    bool q = args[3] != 0;
+    unsigned vece = args[4];
+    unsigned esize = 8 << vece;
+
+    switch (opc) {
+    case INDEX_op_ld_vec:
+        tcg_out_ld(s, TCG_TYPE_V64 + args[3], a0, a1, args[2]);
+        break;
+    case INDEX_op_st_vec:
+        tcg_out_st(s, TCG_TYPE_V64 + args[3], a0, a1, args[2]);
+        break;
+    case INDEX_op_dup_vec:
+        tcg_out_insn(s, 3605, DUP, args[2] != 0, a0, a1, args[3]);
+        break;
+    case INDEX_op_add_vec:
+        tcg_out_insn(s, 3616, ADD, q, vece, a0, a1, a2);
+        break;
+    case INDEX_op_sub_vec:
+        tcg_out_insn(s, 3616, SUB, q, vece, a0, a1, a2);
+        break;
+    case INDEX_op_and_vec:
+        tcg_out_insn(s, 3616, AND, q, 0, a0, a1, a2);
+        break;
+    case INDEX_op_or_vec:
+        tcg_out_insn(s, 3616, ORR, q, 0, a0, a1, a2);
+        break;
+    case INDEX_op_xor_vec:
+        tcg_out_insn(s, 3616, EOR, q, 0, a0, a1, a2);
+        break;
+    case INDEX_op_andc_vec:
+        tcg_out_insn(s, 3616, BIC, q, 0, a0, a1, a2);
+        break;
+
+    case INDEX_op_shli_vec:
+        tcg_out_insn(s, 3614, SHL, q, a0, a1, esize + args[2]);
+        break;
+    case INDEX_op_shri_vec:
+    case INDEX_op_sari_vec:
+        if (args[2] == 0) {
+            /* A right shift by zero cannot be encoded.  */
+            tcg_out_insn(s, 3616, ORR, q, 0, a0, a1, a1);
+        } else if (opc == INDEX_op_shri_vec) {
+            tcg_out_insn(s, 3614, USHR, q, a0, a1, 2 * esize - args[2]);
+        } else {
+            tcg_out_insn(s, 3614, SSHR, q, a0, a1, 2 * esize - args[2]);
+        }
+        break;
+
+    case INDEX_op_cmp_vec:
+        q = args[4] != 0;
+        vece = args[5];
+        switch (args[3]) {
+        case TCG_COND_EQ:
+            tcg_out_insn(s, 3616, CMEQ, q, vece, a0, a1, a2);
+            break;
+        case TCG_COND_GT:
+            tcg_out_insn(s, 3616, CMGT, q, vece, a0, a1, a2);
+            break;
+        default:
+            tcg_abort();
+        }
+        break;
+
+    default:
+        tcg_abort();
+    }
+}
+
 static void tcg_out_op(TCGContext *s, TCGOpcode opc,
                        const TCGArg args[TCG_MAX_OP_ARGS],
                        const int const_args[TCG_MAX_OP_ARGS])
@@ -1344,6 +1586,10 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc,
         s->tb_jmp_reset_offset[a0] = tcg_current_code_size(s);
         break;
 
+    case INDEX_op_goto_ptr:
+        tcg_out_insn(s, 3207, BR, a0);
+        break;
+
     case INDEX_op_br:
         tcg_out_goto_label(s, arg_label(a0));
         break;
@@ -1670,6 +1916,22 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc,
         tcg_out_mb(s, a0);
         break;
 
+    case INDEX_op_ld_vec:
+    case INDEX_op_st_vec:
+    case INDEX_op_dup_vec:
+    case INDEX_op_add_vec:
+    case INDEX_op_sub_vec:
+    case INDEX_op_and_vec:
+    case INDEX_op_or_vec:
+    case INDEX_op_xor_vec:
+    case INDEX_op_andc_vec:
+    case INDEX_op_shli_vec:
+    case INDEX_op_shri_vec:
+    case INDEX_op_sari_vec:
+    case INDEX_op_cmp_vec:
+        tcg_out_vec_op(s, opc, args);
+        break;
+
     case INDEX_op_mov_i32:  /* Always emitted via tcg_out_mov.  */
     case INDEX_op_mov_i64:
     case INDEX_op_movi_i32: /* Always emitted via tcg_out_movi.  */
@@ -1685,6 +1947,7 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc,
 static const TCGTargetOpDef aarch64_op_defs[] = {
     { INDEX_op_exit_tb, { } },
     { INDEX_op_goto_tb, { } },
+    { INDEX_op_goto_ptr, { "r" } },
     { INDEX_op_br, { } },
 
     { INDEX_op_ld8u_i32, { "r", "r" } },
@@ -1795,6 +2058,20 @@ static const TCGTargetOpDef aarch64_op_defs[] = {
     { INDEX_op_mulsh_i64, { "r", "r", "r" } },
 
     { INDEX_op_mb, { } },
+
+    { INDEX_op_ld_vec, { "w", "r" } },
+    { INDEX_op_st_vec, { "w", "r" } },
+    { INDEX_op_dup_vec, { "w", "r" } },
+    { INDEX_op_add_vec, { "w", "w", "w" } },
+    { INDEX_op_sub_vec, { "w", "w", "w" } },
+    { INDEX_op_and_vec, { "w", "w", "w" } },
+    { INDEX_op_or_vec, { "w", "w", "w" } },
+    { INDEX_op_xor_vec, { "w", "w", "w" } },
+    { INDEX_op_andc_vec, { "w", "w", "w" } },
+    { INDEX_op_shli_vec, { "w", "w" } },
+    { INDEX_op_shri_vec, { "w", "w" } },
+    { INDEX_op_sari_vec, { "w", "w" } },
+    { INDEX_op_cmp_vec, { "w", "w", "w" } },
     { -1 },
 };
 
@@ -1802,6 +2079,10 @@ static void tcg_target_init(TCGContext *s)
 {
     tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_I32], 0, 0xffffffff);
     tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_I64], 0, 0xffffffff);
+    tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_V64],
+                     TCG_REG_V0, ALL_VECTOR_REGS);
+    tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_V128],
+                     TCG_REG_V0, ALL_VECTOR_REGS);
 
     tcg_regset_set32(tcg_target_call_clobber_regs, 0,
                      (1 << TCG_REG_X0) | (1 << TCG_REG_X1) |
@@ -1814,6 +2095,8 @@ static void tcg_target_init(TCGContext *s)
                      (1 << TCG_REG_X14) | (1 << TCG_REG_X15) |
                      (1 << TCG_REG_X16) | (1 << TCG_REG_X17) |
                      (1 << TCG_REG_X18) | (1 << TCG_REG_X30));
+    tcg_regset_set32(tcg_target_call_clobber_regs,
+                     TCG_REG_V0, ALL_VECTOR_REGS);
 
     tcg_regset_clear(s->reserved_regs);
     tcg_regset_set_reg(s->reserved_regs, TCG_REG_SP);
@@ -1875,6 +2158,11 @@ static void tcg_target_qemu_prologue(TCGContext *s)
     tcg_out_mov(s, TCG_TYPE_PTR, TCG_AREG0, tcg_target_call_iarg_regs[0]);
     tcg_out_insn(s, 3207, BR, tcg_target_call_iarg_regs[1]);
 
+    /* Return path for goto_ptr.  Set return value to 0, a-la exit_tb,
+       and fall through to the rest of the epilogue.  */
+    s->code_gen_epilogue = s->code_ptr;
+    tcg_out_movi(s, TCG_TYPE_REG, TCG_REG_X0, 0);
+
     tb_ret_addr = s->code_ptr;
 
     /* Remove TCG locals stack space.  */
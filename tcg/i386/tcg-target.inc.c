@@ -29,6 +29,9 @@ static const char * const tcg_target_reg_names[TCG_TARGET_NB_REGS] = {
 #if TCG_TARGET_REG_BITS == 64
     "%rax", "%rcx", "%rdx", "%rbx", "%rsp", "%rbp", "%rsi", "%rdi",
     "%r8",  "%r9",  "%r10", "%r11", "%r12", "%r13", "%r14", "%r15",
+    "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5", "%xmm6", "%xmm7",
+    "%xmm8", "%xmm9", "%xmm10", "%xmm11",
+    "%xmm12", "%xmm13", "%xmm14", "%xmm15",
 #else
     "%eax", "%ecx", "%edx", "%ebx", "%esp", "%ebp", "%esi", "%edi",
 #endif
@@ -52,6 +55,22 @@ static const int tcg_target_reg_alloc_order[] = {
     TCG_REG_RSI,
     TCG_REG_RDI,
     TCG_REG_RAX,
+    TCG_REG_XMM0,
+    TCG_REG_XMM1,
+    TCG_REG_XMM2,
+    TCG_REG_XMM3,
+    TCG_REG_XMM4,
+    TCG_REG_XMM5,
+    TCG_REG_XMM6,
+    TCG_REG_XMM7,
+    TCG_REG_XMM8,
+    TCG_REG_XMM9,
+    TCG_REG_XMM10,
+    TCG_REG_XMM11,
+    TCG_REG_XMM12,
+    TCG_REG_XMM13,
+    TCG_REG_XMM14,
+    TCG_REG_XMM15,
 #else
     TCG_REG_EBX,
     TCG_REG_ESI,
@@ -93,6 +112,15 @@ static const int tcg_target_call_oarg_regs[] = {
 #define TCG_CT_CONST_U32 0x200
 #define TCG_CT_CONST_I32 0x400
 
+/* Registers used with x constraint.  All of them are call-clobbered,
+   except that the Windows ABI preserves xmm6-xmm15; we do not save
+   those in the prologue, so leave them alone.  */
+#if defined(_WIN64)
+# define ALL_VECTOR_REGS 0x3fu
+#else
+# define ALL_VECTOR_REGS 0xffffu
+#endif
+
 /* Registers used with L constraint, which are the first argument 
    registers on x86_64, and two random call clobbered registers on
    i386. */
@@ -129,9 +157,11 @@ static bool have_movbe;
 # define have_movbe 0
 #endif
 
-/* We need this symbol in tcg-target.h, and we can't properly conditionalize
-   it there.  Therefore we always define the variable.  */
+/* We need these symbols in tcg-target.h, and we can't properly conditionalize
+   them there.  Therefore we always define the variables.  */
 bool have_bmi1;
+bool have_lzcnt;
+bool have_popcnt;
 
 #if defined(CONFIG_CPUID_H) && defined(bit_BMI2)
 static bool have_bmi2;
@@ -238,6 +268,11 @@ static int target_parse_constraint(TCGArgConstraint *ct, const char **pct_str)
         tcg_regset_reset_reg(ct->u.regs, TCG_REG_L1);
         break;
 
+    case 'x':
+        ct->ct |= TCG_CT_REG;
+        tcg_regset_set32(ct->u.regs, TCG_REG_XMM0, ALL_VECTOR_REGS);
+        break;
+
     case 'e':
         ct->ct |= TCG_CT_CONST_S32;
         break;
@@ -306,6 +341,8 @@ static inline int tcg_target_const_match(tcg_target_long val, TCGType type,
 #define OPC_ARITH_GvEv	(0x03)		/* ... plus (ARITH_FOO << 3) */
 #define OPC_ANDN        (0xf2 | P_EXT38)
 #define OPC_ADD_GvEv	(OPC_ARITH_GvEv | (ARITH_ADD << 3))
+#define OPC_AND_GvEv	(OPC_ARITH_GvEv | (ARITH_AND << 3))
+#define OPC_BSF         (0xbc | P_EXT)
 #define OPC_BSWAP	(0xc8 | P_EXT)
 #define OPC_CALL_Jz	(0xe8)
 #define OPC_CMOVCC      (0x40 | P_EXT)  /* ... plus condition code */
@@ -320,6 +357,7 @@ static inline int tcg_target_const_match(tcg_target_long val, TCGType type,
 #define OPC_JMP_long	(0xe9)
 #define OPC_JMP_short	(0xeb)
 #define OPC_LEA         (0x8d)
+#define OPC_LZCNT       (0xbd | P_EXT | P_SIMDF3)
 #define OPC_MOVB_EvGv	(0x88)		/* stores, more or less */
 #define OPC_MOVL_EvGv	(0x89)		/* stores, more or less */
 #define OPC_MOVL_GvEv	(0x8b)		/* loads, more or less */
@@ -333,6 +371,38 @@ static inline int tcg_target_const_match(tcg_target_long val, TCGType type,
 #define OPC_MOVSLQ	(0x63 | P_REXW)
 #define OPC_MOVZBL	(0xb6 | P_EXT)
 #define OPC_MOVZWL	(0xb7 | P_EXT)
+#define OPC_PADDB       (0xfc | P_EXT | P_DATA16)
+#define OPC_PADDW       (0xfd | P_EXT | P_DATA16)
+#define OPC_PADDD       (0xfe | P_EXT | P_DATA16)
+#define OPC_PADDQ       (0xd4 | P_EXT | P_DATA16)
+#define OPC_PAND        (0xdb | P_EXT | P_DATA16)
+#define OPC_PANDN       (0xdf | P_EXT | P_DATA16)
+#define OPC_PCMPEQB     (0x74 | P_EXT | P_DATA16)
+#define OPC_PCMPEQW     (0x75 | P_EXT | P_DATA16)
+#define OPC_PCMPEQD     (0x76 | P_EXT | P_DATA16)
+#define OPC_PCMPGTB     (0x64 | P_EXT | P_DATA16)
+#define OPC_PCMPGTW     (0x65 | P_EXT | P_DATA16)
+#define OPC_PCMPGTD     (0x66 | P_EXT | P_DATA16)
+#define OPC_POPCNT      (0xb8 | P_EXT | P_SIMDF3)
+#define OPC_POR         (0xeb | P_EXT | P_DATA16)
+#define OPC_PSHIFTW_Ib  (0x71 | P_EXT | P_DATA16) /* /2 /4 /6 */
+#define OPC_PSHIFTD_Ib  (0x72 | P_EXT | P_DATA16) /* /2 /4 /6 */
+#define OPC_PSHIFTQ_Ib  (0x73 | P_EXT | P_DATA16) /* /2 /6 */
+#define OPC_PSHUFD      (0x70 | P_EXT | P_DATA16)
+#define OPC_PSUBB       (0xf8 | P_EXT | P_DATA16)
+#define OPC_PSUBW       (0xf9 | P_EXT | P_DATA16)
+#define OPC_PSUBD       (0xfa | P_EXT | P_DATA16)
+#define OPC_PSUBQ       (0xfb | P_EXT | P_DATA16)
+#define OPC_PUNPCKLBW   (0x60 | P_EXT | P_DATA16)
+#define OPC_PUNPCKLWD   (0x61 | P_EXT | P_DATA16)
+#define OPC_PUNPCKLQDQ  (0x6c | P_EXT | P_DATA16)
+#define OPC_PXOR        (0xef | P_EXT | P_DATA16)
+#define OPC_MOVD_VyEy   (0x6e | P_EXT | P_DATA16)
+#define OPC_MOVDQA_VxWx (0x6f | P_EXT | P_DATA16)
+#define OPC_MOVDQU_VxWx (0x6f | P_EXT | P_SIMDF3)
+#define OPC_MOVDQU_WxVx (0x7f | P_EXT | P_SIMDF3)
+#define OPC_MOVQ_VqWq   (0x7e | P_EXT | P_SIMDF3)
+#define OPC_MOVQ_WqVq   (0xd6 | P_EXT | P_DATA16)
 #define OPC_POP_r32	(0x58)
 #define OPC_PUSH_r32	(0x50)
 #define OPC_PUSH_Iv	(0x68)
@@ -346,6 +416,7 @@ static inline int tcg_target_const_match(tcg_target_long val, TCGType type,
 #define OPC_SHLX        (0xf7 | P_EXT38 | P_DATA16)
 #define OPC_SHRX        (0xf7 | P_EXT38 | P_SIMDF2)
 #define OPC_TESTL	(0x85)
+#define OPC_TZCNT       (0xbc | P_EXT | P_SIMDF3)
 #define OPC_XCHG_ax_r32	(0x90)
 
 #define OPC_GRP3_Ev	(0xf7)
@@ -369,6 +440,11 @@ static inline int tcg_target_const_match(tcg_target_long val, TCGType type,
 #define SHIFT_SHR 5
 #define SHIFT_SAR 7
 
+/* Group 12-14 opcode extensions for the SSE shifts by immediate.  */
+#define PSHIFT_SRL 2
+#define PSHIFT_SRA 4
+#define PSHIFT_SLL 6
+
 /* Group 3 opcode extensions for 0xf6, 0xf7.  To be used with OPC_GRP3.  */
 #define EXT3_NOT   2
 #define EXT3_NEG   3
@@ -424,10 +500,16 @@ static void tcg_out_opc(TCGContext *s, int opc, int r, int rm, int x)
         tcg_out8(s, 0x65);
     }
     if (opc & P_DATA16) {
-        /* We should never be asking for both 16 and 64-bit operation.  */
-        tcg_debug_assert((opc & P_REXW) == 0);
+        /* We should never be asking for both 16 and 64-bit operation,
+           except in SSE instructions where 0x66 selects the opcode.  */
+        tcg_debug_assert((opc & P_REXW) == 0 || (opc & P_EXT));
         tcg_out8(s, 0x66);
     }
+    if (opc & P_SIMDF3) {
+        tcg_out8(s, 0xf3);
+    } else if (opc & P_SIMDF2) {
+        tcg_out8(s, 0xf2);
+    }
     if (opc & P_ADDR32) {
         tcg_out8(s, 0x67);
     }
@@ -635,7 +717,17 @@ static inline void tcg_out_mov(TCGContext *s, TCGType type,
                                TCGReg ret, TCGReg arg)
 {
     if (arg != ret) {
-        int opc = OPC_MOVL_GvEv + (type == TCG_TYPE_I64 ? P_REXW : 0);
+        int opc;
+
+        switch (type) {
+        case TCG_TYPE_V64:
+        case TCG_TYPE_V128:
+            opc = OPC_MOVDQA_VxWx;
+            break;
+        default:
+            opc = OPC_MOVL_GvEv + (type == TCG_TYPE_I64 ? P_REXW : 0);
+            break;
+        }
         tcg_out_modrm(s, opc, ret, arg);
     }
 }
@@ -660,9 +752,10 @@ static void tcg_out_movi(TCGContext *s, TCGType type,
         return;
     }
 
-    /* Try a 7 byte pc-relative lea before the 10 byte movq.  */
+    /* Try a 7 byte pc-relative lea before the 10 byte movq.  Not if
+       the code may be moved, though.  */
     diff = arg - ((uintptr_t)s->code_ptr + 7);
-    if (diff == (int32_t)diff) {
+    if (diff == (int32_t)diff && s->nb_code_relocs < 0) {
         tcg_out_opc(s, OPC_LEA | P_REXW, ret, 0, 0);
         tcg_out8(s, (LOWREGMASK(ret) << 3) | 5);
         tcg_out32(s, diff);
@@ -711,14 +804,38 @@ static inline void tcg_out_pop(TCGContext *s, int reg)
 static inline void tcg_out_ld(TCGContext *s, TCGType type, TCGReg ret,
                               TCGReg arg1, intptr_t arg2)
 {
-    int opc = OPC_MOVL_GvEv + (type == TCG_TYPE_I64 ? P_REXW : 0);
+    int opc;
+
+    switch (type) {
+    case TCG_TYPE_V64:
+        opc = OPC_MOVQ_VqWq;
+        break;
+    case TCG_TYPE_V128:
+        opc = OPC_MOVDQU_VxWx;
+        break;
+    default:
+        opc = OPC_MOVL_GvEv + (type == TCG_TYPE_I64 ? P_REXW : 0);
+        break;
+    }
     tcg_out_modrm_offset(s, opc, ret, arg1, arg2);
 }
 
 static inline void tcg_out_st(TCGContext *s, TCGType type, TCGReg arg,
                               TCGReg arg1, intptr_t arg2)
 {
-    int opc = OPC_MOVL_EvGv + (type == TCG_TYPE_I64 ? P_REXW : 0);
+    int opc;
+
+    switch (type) {
+    case TCG_TYPE_V64:
+        opc = OPC_MOVQ_WqVq;
+        break;
+    case TCG_TYPE_V128:
+        opc = OPC_MOVDQU_WxVx;
+        break;
+    default:
+        opc = OPC_MOVL_EvGv + (type == TCG_TYPE_I64 ? P_REXW : 0);
+        break;
+    }
     tcg_out_modrm_offset(s, opc, arg, arg1, arg2);
 }
 
@@ -1118,15 +1235,88 @@ static void tcg_out_movcond64(TCGContext *s, TCGCond cond, TCGArg dest,
 }
 #endif
 
+/* DEST holds the result of a BSF, TZCNT or LZCNT of itself; if COND
+   says that the input was zero, replace it with ARG2.  */
+static void tcg_out_count_zero(TCGContext *s, TCGCond cond, int rexw,
+                               TCGReg dest, TCGArg arg2, int const_a2)
+{
+    if (!const_a2 && arg2 == dest) {
+        /* The input was also the zero value, so the result is zero.  */
+        arg2 = 0;
+        const_a2 = 1;
+    }
+    if (!const_a2 && have_cmov) {
+        tcg_out_modrm(s, OPC_CMOVCC | tcg_cond_to_jcc[cond] | rexw,
+                      dest, arg2);
+    } else {
+        TCGType type = rexw ? TCG_TYPE_I64 : TCG_TYPE_I32;
+        TCGLabel *over = gen_new_label();
+
+        tcg_out_jxx(s, tcg_cond_to_jcc[tcg_invert_cond(cond)], over, 1);
+        if (const_a2) {
+            tcg_out_movi(s, type, dest, arg2);
+        } else {
+            tcg_out_mov(s, type, dest, arg2);
+        }
+        tcg_out_label(s, over, s->code_ptr);
+    }
+}
+
+static void tcg_out_ctz(TCGContext *s, int rexw, TCGReg dest,
+                        TCGArg arg2, int const_a2)
+{
+    if (have_bmi1) {
+        /* TZCNT sets CF for a zero input, and then returns the width.  */
+        tcg_out_modrm(s, OPC_TZCNT + rexw, dest, dest);
+        if (const_a2 && arg2 == (rexw ? 64 : 32)) {
+            return;
+        }
+        tcg_out_count_zero(s, TCG_COND_LTU, rexw, dest, arg2, const_a2);
+    } else {
+        /* BSF sets ZF for a zero input, and leaves DEST undefined.  */
+        tcg_out_modrm(s, OPC_BSF + rexw, dest, dest);
+        tcg_out_count_zero(s, TCG_COND_EQ, rexw, dest, arg2, const_a2);
+    }
+}
+
+static void tcg_out_clz(TCGContext *s, int rexw, TCGReg dest,
+                        TCGArg arg2, int const_a2)
+{
+    /* LZCNT sets CF for a zero input, and then returns the width.  */
+    tcg_debug_assert(have_lzcnt);
+    tcg_out_modrm(s, OPC_LZCNT + rexw, dest, dest);
+    if (const_a2 && arg2 == (rexw ? 64 : 32)) {
+        return;
+    }
+    tcg_out_count_zero(s, TCG_COND_LTU, rexw, dest, arg2, const_a2);
+}
+
+/* Load a host address.  Use a movq if the code may be moved, so that
+   the immediate can be relocated.  */
+static void tcg_out_movi_ptr(TCGContext *s, TCGReg ret, uintptr_t arg)
+{
+#if TCG_TARGET_REG_BITS == 64
+    if (s->nb_code_relocs >= 0) {
+        tcg_out_opc(s, OPC_MOVL_Iv + P_REXW + LOWREGMASK(ret), 0, ret, 0);
+        tcg_out_code_reloc(s, s->code_ptr, TCG_CODE_RELOC_ABS64, arg);
+        tcg_out64(s, arg);
+        return;
+    }
+#endif
+    tcg_out_movi(s, TCG_TYPE_PTR, ret, arg);
+}
+
 static void tcg_out_branch(TCGContext *s, int call, tcg_insn_unit *dest)
 {
     intptr_t disp = tcg_pcrel_diff(s, dest) - 5;
 
     if (disp == (int32_t)disp) {
         tcg_out_opc(s, call ? OPC_CALL_Jz : OPC_JMP_long, 0, 0, 0);
+        tcg_out_code_reloc(s, s->code_ptr, TCG_CODE_RELOC_PCREL32,
+                           (uintptr_t)dest);
         tcg_out32(s, disp);
     } else {
-        tcg_out_movi(s, TCG_TYPE_PTR, TCG_REG_R10, (uintptr_t)dest);
+        tcg_out_movi_ptr(s, TCG_REG_R10, (uintptr_t)dest);
         tcg_out_modrm(s, OPC_GRP5,
                       call ? EXT5_CALLN_Ev : EXT5_JMPN_Ev, TCG_REG_R10);
     }
@@ -1194,6 +1384,10 @@ static void * const qemu_st_helpers[16] = {
    WHICH is the offset into the CPUTLBEntry structure of the slot to read.
    This should be offsetof addr_read or addr_write.
 
+   The size of the TLB is not known at translation time: the index is
+   masked with env->tlb_mask[MEM_INDEX] and added to the pointer in
+   env->tlb_table[MEM_INDEX], both straight from memory.
+
    Outputs:
    LABEL_PTRS is filled with 1 (32-bit addresses) or 2 (64-bit addresses)
    positions of the displacements of forward jumps to the TLB miss case.
@@ -1227,7 +1421,7 @@ static inline void tcg_out_tlb_load(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
         }
         if (TCG_TYPE_PTR == TCG_TYPE_I64) {
             hrexw = P_REXW;
-            if (TARGET_PAGE_BITS + CPU_TLB_BITS > 32) {
+            if (TARGET_PAGE_BITS + CPU_TLB_DYN_MAX_BITS > 32) {
                 tlbtype = TCG_TYPE_I64;
                 tlbrexw = P_REXW;
             }
@@ -1249,15 +1443,17 @@ static inline void tcg_out_tlb_load(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
                    TARGET_PAGE_BITS - CPU_TLB_ENTRY_BITS);
 
     tgen_arithi(s, ARITH_AND + trexw, r1, tlb_mask, 0);
-    tgen_arithi(s, ARITH_AND + tlbrexw, r0,
-                (CPU_TLB_SIZE - 1) << CPU_TLB_ENTRY_BITS, 0);
 
-    tcg_out_modrm_sib_offset(s, OPC_LEA + hrexw, r0, TCG_AREG0, r0, 0,
-                             offsetof(CPUArchState, tlb_table[mem_index][0])
-                             + which);
+    /* and tlb_mask[mem_index](env), r0 */
+    tcg_out_modrm_offset(s, OPC_AND_GvEv + tlbrexw, r0, TCG_AREG0,
+                         offsetof(CPUArchState, tlb_mask[mem_index]));
 
-    /* cmp 0(r0), r1 */
-    tcg_out_modrm_offset(s, OPC_CMP_GvEv + trexw, r1, r0, 0);
+    /* add tlb_table[mem_index](env), r0 */
+    tcg_out_modrm_offset(s, OPC_ADD_GvEv + hrexw, r0, TCG_AREG0,
+                         offsetof(CPUArchState, tlb_table[mem_index]));
+
+    /* cmp which(r0), r1 */
+    tcg_out_modrm_offset(s, OPC_CMP_GvEv + trexw, r1, r0, which);
 
     /* Prepare for both the fast path add of the tlb addend, and the slow
        path function argument setup.  There are two cases worth note:
@@ -1273,8 +1469,8 @@ static inline void tcg_out_tlb_load(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
     s->code_ptr += 4;
 
     if (TARGET_LONG_BITS > TCG_TARGET_REG_BITS) {
-        /* cmp 4(r0), addrhi */
-        tcg_out_modrm_offset(s, OPC_CMP_GvEv, addrhi, r0, 4);
+        /* cmp which+4(r0), addrhi */
+        tcg_out_modrm_offset(s, OPC_CMP_GvEv, addrhi, r0, which + 4);
 
         /* jne slow_path */
         tcg_out_opc(s, OPC_JCC_long + JCC_JNE, 0, 0, 0);
@@ -1286,7 +1482,7 @@ static inline void tcg_out_tlb_load(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
 
     /* add addend(r0), r1 */
     tcg_out_modrm_offset(s, OPC_ADD_GvEv + hrexw, r1, r0,
-                         offsetof(CPUTLBEntry, addend) - which);
+                         offsetof(CPUTLBEntry, addend));
 }
 
 /*
@@ -1792,6 +1988,76 @@ static void tcg_out_qemu_st(TCGContext *s, const TCGArg *args, bool is64)
 #endif
 }
 
+#if TCG_TARGET_REG_BITS == 64
+static const int padd_insn[4] = {
+    OPC_PADDB, OPC_PADDW, OPC_PADDD, OPC_PADDQ
+};
+static const int psub_insn[4] = {
+    OPC_PSUBB, OPC_PSUBW, OPC_PSUBD, OPC_PSUBQ
+};
+static const int pcmpeq_insn[3] = {
+    OPC_PCMPEQB, OPC_PCMPEQW, OPC_PCMPEQD
+};
+static const int pcmpgt_insn[3] = {
+    OPC_PCMPGTB, OPC_PCMPGTW, OPC_PCMPGTD
+};
+static const int pshift_insn[4] = {
+    0, OPC_PSHIFTW_Ib, OPC_PSHIFTD_Ib, OPC_PSHIFTQ_Ib
+};
+
+bool tcg_can_emit_vec_op(TCGOpcode opc, TCGType type, unsigned vece)
+{
+    switch (opc) {
+    case INDEX_op_ld_vec:
+    case INDEX_op_st_vec:
+    case INDEX_op_dup_vec:
+    case INDEX_op_add_vec:
+    case INDEX_op_sub_vec:
+    case INDEX_op_and_vec:
+    case INDEX_op_or_vec:
+    case INDEX_op_xor_vec:
+    case INDEX_op_andc_vec:
+        return true;
+    case INDEX_op_shli_vec:
+    case INDEX_op_shri_vec:
+        /* There are no byte shifts.  */
+        return vece != MO_8;
+    case INDEX_op_sari_vec:
+        /* ... and psraq is AVX-512.  */
+        return vece == MO_16 || vece == MO_32;
+    case INDEX_op_cmp_vec:
+        /* pcmpeqq and pcmpgtq are SSE4.  */
+        return vece != MO_64;
+    default:
+        return false;
+    }
+}
+
+/* Replicate the VECE-sized element at the bottom of the general register
+   SRC into the vector register DEST.  */
+static void tcg_out_dupv(TCGContext *s, unsigned vece, TCGReg dest, TCGReg src)
+{
+    tcg_out_modrm(s, OPC_MOVD_VyEy | (vece == MO_64 ? P_REXW : 0), dest, src);
+    switch (vece) {
+    case MO_8:
+        tcg_out_modrm(s, OPC_PUNPCKLBW, dest, dest);
+        /* FALLTHRU */
+    case MO_16:
+        tcg_out_modrm(s, OPC_PUNPCKLWD, dest, dest);
+        /* FALLTHRU */
+    case MO_32:
+        tcg_out_modrm(s, OPC_PSHUFD, dest, dest);
+        tcg_out8(s, 0);
+        break;
+    case MO_64:
+        tcg_out_modrm(s, OPC_PUNPCKLQDQ, dest, dest);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
+#endif
+
 static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
                               const TCGArg *args, const int *const_args)
 {
@@ -1809,7 +2075,12 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
 
     switch(opc) {
     case INDEX_op_exit_tb:
-        tcg_out_movi(s, TCG_TYPE_PTR, TCG_REG_EAX, args[0]);
+        if (args[0]) {
+            /* The TB pointer, which differs if the code is reloaded.  */
+            tcg_out_movi_ptr(s, TCG_REG_EAX, args[0]);
+        } else {
+            tcg_out_movi(s, TCG_TYPE_PTR, TCG_REG_EAX, 0);
+        }
         tcg_out_jmp(s, tb_ret_addr);
         break;
     case INDEX_op_goto_tb:
@@ -1833,6 +2104,10 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
         }
         s->tb_jmp_reset_offset[args[0]] = tcg_current_code_size(s);
         break;
+    case INDEX_op_goto_ptr:
+        /* jmp to the given host address (could be epilogue) */
+        tcg_out_modrm(s, OPC_GRP5, EXT5_JMPN_Ev, args[0]);
+        break;
     case INDEX_op_br:
         tcg_out_jxx(s, JCC_JMP, arg_label(args[0]), 0);
         break;
@@ -2033,6 +2308,48 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
         tcg_out_ext16u(s, args[0], args[1]);
         break;
 
+    OP_32_64(ctz):
+        tcg_out_ctz(s, rexw, args[0], args[2], const_args[2]);
+        break;
+    OP_32_64(clz):
+        tcg_out_clz(s, rexw, args[0], args[2], const_args[2]);
+        break;
+    OP_32_64(ctpop):
+        tcg_out_modrm(s, OPC_POPCNT + rexw, args[0], args[1]);
+        break;
+
+    OP_32_64(extract):
+        /* On the off-chance that we can use the high-byte registers.
+           Otherwise we emit the same ext16 + shift pattern that we
+           would have gotten from the normal tcg-op.c expansion.  */
+        if (args[2] == 8 && args[3] == 8) {
+            if (args[1] < 4 && args[0] < 8) {
+                tcg_out_modrm(s, OPC_MOVZBL, args[0], args[1] + 4);
+            } else {
+                tcg_out_ext16u(s, args[0], args[1]);
+                tcg_out_shifti(s, SHIFT_SHR, args[0], 8);
+            }
+        } else {
+            /* The 64-bit extraction of a field that ends at bit 31:
+               a 32-bit shift right zero-extends to 64 bits.  */
+            tcg_debug_assert(args[2] + args[3] == 32);
+            tcg_out_mov(s, TCG_TYPE_I32, args[0], args[1]);
+            tcg_out_shifti(s, SHIFT_SHR, args[0], args[2]);
+        }
+        break;
+    case INDEX_op_sextract_i32:
+        /* We don't implement sextract_i64, as we cannot sign-extend to
+           64-bits without using the REX prefix that explicitly excludes
+           access to the high-byte registers.  */
+        tcg_debug_assert(args[2] == 8 && args[3] == 8);
+        if (args[1] < 4 && args[0] < 8) {
+            tcg_out_modrm(s, OPC_MOVSBL, args[0], args[1] + 4);
+        } else {
+            tcg_out_ext16s(s, args[0], args[1], 0);
+            tcg_out_shifti(s, SHIFT_SAR, args[0], 8);
+        }
+        break;
+
     case INDEX_op_qemu_ld_i32:
         tcg_out_qemu_ld(s, args, 0);
         break;
@@ -2125,6 +2442,61 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
     case INDEX_op_ext32s_i64:
         tcg_out_ext32s(s, args[0], args[1]);
         break;
+
+    /* The vector operations operate on whole xmm registers; for 64-bit
+       vectors only the low half is loaded and stored.  */
+    case INDEX_op_ld_vec:
+        tcg_out_ld(s, TCG_TYPE_V64 + args[3], args[0], args[1], args[2]);
+        break;
+    case INDEX_op_st_vec:
+        tcg_out_st(s, TCG_TYPE_V64 + args[3], args[0], args[1], args[2]);
+        break;
+    case INDEX_op_dup_vec:
+        tcg_out_dupv(s, args[3], args[0], args[1]);
+        break;
+    case INDEX_op_add_vec:
+        tcg_out_modrm(s, padd_insn[args[4]], args[0], args[2]);
+        break;
+    case INDEX_op_sub_vec:
+        tcg_out_modrm(s, psub_insn[args[4]], args[0], args[2]);
+        break;
+    case INDEX_op_and_vec:
+        tcg_out_modrm(s, OPC_PAND, args[0], args[2]);
+        break;
+    case INDEX_op_or_vec:
+        tcg_out_modrm(s, OPC_POR, args[0], args[2]);
+        break;
+    case INDEX_op_xor_vec:
+        tcg_out_modrm(s, OPC_PXOR, args[0], args[2]);
+        break;
+    case INDEX_op_andc_vec:
+        /* pandn inverts its first operand, which is tied to the output.  */
+        tcg_out_modrm(s, OPC_PANDN, args[0], args[1]);
+        break;
+    case INDEX_op_shli_vec:
+        c = PSHIFT_SLL;
+        goto gen_pshift;
+    case INDEX_op_shri_vec:
+        c = PSHIFT_SRL;
+        goto gen_pshift;
+    case INDEX_op_sari_vec:
+        c = PSHIFT_SRA;
+    gen_pshift:
+        tcg_out_modrm(s, pshift_insn[args[4]], c, args[0]);
+        tcg_out8(s, args[2]);
+        break;
+    case INDEX_op_cmp_vec:
+        switch (args[3]) {
+        case TCG_COND_EQ:
+            tcg_out_modrm(s, pcmpeq_insn[args[5]], args[0], args[2]);
+            break;
+        case TCG_COND_GT:
+            tcg_out_modrm(s, pcmpgt_insn[args[5]], args[0], args[2]);
+            break;
+        default:
+            tcg_abort();
+        }
+        break;
 #endif
 
     OP_32_64(deposit):
@@ -2161,6 +2533,7 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
 static const TCGTargetOpDef x86_op_defs[] = {
     { INDEX_op_exit_tb, { } },
     { INDEX_op_goto_tb, { } },
+    { INDEX_op_goto_ptr, { "r" } },
     { INDEX_op_br, { } },
     { INDEX_op_ld8u_i32, { "r", "r" } },
     { INDEX_op_ld8s_i32, { "r", "r" } },
@@ -2180,6 +2553,9 @@ static const TCGTargetOpDef x86_op_defs[] = {
     { INDEX_op_or_i32, { "r", "0", "ri" } },
     { INDEX_op_xor_i32, { "r", "0", "ri" } },
     { INDEX_op_andc_i32, { "r", "r", "ri" } },
+    { INDEX_op_clz_i32, { "r", "0", "ri" } },
+    { INDEX_op_ctz_i32, { "r", "0", "ri" } },
+    { INDEX_op_ctpop_i32, { "r", "r" } },
 
     { INDEX_op_shl_i32, { "r", "0", "Ci" } },
     { INDEX_op_shr_i32, { "r", "0", "Ci" } },
@@ -2204,6 +2580,8 @@ static const TCGTargetOpDef x86_op_defs[] = {
     { INDEX_op_setcond_i32, { "q", "r", "ri" } },
 
     { INDEX_op_deposit_i32, { "Q", "0", "Q" } },
+    { INDEX_op_extract_i32, { "r", "r" } },
+    { INDEX_op_sextract_i32, { "r", "r" } },
     { INDEX_op_movcond_i32, { "r", "r", "ri", "r", "0" } },
 
     { INDEX_op_mulu2_i32, { "a", "d", "a", "r" } },
@@ -2238,6 +2616,9 @@ static const TCGTargetOpDef x86_op_defs[] = {
     { INDEX_op_or_i64, { "r", "0", "re" } },
     { INDEX_op_xor_i64, { "r", "0", "re" } },
     { INDEX_op_andc_i64, { "r", "r", "rI" } },
+    { INDEX_op_clz_i64, { "r", "0", "ri" } },
+    { INDEX_op_ctz_i64, { "r", "0", "ri" } },
+    { INDEX_op_ctpop_i64, { "r", "r" } },
 
     { INDEX_op_shl_i64, { "r", "0", "Ci" } },
     { INDEX_op_shr_i64, { "r", "0", "Ci" } },
@@ -2265,12 +2646,27 @@ static const TCGTargetOpDef x86_op_defs[] = {
     { INDEX_op_extu_i32_i64, { "r", "r" } },
 
     { INDEX_op_deposit_i64, { "Q", "0", "Q" } },
+    { INDEX_op_extract_i64, { "r", "r" } },
     { INDEX_op_movcond_i64, { "r", "r", "re", "r", "0" } },
 
     { INDEX_op_mulu2_i64, { "a", "d", "a", "r" } },
     { INDEX_op_muls2_i64, { "a", "d", "a", "r" } },
     { INDEX_op_add2_i64, { "r", "r", "0", "1", "re", "re" } },
     { INDEX_op_sub2_i64, { "r", "r", "0", "1", "re", "re" } },
+
+    { INDEX_op_ld_vec, { "x", "r" } },
+    { INDEX_op_st_vec, { "x", "r" } },
+    { INDEX_op_dup_vec, { "x", "r" } },
+    { INDEX_op_add_vec, { "x", "0", "x" } },
+    { INDEX_op_sub_vec, { "x", "0", "x" } },
+    { INDEX_op_and_vec, { "x", "0", "x" } },
+    { INDEX_op_or_vec, { "x", "0", "x" } },
+    { INDEX_op_xor_vec, { "x", "0", "x" } },
+    { INDEX_op_andc_vec, { "x", "x", "0" } },
+    { INDEX_op_shli_vec, { "x", "0" } },
+    { INDEX_op_shri_vec, { "x", "0" } },
+    { INDEX_op_sari_vec, { "x", "0" } },
+    { INDEX_op_cmp_vec, { "x", "0", "x" } },
 #endif
 
 #if TCG_TARGET_REG_BITS == 64
@@ -2358,6 +2754,11 @@ static void tcg_target_qemu_prologue(TCGContext *s)
     tcg_out_modrm(s, OPC_GRP5, EXT5_JMPN_Ev, tcg_target_call_iarg_regs[1]);
 #endif
 
+    /* Return path for goto_ptr.  Set return value to 0, a-la exit_tb,
+       and fall through to the rest of the epilogue.  */
+    s->code_gen_epilogue = s->code_ptr;
+    tcg_out_movi(s, TCG_TYPE_REG, TCG_REG_EAX, 0);
+
     /* TB epilogue */
     tb_ret_addr = s->code_ptr;
 
@@ -2394,6 +2795,9 @@ static void tcg_target_init(TCGContext *s)
         /* MOVBE is only available on Intel Atom and Haswell CPUs, so we
            need to probe for it.  */
         have_movbe = (c & bit_MOVBE) != 0;
+#endif
+#ifdef bit_POPCNT
+        have_popcnt = (c & bit_POPCNT) != 0;
 #endif
     }
 
@@ -2407,11 +2811,28 @@ static void tcg_target_init(TCGContext *s)
         have_bmi2 = (b & bit_BMI2) != 0;
 #endif
     }
+
+    max = __get_cpuid_max(0x80000000, 0);
+    if (max >= 0x80000001) {
+        /* LZCNT is available on AMD Barcelona and Intel Haswell CPUs.  */
+        __cpuid(0x80000001, a, b, c, d);
+#ifdef bit_LZCNT
+        have_lzcnt = (c & bit_LZCNT) != 0;
 #endif
+    }
+#endif
+
+    tcg_target_features = have_cmov | have_movbe << 1 | have_bmi1 << 2
+                          | have_bmi2 << 3 | have_lzcnt << 4
+                          | have_popcnt << 5;
 
     if (TCG_TARGET_REG_BITS == 64) {
         tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_I32], 0, 0xffff);
         tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_I64], 0, 0xffff);
+        tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_V64],
+                         TCG_REG_XMM0, ALL_VECTOR_REGS);
+        tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_V128],
+                         TCG_REG_XMM0, ALL_VECTOR_REGS);
     } else {
         tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_I32], 0, 0xff);
     }
@@ -2429,6 +2850,8 @@ static void tcg_target_init(TCGContext *s)
         tcg_regset_set_reg(tcg_target_call_clobber_regs, TCG_REG_R9);
         tcg_regset_set_reg(tcg_target_call_clobber_regs, TCG_REG_R10);
         tcg_regset_set_reg(tcg_target_call_clobber_regs, TCG_REG_R11);
+        tcg_regset_set32(tcg_target_call_clobber_regs,
+                         TCG_REG_XMM0, ALL_VECTOR_REGS);
     }
 
     tcg_regset_clear(s->reserved_regs);
@@ -0,0 +1,104 @@
+/*
+ * TCG Backend Data: constant pool.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Backends that define TCG_TARGET_NEED_POOL_LABELS can load constants
+ * PC-relatively from a pool that is emitted after the code of the TB
+ * (or of the prologue), including the slow paths.  Identical constants
+ * share a single pool entry.
+ */
+
+typedef struct TCGLabelPoolData {
+    struct TCGLabelPoolData *next;
+    tcg_insn_unit *label;       /* the insn that loads the constant */
+    intptr_t addend;
+    int type;                   /* relocation applied to the insn */
+    tcg_target_ulong data;
+} TCGLabelPoolData;
+
+static void tcg_out_nop_fill(tcg_insn_unit *p, int count);
+
+/*
+ * Initialize the pool at the beginning of the TB.
+ */
+
+static inline void tcg_out_pool_init(TCGContext *s)
+{
+    s->pool_labels = NULL;
+}
+
+/*
+ * Record that the insn at LABEL loads DATA from the pool.  The list is
+ * kept sorted by value, so that duplicates end up next to each other.
+ */
+
+static void new_pool_label(TCGContext *s, tcg_target_ulong data, int type,
+                           tcg_insn_unit *label, intptr_t addend)
+{
+    TCGLabelPoolData *n = tcg_malloc(sizeof(*n));
+    TCGLabelPoolData *i, **pp;
+
+    n->label = label;
+    n->addend = addend;
+    n->type = type;
+    n->data = data;
+
+    for (pp = &s->pool_labels; (i = *pp) && i->data > data; pp = &i->next) {
+        continue;
+    }
+    n->next = *pp;
+    *pp = n;
+}
+
+/*
+ * Emit the pool at the end of the TB and point the loads at it.
+ */
+
+static bool tcg_out_pool_finalize(TCGContext *s)
+{
+    TCGLabelPoolData *p = s->pool_labels;
+    tcg_target_ulong *a, *start;
+
+    if (p == NULL) {
+        return true;
+    }
+
+    /* Align the pool to the size of its entries.  */
+    start = (void *)ROUND_UP((uintptr_t)s->code_ptr, sizeof(*a));
+    tcg_out_nop_fill(s->code_ptr, (tcg_insn_unit *)start - s->code_ptr);
+    s->data_gen_ptr = start;
+
+    for (a = start; p != NULL; p = p->next) {
+        if (a == start || a[-1] != p->data) {
+            /* The pool can be much larger than what one operation
+               emits, so check against the high water mark as we go.  */
+            if (unlikely((void *)(a + 1) > s->code_gen_highwater)) {
+                return false;
+            }
+            *a++ = p->data;
+        }
+        patch_reloc(p->label, p->type, (intptr_t)(a - 1), p->addend);
+    }
+
+    s->code_ptr = (tcg_insn_unit *)a;
+    return true;
+}
@@ -0,0 +1,595 @@
+/*
+ * Generic vector operation expansion
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "cpu.h"
+#include "tcg.h"
+#include "tcg-op.h"
+#include "tcg-op-gvec.h"
+
+/* Replicate the low 8 << VECE bits of C across 64 bits.  */
+static uint64_t dup_const(unsigned vece, uint64_t c)
+{
+    switch (vece) {
+    case MO_8:
+        return 0x0101010101010101ull * (uint8_t)c;
+    case MO_16:
+        return 0x0001000100010001ull * (uint16_t)c;
+    case MO_32:
+        return 0x0000000100000001ull * (uint32_t)c;
+    case MO_64:
+        return c;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static void check_size(uint32_t oprsz, uint32_t maxsz)
+{
+    tcg_debug_assert(oprsz % 8 == 0 && oprsz <= maxsz);
+    tcg_debug_assert(maxsz % 8 == 0);
+}
+
+/* Return the vector type to use for the next chunk of OPRSZ - I bytes,
+   or TCG_TYPE_I64 if OPC is not available on the host.  */
+static TCGType choose_vec_type(TCGOpcode opc, unsigned vece,
+                               uint32_t i, uint32_t oprsz)
+{
+    if (opc == 0 || !tcg_host_vectors) {
+        return TCG_TYPE_I64;
+    }
+    if (TCG_TARGET_HAS_v128 && oprsz - i >= 16
+        && tcg_can_emit_vec_op(opc, TCG_TYPE_V128, vece)) {
+        return TCG_TYPE_V128;
+    }
+    if (TCG_TARGET_HAS_v64 && oprsz - i >= 8
+        && tcg_can_emit_vec_op(opc, TCG_TYPE_V64, vece)) {
+        return TCG_TYPE_V64;
+    }
+    return TCG_TYPE_I64;
+}
+
+static inline uint32_t vec_type_size(TCGType type)
+{
+    return type == TCG_TYPE_V128 ? 16 : 8;
+}
+
+static void vec_gen_ld(TCGType type, TCGv_vec r, uint32_t ofs)
+{
+    tcg_gen_op4(tcg_ctx, INDEX_op_ld_vec, GET_TCGV_VEC(r),
+                GET_TCGV_PTR(tcg_ctx->tcg_env), ofs, type - TCG_TYPE_V64);
+}
+
+static void vec_gen_st(TCGType type, TCGv_vec r, uint32_t ofs)
+{
+    tcg_gen_op4(tcg_ctx, INDEX_op_st_vec, GET_TCGV_VEC(r),
+                GET_TCGV_PTR(tcg_ctx->tcg_env), ofs, type - TCG_TYPE_V64);
+}
+
+/* Fill MAXSZ - OPRSZ bytes at DOFS + OPRSZ with zeros.  */
+static void expand_clr(uint32_t dofs, uint32_t oprsz, uint32_t maxsz)
+{
+    TCGv_i64 zero;
+    uint32_t i;
+
+    if (oprsz == maxsz) {
+        return;
+    }
+    zero = tcg_const_i64(0);
+    for (i = oprsz; i < maxsz; i += 8) {
+        tcg_gen_st_i64(zero, tcg_ctx->tcg_env, dofs + i);
+    }
+    tcg_temp_free_i64(zero);
+}
+
+static void gen_ld_elem(unsigned vece, bool sign, TCGv_i64 r, uint32_t ofs)
+{
+    switch (vece) {
+    case MO_8:
+        if (sign) {
+            tcg_gen_ld8s_i64(r, tcg_ctx->tcg_env, ofs);
+        } else {
+            tcg_gen_ld8u_i64(r, tcg_ctx->tcg_env, ofs);
+        }
+        break;
+    case MO_16:
+        if (sign) {
+            tcg_gen_ld16s_i64(r, tcg_ctx->tcg_env, ofs);
+        } else {
+            tcg_gen_ld16u_i64(r, tcg_ctx->tcg_env, ofs);
+        }
+        break;
+    case MO_32:
+        if (sign) {
+            tcg_gen_ld32s_i64(r, tcg_ctx->tcg_env, ofs);
+        } else {
+            tcg_gen_ld32u_i64(r, tcg_ctx->tcg_env, ofs);
+        }
+        break;
+    default:
+        tcg_gen_ld_i64(r, tcg_ctx->tcg_env, ofs);
+        break;
+    }
+}
+
+static void gen_st_elem(unsigned vece, TCGv_i64 r, uint32_t ofs)
+{
+    switch (vece) {
+    case MO_8:
+        tcg_gen_st8_i64(r, tcg_ctx->tcg_env, ofs);
+        break;
+    case MO_16:
+        tcg_gen_st16_i64(r, tcg_ctx->tcg_env, ofs);
+        break;
+    case MO_32:
+        tcg_gen_st32_i64(r, tcg_ctx->tcg_env, ofs);
+        break;
+    default:
+        tcg_gen_st_i64(r, tcg_ctx->tcg_env, ofs);
+        break;
+    }
+}
+
+/* Expansion of a three-operand operation.  OPC is the vector opcode,
+   or 0 if the operation is never done with host vectors.  FNI8 operates
+   on 64 bits holding several elements; if it is NULL, FNIE is called on
+   each element, loaded with sign extension if SIGN.  */
+typedef struct {
+    void (*fni8)(unsigned vece, TCGv_i64 d, TCGv_i64 a, TCGv_i64 b);
+    void (*fnie)(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b, TCGArg arg);
+    TCGOpcode opc;
+    bool sign;
+} GVecGen3;
+
+/* Likewise for a two-operand operation with an immediate.  */
+typedef struct {
+    void (*fni8)(unsigned vece, TCGv_i64 d, TCGv_i64 a, int64_t c);
+    TCGOpcode opc;
+} GVecGen2i;
+
+static void expand_3(const GVecGen3 *g, unsigned vece, uint32_t dofs,
+                     uint32_t aofs, uint32_t bofs, uint32_t oprsz,
+                     uint32_t maxsz, TCGArg arg)
+{
+    uint32_t i = 0;
+
+    check_size(oprsz, maxsz);
+    while (i < oprsz) {
+        TCGType type = choose_vec_type(g->opc, vece, i, oprsz);
+
+        if (type != TCG_TYPE_I64) {
+            TCGv_vec a = tcg_temp_new_vec(type);
+            TCGv_vec b = tcg_temp_new_vec(type);
+            TCGArg vecl = type - TCG_TYPE_V64;
+
+            vec_gen_ld(type, a, aofs + i);
+            vec_gen_ld(type, b, bofs + i);
+            if (g->opc == INDEX_op_cmp_vec) {
+                tcg_gen_op6(tcg_ctx, g->opc, GET_TCGV_VEC(a),
+                            GET_TCGV_VEC(a), GET_TCGV_VEC(b), arg, vecl, vece);
+            } else {
+                tcg_gen_op5(tcg_ctx, g->opc, GET_TCGV_VEC(a),
+                            GET_TCGV_VEC(a), GET_TCGV_VEC(b), vecl, vece);
+            }
+            vec_gen_st(type, a, dofs + i);
+            tcg_temp_free_vec(a);
+            tcg_temp_free_vec(b);
+            i += vec_type_size(type);
+        } else if (g->fni8) {
+            TCGv_i64 a = tcg_temp_new_i64();
+            TCGv_i64 b = tcg_temp_new_i64();
+
+            tcg_gen_ld_i64(a, tcg_ctx->tcg_env, aofs + i);
+            tcg_gen_ld_i64(b, tcg_ctx->tcg_env, bofs + i);
+            g->fni8(vece, a, a, b);
+            tcg_gen_st_i64(a, tcg_ctx->tcg_env, dofs + i);
+            tcg_temp_free_i64(a);
+            tcg_temp_free_i64(b);
+            i += 8;
+        } else {
+            TCGv_i64 a = tcg_temp_new_i64();
+            TCGv_i64 b = tcg_temp_new_i64();
+            uint32_t end = i + 8;
+
+            for (; i < end; i += 1 << vece) {
+                gen_ld_elem(vece, g->sign, a, aofs + i);
+                gen_ld_elem(vece, g->sign, b, bofs + i);
+                g->fnie(a, a, b, arg);
+                gen_st_elem(vece, a, dofs + i);
+            }
+            tcg_temp_free_i64(a);
+            tcg_temp_free_i64(b);
+        }
+    }
+    expand_clr(dofs, oprsz, maxsz);
+}
+
+static void expand_2i(const GVecGen2i *g, unsigned vece, uint32_t dofs,
+                      uint32_t aofs, int64_t c, uint32_t oprsz,
+                      uint32_t maxsz)
+{
+    uint32_t i = 0;
+
+    check_size(oprsz, maxsz);
+    while (i < oprsz) {
+        TCGType type = choose_vec_type(g->opc, vece, i, oprsz);
+
+        if (type != TCG_TYPE_I64) {
+            TCGv_vec a = tcg_temp_new_vec(type);
+
+            vec_gen_ld(type, a, aofs + i);
+            tcg_gen_op5(tcg_ctx, g->opc, GET_TCGV_VEC(a), GET_TCGV_VEC(a),
+                        c, type - TCG_TYPE_V64, vece);
+            vec_gen_st(type, a, dofs + i);
+            tcg_temp_free_vec(a);
+            i += vec_type_size(type);
+        } else {
+            TCGv_i64 a = tcg_temp_new_i64();
+
+            tcg_gen_ld_i64(a, tcg_ctx->tcg_env, aofs + i);
+            g->fni8(vece, a, a, c);
+            tcg_gen_st_i64(a, tcg_ctx->tcg_env, dofs + i);
+            tcg_temp_free_i64(a);
+            i += 8;
+        }
+    }
+    expand_clr(dofs, oprsz, maxsz);
+}
+
+void tcg_gen_gvec_mov(unsigned vece, uint32_t dofs, uint32_t aofs,
+                      uint32_t oprsz, uint32_t maxsz)
+{
+    uint32_t i = 0;
+
+    check_size(oprsz, maxsz);
+    if (dofs != aofs) {
+        while (i < oprsz) {
+            TCGType type = choose_vec_type(INDEX_op_ld_vec, vece, i, oprsz);
+
+            if (type != TCG_TYPE_I64) {
+                TCGv_vec a = tcg_temp_new_vec(type);
+
+                vec_gen_ld(type, a, aofs + i);
+                vec_gen_st(type, a, dofs + i);
+                tcg_temp_free_vec(a);
+                i += vec_type_size(type);
+            } else {
+                TCGv_i64 a = tcg_temp_new_i64();
+
+                tcg_gen_ld_i64(a, tcg_ctx->tcg_env, aofs + i);
+                tcg_gen_st_i64(a, tcg_ctx->tcg_env, dofs + i);
+                tcg_temp_free_i64(a);
+                i += 8;
+            }
+        }
+    }
+    expand_clr(dofs, oprsz, maxsz);
+}
+
+/* Add and subtract the elements held in 64 bits, with M holding the sign
+   bit of each element so that no carry crosses an element boundary.  */
+static void gen_addv_mask(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b, TCGv_i64 m)
+{
+    TCGv_i64 t1 = tcg_temp_new_i64();
+    TCGv_i64 t2 = tcg_temp_new_i64();
+    TCGv_i64 t3 = tcg_temp_new_i64();
+
+    tcg_gen_andc_i64(t1, a, m);
+    tcg_gen_andc_i64(t2, b, m);
+    tcg_gen_xor_i64(t3, a, b);
+    tcg_gen_add_i64(d, t1, t2);
+    tcg_gen_and_i64(t3, t3, m);
+    tcg_gen_xor_i64(d, d, t3);
+
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t2);
+    tcg_temp_free_i64(t3);
+}
+
+static void gen_subv_mask(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b, TCGv_i64 m)
+{
+    TCGv_i64 t1 = tcg_temp_new_i64();
+    TCGv_i64 t2 = tcg_temp_new_i64();
+    TCGv_i64 t3 = tcg_temp_new_i64();
+
+    tcg_gen_or_i64(t1, a, m);
+    tcg_gen_andc_i64(t2, b, m);
+    tcg_gen_eqv_i64(t3, a, b);
+    tcg_gen_sub_i64(d, t1, t2);
+    tcg_gen_and_i64(t3, t3, m);
+    tcg_gen_xor_i64(d, d, t3);
+
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t2);
+    tcg_temp_free_i64(t3);
+}
+
+static void gen_add8(unsigned vece, TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    if (vece == MO_64) {
+        tcg_gen_add_i64(d, a, b);
+    } else {
+        TCGv_i64 m = tcg_const_i64(dup_const(vece, 1ull << ((8 << vece) - 1)));
+        gen_addv_mask(d, a, b, m);
+        tcg_temp_free_i64(m);
+    }
+}
+
+static void gen_sub8(unsigned vece, TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    if (vece == MO_64) {
+        tcg_gen_sub_i64(d, a, b);
+    } else {
+        TCGv_i64 m = tcg_const_i64(dup_const(vece, 1ull << ((8 << vece) - 1)));
+        gen_subv_mask(d, a, b, m);
+        tcg_temp_free_i64(m);
+    }
+}
+
+static void gen_and8(unsigned vece, TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    tcg_gen_and_i64(d, a, b);
+}
+
+static void gen_or8(unsigned vece, TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    tcg_gen_or_i64(d, a, b);
+}
+
+static void gen_xor8(unsigned vece, TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    tcg_gen_xor_i64(d, a, b);
+}
+
+static void gen_andc8(unsigned vece, TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    tcg_gen_andc_i64(d, a, b);
+}
+
+void tcg_gen_gvec_add(unsigned vece, uint32_t dofs, uint32_t aofs,
+                      uint32_t bofs, uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen3 g = { .fni8 = gen_add8, .opc = INDEX_op_add_vec };
+    expand_3(&g, vece, dofs, aofs, bofs, oprsz, maxsz, 0);
+}
+
+void tcg_gen_gvec_sub(unsigned vece, uint32_t dofs, uint32_t aofs,
+                      uint32_t bofs, uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen3 g = { .fni8 = gen_sub8, .opc = INDEX_op_sub_vec };
+    expand_3(&g, vece, dofs, aofs, bofs, oprsz, maxsz, 0);
+}
+
+/* The logical operations do not depend on the element size; use the
+   largest one, which any host supports.  */
+void tcg_gen_gvec_and(unsigned vece, uint32_t dofs, uint32_t aofs,
+                      uint32_t bofs, uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen3 g = { .fni8 = gen_and8, .opc = INDEX_op_and_vec };
+    expand_3(&g, MO_64, dofs, aofs, bofs, oprsz, maxsz, 0);
+}
+
+void tcg_gen_gvec_or(unsigned vece, uint32_t dofs, uint32_t aofs,
+                     uint32_t bofs, uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen3 g = { .fni8 = gen_or8, .opc = INDEX_op_or_vec };
+    expand_3(&g, MO_64, dofs, aofs, bofs, oprsz, maxsz, 0);
+}
+
+void tcg_gen_gvec_xor(unsigned vece, uint32_t dofs, uint32_t aofs,
+                      uint32_t bofs, uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen3 g = { .fni8 = gen_xor8, .opc = INDEX_op_xor_vec };
+    expand_3(&g, MO_64, dofs, aofs, bofs, oprsz, maxsz, 0);
+}
+
+void tcg_gen_gvec_andc(unsigned vece, uint32_t dofs, uint32_t aofs,
+                       uint32_t bofs, uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen3 g = { .fni8 = gen_andc8, .opc = INDEX_op_andc_vec };
+    expand_3(&g, MO_64, dofs, aofs, bofs, oprsz, maxsz, 0);
+}
+
+static void gen_shl8i(unsigned vece, TCGv_i64 d, TCGv_i64 a, int64_t c)
+{
+    uint64_t mask = dup_const(vece, -1ull << c);
+
+    tcg_gen_shli_i64(d, a, c);
+    if (vece != MO_64) {
+        tcg_gen_andi_i64(d, d, mask);
+    }
+}
+
+static void gen_shr8i(unsigned vece, TCGv_i64 d, TCGv_i64 a, int64_t c)
+{
+    uint64_t mask = dup_const(vece, (-1ull >> (64 - (8 << vece))) >> c);
+
+    tcg_gen_shri_i64(d, a, c);
+    if (vece != MO_64) {
+        tcg_gen_andi_i64(d, d, mask);
+    }
+}
+
+static void gen_sar8i(unsigned vece, TCGv_i64 d, TCGv_i64 a, int64_t c)
+{
+    TCGv_i64 s;
+
+    if (vece == MO_64) {
+        tcg_gen_sari_i64(d, a, c);
+        return;
+    }
+
+    /* Shift logically, then replicate the sign bit of each element,
+       isolated in S, into the C bits above it: (S - (S >> C)) << 1
+       sets bits ESIZE - 1 - C ... ESIZE - 2 before the shift, and
+       never borrows from the neighbouring element.  */
+    s = tcg_temp_new_i64();
+    tcg_gen_andi_i64(s, a, dup_const(vece, 1ull << ((8 << vece) - 1)));
+    gen_shr8i(vece, d, a, c);
+    if (c != 0) {
+        TCGv_i64 t = tcg_temp_new_i64();
+        tcg_gen_shri_i64(t, s, c);
+        tcg_gen_sub_i64(s, s, t);
+        tcg_gen_shli_i64(s, s, 1);
+        tcg_gen_or_i64(d, d, s);
+        tcg_temp_free_i64(t);
+    }
+    tcg_temp_free_i64(s);
+}
+
+void tcg_gen_gvec_shli(unsigned vece, uint32_t dofs, uint32_t aofs,
+                       int64_t shift, uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen2i g = { .fni8 = gen_shl8i, .opc = INDEX_op_shli_vec };
+
+    tcg_debug_assert(shift >= 0 && shift < (8 << vece));
+    expand_2i(&g, vece, dofs, aofs, shift, oprsz, maxsz);
+}
+
+void tcg_gen_gvec_shri(unsigned vece, uint32_t dofs, uint32_t aofs,
+                       int64_t shift, uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen2i g = { .fni8 = gen_shr8i, .opc = INDEX_op_shri_vec };
+
+    tcg_debug_assert(shift >= 0 && shift < (8 << vece));
+    expand_2i(&g, vece, dofs, aofs, shift, oprsz, maxsz);
+}
+
+void tcg_gen_gvec_sari(unsigned vece, uint32_t dofs, uint32_t aofs,
+                       int64_t shift, uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen2i g = { .fni8 = gen_sar8i, .opc = INDEX_op_sari_vec };
+
+    tcg_debug_assert(shift >= 0 && shift < (8 << vece));
+    expand_2i(&g, vece, dofs, aofs, shift, oprsz, maxsz);
+}
+
+static void gen_cmpe(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b, TCGArg cond)
+{
+    tcg_gen_setcond_i64(cond, d, a, b);
+    tcg_gen_neg_i64(d, d);
+}
+
+void tcg_gen_gvec_cmp(TCGCond cond, unsigned vece, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz)
+{
+    /* cmp_vec only needs to handle EQ and GT; other conditions are
+       expanded element by element.  Unsigned comparisons need the
+       elements zero-extended, the others sign-extended.  */
+    static const GVecGen3 g_vec = {
+        .fnie = gen_cmpe, .opc = INDEX_op_cmp_vec, .sign = true
+    };
+    static const GVecGen3 g_s = { .fnie = gen_cmpe, .sign = true };
+    static const GVecGen3 g_u = { .fnie = gen_cmpe, .sign = false };
+    const GVecGen3 *g;
+    uint32_t t;
+
+    switch (cond) {
+    case TCG_COND_NEVER:
+    case TCG_COND_ALWAYS:
+        tcg_gen_gvec_dup64i(dofs, oprsz, maxsz,
+                            cond == TCG_COND_ALWAYS ? -1 : 0);
+        return;
+    case TCG_COND_LT:
+        /* a < b is b > a.  */
+        t = aofs;
+        aofs = bofs;
+        bofs = t;
+        cond = TCG_COND_GT;
+        g = &g_vec;
+        break;
+    case TCG_COND_EQ:
+    case TCG_COND_GT:
+        g = &g_vec;
+        break;
+    default:
+        g = is_unsigned_cond(cond) ? &g_u : &g_s;
+        break;
+    }
+    expand_3(g, vece, dofs, aofs, bofs, oprsz, maxsz, cond);
+}
+
+static void gen_extu_elem(unsigned vece, TCGv_i64 d, TCGv_i64 a)
+{
+    switch (vece) {
+    case MO_8:
+        tcg_gen_ext8u_i64(d, a);
+        break;
+    case MO_16:
+        tcg_gen_ext16u_i64(d, a);
+        break;
+    default:
+        tcg_gen_ext32u_i64(d, a);
+        break;
+    }
+}
+
+void tcg_gen_gvec_dup_i64(unsigned vece, uint32_t dofs, uint32_t oprsz,
+                          uint32_t maxsz, TCGv_i64 in)
+{
+    TCGv_i64 t;
+    uint32_t i = 0;
+
+    TCGV_UNUSED_I64(t);
+    check_size(oprsz, maxsz);
+    while (i < oprsz) {
+        TCGType type = choose_vec_type(INDEX_op_dup_vec, vece, i, oprsz);
+
+        if (type != TCG_TYPE_I64) {
+            TCGv_vec v = tcg_temp_new_vec(type);
+
+            tcg_gen_op4(tcg_ctx, INDEX_op_dup_vec, GET_TCGV_VEC(v),
+                        GET_TCGV_I64(in), type - TCG_TYPE_V64, vece);
+            vec_gen_st(type, v, dofs + i);
+            tcg_temp_free_vec(v);
+            i += vec_type_size(type);
+        } else {
+            if (TCGV_IS_UNUSED_I64(t)) {
+                t = tcg_temp_new_i64();
+                if (vece == MO_64) {
+                    tcg_gen_mov_i64(t, in);
+                } else {
+                    gen_extu_elem(vece, t, in);
+                    tcg_gen_muli_i64(t, t, dup_const(vece, 1));
+                }
+            }
+            tcg_gen_st_i64(t, tcg_ctx->tcg_env, dofs + i);
+            i += 8;
+        }
+    }
+    if (!TCGV_IS_UNUSED_I64(t)) {
+        tcg_temp_free_i64(t);
+    }
+    expand_clr(dofs, oprsz, maxsz);
+}
+
+void tcg_gen_gvec_dup_i32(unsigned vece, uint32_t dofs, uint32_t oprsz,
+                          uint32_t maxsz, TCGv_i32 in)
+{
+    TCGv_i64 t = tcg_temp_new_i64();
+
+    tcg_debug_assert(vece <= MO_32);
+    tcg_gen_extu_i32_i64(t, in);
+    tcg_gen_gvec_dup_i64(vece, dofs, oprsz, maxsz, t);
+    tcg_temp_free_i64(t);
+}
+
+void tcg_gen_gvec_dup64i(uint32_t dofs, uint32_t oprsz,
+                         uint32_t maxsz, uint64_t x)
+{
+    TCGv_i64 t = tcg_const_i64(x);
+    uint32_t i;
+
+    check_size(oprsz, maxsz);
+    for (i = 0; i < oprsz; i += 8) {
+        tcg_gen_st_i64(t, tcg_ctx->tcg_env, dofs + i);
+    }
+    tcg_temp_free_i64(t);
+    expand_clr(dofs, oprsz, maxsz);
+}
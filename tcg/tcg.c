@@ -112,11 +112,17 @@ static int tcg_target_const_match(tcg_target_long val, TCGType type,
                                   const TCGArgConstraint *arg_ct);
 static void tcg_out_tb_init(TCGContext *s);
 static bool tcg_out_tb_finalize(TCGContext *s);
+#ifdef TCG_TARGET_NEED_POOL_LABELS
+static void tcg_out_pool_init(TCGContext *s);
+static bool tcg_out_pool_finalize(TCGContext *s);
+#endif
 
 
 
-static TCGRegSet tcg_target_available_regs[2];
+static TCGRegSet tcg_target_available_regs[TCG_TYPE_COUNT];
 static TCGRegSet tcg_target_call_clobber_regs;
+uint32_t tcg_target_features;
+bool tcg_host_vectors = true;
 
 #if TCG_TARGET_INSN_UNIT_SIZE == 1
 static __attribute__((unused)) inline void tcg_out8(TCGContext *s, uint8_t v)
@@ -238,9 +244,31 @@ static void tcg_out_label(TCGContext *s, TCGLabel *l, tcg_insn_unit *ptr)
     l->u.value_ptr = ptr;
 }
 
+/* Record a reference at CODE_PTR to the host address TARGET.  Backends
+   must use fields that can hold any address while relocations are
+   recorded.  */
+static __attribute__((unused))
+void tcg_out_code_reloc(TCGContext *s, tcg_insn_unit *code_ptr,
+                        TCGCodeRelocKind kind, uintptr_t target)
+{
+    TCGCodeReloc *r;
+
+    if (s->nb_code_relocs < 0) {
+        return;
+    }
+    if (s->nb_code_relocs == TCG_MAX_CODE_RELOCS) {
+        s->nb_code_relocs = -1;
+        return;
+    }
+    r = &s->code_relocs[s->nb_code_relocs++];
+    r->offset = tcg_ptr_byte_diff(code_ptr, s->code_buf);
+    r->kind = kind;
+    r->target = target;
+}
+
 TCGLabel *gen_new_label(void)
 {
-    TCGContext *s = &tcg_ctx;
+    TCGContext *s = tcg_ctx;
     TCGLabel *l = tcg_malloc(sizeof(TCGLabel));
 
     *l = (TCGLabel){
@@ -320,6 +348,43 @@ static const TCGHelperInfo all_helpers[] = {
 
 static int indirect_reg_alloc_order[ARRAY_SIZE(tcg_target_reg_alloc_order)];
 
+TCGRegionState tcg_regions;
+
+/* All the contexts, for the statistics; protected by tcg_regions.lock.  */
+static TCGContext **tcg_ctxs;
+static unsigned int n_tcg_ctxs;
+
+static void tcg_ctx_list_add(TCGContext *s)
+{
+    qemu_mutex_lock(&tcg_regions.lock);
+    tcg_ctxs = g_renew(TCGContext *, tcg_ctxs, n_tcg_ctxs + 1);
+    tcg_ctxs[n_tcg_ctxs++] = s;
+    qemu_mutex_unlock(&tcg_regions.lock);
+}
+
+#ifdef CONFIG_PROFILER
+static void tcg_profile_add(TCGProfile *prof, const TCGProfile *orig)
+{
+    prof->tb_count1 += orig->tb_count1;
+    prof->tb_count += orig->tb_count;
+    prof->op_count += orig->op_count;
+    prof->op_count_max = MAX(prof->op_count_max, orig->op_count_max);
+    prof->temp_count += orig->temp_count;
+    prof->temp_count_max = MAX(prof->temp_count_max, orig->temp_count_max);
+    prof->del_op_count += orig->del_op_count;
+    prof->code_in_len += orig->code_in_len;
+    prof->code_out_len += orig->code_out_len;
+    prof->data_out_len += orig->data_out_len;
+    prof->search_out_len += orig->search_out_len;
+    prof->interm_time += orig->interm_time;
+    prof->code_time += orig->code_time;
+    prof->la_time += orig->la_time;
+    prof->opt_time += orig->opt_time;
+    prof->restore_count += orig->restore_count;
+    prof->restore_time += orig->restore_time;
+}
+#endif
+
 void tcg_context_init(TCGContext *s)
 {
     int op, total_args, n, i;
@@ -330,6 +395,7 @@ void tcg_context_init(TCGContext *s)
 
     memset(s, 0, sizeof(*s));
     s->nb_globals = 0;
+    s->nb_code_relocs = -1;
 
     /* Count total number of arguments and allocate the corresponding
        space */
@@ -377,6 +443,181 @@ void tcg_context_init(TCGContext *s)
     for (; i < ARRAY_SIZE(tcg_target_reg_alloc_order); ++i) {
         indirect_reg_alloc_order[i] = tcg_target_reg_alloc_order[i];
     }
+
+    qemu_mutex_init(&tcg_regions.lock);
+    tcg_ctx = s;
+    tcg_ctx_list_add(s);
+}
+
+#ifdef CONFIG_USER_ONLY
+/* In user mode, all the threads share tcg_init_ctx, since translation
+   is serialised by mmap_lock.  */
+void tcg_register_thread(void)
+{
+    tcg_ctx = &tcg_init_ctx;
+}
+#else
+/* Give the calling vCPU thread its own copy of tcg_init_ctx, so that it
+   translates code without blocking the other vCPUs.  This must be
+   called after the prologue is generated and the target has registered
+   its globals.  */
+void tcg_register_thread(void)
+{
+    TCGContext *s = g_malloc(sizeof(*s));
+    int i;
+
+    *s = tcg_init_ctx;
+
+    /* Point the copied globals at the copied temps.  */
+    for (i = 0; i < s->nb_globals; i++) {
+        TCGTemp *ts = &s->temps[i];
+
+        if (ts->mem_base) {
+            ts->mem_base = &s->temps[ts->mem_base - tcg_init_ctx.temps];
+        }
+    }
+    s->frame_temp = &s->temps[s->frame_temp - tcg_init_ctx.temps];
+
+    /* The pools and the region are per context.  */
+    s->pool_first = s->pool_current = s->pool_first_large = NULL;
+    s->pool_cur = s->pool_end = NULL;
+    s->region = NULL;
+#ifdef CONFIG_PROFILER
+    memset(&s->prof, 0, sizeof(s->prof));
+#endif
+
+    tcg_ctx = s;
+    tcg_ctx_list_add(s);
+}
+
+/* Free the context of the calling vCPU thread, which is about to exit.
+   The region it was filling is left to be reclaimed like a full one,
+   and its statistics are kept in tcg_init_ctx.  */
+void tcg_unregister_thread(void)
+{
+    TCGContext *s = tcg_ctx;
+    TCGPool *p, *next;
+    unsigned int i;
+
+    qemu_mutex_lock(&tcg_regions.lock);
+    if (s->region) {
+        s->region->owner = NULL;
+        s->region = NULL;
+    }
+    for (i = 0; i < n_tcg_ctxs; i++) {
+        if (tcg_ctxs[i] == s) {
+            tcg_ctxs[i] = tcg_ctxs[--n_tcg_ctxs];
+            break;
+        }
+    }
+#ifdef CONFIG_PROFILER
+    tcg_profile_add(&tcg_init_ctx.prof, &s->prof);
+#endif
+    qemu_mutex_unlock(&tcg_regions.lock);
+
+    tcg_pool_reset(s);
+    for (p = s->pool_first; p; p = next) {
+        next = p->next;
+        g_free(p);
+    }
+    g_free(s);
+    tcg_ctx = NULL;
+}
+#endif
+
+/* Make R the region that S generates code into.  */
+static void tcg_region_assign(TCGContext *s, TCGRegion *r)
+{
+    r->owner = s;
+    s->region = r;
+    s->code_gen_ptr = r->ptr;
+
+    /* Compute a high-water mark, at which we voluntarily move on to
+       another region.  The size here is arbitrary, significantly larger
+       than we expect the code generation for any one opcode to require.  */
+    s->code_gen_highwater = r->end - 1024;
+}
+
+/* Give up the region of S, which is full, and take the next empty
+   region that no other context owns.  Return false if there is none,
+   leaving S without a region.  */
+bool tcg_region_alloc(TCGContext *s)
+{
+    TCGRegionState *rs = &tcg_regions;
+    bool found = false;
+    size_t i;
+
+    qemu_mutex_lock(&rs->lock);
+    if (s->region) {
+        s->region->owner = NULL;
+        s->region = NULL;
+    }
+    for (i = 0; i < rs->n; i++) {
+        size_t idx = (rs->next + i) % rs->n;
+        TCGRegion *r = &rs->regions[idx];
+
+        if (!r->owner && r->ptr == r->start) {
+            tcg_region_assign(s, r);
+            rs->next = (idx + 1) % rs->n;
+            found = true;
+            break;
+        }
+    }
+    qemu_mutex_unlock(&rs->lock);
+    return found;
+}
+
+/* Empty all the regions for tb_flush.  Each context gets a new region
+   the next time it generates code.  Called while all vCPUs are outside
+   generated code and the translator.  */
+void tcg_region_reset_all(void)
+{
+    TCGRegionState *rs = &tcg_regions;
+    size_t i;
+
+    qemu_mutex_lock(&rs->lock);
+    for (i = 0; i < rs->n; i++) {
+        TCGRegion *r = &rs->regions[i];
+
+        if (r->owner) {
+            r->owner->region = NULL;
+            r->owner = NULL;
+        }
+        r->ptr = r->start;
+        r->nb_tbs = 0;
+    }
+    rs->next = 0;
+    qemu_mutex_unlock(&rs->lock);
+}
+
+/* Split what is left of the buffer after the prologue into regions of
+   equal size, and share the TB array out between them.  */
+static void tcg_region_init(TCGContext *s)
+{
+    TCGRegionState *rs = &tcg_regions;
+    size_t n, size, i;
+
+    n = s->code_gen_buffer_size / TCG_REGION_MIN_SIZE;
+    n = MIN(MAX(n, 1), TCG_MAX_REGIONS);
+    size = QEMU_ALIGN_DOWN(s->code_gen_buffer_size / n, 64);
+
+    rs->n = n;
+    rs->size = size;
+    rs->max_tbs = s->code_gen_max_blocks / n;
+    rs->regions = g_new0(TCGRegion, n);
+    rs->next = 0;
+
+    for (i = 0; i < n; i++) {
+        TCGRegion *r = &rs->regions[i];
+
+        r->start = s->code_gen_buffer + i * size;
+        r->end = r->start + size;
+        r->ptr = r->start;
+        r->tbs = tb_ctx.tbs + i * rs->max_tbs;
+    }
+
+    /* The region is taken when S first generates code.  */
+    s->region = NULL;
 }
 
 void tcg_prologue_init(TCGContext *s)
@@ -389,9 +630,20 @@ void tcg_prologue_init(TCGContext *s)
     s->code_ptr = buf0;
     s->code_buf = buf0;
     s->code_gen_prologue = buf0;
+    s->code_gen_highwater = buf0 + s->code_gen_buffer_size;
+    s->data_gen_ptr = NULL;
 
     /* Generate the prologue.  */
+#ifdef TCG_TARGET_NEED_POOL_LABELS
+    tcg_out_pool_init(s);
+#endif
     tcg_target_qemu_prologue(s);
+#ifdef TCG_TARGET_NEED_POOL_LABELS
+    /* The prologue can load e.g. guest_base from the pool.  */
+    if (!tcg_out_pool_finalize(s)) {
+        tcg_abort();
+    }
+#endif
     buf1 = s->code_ptr;
     flush_icache_range((uintptr_t)buf0, (uintptr_t)buf1);
 
@@ -403,17 +655,19 @@ void tcg_prologue_init(TCGContext *s)
     total_size = s->code_gen_buffer_size - prologue_size;
     s->code_gen_buffer_size = total_size;
 
-    /* Compute a high-water mark, at which we voluntarily flush the buffer
-       and start over.  The size here is arbitrary, significantly larger
-       than we expect the code generation for any one opcode to require.  */
-    s->code_gen_highwater = s->code_gen_buffer + (total_size - 1024);
+    tcg_region_init(s);
 
     tcg_register_jit(s->code_gen_buffer, total_size);
 
+    /* Assert that goto_ptr is implemented completely.  */
+    if (TCG_TARGET_HAS_goto_ptr) {
+        tcg_debug_assert(s->code_gen_epilogue != NULL);
+    }
+
 #ifdef DEBUG_DISAS
     if (qemu_loglevel_mask(CPU_LOG_TB_OUT_ASM)) {
         qemu_log("PROLOGUE: [size=%zu]\n", prologue_size);
-        log_disas(buf0, prologue_size);
+        log_disas_code_and_data(buf0, prologue_size, s->data_gen_ptr);
         qemu_log("\n");
         qemu_log_flush();
     }
@@ -495,7 +749,7 @@ void tcg_set_frame(TCGContext *s, TCGReg reg, intptr_t start, intptr_t size)
 
 TCGv_i32 tcg_global_reg_new_i32(TCGReg reg, const char *name)
 {
-    TCGContext *s = &tcg_ctx;
+    TCGContext *s = tcg_ctx;
     int idx;
 
     if (tcg_regset_test_reg(s->reserved_regs, reg)) {
@@ -507,7 +761,7 @@ TCGv_i32 tcg_global_reg_new_i32(TCGReg reg, const char *name)
 
 TCGv_i64 tcg_global_reg_new_i64(TCGReg reg, const char *name)
 {
-    TCGContext *s = &tcg_ctx;
+    TCGContext *s = tcg_ctx;
     int idx;
 
     if (tcg_regset_test_reg(s->reserved_regs, reg)) {
@@ -520,7 +774,7 @@ TCGv_i64 tcg_global_reg_new_i64(TCGReg reg, const char *name)
 int tcg_global_mem_new_internal(TCGType type, TCGv_ptr base,
                                 intptr_t offset, const char *name)
 {
-    TCGContext *s = &tcg_ctx;
+    TCGContext *s = tcg_ctx;
     TCGTemp *base_ts = &s->temps[GET_TCGV_PTR(base)];
     TCGTemp *ts = tcg_global_alloc(s);
     int indirect_reg = 0, bigendian = 0;
@@ -575,7 +829,7 @@ int tcg_global_mem_new_internal(TCGType type, TCGv_ptr base,
 
 static int tcg_temp_new_internal(TCGType type, int temp_local)
 {
-    TCGContext *s = &tcg_ctx;
+    TCGContext *s = tcg_ctx;
     TCGTemp *ts;
     int idx, k;
 
@@ -635,9 +889,18 @@ TCGv_i64 tcg_temp_new_internal_i64(int temp_local)
     return MAKE_TCGV_I64(idx);
 }
 
+TCGv_vec tcg_temp_new_vec(TCGType type)
+{
+    int idx;
+
+    tcg_debug_assert(type == TCG_TYPE_V64 || type == TCG_TYPE_V128);
+    idx = tcg_temp_new_internal(type, 0);
+    return MAKE_TCGV_VEC(idx);
+}
+
 static void tcg_temp_free_internal(int idx)
 {
-    TCGContext *s = &tcg_ctx;
+    TCGContext *s = tcg_ctx;
     TCGTemp *ts;
     int k;
 
@@ -667,6 +930,11 @@ void tcg_temp_free_i64(TCGv_i64 arg)
     tcg_temp_free_internal(GET_TCGV_I64(arg));
 }
 
+void tcg_temp_free_vec(TCGv_vec arg)
+{
+    tcg_temp_free_internal(GET_TCGV_VEC(arg));
+}
+
 TCGv_i32 tcg_const_i32(int32_t val)
 {
     TCGv_i32 t0;
@@ -702,13 +970,13 @@ TCGv_i64 tcg_const_local_i64(int64_t val)
 #if defined(CONFIG_DEBUG_TCG)
 void tcg_clear_temp_count(void)
 {
-    TCGContext *s = &tcg_ctx;
+    TCGContext *s = tcg_ctx;
     s->temps_in_use = 0;
 }
 
 int tcg_check_temp_count(void)
 {
-    TCGContext *s = &tcg_ctx;
+    TCGContext *s = tcg_ctx;
     if (s->temps_in_use) {
         /* Clear the count so that we don't give another
          * warning immediately next time around.
@@ -1099,6 +1367,7 @@ void tcg_dump_ops(TCGContext *s)
             case INDEX_op_brcond_i64:
             case INDEX_op_setcond_i64:
             case INDEX_op_movcond_i64:
+            case INDEX_op_cmp_vec:
                 if (args[k] < ARRAY_SIZE(cond_name) && cond_name[args[k]]) {
                     col += qemu_log(",%s", cond_name[args[k++]]);
                 } else {
@@ -1334,7 +1603,7 @@ void tcg_op_remove(TCGContext *s, TCGOp *op)
     memset(op, 0, sizeof(*op));
 
 #ifdef CONFIG_PROFILER
-    s->del_op_count++;
+    s->prof.del_op_count++;
 #endif
 }
 
@@ -1406,6 +1675,32 @@ static inline void tcg_la_func_end(TCGContext *s, uint8_t *temp_state)
     memset(temp_state + s->nb_globals, TS_DEAD, s->nb_temps - s->nb_globals);
 }
 
+/* liveness analysis: a helper is about to be called.  Temps that are
+   live across the call would have to be spilled from call-clobbered
+   registers, so steer them towards call-saved registers instead.  */
+static void tcg_la_cross_call(TCGContext *s, uint8_t *temp_state,
+                              TCGRegSet *temp_prefs)
+{
+    int i;
+
+    for (i = 0; i < s->nb_temps; i++) {
+        if (!(temp_state[i] & TS_DEAD)) {
+            TCGRegSet set;
+
+            tcg_regset_andnot(set, temp_prefs[i],
+                              tcg_target_call_clobber_regs);
+            if (set == 0) {
+                tcg_regset_andnot(set,
+                                  tcg_target_available_regs[s->temps[i].type],
+                                  tcg_target_call_clobber_regs);
+            }
+            if (set != 0) {
+                temp_prefs[i] = set;
+            }
+        }
+    }
+}
+
 /* liveness analysis: end of basic block: all temps are dead, globals
    and local temps should be in memory. */
 static inline void tcg_la_bb_end(TCGContext *s, uint8_t *temp_state)
@@ -1422,13 +1717,19 @@ static inline void tcg_la_bb_end(TCGContext *s, uint8_t *temp_state)
 
 /* Liveness analysis : update the opc_arg_life array to tell if a
    given input arguments is dead. Instructions updating dead
-   temporaries are removed. */
-static void liveness_pass_1(TCGContext *s, uint8_t *temp_state)
+   temporaries are removed.
+
+   Working backwards, also collect in TEMP_PREFS the registers that
+   the later uses of each live temp would like it to be in, and record
+   them in op_output_pref for the op that defines the temp.  */
+static void liveness_pass_1(TCGContext *s, uint8_t *temp_state,
+                            TCGRegSet *temp_prefs)
 {
     int nb_globals = s->nb_globals;
     int oi, oi_prev;
 
     tcg_la_func_end(s, temp_state);
+    memset(temp_prefs, 0, s->nb_temps * sizeof(TCGRegSet));
 
     for (oi = s->gen_op_buf[0].prev; oi != 0; oi = oi_prev) {
         int i, nb_iargs, nb_oargs;
@@ -1439,6 +1740,7 @@ static void liveness_pass_1(TCGContext *s, uint8_t *temp_state)
 
         TCGOp * const op = &s->gen_op_buf[oi];
         TCGArg * const args = &s->gen_opparam_buf[op->args];
+        TCGRegSet * const output_pref = s->op_output_pref[oi];
         TCGOpcode opc = op->opc;
         const TCGOpDef *def = &tcg_op_defs[opc];
 
@@ -1475,8 +1777,12 @@ static void liveness_pass_1(TCGContext *s, uint8_t *temp_state)
                             arg_life |= SYNC_ARG << i;
                         }
                         temp_state[arg] = TS_DEAD;
+                        output_pref[i] = temp_prefs[arg];
+                        temp_prefs[arg] = 0;
                     }
 
+                    tcg_la_cross_call(s, temp_state, temp_prefs);
+
                     if (!(call_flags & (TCG_CALL_NO_WRITE_GLOBALS |
                                         TCG_CALL_NO_READ_GLOBALS))) {
                         /* globals should go back to memory */
@@ -1497,12 +1803,27 @@ static void liveness_pass_1(TCGContext *s, uint8_t *temp_state)
                             }
                         }
                     }
-                    /* input arguments are live for preceding opcodes */
+                    /* input arguments are live for preceding opcodes;
+                       those that die here would best be computed
+                       straight into their argument register */
                     for (i = nb_oargs; i < nb_iargs + nb_oargs; i++) {
+                        int nb_regs = ARRAY_SIZE(tcg_target_call_iarg_regs);
+
                         arg = args[i];
-                        if (arg != TCG_CALL_DUMMY_ARG) {
-                            temp_state[arg] &= ~TS_DEAD;
+                        if (arg == TCG_CALL_DUMMY_ARG) {
+                            continue;
                         }
+                        if (temp_state[arg] & TS_DEAD) {
+                            if (i - nb_oargs < nb_regs) {
+                                tcg_regset_clear(temp_prefs[arg]);
+                                tcg_regset_set_reg(temp_prefs[arg],
+                                    tcg_target_call_iarg_regs[i - nb_oargs]);
+                            } else {
+                                temp_prefs[arg] = tcg_target_available_regs[
+                                    s->temps[arg].type];
+                            }
+                        }
+                        temp_state[arg] &= ~TS_DEAD;
                     }
                 }
             }
@@ -1620,6 +1941,8 @@ static void liveness_pass_1(TCGContext *s, uint8_t *temp_state)
                         arg_life |= SYNC_ARG << i;
                     }
                     temp_state[arg] = TS_DEAD;
+                    output_pref[i] = temp_prefs[arg];
+                    temp_prefs[arg] = 0;
                 }
 
                 /* if end of basic block, update */
@@ -1631,18 +1954,55 @@ static void liveness_pass_1(TCGContext *s, uint8_t *temp_state)
                         temp_state[i] |= TS_MEM;
                     }
                 }
+                if (def->flags & TCG_OPF_CALL_CLOBBER) {
+                    tcg_la_cross_call(s, temp_state, temp_prefs);
+                }
 
                 /* record arguments that die in this opcode */
                 for (i = nb_oargs; i < nb_oargs + nb_iargs; i++) {
                     arg = args[i];
                     if (temp_state[arg] & TS_DEAD) {
                         arg_life |= DEAD_ARG << i;
+                        /* no later use: any register will do so far */
+                        temp_prefs[arg] =
+                            tcg_target_available_regs[s->temps[arg].type];
                     }
                 }
                 /* input arguments are live for preceding opcodes */
                 for (i = nb_oargs; i < nb_oargs + nb_iargs; i++) {
                     temp_state[args[i]] &= ~TS_DEAD;
                 }
+
+                /* narrow down the preferences with this op's constraints */
+                if (opc == INDEX_op_mov_i32 || opc == INDEX_op_mov_i64
+                    || opc == INDEX_op_mov_vec) {
+                    /* moves have no constraints, but if the source dies
+                       here it should rather be in the destination's
+                       register, so that the move can be elided.  */
+                    if (IS_DEAD_ARG(1) && output_pref[0] != 0) {
+                        temp_prefs[args[1]] = output_pref[0];
+                    }
+                } else {
+                    /* OPC may have been simplified above, so look up
+                       its definition again.  */
+                    const TCGOpDef *cdef = &tcg_op_defs[opc];
+
+                    for (i = nb_oargs; i < nb_oargs + nb_iargs; i++) {
+                        const TCGArgConstraint *ct = &cdef->args_ct[i];
+                        TCGRegSet set;
+
+                        tcg_regset_and(set, temp_prefs[args[i]], ct->u.regs);
+                        if (ct->ct & TCG_CT_IALIAS) {
+                            tcg_regset_and(set, set,
+                                           output_pref[ct->alias_index]);
+                        }
+                        if (set == 0) {
+                            /* the uses disagree; just satisfy this one */
+                            set = ct->u.regs;
+                        }
+                        temp_prefs[args[i]] = set;
+                    }
+                }
             }
             break;
         }
@@ -1884,24 +2244,36 @@ static void check_regs(TCGContext *s)
 static void temp_allocate_frame(TCGContext *s, int temp)
 {
     TCGTemp *ts;
+    tcg_target_long size;
+
     ts = &s->temps[temp];
+    switch (ts->type) {
+    case TCG_TYPE_V64:
+        size = 8;
+        break;
+    case TCG_TYPE_V128:
+        size = 16;
+        break;
+    default:
+        size = sizeof(tcg_target_long);
+        break;
+    }
 #if !(defined(__sparc__) && TCG_TARGET_REG_BITS == 64)
     /* Sparc64 stack is accessed with offset of 2047 */
-    s->current_frame_offset = (s->current_frame_offset +
-                               (tcg_target_long)sizeof(tcg_target_long) - 1) &
-        ~(sizeof(tcg_target_long) - 1);
+    s->current_frame_offset = (s->current_frame_offset + size - 1) &
+        ~(size - 1);
 #endif
-    if (s->current_frame_offset + (tcg_target_long)sizeof(tcg_target_long) >
-        s->frame_end) {
+    if (s->current_frame_offset + size > s->frame_end) {
         tcg_abort();
     }
     ts->mem_offset = s->current_frame_offset;
     ts->mem_base = s->frame_temp;
     ts->mem_allocated = 1;
-    s->current_frame_offset += sizeof(tcg_target_long);
+    s->current_frame_offset += size;
 }
 
-static void temp_load(TCGContext *, TCGTemp *, TCGRegSet, TCGRegSet);
+static void temp_load(TCGContext *, TCGTemp *, TCGRegSet, TCGRegSet,
+                      TCGRegSet);
 
 /* Mark a temporary as free or dead.  If 'free_or_dead' is negative,
    mark it free; otherwise mark it dead.  */
@@ -1950,7 +2322,7 @@ static void temp_sync(TCGContext *s, TCGTemp *ts,
                 break;
             }
             temp_load(s, ts, tcg_target_available_regs[ts->type],
-                      allocated_regs);
+                      allocated_regs, 0);
             /* fallthrough */
 
         case TEMP_VAL_REG:
@@ -1981,31 +2353,54 @@ static void tcg_reg_free(TCGContext *s, TCGReg reg, TCGRegSet allocated_regs)
     }
 }
 
-/* Allocate a register belonging to reg1 & ~reg2 */
+/* Allocate a register belonging to reg1 & ~reg2, preferably one that
+   is also in PREFERRED_REGS */
 static TCGReg tcg_reg_alloc(TCGContext *s, TCGRegSet desired_regs,
-                            TCGRegSet allocated_regs, bool rev)
+                            TCGRegSet allocated_regs,
+                            TCGRegSet preferred_regs, bool rev)
 {
-    int i, n = ARRAY_SIZE(tcg_target_reg_alloc_order);
+    int i, j, f, n = ARRAY_SIZE(tcg_target_reg_alloc_order);
     const int *order;
     TCGReg reg;
-    TCGRegSet reg_ct;
+    TCGRegSet reg_ct[2];
 
-    tcg_regset_andnot(reg_ct, desired_regs, allocated_regs);
+    tcg_regset_andnot(reg_ct[1], desired_regs, allocated_regs);
+    tcg_regset_and(reg_ct[0], reg_ct[1], preferred_regs);
     order = rev ? indirect_reg_alloc_order : tcg_target_reg_alloc_order;
 
-    /* first try free registers */
-    for(i = 0; i < n; i++) {
-        reg = order[i];
-        if (tcg_regset_test_reg(reg_ct, reg) && s->reg_to_temp[reg] == NULL)
-            return reg;
+    /* Skip the preferred set if it is empty or makes no difference.  */
+    f = (reg_ct[0] == 0 || reg_ct[0] == reg_ct[1]);
+
+    /* first try free registers, preferred ones first */
+    for (j = f; j < 2; j++) {
+        for (i = 0; i < n; i++) {
+            reg = order[i];
+            if (tcg_regset_test_reg(reg_ct[j], reg)
+                && s->reg_to_temp[reg] == NULL) {
+                return reg;
+            }
+        }
     }
 
-    /* XXX: do better spill choice */
-    for(i = 0; i < n; i++) {
-        reg = order[i];
-        if (tcg_regset_test_reg(reg_ct, reg)) {
-            tcg_reg_free(s, reg, allocated_regs);
-            return reg;
+    /* We must spill something.  A temp whose memory copy is up to date
+       can be dropped without emitting a store, so evict those first.  */
+    for (j = f; j < 2; j++) {
+        for (i = 0; i < n; i++) {
+            reg = order[i];
+            if (tcg_regset_test_reg(reg_ct[j], reg)
+                && s->reg_to_temp[reg]->mem_coherent) {
+                tcg_reg_free(s, reg, allocated_regs);
+                return reg;
+            }
+        }
+    }
+    for (j = f; j < 2; j++) {
+        for (i = 0; i < n; i++) {
+            reg = order[i];
+            if (tcg_regset_test_reg(reg_ct[j], reg)) {
+                tcg_reg_free(s, reg, allocated_regs);
+                return reg;
+            }
         }
     }
 
@@ -2013,9 +2408,9 @@ static TCGReg tcg_reg_alloc(TCGContext *s, TCGRegSet desired_regs,
 }
 
 /* Make sure the temporary is in a register.  If needed, allocate the register
-   from DESIRED while avoiding ALLOCATED.  */
+   from DESIRED while avoiding ALLOCATED, preferably from PREFERRED.  */
 static void temp_load(TCGContext *s, TCGTemp *ts, TCGRegSet desired_regs,
-                      TCGRegSet allocated_regs)
+                      TCGRegSet allocated_regs, TCGRegSet preferred_regs)
 {
     TCGReg reg;
 
@@ -2023,12 +2418,14 @@ static void temp_load(TCGContext *s, TCGTemp *ts, TCGRegSet desired_regs,
     case TEMP_VAL_REG:
         return;
     case TEMP_VAL_CONST:
-        reg = tcg_reg_alloc(s, desired_regs, allocated_regs, ts->indirect_base);
+        reg = tcg_reg_alloc(s, desired_regs, allocated_regs,
+                            preferred_regs, ts->indirect_base);
         tcg_out_movi(s, ts->type, reg, ts->val);
         ts->mem_coherent = 0;
         break;
     case TEMP_VAL_MEM:
-        reg = tcg_reg_alloc(s, desired_regs, allocated_regs, ts->indirect_base);
+        reg = tcg_reg_alloc(s, desired_regs, allocated_regs,
+                            preferred_regs, ts->indirect_base);
         tcg_out_ld(s, ts->type, reg, ts->mem_base->reg, ts->mem_offset);
         ts->mem_coherent = 1;
         break;
@@ -2130,7 +2527,8 @@ static void tcg_reg_alloc_movi(TCGContext *s, const TCGArg *args,
 }
 
 static void tcg_reg_alloc_mov(TCGContext *s, const TCGOpDef *def,
-                              const TCGArg *args, TCGLifeData arg_life)
+                              const TCGArg *args, TCGLifeData arg_life,
+                              const TCGRegSet *output_pref)
 {
     TCGRegSet allocated_regs;
     TCGTemp *ts, *ots;
@@ -2159,7 +2557,8 @@ static void tcg_reg_alloc_mov(TCGContext *s, const TCGOpDef *def,
        the SOURCE value into its own register first, that way we
        don't have to reload SOURCE the next time it is used. */
     if (ts->val_type == TEMP_VAL_MEM) {
-        temp_load(s, ts, tcg_target_available_regs[itype], allocated_regs);
+        temp_load(s, ts, tcg_target_available_regs[itype], allocated_regs,
+                  output_pref[0]);
     }
 
     tcg_debug_assert(ts->val_type == TEMP_VAL_REG);
@@ -2189,7 +2588,8 @@ static void tcg_reg_alloc_mov(TCGContext *s, const TCGOpDef *def,
                    input one. */
                 tcg_regset_set_reg(allocated_regs, ts->reg);
                 ots->reg = tcg_reg_alloc(s, tcg_target_available_regs[otype],
-                                         allocated_regs, ots->indirect_base);
+                                         allocated_regs, output_pref[0],
+                                         ots->indirect_base);
             }
             tcg_out_mov(s, otype, ots->reg, ts->reg);
         }
@@ -2204,9 +2604,10 @@ static void tcg_reg_alloc_mov(TCGContext *s, const TCGOpDef *def,
 
 static void tcg_reg_alloc_op(TCGContext *s, 
                              const TCGOpDef *def, TCGOpcode opc,
-                             const TCGArg *args, TCGLifeData arg_life)
+                             const TCGArg *args, TCGLifeData arg_life,
+                             const TCGRegSet *output_pref)
 {
-    TCGRegSet allocated_regs;
+    TCGRegSet allocated_regs, preferred_regs;
     int i, k, nb_iargs, nb_oargs;
     TCGReg reg;
     TCGArg arg;
@@ -2239,7 +2640,13 @@ static void tcg_reg_alloc_op(TCGContext *s,
             goto iarg_end;
         }
 
-        temp_load(s, ts, arg_ct->u.regs, allocated_regs);
+        /* an input that is overwritten by an output had better be
+           where the output would like to be */
+        tcg_regset_clear(preferred_regs);
+        if (arg_ct->ct & TCG_CT_IALIAS) {
+            preferred_regs = output_pref[arg_ct->alias_index];
+        }
+        temp_load(s, ts, arg_ct->u.regs, allocated_regs, preferred_regs);
 
         if (arg_ct->ct & TCG_CT_IALIAS) {
             if (ts->fixed_reg) {
@@ -2274,7 +2681,7 @@ static void tcg_reg_alloc_op(TCGContext *s,
             /* allocate a new register matching the constraint 
                and move the temporary register into it */
             reg = tcg_reg_alloc(s, arg_ct->u.regs, allocated_regs,
-                                ts->indirect_base);
+                                preferred_regs, ts->indirect_base);
             tcg_out_mov(s, ts->type, reg, ts->reg);
         }
         new_args[i] = reg;
@@ -2324,7 +2731,7 @@ static void tcg_reg_alloc_op(TCGContext *s,
                     goto oarg_end;
                 }
                 reg = tcg_reg_alloc(s, arg_ct->u.regs, allocated_regs,
-                                    ts->indirect_base);
+                                    output_pref[i], ts->indirect_base);
             }
             tcg_regset_set_reg(allocated_regs, reg);
             /* if a fixed register is used, then a move will be done afterwards */
@@ -2409,7 +2816,7 @@ static void tcg_reg_alloc_call(TCGContext *s, int nb_oargs, int nb_iargs,
         if (arg != TCG_CALL_DUMMY_ARG) {
             ts = &s->temps[arg];
             temp_load(s, ts, tcg_target_available_regs[ts->type],
-                      s->reserved_regs);
+                      s->reserved_regs, 0);
             tcg_out_st(s, ts->type, ts->reg, TCG_REG_CALL_STACK, stack_offset);
         }
 #ifndef TCG_TARGET_STACK_GROWSUP
@@ -2424,18 +2831,19 @@ static void tcg_reg_alloc_call(TCGContext *s, int nb_oargs, int nb_iargs,
         if (arg != TCG_CALL_DUMMY_ARG) {
             ts = &s->temps[arg];
             reg = tcg_target_call_iarg_regs[i];
-            tcg_reg_free(s, reg, allocated_regs);
 
             if (ts->val_type == TEMP_VAL_REG) {
                 if (ts->reg != reg) {
+                    tcg_reg_free(s, reg, allocated_regs);
                     tcg_out_mov(s, ts->type, reg, ts->reg);
                 }
             } else {
                 TCGRegSet arg_set;
 
+                tcg_reg_free(s, reg, allocated_regs);
                 tcg_regset_clear(arg_set);
                 tcg_regset_set_reg(arg_set, reg);
-                temp_load(s, ts, arg_set, allocated_regs);
+                temp_load(s, ts, arg_set, allocated_regs, 0);
             }
 
             tcg_regset_set_reg(allocated_regs, reg);
@@ -2526,15 +2934,15 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
         int n;
 
         n = s->gen_op_buf[0].prev + 1;
-        s->op_count += n;
-        if (n > s->op_count_max) {
-            s->op_count_max = n;
+        s->prof.op_count += n;
+        if (n > s->prof.op_count_max) {
+            s->prof.op_count_max = n;
         }
 
         n = s->nb_temps;
-        s->temp_count += n;
-        if (n > s->temp_count_max) {
-            s->temp_count_max = n;
+        s->prof.temp_count += n;
+        if (n > s->prof.temp_count_max) {
+            s->prof.temp_count_max = n;
         }
     }
 #endif
@@ -2549,7 +2957,7 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
 #endif
 
 #ifdef CONFIG_PROFILER
-    s->opt_time -= profile_getclock();
+    s->prof.opt_time -= profile_getclock();
 #endif
 
 #ifdef USE_TCG_OPTIMIZATIONS
@@ -2557,14 +2965,15 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
 #endif
 
 #ifdef CONFIG_PROFILER
-    s->opt_time += profile_getclock();
-    s->la_time -= profile_getclock();
+    s->prof.opt_time += profile_getclock();
+    s->prof.la_time -= profile_getclock();
 #endif
 
     {
         uint8_t *temp_state = tcg_malloc(s->nb_temps + s->nb_indirects);
+        TCGRegSet *temp_prefs = tcg_malloc(s->nb_temps * sizeof(TCGRegSet));
 
-        liveness_pass_1(s, temp_state);
+        liveness_pass_1(s, temp_state, temp_prefs);
 
         if (s->nb_indirects > 0) {
 #ifdef DEBUG_DISAS
@@ -2578,13 +2987,13 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
             /* Replace indirect temps with direct temps.  */
             if (liveness_pass_2(s, temp_state)) {
                 /* If changes were made, re-run liveness.  */
-                liveness_pass_1(s, temp_state);
+                liveness_pass_1(s, temp_state, temp_prefs);
             }
         }
     }
 
 #ifdef CONFIG_PROFILER
-    s->la_time += profile_getclock();
+    s->prof.la_time += profile_getclock();
 #endif
 
 #ifdef DEBUG_DISAS
@@ -2600,8 +3009,12 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
 
     s->code_buf = tb->tc_ptr;
     s->code_ptr = tb->tc_ptr;
+    s->data_gen_ptr = NULL;
 
     tcg_out_tb_init(s);
+#ifdef TCG_TARGET_NEED_POOL_LABELS
+    tcg_out_pool_init(s);
+#endif
 
     num_insns = -1;
     for (oi = s->gen_op_buf[0].next; oi != 0; oi = oi_next) {
@@ -2619,7 +3032,8 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
         switch (opc) {
         case INDEX_op_mov_i32:
         case INDEX_op_mov_i64:
-            tcg_reg_alloc_mov(s, def, args, arg_life);
+        case INDEX_op_mov_vec:
+            tcg_reg_alloc_mov(s, def, args, arg_life, s->op_output_pref[oi]);
             break;
         case INDEX_op_movi_i32:
         case INDEX_op_movi_i64:
@@ -2658,7 +3072,8 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
             /* Note: in order to speed up the code, it would be much
                faster to have specialized register allocator functions for
                some common argument patterns */
-            tcg_reg_alloc_op(s, def, opc, args, arg_life);
+            tcg_reg_alloc_op(s, def, opc, args, arg_life,
+                             s->op_output_pref[oi]);
             break;
         }
 #ifdef CONFIG_DEBUG_TCG
@@ -2679,6 +3094,11 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
     if (!tcg_out_tb_finalize(s)) {
         return -1;
     }
+#ifdef TCG_TARGET_NEED_POOL_LABELS
+    if (!tcg_out_pool_finalize(s)) {
+        return -1;
+    }
+#endif
 
     /* flush instruction cache */
     flush_icache_range((uintptr_t)s->code_buf, (uintptr_t)s->code_ptr);
@@ -2687,12 +3107,31 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
 }
 
 #ifdef CONFIG_PROFILER
+/* Sum the profile of all the contexts into PROF.  The counters of the
+   other threads are read while they may be updating them, which is good
+   enough for statistics.  */
+static void tcg_profile_snapshot(TCGProfile *prof)
+{
+    unsigned int i;
+
+    memset(prof, 0, sizeof(*prof));
+    qemu_mutex_lock(&tcg_regions.lock);
+    for (i = 0; i < n_tcg_ctxs; i++) {
+        tcg_profile_add(prof, &tcg_ctxs[i]->prof);
+    }
+    qemu_mutex_unlock(&tcg_regions.lock);
+}
+
 void tcg_dump_info(FILE *f, fprintf_function cpu_fprintf)
 {
-    TCGContext *s = &tcg_ctx;
-    int64_t tb_count = s->tb_count;
-    int64_t tb_div_count = tb_count ? tb_count : 1;
-    int64_t tot = s->interm_time + s->code_time;
+    TCGProfile prof, *s = &prof;
+    int64_t tb_count, tb_div_count;
+    int64_t tot;
+
+    tcg_profile_snapshot(s);
+    tb_count = s->tb_count;
+    tb_div_count = tb_count ? tb_count : 1;
+    tot = s->interm_time + s->code_time;
 
     cpu_fprintf(f, "JIT cycles          %" PRId64 " (%0.3f s at 2.4 GHz)\n",
                 tot, tot / 2.4e9);
@@ -2708,6 +3147,8 @@ void tcg_dump_info(FILE *f, fprintf_function cpu_fprintf)
                 (double)s->temp_count / tb_div_count, s->temp_count_max);
     cpu_fprintf(f, "avg host code/TB    %0.1f\n",
                 (double)s->code_out_len / tb_div_count);
+    cpu_fprintf(f, "  of which pool/TB  %0.1f\n",
+                (double)s->data_out_len / tb_div_count);
     cpu_fprintf(f, "avg search data/TB  %0.1f\n",
                 (double)s->search_out_len / tb_div_count);
     
@@ -79,6 +79,15 @@ typedef uint64_t tcg_target_ulong;
 #error unsupported
 #endif
 
+/* Oversized TCG guests make things like MTTCG hard
+ * as we can't use atomics for cputlb updates.
+ */
+#if TARGET_LONG_BITS > TCG_TARGET_REG_BITS
+#define TCG_OVERSIZED_GUEST 1
+#else
+#define TCG_OVERSIZED_GUEST 0
+#endif
+
 #if TCG_TARGET_NB_REGS <= 32
 typedef uint32_t TCGRegSet;
 #elif TCG_TARGET_NB_REGS <= 64
@@ -111,7 +120,12 @@ typedef uint64_t TCGRegSet;
 #define TCG_TARGET_HAS_eqv_i64          0
 #define TCG_TARGET_HAS_nand_i64         0
 #define TCG_TARGET_HAS_nor_i64          0
+#define TCG_TARGET_HAS_clz_i64          0
+#define TCG_TARGET_HAS_ctz_i64          0
+#define TCG_TARGET_HAS_ctpop_i64        0
 #define TCG_TARGET_HAS_deposit_i64      0
+#define TCG_TARGET_HAS_extract_i64      0
+#define TCG_TARGET_HAS_sextract_i64     0
 #define TCG_TARGET_HAS_movcond_i64      0
 #define TCG_TARGET_HAS_add2_i64         0
 #define TCG_TARGET_HAS_sub2_i64         0
@@ -130,6 +144,27 @@ typedef uint64_t TCGRegSet;
 #ifndef TCG_TARGET_deposit_i64_valid
 #define TCG_TARGET_deposit_i64_valid(ofs, len) 1
 #endif
+#ifndef TCG_TARGET_extract_i32_valid
+#define TCG_TARGET_extract_i32_valid(ofs, len) 1
+#endif
+#ifndef TCG_TARGET_extract_i64_valid
+#define TCG_TARGET_extract_i64_valid(ofs, len) 1
+#endif
+
+/* Host vector registers.  Backends that have them define
+   TCG_TARGET_HAS_v64 and/or TCG_TARGET_HAS_v128, and implement
+   tcg_can_emit_vec_op.  */
+#if !defined(TCG_TARGET_HAS_v64) && !defined(TCG_TARGET_HAS_v128)
+#define TCG_TARGET_MAYBE_vec            0
+#else
+#define TCG_TARGET_MAYBE_vec            1
+#endif
+#ifndef TCG_TARGET_HAS_v64
+#define TCG_TARGET_HAS_v64              0
+#endif
+#ifndef TCG_TARGET_HAS_v128
+#define TCG_TARGET_HAS_v128             0
+#endif
 
 /* Only one of DIV or DIV2 should be defined.  */
 #if defined(TCG_TARGET_HAS_div_i32)
@@ -207,6 +242,24 @@ typedef struct TCGRelocation {
     intptr_t addend;
 } TCGRelocation; 
 
+/* References from generated code to host addresses outside of it.  They
+   are recorded when the code is to be saved and loaded again at another
+   address, see tcg_out_code_reloc.  */
+typedef enum TCGCodeRelocKind {
+    /* A 64-bit absolute address.  */
+    TCG_CODE_RELOC_ABS64,
+    /* A 32-bit displacement from the end of the field.  */
+    TCG_CODE_RELOC_PCREL32,
+} TCGCodeRelocKind;
+
+typedef struct TCGCodeReloc {
+    uint32_t offset;            /* of the field, from the start of the code */
+    TCGCodeRelocKind kind;
+    uintptr_t target;
+} TCGCodeReloc;
+
+#define TCG_MAX_CODE_RELOCS 256
+
 typedef struct TCGLabel {
     unsigned has_value : 1;
     unsigned id : 31;
@@ -235,6 +288,9 @@ typedef struct TCGPool {
 typedef enum TCGType {
     TCG_TYPE_I32,
     TCG_TYPE_I64,
+    /* Host vector registers, see TCG_TARGET_HAS_v64/v128.  */
+    TCG_TYPE_V64,
+    TCG_TYPE_V128,
     TCG_TYPE_COUNT, /* number of different types */
 
     /* An alias for the size of the host register.  */
@@ -388,6 +444,7 @@ typedef tcg_target_ulong TCGArg;
 typedef struct TCGv_i32_d *TCGv_i32;
 typedef struct TCGv_i64_d *TCGv_i64;
 typedef struct TCGv_ptr_d *TCGv_ptr;
+typedef struct TCGv_vec_d *TCGv_vec;
 typedef TCGv_ptr TCGv_env;
 #if TARGET_LONG_BITS == 32
 #define TCGv TCGv_i32
@@ -412,6 +469,11 @@ static inline TCGv_ptr QEMU_ARTIFICIAL MAKE_TCGV_PTR(intptr_t i)
     return (TCGv_ptr)i;
 }
 
+static inline TCGv_vec QEMU_ARTIFICIAL MAKE_TCGV_VEC(intptr_t i)
+{
+    return (TCGv_vec)i;
+}
+
 static inline intptr_t QEMU_ARTIFICIAL GET_TCGV_I32(TCGv_i32 t)
 {
     return (intptr_t)t;
@@ -427,6 +489,11 @@ static inline intptr_t QEMU_ARTIFICIAL GET_TCGV_PTR(TCGv_ptr t)
     return (intptr_t)t;
 }
 
+static inline intptr_t QEMU_ARTIFICIAL GET_TCGV_VEC(TCGv_vec t)
+{
+    return (intptr_t)t;
+}
+
 #if TCG_TARGET_REG_BITS == 32
 #define TCGV_LOW(t) MAKE_TCGV_I32(GET_TCGV_I64(t))
 #define TCGV_HIGH(t) MAKE_TCGV_I32(GET_TCGV_I64(t) + 1)
@@ -615,6 +682,66 @@ QEMU_BUILD_BUG_ON(OPPARAM_BUF_SIZE > (1 << 14));
 /* Make sure that we don't overflow 64 bits without noticing.  */
 QEMU_BUILD_BUG_ON(sizeof(TCGOp) > 8);
 
+/* A slice of the code generation buffer.  Code for a TB never crosses
+   a region boundary, so a full region can be reclaimed on its own
+   without flushing the whole buffer.  A region is filled by the one
+   TCGContext that owns it, so that each thread translates into its own
+   region without taking a lock.  */
+typedef struct TCGRegion {
+    void *start;
+    void *end;
+    /* End of the code generated so far.  */
+    void *ptr;
+    /* TBs whose code lives in this region, in increasing tc_ptr order.  */
+    TranslationBlock *tbs;
+    int nb_tbs;
+    /* The context filling the region, or NULL once it is full.  */
+    TCGContext *owner;
+} TCGRegion;
+
+/* Regions are no smaller than this, and there are at most
+   TCG_MAX_REGIONS of them.  */
+#define TCG_REGION_MIN_SIZE (2 * 1024 * 1024)
+#define TCG_MAX_REGIONS     64
+
+/* The regions of the buffer, shared by all the contexts.  The layout
+   does not change after tcg_prologue_init.  LOCK protects the owner of
+   each region and NEXT; only the owner writes ptr and nb_tbs.  Regions
+   are only freed, by tb_flush or by reclaiming one, while all vCPUs are
+   outside generated code and the translator.  */
+typedef struct TCGRegionState {
+    QemuMutex lock;
+    TCGRegion *regions;
+    size_t n;
+    size_t size;
+    int max_tbs;
+    /* Regions are handed out in turn starting from here, so that the
+       first full one found from here is the oldest.  */
+    size_t next;
+} TCGRegionState;
+
+#ifdef CONFIG_PROFILER
+typedef struct TCGProfile {
+    int64_t tb_count1;
+    int64_t tb_count;
+    int64_t op_count; /* total insn count */
+    int op_count_max; /* max insn per TB */
+    int64_t temp_count;
+    int temp_count_max;
+    int64_t del_op_count;
+    int64_t code_in_len;
+    int64_t code_out_len;
+    int64_t data_out_len;
+    int64_t search_out_len;
+    int64_t interm_time;
+    int64_t code_time;
+    int64_t la_time;
+    int64_t opt_time;
+    int64_t restore_count;
+    int64_t restore_time;
+} TCGProfile;
+#endif
+
 struct TCGContext {
     uint8_t *pool_cur, *pool_end;
     TCGPool *pool_first, *pool_current, *pool_first_large;
@@ -640,23 +767,7 @@ struct TCGContext {
     GHashTable *helpers;
 
 #ifdef CONFIG_PROFILER
-    /* profiling info */
-    int64_t tb_count1;
-    int64_t tb_count;
-    int64_t op_count; /* total insn count */
-    int op_count_max; /* max insn per TB */
-    int64_t temp_count;
-    int temp_count_max;
-    int64_t del_op_count;
-    int64_t code_in_len;
-    int64_t code_out_len;
-    int64_t search_out_len;
-    int64_t interm_time;
-    int64_t code_time;
-    int64_t la_time;
-    int64_t opt_time;
-    int64_t restore_count;
-    int64_t restore_time;
+    TCGProfile prof;
 #endif
 
 #ifdef CONFIG_DEBUG_TCG
@@ -673,22 +784,49 @@ struct TCGContext {
        extension that allows arithmetic on void*.  */
     int code_gen_max_blocks;
     void *code_gen_prologue;
+    void *code_gen_epilogue;
     void *code_gen_buffer;
     size_t code_gen_buffer_size;
     void *code_gen_ptr;
 
-    /* Threshold to flush the translated code buffer.  */
+    /* Threshold to switch to another region of the buffer.  */
     void *code_gen_highwater;
 
-    TBContext tb_ctx;
+    /* The region this context generates code into, or NULL if it has
+       to get one first.  */
+    TCGRegion *region;
 
     /* Track which vCPU triggers events */
     CPUState *cpu;                      /* *_trans */
     TCGv_env tcg_env;                   /* *_exec  */
 
+    /* cflags of the TB being translated */
+    uint32_t tb_cflags;
+
+    /* State kept by gen_tb_start for gen_tb_end, see gen-icount.h.  */
+    TCGLabel *exitreq_label;
+    TCGLabel *icount_label;
+    int icount_start_insn_idx;
+    int exec_count_start_idx;
+    int exec_count_end_idx;
+    bool superblock_candidate;
+
+    /* Relocations of the code being generated.  Set nb_code_relocs to
+       0 to record them; it is -1 if they are not recorded or if some of
+       them could not be.  */
+    int nb_code_relocs;
+    TCGCodeReloc code_relocs[TCG_MAX_CODE_RELOCS];
+
     /* The TCGBackendData structure is private to tcg-target.inc.c.  */
     struct TCGBackendData *be;
 
+    /* Start of the constant pool at the end of the code being generated,
+       or NULL if the code has none.  */
+    void *data_gen_ptr;
+#ifdef TCG_TARGET_NEED_POOL_LABELS
+    struct TCGLabelPoolData *pool_labels;
+#endif
+
     TCGTempSet free_temps[TCG_TYPE_COUNT * 2];
     TCGTemp temps[TCG_MAX_TEMPS]; /* globals first, temps after */
 
@@ -699,23 +837,42 @@ struct TCGContext {
     TCGOp gen_op_buf[OPC_BUF_SIZE];
     TCGArg gen_opparam_buf[OPPARAM_BUF_SIZE];
 
+    /* Registers preferred for the outputs of each op, computed by the
+       liveness pass from how the outputs are used later on.  Indexed
+       like gen_op_buf.  */
+    TCGRegSet op_output_pref[OPC_BUF_SIZE][2];
+
     uint16_t gen_insn_end_off[TCG_MAX_INSNS];
     target_ulong gen_insn_data[TCG_MAX_INSNS][TARGET_INSN_START_WORDS];
 };
 
-extern TCGContext tcg_ctx;
+/* TCG_INIT_CTX is set up by tcg_context_init and the target's translator
+   initialisation.  Each thread that translates code gets its own copy
+   of it from tcg_register_thread; TCG_CTX points to that copy.  */
+extern TCGContext tcg_init_ctx;
+extern __thread TCGContext *tcg_ctx;
+extern TCGRegionState tcg_regions;
 extern bool parallel_cpus;
 
+/* Host CPU features that tcg_target_init found and that change the code
+   emitted by the backend, in a backend-specific encoding.  Code saved by
+   one process is only valid for another with the same value.  */
+extern uint32_t tcg_target_features;
+
+/* False if the generic vector operations must be expanded to integer
+   operations even on hosts with vector registers, see tcg-op-gvec.c.  */
+extern bool tcg_host_vectors;
+
 static inline void tcg_set_insn_param(int op_idx, int arg, TCGArg v)
 {
-    int op_argi = tcg_ctx.gen_op_buf[op_idx].args;
-    tcg_ctx.gen_opparam_buf[op_argi + arg] = v;
+    int op_argi = tcg_ctx->gen_op_buf[op_idx].args;
+    tcg_ctx->gen_opparam_buf[op_argi + arg] = v;
 }
 
 /* The number of opcodes emitted so far.  */
 static inline int tcg_op_buf_count(void)
 {
-    return tcg_ctx.gen_next_op_idx;
+    return tcg_ctx->gen_next_op_idx;
 }
 
 /* Test for whether to terminate the TB for using too many opcodes.  */
@@ -735,13 +892,13 @@ void tb_lock_reset(void);
 
 static inline void *tcg_malloc(int size)
 {
-    TCGContext *s = &tcg_ctx;
+    TCGContext *s = tcg_ctx;
     uint8_t *ptr, *ptr_end;
     size = (size + sizeof(long) - 1) & ~(sizeof(long) - 1);
     ptr = s->pool_cur;
     ptr_end = ptr + size;
     if (unlikely(ptr_end > s->pool_end)) {
-        return tcg_malloc_internal(&tcg_ctx, size);
+        return tcg_malloc_internal(tcg_ctx, size);
     } else {
         s->pool_cur = ptr_end;
         return ptr;
@@ -749,7 +906,11 @@ static inline void *tcg_malloc(int size)
 }
 
 void tcg_context_init(TCGContext *s);
+void tcg_register_thread(void);
+void tcg_unregister_thread(void);
 void tcg_prologue_init(TCGContext *s);
+bool tcg_region_alloc(TCGContext *s);
+void tcg_region_reset_all(void);
 void tcg_func_start(TCGContext *s);
 
 int tcg_gen_code(TCGContext *s, TranslationBlock *tb);
@@ -763,9 +924,11 @@ TCGv_i64 tcg_global_reg_new_i64(TCGReg reg, const char *name);
 
 TCGv_i32 tcg_temp_new_internal_i32(int temp_local);
 TCGv_i64 tcg_temp_new_internal_i64(int temp_local);
+TCGv_vec tcg_temp_new_vec(TCGType type);
 
 void tcg_temp_free_i32(TCGv_i32 arg);
 void tcg_temp_free_i64(TCGv_i64 arg);
+void tcg_temp_free_vec(TCGv_vec arg);
 
 static inline TCGv_i32 tcg_global_mem_new_i32(TCGv_ptr reg, intptr_t offset,
                                               const char *name)
@@ -875,6 +1038,18 @@ do {\
 
 void tcg_add_target_add_op_defs(const TCGTargetOpDef *tdefs);
 
+/* Return true if the host can emit the vector operation OPC, on
+   vectors of TYPE with elements of 8 << VECE bits.  */
+#if TCG_TARGET_MAYBE_vec
+bool tcg_can_emit_vec_op(TCGOpcode opc, TCGType type, unsigned vece);
+#else
+static inline bool tcg_can_emit_vec_op(TCGOpcode opc, TCGType type,
+                                       unsigned vece)
+{
+    return false;
+}
+#endif
+
 #if UINTPTR_MAX == UINT32_MAX
 #define TCGV_NAT_TO_PTR(n) MAKE_TCGV_PTR(GET_TCGV_I32(n))
 #define TCGV_PTR_TO_NAT(n) MAKE_TCGV_I32(GET_TCGV_PTR(n))
@@ -1032,15 +1207,17 @@ static inline unsigned get_mmuidx(TCGMemOpIdx oi)
  * @tb_ptr: address of generated code for the TB to execute
  *
  * Start executing code from a given translation block.
- * Where translation blocks have been linked, execution
- * may proceed from the given TB into successive ones.
+ * Where translation blocks have been linked, or are reached
+ * through goto_ptr, execution may proceed from the given TB
+ * into successive ones.
  * Control eventually returns only when some action is needed
  * from the top-level loop: either control must pass to a TB
  * which has not yet been directly linked, or an asynchronous
  * event such as an interrupt needs handling.
  *
  * Return: The return value is the value passed to the corresponding
- * tcg_gen_exit_tb() at translation time of the last TB attempted to execute.
+ * tcg_gen_exit_tb() at translation time of the last TB attempted to execute,
+ * or zero if a goto_ptr found no TB to continue with.
  * The value is either zero or a 4-byte aligned pointer to that TB combined
  * with additional information in its two least significant bits. The
  * additional information is encoded as follows:
@@ -1081,7 +1258,7 @@ static inline unsigned get_mmuidx(TCGMemOpIdx oi)
 uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr);
 #else
 # define tcg_qemu_tb_exec(env, tb_ptr) \
-    ((uintptr_t (*)(void *, void *))tcg_ctx.code_gen_prologue)(env, tb_ptr)
+    ((uintptr_t (*)(void *, void *))tcg_ctx->code_gen_prologue)(env, tb_ptr)
 #endif
 
 void tcg_register_jit(void *buf, size_t buf_size);
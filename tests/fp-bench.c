@@ -0,0 +1,219 @@
+/*
+ * softfloat micro-benchmark
+ *
+ * Measures the throughput of the basic float32/float64 operations, either
+ * through the software implementation or through the host FPU fast path.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+#include "fpu/softfloat.h"
+
+#define N_OPERANDS 1024
+
+enum op {
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_SQRT,
+};
+
+static const char * const op_names[] = {
+    [OP_ADD] = "add",
+    [OP_SUB] = "sub",
+    [OP_MUL] = "mul",
+    [OP_DIV] = "div",
+    [OP_SQRT] = "sqrt",
+};
+
+static enum op op = OP_ADD;
+static bool use_double;
+static bool use_soft;
+static uint64_t n_ops = 100 * 1000 * 1000;
+
+static float32 f32_ops[N_OPERANDS][2];
+static float64 f64_ops[N_OPERANDS][2];
+
+static const char commands_string[] =
+    " -o = operation (add, sub, mul, div, sqrt; default add)\n"
+    " -p = precision (single, double; default single)\n"
+    " -s = always use the software implementation\n"
+    " -n = number of operations (default 100000000)";
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+static uint64_t xorshift64star(uint64_t x)
+{
+    x ^= x >> 12; /* a */
+    x ^= x << 25; /* b */
+    x ^= x >> 27; /* c */
+    return x * UINT64_C(2685821657736338717);
+}
+
+/* Normal operands between 1 and 2, so that no operation leaves the fast
+ * path because of an underflow or overflow.
+ */
+static void init_operands(void)
+{
+    uint64_t r = 1;
+    int i, j;
+
+    for (i = 0; i < N_OPERANDS; i++) {
+        for (j = 0; j < 2; j++) {
+            r = xorshift64star(r);
+            f32_ops[i][j] = make_float32(0x3f800000 | (r & 0x7fffff));
+            f64_ops[i][j] = make_float64(0x3ff0000000000000ULL |
+                                         (r & 0xfffffffffffffULL));
+        }
+    }
+}
+
+static uint64_t run_float32(float_status *s)
+{
+    uint32_t acc = 0;
+    uint64_t i;
+
+    for (i = 0; i < n_ops; i++) {
+        float32 a = f32_ops[i % N_OPERANDS][0];
+        float32 b = f32_ops[i % N_OPERANDS][1];
+        float32 r;
+
+        if (use_soft) {
+            s->float_exception_flags = 0;
+        }
+        switch (op) {
+        case OP_ADD:
+            r = float32_add(a, b, s);
+            break;
+        case OP_SUB:
+            r = float32_sub(a, b, s);
+            break;
+        case OP_MUL:
+            r = float32_mul(a, b, s);
+            break;
+        case OP_DIV:
+            r = float32_div(a, b, s);
+            break;
+        case OP_SQRT:
+            r = float32_sqrt(a, s);
+            break;
+        default:
+            g_assert_not_reached();
+        }
+        acc ^= float32_val(r);
+    }
+    return acc;
+}
+
+static uint64_t run_float64(float_status *s)
+{
+    uint64_t acc = 0;
+    uint64_t i;
+
+    for (i = 0; i < n_ops; i++) {
+        float64 a = f64_ops[i % N_OPERANDS][0];
+        float64 b = f64_ops[i % N_OPERANDS][1];
+        float64 r;
+
+        if (use_soft) {
+            s->float_exception_flags = 0;
+        }
+        switch (op) {
+        case OP_ADD:
+            r = float64_add(a, b, s);
+            break;
+        case OP_SUB:
+            r = float64_sub(a, b, s);
+            break;
+        case OP_MUL:
+            r = float64_mul(a, b, s);
+            break;
+        case OP_DIV:
+            r = float64_div(a, b, s);
+            break;
+        case OP_SQRT:
+            r = float64_sqrt(a, s);
+            break;
+        default:
+            g_assert_not_reached();
+        }
+        acc ^= float64_val(r);
+    }
+    return acc;
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c, i;
+
+    for (;;) {
+        c = getopt(argc, argv, "hn:o:p:s");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 'n':
+            n_ops = atoll(optarg);
+            break;
+        case 'o':
+            for (i = 0; i < ARRAY_SIZE(op_names); i++) {
+                if (!strcmp(optarg, op_names[i])) {
+                    op = i;
+                    break;
+                }
+            }
+            if (i == ARRAY_SIZE(op_names)) {
+                fprintf(stderr, "Unknown operation '%s'\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'p':
+            if (!strcmp(optarg, "double")) {
+                use_double = true;
+            } else if (strcmp(optarg, "single")) {
+                fprintf(stderr, "Unknown precision '%s'\n", optarg);
+                exit(1);
+            }
+            break;
+        case 's':
+            use_soft = true;
+            break;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    /* Operations that set the inexact flag keep it set, so after the first
+     * one the host FPU is used unless -s clears the flags every time.
+     */
+    float_status status = {
+        .float_rounding_mode = float_round_nearest_even,
+        .float_exception_flags = float_flag_inexact,
+    };
+    int64_t start, elapsed;
+    uint64_t acc;
+
+    parse_args(argc, argv);
+    init_operands();
+
+    start = get_clock();
+    acc = use_double ? run_float64(&status) : run_float32(&status);
+    elapsed = get_clock() - start;
+
+    printf("%s %s%s: %.2f MFlops (checksum %" PRIx64 ")\n",
+           use_double ? "float64" : "float32", op_names[op],
+           use_soft ? " (soft)" : "",
+           (double)n_ops * 1000 / elapsed, acc);
+    return 0;
+}
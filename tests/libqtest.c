@@ -621,6 +621,18 @@ int64_t qtest_clock_set(QTestState *s, int64_t val)
     return qtest_clock_rsp(s);
 }
 
+int qtest_flatview_check(QTestState *s)
+{
+    gchar **words;
+    int n;
+
+    qtest_sendf(s, "flatview_check\n");
+    words = qtest_rsp(s, 2);
+    n = g_ascii_strtoll(words[1], NULL, 0);
+    g_strfreev(words);
+    return n;
+}
+
 void qtest_irq_intercept_out(QTestState *s, const char *qom_path)
 {
     qtest_sendf(s, "irq_intercept_out %s\n", qom_path);
@@ -409,6 +409,17 @@ int64_t qtest_clock_step(QTestState *s, int64_t step);
  */
 int64_t qtest_clock_set(QTestState *s, int64_t val);
 
+/**
+ * qtest_flatview_check:
+ * @s: QTestState instance to operate on.
+ *
+ * Compare the flat view of each address space with a rendering of its
+ * memory regions from scratch.
+ *
+ * Returns: The number of address spaces whose flat view is out of date.
+ */
+int qtest_flatview_check(QTestState *s);
+
 /**
  * qtest_big_endian:
  * @s: QTestState instance to operate on.
@@ -881,6 +892,19 @@ static inline int64_t clock_set(int64_t val)
     return qtest_clock_set(global_qtest, val);
 }
 
+/**
+ * flatview_check:
+ *
+ * Compare the flat view of each address space with a rendering of its
+ * memory regions from scratch.
+ *
+ * Returns: The number of address spaces whose flat view is out of date.
+ */
+static inline int flatview_check(void)
+{
+    return qtest_flatview_check(global_qtest);
+}
+
 /**
  * target_big_endian:
  *
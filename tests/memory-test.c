@@ -0,0 +1,310 @@
+/*
+ * Memory API tests on a PC machine
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "libqtest.h"
+
+#define LOW(x) ((x) & 0xff)
+#define HIGH(x) ((x) >> 8)
+
+#define BOOT_SECTOR_ADDRESS 0x7c00
+#define RESULT_OFFSET       0x88
+#define SIGNATURE_OFFSET    0x84
+#define SIGNATURE           0xdead
+
+/* Written by the guest to RDBAL and RDBAH with a single 64-bit access.  */
+#define RDBA_LOW            0x76543210
+#define RDBA_HIGH           0xfedcba98
+
+/*
+ * Switch to flat protected mode, then access the e1000 device at 00:04.0,
+ * whose BAR 0 SeaBIOS has mapped.  The MMIO ops implement 32-bit accesses
+ * only, and e1000_mmio_write() ignores the size, so a 64-bit access must
+ * be split into two dword accesses by access_with_adjusted_size; passed
+ * straight to the device, it would only reach the first register.
+ *
+ * The guest writes the receive descriptor base address, RDBAL and RDBAH,
+ * with an MMX movq, reads each register back with a dword access, then
+ * both with a movq.  The results go to RESULT_OFFSET, then SIGNATURE is
+ * written.
+ */
+static uint8_t boot_sector[0x200] = {
+    /* 7c00: cli */
+    [0x00] = 0xfa,
+    /* 7c01: xor %ax,%ax */
+    [0x01] = 0x31, 0xc0,
+    /* 7c03: mov %ax,%ds */
+    [0x03] = 0x8e, 0xd8,
+    /* 7c05: lgdtl 0x7cb8 */
+    [0x05] = 0x66, 0x0f, 0x01, 0x16, 0xb8, 0x7c,
+    /* 7c0b: mov %cr0,%eax */
+    [0x0b] = 0x0f, 0x20, 0xc0,
+    /* 7c0e: or $1,%al */
+    [0x0e] = 0x0c, 0x01,
+    /* 7c10: mov %eax,%cr0 */
+    [0x10] = 0x0f, 0x22, 0xc0,
+    /* 7c13: ljmpl $0x08,$0x7c1b */
+    [0x13] = 0x66, 0xea, 0x1b, 0x7c, 0x00, 0x00, 0x08, 0x00,
+
+    /* 32-bit code from here on */
+    /* 7c1b: mov $0x10,%eax */
+    [0x1b] = 0xb8, 0x10, 0x00, 0x00, 0x00,
+    /* 7c20: mov %eax,%ds */
+    [0x20] = 0x8e, 0xd8,
+    /* 7c22: mov %eax,%es */
+    [0x22] = 0x8e, 0xc0,
+    /* 7c24: mov %eax,%ss */
+    [0x24] = 0x8e, 0xd0,
+    /* 7c26: mov $0x80002010,%eax (BAR 0 of 00:04.0) */
+    [0x26] = 0xb8, 0x10, 0x20, 0x00, 0x80,
+    /* 7c2b: mov $0xcf8,%dx */
+    [0x2b] = 0x66, 0xba, 0xf8, 0x0c,
+    /* 7c2f: out %eax,(%dx) */
+    [0x2f] = 0xef,
+    /* 7c30: mov $0xcfc,%dx */
+    [0x30] = 0x66, 0xba, 0xfc, 0x0c,
+    /* 7c34: in (%dx),%eax */
+    [0x34] = 0xed,
+    /* 7c35: and $0xfffffff0,%eax */
+    [0x35] = 0x83, 0xe0, 0xf0,
+    /* 7c38: mov %eax,%ebx */
+    [0x38] = 0x89, 0xc3,
+    /* 7c3a: movq 0x7c98,%mm0 */
+    [0x3a] = 0x0f, 0x6f, 0x05, 0x98, 0x7c, 0x00, 0x00,
+    /* 7c41: movq %mm0,0x2800(%ebx) (RDBAL and RDBAH) */
+    [0x41] = 0x0f, 0x7f, 0x83, 0x00, 0x28, 0x00, 0x00,
+    /* 7c48: mov 0x2800(%ebx),%eax */
+    [0x48] = 0x8b, 0x83, 0x00, 0x28, 0x00, 0x00,
+    /* 7c4e: mov %eax,0x7c88 */
+    [0x4e] = 0xa3, 0x88, 0x7c, 0x00, 0x00,
+    /* 7c53: mov 0x2804(%ebx),%eax */
+    [0x53] = 0x8b, 0x83, 0x04, 0x28, 0x00, 0x00,
+    /* 7c59: mov %eax,0x7c8c */
+    [0x59] = 0xa3, 0x8c, 0x7c, 0x00, 0x00,
+    /* 7c5e: movq 0x2800(%ebx),%mm1 */
+    [0x5e] = 0x0f, 0x6f, 0x8b, 0x00, 0x28, 0x00, 0x00,
+    /* 7c65: movq %mm1,0x7c90 */
+    [0x65] = 0x0f, 0x7f, 0x0d, 0x90, 0x7c, 0x00, 0x00,
+    /* 7c6c: movw $SIGNATURE,0x7c84 */
+    [0x6c] = 0x66, 0xc7, 0x05, 0x84, 0x7c, 0x00, 0x00,
+             LOW(SIGNATURE), HIGH(SIGNATURE),
+    /* 7c75: hlt */
+    [0x75] = 0xf4,
+    /* 7c76: jmp 0x7c75 */
+    [0x76] = 0xeb, 0xfd,
+
+    [SIGNATURE_OFFSET] = LOW(0xface),
+    [SIGNATURE_OFFSET + 1] = HIGH(0xface),
+
+    /* 7c98: RDBA_HIGH << 32 | RDBA_LOW */
+    [0x98] = 0x10, 0x32, 0x54, 0x76, 0x98, 0xba, 0xdc, 0xfe,
+
+    /* 7ca0: GDT with a null descriptor, then flat code and data */
+    [0xa8] = 0xff, 0xff, 0x00, 0x00, 0x00, 0x9a, 0xcf, 0x00,
+    [0xb0] = 0xff, 0xff, 0x00, 0x00, 0x00, 0x92, 0xcf, 0x00,
+    /* 7cb8: GDT limit and base */
+    [0xb8] = 0x17, 0x00, 0xa0, 0x7c, 0x00, 0x00,
+
+    /* End of boot sector marker */
+    [0x1fe] = 0x55,
+    [0x1ff] = 0xaa,
+};
+
+static void test_direct_e1000(void)
+{
+    char disk[] = "/tmp/qtest-memory-disk-XXXXXX";
+    uint32_t result = BOOT_SECTOR_ADDRESS + RESULT_OFFSET;
+    uint16_t signature = 0;
+    char *args;
+    int fd, i;
+
+    fd = mkstemp(disk);
+    g_assert(fd >= 0);
+    g_assert(write(fd, boot_sector, sizeof(boot_sector)) ==
+             sizeof(boot_sector));
+    close(fd);
+
+    /* The guest accesses go through the TLB, so they need TCG */
+    args = g_strdup_printf("-machine accel=tcg -nodefaults "
+                           "-drive file=%s,format=raw "
+                           "-device e1000,addr=04.0,romfile=",
+                           disk);
+    qtest_start(args);
+
+    /* Wait at most 90 seconds for the firmware to boot the disk */
+    for (i = 0; i < 900; i++) {
+        signature = readw(BOOT_SECTOR_ADDRESS + SIGNATURE_OFFSET);
+        if (signature == SIGNATURE) {
+            break;
+        }
+        g_usleep(100 * 1000);
+    }
+    g_assert_cmphex(signature, ==, SIGNATURE);
+
+    /* Both registers were written by the 64-bit store...  */
+    g_assert_cmphex(readl(result), ==, RDBA_LOW);
+    g_assert_cmphex(readl(result + 4), ==, RDBA_HIGH);
+    /* ... and are both read by the 64-bit load.  */
+    g_assert_cmphex(readq(result + 8), ==,
+                    (uint64_t)RDBA_HIGH << 32 | RDBA_LOW);
+
+    qtest_quit(global_qtest);
+    unlink(disk);
+    g_free(args);
+}
+
+/*
+ * Incremental FlatView rendering: program random values in the registers
+ * of the PCI devices and of the host bridge that change the memory
+ * topology.  BARs and bridge windows overlap each other, RAM and the VGA
+ * window; PAM and SMRAM toggle aliases of RAM.  After each change, the
+ * view of each address space must be the same as a full render.
+ */
+
+#define RENDER_STEPS 500
+
+/* Devices, as bus << 8 | devfn */
+#define I440FX      0x000
+#define VIRTIO_NET  0x020
+#define BRIDGE      0x028
+#define E1000       0x108
+#define VGA         0x110
+
+enum {
+    REG_CMD,            /* PCI_COMMAND */
+    REG_MEM_BAR,        /* 32-bit memory BAR */
+    REG_IO_BAR,
+    REG_MEM_WINDOW,     /* bridge memory base or limit */
+    REG_IO_WINDOW,      /* bridge I/O base or limit */
+    REG_BRIDGE_CTL,     /* bridge VGA enable */
+    REG_PAM,
+    REG_SMRAM,
+};
+
+typedef struct RenderReg {
+    int dev;
+    int offset;
+    int kind;
+} RenderReg;
+
+static const RenderReg render_regs[] = {
+    { VIRTIO_NET, 0x04, REG_CMD },
+    { VIRTIO_NET, 0x10, REG_IO_BAR },
+    { VIRTIO_NET, 0x14, REG_MEM_BAR },
+    { VIRTIO_NET, 0x20, REG_MEM_BAR },
+    { BRIDGE, 0x04, REG_CMD },
+    { BRIDGE, 0x1c, REG_IO_WINDOW },
+    { BRIDGE, 0x1d, REG_IO_WINDOW },
+    { BRIDGE, 0x20, REG_MEM_WINDOW },
+    { BRIDGE, 0x22, REG_MEM_WINDOW },
+    { BRIDGE, 0x3e, REG_BRIDGE_CTL },
+    { E1000, 0x04, REG_CMD },
+    { E1000, 0x10, REG_MEM_BAR },
+    { E1000, 0x14, REG_IO_BAR },
+    { VGA, 0x04, REG_CMD },
+    { VGA, 0x10, REG_MEM_BAR },
+    { I440FX, 0x59, REG_PAM },
+    { I440FX, 0x5a, REG_PAM },
+    { I440FX, 0x5e, REG_PAM },
+    { I440FX, 0x5f, REG_PAM },
+    { I440FX, 0x72, REG_SMRAM },
+};
+
+static void pci_config_write(int dev, int offset, int size, uint32_t val)
+{
+    outl(0xcf8, 0x80000000 | dev << 8 | (offset & ~3));
+    switch (size) {
+    case 1:
+        outb(0xcfc + (offset & 3), val);
+        break;
+    case 2:
+        outw(0xcfc + (offset & 2), val);
+        break;
+    default:
+        outl(0xcfc, val);
+        break;
+    }
+}
+
+static void render_step(void)
+{
+    const RenderReg *reg;
+    uint32_t r = g_test_rand_int();
+
+    reg = &render_regs[g_test_rand_int_range(0, ARRAY_SIZE(render_regs))];
+    switch (reg->kind) {
+    case REG_CMD:
+        /* I/O, memory and bus master enable */
+        pci_config_write(reg->dev, reg->offset, 2, r & 7);
+        break;
+    case REG_MEM_BAR:
+        /* Mostly in the PCI hole, sometimes over low RAM and VGA */
+        if (r & 3) {
+            pci_config_write(reg->dev, reg->offset, 4,
+                             0xe0000000 | (r & 0x003ff000));
+        } else {
+            pci_config_write(reg->dev, reg->offset, 4, r & 0x000ff000);
+        }
+        break;
+    case REG_IO_BAR:
+        pci_config_write(reg->dev, reg->offset, 4, 0xc000 | (r & 0x3fe0));
+        break;
+    case REG_MEM_WINDOW:
+        /* Bits 31:20 of the address */
+        pci_config_write(reg->dev, reg->offset, 2, 0xe000 | (r & 0x0030));
+        break;
+    case REG_IO_WINDOW:
+        /* Bits 15:12 of the address */
+        pci_config_write(reg->dev, reg->offset, 1, 0xc0 | (r & 0x30));
+        break;
+    case REG_BRIDGE_CTL:
+        pci_config_write(reg->dev, reg->offset, 2, r & 0x08);
+        break;
+    case REG_PAM:
+        /* Read and write enables of both halves of the segment */
+        pci_config_write(reg->dev, reg->offset, 1, r & 0x33);
+        break;
+    case REG_SMRAM:
+        /* D_OPEN and G_SMRAME, but never D_LCK */
+        pci_config_write(reg->dev, reg->offset, 1, 0x02 | (r & 0x48));
+        break;
+    }
+}
+
+static void test_render_incremental(void)
+{
+    int step;
+
+    qtest_start("-nodefaults "
+                "-device virtio-net-pci,addr=04.0,romfile= "
+                "-device pci-bridge,id=br0,chassis_nr=1,addr=05.0 "
+                "-device e1000,bus=br0,addr=01.0,romfile= "
+                "-device VGA,bus=br0,addr=02.0");
+
+    /* Number the bus behind the bridge */
+    pci_config_write(BRIDGE, 0x19, 1, 1);
+    pci_config_write(BRIDGE, 0x1a, 1, 1);
+    g_assert_cmpint(flatview_check(), ==, 0);
+
+    for (step = 0; step < RENDER_STEPS; step++) {
+        render_step();
+        g_assert_cmpint(flatview_check(), ==, 0);
+    }
+
+    qtest_quit(global_qtest);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("memory/direct/e1000", test_direct_e1000);
+    qtest_add_func("memory/render/incremental", test_render_incremental);
+
+    return g_test_run();
+}
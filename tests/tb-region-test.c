@@ -0,0 +1,190 @@
+/*
+ * Translation buffer region tests on a PC machine
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "libqtest.h"
+
+#define COUNT_ADDRESS       0x9000
+#define FAIL_ADDRESS        0x9004
+#define FAIL_SIGNATURE      0xdead
+
+/*
+ * Write a new function at 0x8000 and call it, forever.  Each write
+ * invalidates the TB of the previous function, so every iteration
+ * translates new code and the code buffer keeps filling up.  The
+ * function loads the iteration count in %ax and adds 1 to it sixteen
+ * times; if the result is wrong, FAIL_SIGNATURE is written and the
+ * guest halts.  The iteration count is kept at COUNT_ADDRESS.
+ */
+static uint8_t boot_sector[0x200] = {
+    /* 7c00: ljmp $0,$0x7c05 */
+    [0x00] = 0xea, 0x05, 0x7c, 0x00, 0x00,
+    /* 7c05: xor %ax,%ax */
+    [0x05] = 0x31, 0xc0,
+    /* 7c07: mov %ax,%ds */
+    [0x07] = 0x8e, 0xd8,
+    /* 7c09: mov %ax,%es */
+    [0x09] = 0x8e, 0xc0,
+    /* 7c0b: mov %ax,%ss */
+    [0x0b] = 0x8e, 0xd0,
+    /* 7c0d: mov $0x7c00,%sp */
+    [0x0d] = 0xbc, 0x00, 0x7c,
+    /* 7c10: cli */
+    [0x10] = 0xfa,
+    /* 7c11: xor %dx,%dx */
+    [0x11] = 0x31, 0xd2,
+
+    /* 7c13: mov $0x8000,%di */
+    [0x13] = 0xbf, 0x00, 0x80,
+    /* 7c16: mov $0xb8,%al (mov $imm16,%ax) */
+    [0x16] = 0xb0, 0xb8,
+    /* 7c18: stosb */
+    [0x18] = 0xaa,
+    /* 7c19: mov %dx,%ax */
+    [0x19] = 0x89, 0xd0,
+    /* 7c1b: stosw */
+    [0x1b] = 0xab,
+    /* 7c1c: mov $16,%cx */
+    [0x1c] = 0xb9, 0x10, 0x00,
+    /* 7c1f: mov $0x05,%al (add $imm16,%ax) */
+    [0x1f] = 0xb0, 0x05,
+    /* 7c21: stosb */
+    [0x21] = 0xaa,
+    /* 7c22: mov $1,%ax */
+    [0x22] = 0xb8, 0x01, 0x00,
+    /* 7c25: stosw */
+    [0x25] = 0xab,
+    /* 7c26: loop 0x7c1f */
+    [0x26] = 0xe2, 0xf7,
+    /* 7c28: mov $0xc3,%al (ret) */
+    [0x28] = 0xb0, 0xc3,
+    /* 7c2a: stosb */
+    [0x2a] = 0xaa,
+    /* 7c2b: call 0x8000 */
+    [0x2b] = 0xe8, 0xd2, 0x03,
+    /* 7c2e: mov %dx,%bx */
+    [0x2e] = 0x89, 0xd3,
+    /* 7c30: add $16,%bx */
+    [0x30] = 0x83, 0xc3, 0x10,
+    /* 7c33: cmp %bx,%ax */
+    [0x33] = 0x39, 0xd8,
+    /* 7c35: jne 0x7c44 */
+    [0x35] = 0x75, 0x0d,
+    /* 7c37: inc %dx */
+    [0x37] = 0x42,
+    /* 7c38: mov %dx,0x9000 */
+    [0x38] = 0x89, 0x16, 0x00, 0x90,
+    /* 7c3c: jne 0x7c13 */
+    [0x3c] = 0x75, 0xd5,
+    /* 7c3e: incw 0x9002 */
+    [0x3e] = 0xff, 0x06, 0x02, 0x90,
+    /* 7c42: jmp 0x7c13 */
+    [0x42] = 0xeb, 0xcf,
+
+    /* 7c44: movw $FAIL_SIGNATURE,0x9004 */
+    [0x44] = 0xc7, 0x06, 0x04, 0x90, 0xad, 0xde,
+    /* 7c4a: hlt */
+    [0x4a] = 0xf4,
+    /* 7c4b: jmp 0x7c4a */
+    [0x4b] = 0xeb, 0xfd,
+
+    /* End of boot sector marker */
+    [0x1fe] = 0x55,
+    [0x1ff] = 0xaa,
+};
+
+/* Return the value of the "info jit" line that starts with NAME.  */
+static unsigned jit_stat(const char *name)
+{
+    char *info = hmp("info jit");
+    char *line = strstr(info, name);
+    unsigned val;
+
+    g_assert(line);
+    g_assert(sscanf(line + strlen(name), "%u", &val) == 1);
+    g_free(info);
+    return val;
+}
+
+/*
+ * Boot the loop above with ARGS, and wait until the code buffer has been
+ * recycled at least twice by tb_flush or by reclaiming a region.  The
+ * guest must still be running and computing the right results then.
+ */
+static void run_loop(const char *args, unsigned *flushes, unsigned *reclaims)
+{
+    char disk[] = "/tmp/qtest-tb-region-disk-XXXXXX";
+    char *cmdline;
+    uint32_t count;
+    int fd, i;
+
+    fd = mkstemp(disk);
+    g_assert(fd >= 0);
+    g_assert(write(fd, boot_sector, sizeof(boot_sector)) ==
+             sizeof(boot_sector));
+    close(fd);
+
+    cmdline = g_strdup_printf("-nodefaults -drive file=%s,format=raw %s",
+                              disk, args);
+    qtest_start(cmdline);
+
+    /* Wait at most 90 seconds */
+    for (i = 0; i < 900; i++) {
+        *flushes = jit_stat("TB flush count");
+        *reclaims = jit_stat("TB region reclaims");
+        if (*flushes + *reclaims >= 2) {
+            break;
+        }
+        g_usleep(100 * 1000);
+    }
+    g_assert_cmpuint(*flushes + *reclaims, >=, 2);
+    g_test_message("flushes %u reclaims %u", *flushes, *reclaims);
+
+    count = readl(COUNT_ADDRESS);
+    g_usleep(100 * 1000);
+    g_assert_cmpuint(readl(COUNT_ADDRESS), !=, count);
+    g_assert_cmphex(readw(FAIL_ADDRESS), !=, FAIL_SIGNATURE);
+
+    qtest_quit(global_qtest);
+    unlink(disk);
+    g_free(cmdline);
+}
+
+/* With several regions, the oldest one is reclaimed, not the whole buffer.  */
+static void test_reclaim(void)
+{
+    unsigned flushes, reclaims;
+
+    run_loop("-accel tcg,thread=multi -smp 2 -tb-size 8",
+             &flushes, &reclaims);
+    g_assert_cmpuint(reclaims, >=, 2);
+    g_assert_cmpuint(flushes, ==, 0);
+}
+
+/*
+ * With a single region, whichever vCPU translates first owns it, and the
+ * other one finds no region to reclaim when it needs one: tb_flush runs.
+ */
+static void test_flush(void)
+{
+    unsigned flushes, reclaims;
+
+    run_loop("-accel tcg,thread=multi -smp 2 -tb-size 2",
+             &flushes, &reclaims);
+    g_assert_cmpuint(flushes, >=, 1);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("tb-region/reclaim", test_reclaim);
+    qtest_add_func("tb-region/flush", test_flush);
+
+    return g_test_run();
+}
@@ -0,0 +1,176 @@
+/*
+ * MMX and SSE2 integer operations that TCG expands as vector operations
+ *
+ * Print the result of each operation for a set of inputs.  The output
+ * must be the same natively, under QEMU, and under QEMU with
+ * -no-host-vector, where the operations are expanded to integer
+ * operations instead of host vector instructions.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+typedef int64_t v2di __attribute__((vector_size(16)));
+
+typedef union {
+    v2di v;
+    uint64_t q[2];
+} XMMReg;
+
+#define NB_VALUES 10
+
+static XMMReg values[NB_VALUES];
+
+/* Random bytes, and the same bytes with some elements copied from the
+   previous value, so that the comparisons find equal elements.  */
+static void init_values(void)
+{
+    uint64_t x = 0x0123456789abcdefull;
+    int i, j;
+
+    for (i = 0; i < NB_VALUES; i++) {
+        for (j = 0; j < 2; j++) {
+            x = x * 6364136223846793005ull + 1442695040888963407ull;
+            values[i].q[j] = x;
+        }
+    }
+    values[1].q[1] = values[0].q[1];
+    values[3].q[0] = (values[2].q[0] & 0xffff0000ffff0000ull) |
+                     (values[3].q[0] & 0x0000ffff0000ffffull);
+    values[5].q[0] = (values[4].q[0] & 0xff00ff00ff00ff00ull) |
+                     (values[5].q[0] & 0x00ff00ff00ff00ffull);
+    values[6].q[0] = 0x7fff80007f80ff01ull;
+    values[6].q[1] = 0x8000000000000000ull;
+    values[7].q[0] = 0x80007fff807f01ffull;
+    values[7].q[1] = 0x7fffffffffffffffull;
+    values[8].q[0] = 0;
+    values[8].q[1] = ~0ull;
+}
+
+/* Both the register and the memory form of the source operand.  */
+#define TEST_SSE(insn)                                                 \
+    do {                                                               \
+        for (i = 0; i < NB_VALUES; i++) {                              \
+            for (j = 0; j < NB_VALUES; j++) {                          \
+                XMMReg r1 = values[i], r2 = values[i];                 \
+                asm(insn " %1, %0" : "+x" (r1.v) : "x" (values[j].v)); \
+                asm(insn " %1, %0" : "+x" (r2.v) : "m" (values[j]));   \
+                printf("%-8s %016" PRIx64 "%016" PRIx64                \
+                       " %016" PRIx64 "%016" PRIx64                    \
+                       " %016" PRIx64 "%016" PRIx64 "%s\n",            \
+                       insn, values[i].q[1], values[i].q[0],           \
+                       values[j].q[1], values[j].q[0],                 \
+                       r1.q[1], r1.q[0],                               \
+                       r1.q[0] == r2.q[0] && r1.q[1] == r2.q[1]        \
+                       ? "" : " mem differs");                         \
+            }                                                          \
+        }                                                              \
+    } while (0)
+
+#define TEST_MMX(insn)                                                 \
+    do {                                                               \
+        for (i = 0; i < NB_VALUES; i++) {                              \
+            for (j = 0; j < NB_VALUES; j++) {                          \
+                uint64_t r1 = values[i].q[0], r2 = values[i].q[0];     \
+                asm(insn " %1, %0" : "+y" (r1) : "y" (values[j].q[0]));\
+                asm(insn " %1, %0" : "+y" (r2) : "m" (values[j].q[0]));\
+                asm("emms");                                           \
+                printf("%-8s %016" PRIx64 " %016" PRIx64               \
+                       " %016" PRIx64 "%s\n",                          \
+                       insn, values[i].q[0], values[j].q[0], r1,       \
+                       r1 == r2 ? "" : " mem differs");                \
+            }                                                          \
+        }                                                              \
+    } while (0)
+
+/* The shift counts go past the element size, where the logical shifts
+   clear the element and the arithmetic ones fill it with the sign.  */
+#define TEST_SHIFT(insn)                                               \
+    do {                                                               \
+        for (i = 0; i < NB_VALUES; i++) {                              \
+            TEST_SHIFT_COUNT(insn, i, 0);                              \
+            TEST_SHIFT_COUNT(insn, i, 1);                              \
+            TEST_SHIFT_COUNT(insn, i, 7);                              \
+            TEST_SHIFT_COUNT(insn, i, 15);                             \
+            TEST_SHIFT_COUNT(insn, i, 16);                             \
+            TEST_SHIFT_COUNT(insn, i, 31);                             \
+            TEST_SHIFT_COUNT(insn, i, 32);                             \
+            TEST_SHIFT_COUNT(insn, i, 63);                             \
+            TEST_SHIFT_COUNT(insn, i, 64);                             \
+            TEST_SHIFT_COUNT(insn, i, 255);                            \
+        }                                                              \
+    } while (0)
+
+#define TEST_SHIFT_COUNT(insn, i, count)                               \
+    do {                                                               \
+        XMMReg r = values[i];                                          \
+        uint64_t m = values[i].q[0];                                   \
+        asm(insn " $" #count ", %0" : "+x" (r.v));                     \
+        asm(insn " $" #count ", %0" : "+y" (m));                       \
+        asm("emms");                                                   \
+        printf("%-8s %016" PRIx64 "%016" PRIx64 " %3d"                 \
+               " %016" PRIx64 "%016" PRIx64 " %016" PRIx64 "\n",       \
+               insn, values[i].q[1], values[i].q[0], count,            \
+               r.q[1], r.q[0], m);                                     \
+    } while (0)
+
+int main(void)
+{
+    int i, j;
+
+    init_values();
+
+    TEST_SSE("paddb");
+    TEST_SSE("paddw");
+    TEST_SSE("paddd");
+    TEST_SSE("paddq");
+    TEST_SSE("psubb");
+    TEST_SSE("psubw");
+    TEST_SSE("psubd");
+    TEST_SSE("psubq");
+    TEST_SSE("pand");
+    TEST_SSE("pandn");
+    TEST_SSE("por");
+    TEST_SSE("pxor");
+    TEST_SSE("pcmpeqb");
+    TEST_SSE("pcmpeqw");
+    TEST_SSE("pcmpeqd");
+    TEST_SSE("pcmpgtb");
+    TEST_SSE("pcmpgtw");
+    TEST_SSE("pcmpgtd");
+    TEST_SSE("movdqa");
+
+    TEST_MMX("paddb");
+    TEST_MMX("paddw");
+    TEST_MMX("paddd");
+    TEST_MMX("paddq");
+    TEST_MMX("psubb");
+    TEST_MMX("psubw");
+    TEST_MMX("psubd");
+    TEST_MMX("psubq");
+    TEST_MMX("pand");
+    TEST_MMX("pandn");
+    TEST_MMX("por");
+    TEST_MMX("pxor");
+    TEST_MMX("pcmpeqb");
+    TEST_MMX("pcmpeqw");
+    TEST_MMX("pcmpeqd");
+    TEST_MMX("pcmpgtb");
+    TEST_MMX("pcmpgtw");
+    TEST_MMX("pcmpgtd");
+
+    TEST_SHIFT("psllw");
+    TEST_SHIFT("pslld");
+    TEST_SHIFT("psllq");
+    TEST_SHIFT("psrlw");
+    TEST_SHIFT("psrld");
+    TEST_SHIFT("psrlq");
+    TEST_SHIFT("psraw");
+    TEST_SHIFT("psrad");
+
+    return 0;
+}
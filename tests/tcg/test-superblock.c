@@ -0,0 +1,140 @@
+/*
+ * Branchy loop for superblocks
+ *
+ * Run this with and without -superblock; the output must be the same.
+ * The loop has biased conditional jumps whose rare side becomes a side
+ * exit of the superblock, direct calls and jumps that the superblock
+ * follows, blocks that end with a backward jump or a ret and so drop
+ * their execution counter, and a straight-line part that is too long
+ * for one block.  The flags are consumed after each side exit and
+ * after the call, and the registers and flags are printed at the end.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#define NB_VALUES 20000
+
+/* The flags that the loop can leave in a defined state: CF PF ZF SF OF.  */
+#define FLAGS_MASK 0x8c5
+
+/* void sb_kernel(const uint32_t *data, long n, uint64_t *regs) */
+void sb_kernel(const uint32_t *data, long n, uint64_t *regs);
+
+asm(".text\n"
+    ".balign 4096\n"
+    ".globl sb_kernel\n"
+    ".type sb_kernel, @function\n"
+    "sb_kernel:\n"
+    "    push %rdx\n"
+    "    xor %eax, %eax\n"
+    "    xor %ecx, %ecx\n"
+    "    movabs $0x9e3779b97f4a7c15, %r8\n"
+    "    xor %r9d, %r9d\n"
+    "    xor %r10d, %r10d\n"
+    "    xor %r11d, %r11d\n"
+    "1:  mov (%rdi), %edx\n"
+    "    add $4, %rdi\n"
+    /* Taken for 1/16 of the values.  */
+    "    test $15, %dl\n"
+    "    jz 5f\n"
+    "    add %rdx, %rax\n"
+    "    rol $7, %rax\n"
+    /* Taken for 1/8 of the values.  */
+    "    cmp $0xe0000000, %edx\n"
+    "    jae 6f\n"
+    "2:  call 7f\n"
+    /* CF comes from the shr in the callee.  */
+    "    adc %r9, %rcx\n"
+    "    jmp 3f\n"
+    "    ud2\n"
+    "3:\n"
+    "    .rept 100\n"
+    "    xor %rax, %r10\n"
+    "    add %r10, %r11\n"
+    "    rol $3, %r11\n"
+    "    .endr\n"
+    "    cmp %r11, %rcx\n"
+    "    jb 4f\n"
+    "    inc %r9\n"
+    "4:  dec %rsi\n"
+    "    jnz 1b\n"
+    "    jmp 9f\n"
+    /* Rare sides of the jumps above.  */
+    "5:  imul $0x45d9f3b, %rdx, %rdx\n"
+    "    xor %rdx, %r9\n"
+    "    sub %rdx, %rcx\n"
+    "    jmp 2b\n"
+    "6:  sbb %r8, %r9\n"
+    "    inc %r10\n"
+    "    jmp 2b\n"
+    "7:  add %rdx, %r8\n"
+    "    shr $1, %r8\n"
+    "    ret\n"
+    "9:  pop %rdx\n"
+    "    mov %rax, 0(%rdx)\n"
+    "    mov %rcx, 8(%rdx)\n"
+    "    mov %r8, 16(%rdx)\n"
+    "    mov %r9, 24(%rdx)\n"
+    "    mov %r10, 32(%rdx)\n"
+    "    mov %r11, 40(%rdx)\n"
+    "    pushf\n"
+    "    pop 48(%rdx)\n"
+    "    ret\n"
+    ".size sb_kernel, . - sb_kernel\n");
+
+static uint32_t data[NB_VALUES];
+
+static uint32_t next_value(uint64_t *x)
+{
+    *x = *x * 6364136223846793005ull + 1442695040888963407ull;
+    return *x >> 32;
+}
+
+static void run(const char *name)
+{
+    uint64_t regs[7];
+
+    sb_kernel(data, NB_VALUES, regs);
+    printf("%-9s rax %016" PRIx64 " rcx %016" PRIx64 " r8 %016" PRIx64
+           " r9 %016" PRIx64 " r10 %016" PRIx64 " r11 %016" PRIx64
+           " flags %03" PRIx64 "\n", name, regs[0], regs[1], regs[2],
+           regs[3], regs[4], regs[5], regs[6] & FLAGS_MASK);
+}
+
+int main(void)
+{
+    uint64_t x = 1;
+    int i;
+
+    /* The profile is the same all along.  */
+    for (i = 0; i < NB_VALUES; i++) {
+        data[i] = next_value(&x);
+    }
+    run("random");
+
+    /* The first jump is never taken in the first half and always in the
+       second, after superblocks have been formed.  */
+    for (i = 0; i < NB_VALUES; i++) {
+        data[i] = next_value(&x);
+        if (i < NB_VALUES / 2) {
+            data[i] |= 1;
+        } else {
+            data[i] &= ~15;
+        }
+    }
+    run("flip");
+
+    /* Both jumps go either way, so there is no bias to follow.  */
+    for (i = 0; i < NB_VALUES; i++) {
+        data[i] = next_value(&x);
+        data[i] = (i & 1) ? data[i] | 0xe0000001 : data[i] & ~15;
+    }
+    run("alternate");
+
+    return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * Fault in the middle of a translation block loaded from -tb-cache
+ *
+ * Run this twice with the same cache directory and guest base (-B).
+ * The second run uses the code saved by the first one, and the guest
+ * state at the fault must be the same as with freshly translated code.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+
+#include <asm/unistd.h>
+
+#define SIGSEGV     11
+#define SA_SIGINFO  0x00000004
+#define SA_RESTORER 0x04000000
+
+#define stringify(x)  #x
+#define xstringify(x) stringify(x)
+
+struct kernel_sigaction {
+    void *handler;
+    unsigned long flags;
+    void *restorer;
+    unsigned long mask[2];
+};
+
+/* The start of the i386 ucontext, up to the eip in its sigcontext.  */
+struct kernel_ucontext {
+    unsigned long uc_flags;
+    void *uc_link;
+    void *ss_sp;
+    int ss_flags;
+    unsigned long ss_size;
+    unsigned long gs, fs, es, ds;
+    unsigned long edi, esi, ebp, esp, ebx, edx, ecx, eax;
+    unsigned long trapno, err, eip;
+};
+
+/* One block: two moves, a load that faults, and a move after it.  */
+asm(".text\n"
+    "faulting_block:\n"
+    "    mov $1, %eax\n"
+    "    mov $2, %edx\n"
+    "fault_insn:\n"
+    "    mov (%ecx), %ecx\n"
+    "fault_next:\n"
+    "    mov $3, %eax\n"
+    "    ret\n"
+    "restore_rt:\n"
+    "    mov $" xstringify(__NR_rt_sigreturn) ", %eax\n"
+    "    int $0x80\n");
+
+extern char fault_insn[], fault_next[], restore_rt[];
+
+static int nb_faults;
+static int failed;
+
+static inline int syscall4(int nr, long a, long b, long c, long d)
+{
+    int ret;
+
+    asm volatile("pushl %%ebx\n"
+                 "movl %%edi, %%ebx\n"
+                 "int $0x80\n"
+                 "popl %%ebx\n"
+                 : "=a" (ret)
+                 : "0" (nr), "D" (a), "c" (b), "d" (c), "S" (d)
+                 : "memory");
+    return ret;
+}
+
+static void fail(const char *msg)
+{
+    int len = 0;
+
+    while (msg[len]) {
+        len++;
+    }
+    syscall4(__NR_write, 1, (long)msg, len, 0);
+    failed = 1;
+}
+
+static void segv_handler(int sig, void *info, struct kernel_ucontext *uc)
+{
+    if (uc->eip != (unsigned long)fault_insn) {
+        fail("wrong eip at the fault\n");
+    }
+    if (uc->eax != 1 || uc->edx != 2) {
+        fail("wrong eax or edx at the fault\n");
+    }
+    nb_faults++;
+    uc->eip = (unsigned long)fault_next;
+}
+
+void _start(void)
+{
+    struct kernel_sigaction act = {
+        .handler = segv_handler,
+        .flags = SA_SIGINFO | SA_RESTORER,
+        .restorer = restore_rt,
+    };
+    long addr;
+    int i, ret;
+
+    syscall4(__NR_rt_sigaction, SIGSEGV, (long)&act, 0, 8);
+    for (i = 0; i < 10; i++) {
+        addr = 0;
+        asm volatile("call faulting_block"
+                     : "=a" (ret), "+c" (addr)
+                     :
+                     : "edx", "memory");
+        if (ret != 3) {
+            fail("wrong eax after the block\n");
+        }
+    }
+    if (nb_faults != 10) {
+        fail("wrong number of faults\n");
+    }
+    if (!failed) {
+        syscall4(__NR_write, 1, (long)"OK\n", 3, 0);
+    }
+    syscall4(__NR_exit, failed, 0, 0, 0);
+}
@@ -0,0 +1,197 @@
+/*
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/interval-tree.h"
+
+/* The address space is divided in N slots of SLOT_SIZE addresses; every
+   node covers a whole number of slots.  owner[] is the reference model.  */
+#define N 512
+#define SLOT_SIZE 16
+
+static IntervalTree tree;
+static IntervalTreeNode *owner[N];
+static IntervalTreeNode nodes[N];
+
+static void check_node(IntervalTreeNode *p, IntervalTreeNode *parent,
+                       uint64_t min, uint64_t max, size_t *count)
+{
+    if (p == NULL) {
+        return;
+    }
+    g_assert_cmpuint(p->start, >=, min);
+    g_assert_cmpuint(p->last, <=, max);
+    g_assert_cmpuint(p->start, <=, p->last);
+    if (parent) {
+        g_assert_cmpuint(p->priority, <=, parent->priority);
+    }
+    (*count)++;
+    if (p->start) {
+        check_node(p->left, p, min, p->start - 1, count);
+    } else {
+        g_assert(p->left == NULL);
+    }
+    check_node(p->right, p, p->last + 1, max, count);
+}
+
+static void check(void)
+{
+    IntervalTreeNode *p, *prev;
+    size_t count = 0, expected = 0;
+    uint64_t addr;
+    int i;
+
+    check_node(tree.root, NULL, 0, UINT64_MAX, &count);
+
+    for (i = 0; i < N; i++) {
+        if (owner[i] && (i == 0 || owner[i - 1] != owner[i])) {
+            expected++;
+        }
+        for (addr = i * SLOT_SIZE; addr < (i + 1) * SLOT_SIZE; addr += 5) {
+            g_assert(interval_tree_lookup(&tree, addr) == owner[i]);
+        }
+    }
+    g_assert_cmpuint(count, ==, expected);
+    g_assert(interval_tree_lookup(&tree, N * SLOT_SIZE) == NULL);
+    g_assert(interval_tree_lookup(&tree, UINT64_MAX) == NULL);
+
+    /* Iterate over the whole tree, and over a range in the middle.  */
+    prev = NULL;
+    count = 0;
+    for (p = interval_tree_iter_first(&tree, 0, UINT64_MAX); p;
+         p = interval_tree_iter_next(&tree, p, UINT64_MAX)) {
+        g_assert(owner[p->start / SLOT_SIZE] == p);
+        g_assert(prev == NULL || prev->last < p->start);
+        prev = p;
+        count++;
+    }
+    g_assert_cmpuint(count, ==, expected);
+
+    p = interval_tree_iter_first(&tree, N / 4 * SLOT_SIZE + 1,
+                                 N / 2 * SLOT_SIZE + 1);
+    for (i = N / 4; i <= N / 2; i++) {
+        if (owner[i] == NULL) {
+            continue;
+        }
+        g_assert(p == owner[i]);
+        while (i < N / 2 && owner[i + 1] == p) {
+            i++;
+        }
+        p = interval_tree_iter_next(&tree, p, N / 2 * SLOT_SIZE + 1);
+    }
+    g_assert(p == NULL);
+}
+
+/* Insert a node covering the free slots [first, last].  */
+static void insert(int first, int last)
+{
+    IntervalTreeNode *node = &nodes[first];
+    int i;
+
+    node->start = first * SLOT_SIZE;
+    node->last = (last + 1) * SLOT_SIZE - 1;
+    interval_tree_insert(&tree, node);
+    for (i = first; i <= last; i++) {
+        g_assert(owner[i] == NULL);
+        owner[i] = node;
+    }
+}
+
+static void remove_node(IntervalTreeNode *node)
+{
+    int i;
+
+    interval_tree_remove(&tree, node);
+    for (i = node->start / SLOT_SIZE; i <= node->last / SLOT_SIZE; i++) {
+        owner[i] = NULL;
+    }
+}
+
+static void test_empty(void)
+{
+    interval_tree_init(&tree);
+    memset(owner, 0, sizeof(owner));
+    g_assert(interval_tree_lookup(&tree, 0) == NULL);
+    g_assert(interval_tree_iter_first(&tree, 0, UINT64_MAX) == NULL);
+    check();
+}
+
+static void test_sequential(void)
+{
+    int i;
+
+    test_empty();
+    for (i = 0; i < N; i++) {
+        insert(i, i);
+    }
+    check();
+    for (i = 0; i < N; i += 2) {
+        remove_node(owner[i]);
+    }
+    check();
+    for (i = N - 1; i >= 0; i -= 2) {
+        remove_node(owner[i]);
+    }
+    check();
+    g_assert(tree.root == NULL);
+}
+
+static void test_random(void)
+{
+    GRand *rand = g_rand_new_with_seed(1);
+    int iter, i, j;
+
+    test_empty();
+    for (iter = 0; iter < 20000; iter++) {
+        i = g_rand_int_range(rand, 0, N);
+        if (owner[i]) {
+            remove_node(owner[i]);
+        } else {
+            /* Extend the new node over up to 7 more free slots.  */
+            j = i;
+            while (j < N - 1 && j < i + 7 && !owner[j + 1]) {
+                j++;
+            }
+            insert(i, g_rand_int_range(rand, i, j + 1));
+        }
+        if (iter % 1000 == 0) {
+            check();
+        }
+    }
+    check();
+    g_rand_free(rand);
+}
+
+static void test_iter_remove(void)
+{
+    IntervalTreeNode *p, *next;
+    int i;
+
+    test_empty();
+    for (i = 0; i < N; i += 4) {
+        insert(i, i + 2);
+    }
+    check();
+
+    /* Remove the nodes as they are visited.  */
+    for (p = interval_tree_iter_first(&tree, 0, N * SLOT_SIZE / 2); p;
+         p = next) {
+        next = interval_tree_iter_next(&tree, p, N * SLOT_SIZE / 2);
+        remove_node(p);
+        g_assert(next == NULL || next->start > p->last);
+    }
+    check();
+    g_assert(interval_tree_lookup(&tree, N * SLOT_SIZE / 2 + 1) == NULL);
+    g_assert(interval_tree_lookup(&tree, (N / 2 + 4) * SLOT_SIZE) != NULL);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/interval-tree/empty", test_empty);
+    g_test_add_func("/interval-tree/sequential", test_sequential);
+    g_test_add_func("/interval-tree/random", test_random);
+    g_test_add_func("/interval-tree/iter-remove", test_iter_remove);
+    return g_test_run();
+}
@@ -0,0 +1,215 @@
+/*
+ * softfloat host FPU fast path test
+ *
+ * The basic float32/float64 operations use the host FPU when the inexact
+ * flag is already set and the rounding mode is nearest-even.  Run every
+ * operation on the same inputs with the flag clear, which always takes the
+ * software path, and with the flag set, and check that results and flags
+ * are bit-for-bit identical.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "fpu/softfloat.h"
+
+#define N_INPUTS 200000
+
+typedef float32 (*float32_op)(float32, float32, float_status *);
+typedef float64 (*float64_op)(float64, float64, float_status *);
+
+typedef struct StatusTemplate {
+    const char *name;
+    float_status status;
+} StatusTemplate;
+
+static const StatusTemplate templates[] = {
+    { "default", {
+        .float_rounding_mode = float_round_nearest_even,
+    } },
+    { "tininess-before-rounding", {
+        .float_rounding_mode = float_round_nearest_even,
+        .float_detect_tininess = float_tininess_before_rounding,
+    } },
+    { "flush-to-zero", {
+        .float_rounding_mode = float_round_nearest_even,
+        .flush_to_zero = 1,
+        .flush_inputs_to_zero = 1,
+    } },
+    { "default-nan", {
+        .float_rounding_mode = float_round_nearest_even,
+        .default_nan_mode = 1,
+    } },
+    { "round-to-zero", {
+        .float_rounding_mode = float_round_to_zero,
+    } },
+};
+
+static uint64_t rng_state;
+
+static uint64_t xorshift64star(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * UINT64_C(2685821657736338717);
+}
+
+/* Pick an exponent for an input of class `c', favouring the edges of the
+ * fast path: zeros, denormals, infinities and NaNs, results that underflow
+ * or overflow, and cancellation around 1.0.
+ */
+static int random_exp(unsigned c, int max_exp, int bias, int range)
+{
+    uint64_t r = xorshift64star();
+
+    switch (c % 8) {
+    case 0:
+        return 0;
+    case 1:
+        return max_exp;
+    case 2:
+        return 1 + r % range;
+    case 3:
+        return max_exp - 1 - r % range;
+    case 4:
+    case 5:
+        return bias - range / 2 + r % range;
+    default:
+        return 1 + r % (max_exp - 1);
+    }
+}
+
+static float32 random_float32(void)
+{
+    uint64_t r = xorshift64star();
+    uint32_t frac = r & 0x7fffff;
+    uint32_t exp = random_exp(r >> 32, 0xff, 0x7f, 32);
+
+    if ((r >> 40) % 16 == 0) {
+        frac = 0;
+    }
+    return make_float32(((r >> 63) << 31) | (exp << 23) | frac);
+}
+
+static float64 random_float64(void)
+{
+    uint64_t r = xorshift64star();
+    uint64_t frac = r & 0xfffffffffffffULL;
+    uint64_t exp = random_exp(r >> 52, 0x7ff, 0x3ff, 64);
+
+    if ((xorshift64star() & 15) == 0) {
+        frac = 0;
+    }
+    return make_float64(((r >> 63) << 63) | (exp << 52) | frac);
+}
+
+static void check_float32(float32_op op, const float_status *template,
+                          float32 a, float32 b)
+{
+    float_status soft = *template;
+    float_status hard = *template;
+    float32 rs, rh;
+
+    hard.float_exception_flags = float_flag_inexact;
+    rs = op(a, b, &soft);
+    rh = op(a, b, &hard);
+    if (float32_val(rs) != float32_val(rh) ||
+        (soft.float_exception_flags | float_flag_inexact) !=
+        hard.float_exception_flags) {
+        g_test_message("inputs 0x%08" PRIx32 " 0x%08" PRIx32,
+                       float32_val(a), float32_val(b));
+    }
+    g_assert_cmphex(float32_val(rs), ==, float32_val(rh));
+    g_assert_cmphex(soft.float_exception_flags | float_flag_inexact, ==,
+                    hard.float_exception_flags);
+}
+
+static void check_float64(float64_op op, const float_status *template,
+                          float64 a, float64 b)
+{
+    float_status soft = *template;
+    float_status hard = *template;
+    float64 rs, rh;
+
+    hard.float_exception_flags = float_flag_inexact;
+    rs = op(a, b, &soft);
+    rh = op(a, b, &hard);
+    if (float64_val(rs) != float64_val(rh) ||
+        (soft.float_exception_flags | float_flag_inexact) !=
+        hard.float_exception_flags) {
+        g_test_message("inputs 0x%016" PRIx64 " 0x%016" PRIx64,
+                       float64_val(a), float64_val(b));
+    }
+    g_assert_cmphex(float64_val(rs), ==, float64_val(rh));
+    g_assert_cmphex(soft.float_exception_flags | float_flag_inexact, ==,
+                    hard.float_exception_flags);
+}
+
+static float32 sqrt_float32(float32 a, float32 b, float_status *s)
+{
+    return float32_sqrt(a, s);
+}
+
+static float64 sqrt_float64(float64 a, float64 b, float_status *s)
+{
+    return float64_sqrt(a, s);
+}
+
+static void test_float32(gconstpointer opaque)
+{
+    float32_op op = opaque;
+    int i, t;
+
+    for (t = 0; t < ARRAY_SIZE(templates); t++) {
+        rng_state = 1;
+        for (i = 0; i < N_INPUTS; i++) {
+            float32 a = random_float32();
+            float32 b = random_float32();
+
+            /* Operands close to each other, for cancellation.  */
+            if (i % 4 == 0) {
+                b = make_float32(float32_val(a) ^ (xorshift64star() & 0xff));
+            }
+            check_float32(op, &templates[t].status, a, b);
+        }
+    }
+}
+
+static void test_float64(gconstpointer opaque)
+{
+    float64_op op = opaque;
+    int i, t;
+
+    for (t = 0; t < ARRAY_SIZE(templates); t++) {
+        rng_state = 1;
+        for (i = 0; i < N_INPUTS; i++) {
+            float64 a = random_float64();
+            float64 b = random_float64();
+
+            /* Operands close to each other, for cancellation.  */
+            if (i % 4 == 0) {
+                b = make_float64(float64_val(a) ^ (xorshift64star() & 0xff));
+            }
+            check_float64(op, &templates[t].status, a, b);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_data_func("/softfloat/float32/add", float32_add, test_float32);
+    g_test_add_data_func("/softfloat/float32/sub", float32_sub, test_float32);
+    g_test_add_data_func("/softfloat/float32/mul", float32_mul, test_float32);
+    g_test_add_data_func("/softfloat/float32/div", float32_div, test_float32);
+    g_test_add_data_func("/softfloat/float32/sqrt", sqrt_float32,
+                         test_float32);
+    g_test_add_data_func("/softfloat/float64/add", float64_add, test_float64);
+    g_test_add_data_func("/softfloat/float64/sub", float64_sub, test_float64);
+    g_test_add_data_func("/softfloat/float64/mul", float64_mul, test_float64);
+    g_test_add_data_func("/softfloat/float64/div", float64_div, test_float64);
+    g_test_add_data_func("/softfloat/float64/sqrt", sqrt_float64,
+                         test_float64);
+    return g_test_run();
+}
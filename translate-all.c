@@ -31,6 +31,9 @@
 #include "tcg.h"
 #if defined(CONFIG_USER_ONLY)
 #include "qemu.h"
+#include "qemu/interval-tree.h"
+#include "qemu/rcu.h"
+#include "qemu/seqlock.h"
 #if defined(__FreeBSD__) || defined(__FreeBSD_kernel__)
 #include <sys/param.h>
 #if __FreeBSD_version >= 700104
@@ -52,6 +55,7 @@
 #include "exec/cputlb.h"
 #include "exec/tb-hash.h"
 #include "translate-all.h"
+#include "perf.h"
 #include "qemu/bitmap.h"
 #include "qemu/timer.h"
 #include "exec/log.h"
@@ -76,11 +80,25 @@ typedef struct PageDesc {
        of lookups we do to a given page to use a bitmap */
     unsigned int code_write_count;
     unsigned long *code_bitmap;
-#else
-    unsigned long flags;
 #endif
 } PageDesc;
 
+#ifdef CONFIG_USER_ONLY
+/* In user mode the flags of the guest pages are kept in an interval
+   tree, where a whole mapping takes a single node.  Nodes are never
+   modified once in the tree; they are replaced, and freed after an RCU
+   grace period.  Updates are done with mmap_lock held and bump
+   pageflags_seq, so that lookups can be done without the lock.  */
+typedef struct PageFlagsNode {
+    struct rcu_head rcu;
+    IntervalTreeNode itree;
+    int flags;
+} PageFlagsNode;
+
+static IntervalTree pageflags_root;
+static QemuSeqLock pageflags_seq;
+#endif
+
 /* In system mode we want L1_MAP to be based on ram offsets,
    while in user mode we want it to be based on virtual addresses.  */
 #if !defined(CONFIG_USER_ONLY)
@@ -117,13 +135,17 @@ static int v_l2_levels;
 static void *l1_map[V_L1_MAX_SIZE];
 
 /* code generation context */
-TCGContext tcg_ctx;
+TCGContext tcg_init_ctx;
+__thread TCGContext *tcg_ctx;
+TBContext tb_ctx;
 bool parallel_cpus;
 
+/* Number of executions after which a TB is retranslated as a superblock
+   together with its likely successors, or 0 to never form superblocks.  */
+unsigned int superblock_threshold;
+
 /* translation block context */
-#ifdef CONFIG_USER_ONLY
 __thread int have_tb_lock;
-#endif
 
 static void page_table_config_init(void)
 {
@@ -147,37 +169,31 @@ static void page_table_config_init(void)
 
 void tb_lock(void)
 {
-#ifdef CONFIG_USER_ONLY
     assert(!have_tb_lock);
-    qemu_mutex_lock(&tcg_ctx.tb_ctx.tb_lock);
+    qemu_mutex_lock(&tb_ctx.tb_lock);
     have_tb_lock++;
-#endif
 }
 
 void tb_unlock(void)
 {
-#ifdef CONFIG_USER_ONLY
     assert(have_tb_lock);
     have_tb_lock--;
-    qemu_mutex_unlock(&tcg_ctx.tb_ctx.tb_lock);
-#endif
+    qemu_mutex_unlock(&tb_ctx.tb_lock);
 }
 
 void tb_lock_reset(void)
 {
-#ifdef CONFIG_USER_ONLY
     if (have_tb_lock) {
-        qemu_mutex_unlock(&tcg_ctx.tb_ctx.tb_lock);
+        qemu_mutex_unlock(&tb_ctx.tb_lock);
         have_tb_lock = 0;
     }
-#endif
 }
 
 static TranslationBlock *tb_find_pc(uintptr_t tc_ptr);
 
 void cpu_gen_init(void)
 {
-    tcg_context_init(&tcg_ctx); 
+    tcg_context_init(&tcg_init_ctx);
 }
 
 /* Encode VAL as a signed leb128 sequence at P.
@@ -235,7 +251,7 @@ static target_long decode_sleb128(uint8_t **pp)
 
 static int encode_search(TranslationBlock *tb, uint8_t *block)
 {
-    uint8_t *highwater = tcg_ctx.code_gen_highwater;
+    uint8_t *highwater = tcg_ctx->code_gen_highwater;
     uint8_t *p = block;
     int i, j, n;
 
@@ -248,12 +264,12 @@ static int encode_search(TranslationBlock *tb, uint8_t *block)
             if (i == 0) {
                 prev = (j == 0 ? tb->pc : 0);
             } else {
-                prev = tcg_ctx.gen_insn_data[i - 1][j];
+                prev = tcg_ctx->gen_insn_data[i - 1][j];
             }
-            p = encode_sleb128(p, tcg_ctx.gen_insn_data[i][j] - prev);
+            p = encode_sleb128(p, tcg_ctx->gen_insn_data[i][j] - prev);
         }
-        prev = (i == 0 ? 0 : tcg_ctx.gen_insn_end_off[i - 1]);
-        p = encode_sleb128(p, tcg_ctx.gen_insn_end_off[i] - prev);
+        prev = (i == 0 ? 0 : tcg_ctx->gen_insn_end_off[i - 1]);
+        p = encode_sleb128(p, tcg_ctx->gen_insn_end_off[i] - prev);
 
         /* Test for (pending) buffer overflow.  The assumption is that any
            one row beginning below the high water mark cannot overrun
@@ -311,8 +327,8 @@ static int cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
     restore_state_to_opc(env, tb, data);
 
 #ifdef CONFIG_PROFILER
-    tcg_ctx.restore_time += profile_getclock() - ti;
-    tcg_ctx.restore_count++;
+    tcg_ctx->prof.restore_time += profile_getclock() - ti;
+    tcg_ctx->prof.restore_count++;
 #endif
     return 0;
 }
@@ -320,7 +336,15 @@ static int cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
 bool cpu_restore_state(CPUState *cpu, uintptr_t retaddr)
 {
     TranslationBlock *tb;
+    bool r = false;
+    /* A host fault taken while translating (user-mode) gets here with
+     * tb_lock already held; cpu_loop_exit will release it.
+     */
+    bool locked = have_tb_lock;
 
+    if (!locked) {
+        tb_lock();
+    }
     tb = tb_find_pc(retaddr);
     if (tb) {
         cpu_restore_state_from_tb(cpu, tb, retaddr);
@@ -329,9 +353,13 @@ bool cpu_restore_state(CPUState *cpu, uintptr_t retaddr)
             tb_phys_invalidate(tb, -1);
             tb_free(tb);
         }
-        return true;
+        r = true;
     }
-    return false;
+    if (!locked) {
+        tb_unlock();
+    }
+
+    return r;
 }
 
 void page_size_init(void)
@@ -464,6 +492,154 @@ static inline PageDesc *page_find(tb_page_addr_t index)
     return page_find_alloc(index, 0);
 }
 
+/* Return the first allocated PageDesc whose index is at least *PINDEX
+ * and below END, and store its index in *PINDEX.  Return NULL if there
+ * is none.  Unlike a loop over page_find, this skips the unpopulated
+ * parts of l1_map a whole table at a time.
+ */
+static PageDesc *page_find_next(tb_page_addr_t *pindex, tb_page_addr_t end)
+{
+    tb_page_addr_t index = *pindex;
+
+    while (index < end) {
+        void **lp = l1_map + ((index >> v_l1_shift) & (v_l1_size - 1));
+        void *p = atomic_rcu_read(lp);
+        tb_page_addr_t next;
+        int i;
+
+        for (i = v_l2_levels; p != NULL && i > 0; i--) {
+            lp = (void **)p + ((index >> (i * V_L2_BITS)) & (V_L2_SIZE - 1));
+            p = atomic_rcu_read(lp);
+        }
+        if (p != NULL) {
+            *pindex = index;
+            return (PageDesc *)p + (index & (V_L2_SIZE - 1));
+        }
+
+        /* The missing table at level I covers (I + 1) * V_L2_BITS bits.  */
+        next = (index | (((tb_page_addr_t)1 << ((i + 1) * V_L2_BITS)) - 1)) + 1;
+        if (next <= index) {
+            break;
+        }
+        index = next;
+    }
+    return NULL;
+}
+
+#ifdef CONFIG_USER_ONLY
+static PageFlagsNode *pageflags_node(IntervalTreeNode *n)
+{
+    return n ? container_of(n, PageFlagsNode, itree) : NULL;
+}
+
+/* Return the first node overlapping [START, LAST], or NULL.  Without
+   mmap_lock, this must be done inside a pageflags_seq read section.  */
+static PageFlagsNode *pageflags_find(target_ulong start, target_ulong last)
+{
+    return pageflags_node(interval_tree_iter_first(&pageflags_root,
+                                                   start, last));
+}
+
+/* Return the node after P if it starts at or before LAST, or NULL.  */
+static PageFlagsNode *pageflags_next(PageFlagsNode *p, target_ulong last)
+{
+    return pageflags_node(interval_tree_iter_next(&pageflags_root,
+                                                  &p->itree, last));
+}
+
+/* The functions below modify the tree.  They are called with mmap_lock
+   held, inside a pageflags_seq write section.  */
+
+static PageFlagsNode *pageflags_create(target_ulong start, target_ulong last,
+                                       int flags)
+{
+    PageFlagsNode *p = g_new(PageFlagsNode, 1);
+
+    p->itree.start = start;
+    p->itree.last = last;
+    p->flags = flags;
+    interval_tree_insert(&pageflags_root, &p->itree);
+    return p;
+}
+
+static void pageflags_remove(PageFlagsNode *p)
+{
+    interval_tree_remove(&pageflags_root, &p->itree);
+    g_free_rcu(p, rcu);
+}
+
+/* Merge the adjacent nodes that have the same flags, from the node
+   before START to the node after LAST.  */
+static void pageflags_coalesce(target_ulong start, target_ulong last)
+{
+    PageFlagsNode *p, *next;
+
+    if (start != 0) {
+        start--;
+    }
+    if (last != (target_ulong)-1) {
+        last++;
+    }
+    p = pageflags_find(start, last);
+    while (p && (next = pageflags_next(p, last)) != NULL) {
+        if (next->itree.start == p->itree.last + 1 &&
+            next->flags == p->flags) {
+            target_ulong p_start = p->itree.start;
+            target_ulong p_last = next->itree.last;
+            int flags = p->flags;
+
+            pageflags_remove(p);
+            pageflags_remove(next);
+            p = pageflags_create(p_start, p_last, flags);
+        } else {
+            p = next;
+        }
+    }
+}
+
+/* Set SET_FLAGS and clear CLEAR_FLAGS in the mapped pages of
+   [START, LAST], splitting nodes as needed.  Only the pages with
+   PAGE_WRITE_ORG can get PAGE_WRITE.  Return the union of the new
+   flags.  Called with mmap_lock held.  */
+static int pageflags_set_clear(target_ulong start, target_ulong last,
+                               int set_flags, int clear_flags)
+{
+    PageFlagsNode *p, *next;
+    int ret = 0;
+
+    seqlock_write_begin(&pageflags_seq);
+    for (p = pageflags_find(start, last); p; p = next) {
+        target_ulong p_start = p->itree.start;
+        target_ulong p_last = p->itree.last;
+        int p_flags = p->flags;
+        int flags = (p_flags | set_flags) & ~clear_flags;
+
+        if (!(p_flags & PAGE_WRITE_ORG)) {
+            flags &= ~PAGE_WRITE;
+        }
+        ret |= flags;
+        next = pageflags_next(p, last);
+        if (flags == p_flags) {
+            continue;
+        }
+
+        pageflags_remove(p);
+        if (p_start < start) {
+            pageflags_create(p_start, start - 1, p_flags);
+            p_start = start;
+        }
+        if (p_last > last) {
+            pageflags_create(last + 1, p_last, p_flags);
+            p_last = last;
+        }
+        pageflags_create(p_start, p_last, flags);
+    }
+    pageflags_coalesce(start, last);
+    seqlock_write_end(&pageflags_seq);
+    return ret;
+}
+#endif
+
 #if defined(CONFIG_USER_ONLY)
 /* Currently it is not recommended to allocate big chunks of data in
    user mode. It will change when a dedicated libc will be used.  */
@@ -553,7 +729,7 @@ static inline void *split_cross_256mb(void *buf1, size_t size1)
         buf1 = buf2;
     }
 
-    tcg_ctx.code_gen_buffer_size = size1;
+    tcg_init_ctx.code_gen_buffer_size = size1;
     return buf1;
 }
 #endif
@@ -616,16 +792,16 @@ static inline void *alloc_code_gen_buffer(void)
     size = full_size - qemu_real_host_page_size;
 
     /* Honor a command-line option limiting the size of the buffer.  */
-    if (size > tcg_ctx.code_gen_buffer_size) {
-        size = (((uintptr_t)buf + tcg_ctx.code_gen_buffer_size)
+    if (size > tcg_init_ctx.code_gen_buffer_size) {
+        size = (((uintptr_t)buf + tcg_init_ctx.code_gen_buffer_size)
                 & qemu_real_host_page_mask) - (uintptr_t)buf;
     }
-    tcg_ctx.code_gen_buffer_size = size;
+    tcg_init_ctx.code_gen_buffer_size = size;
 
 #ifdef __mips__
     if (cross_256mb(buf, size)) {
         buf = split_cross_256mb(buf, size);
-        size = tcg_ctx.code_gen_buffer_size;
+        size = tcg_init_ctx.code_gen_buffer_size;
     }
 #endif
 
@@ -638,7 +814,7 @@ static inline void *alloc_code_gen_buffer(void)
 #elif defined(_WIN32)
 static inline void *alloc_code_gen_buffer(void)
 {
-    size_t size = tcg_ctx.code_gen_buffer_size;
+    size_t size = tcg_init_ctx.code_gen_buffer_size;
     void *buf1, *buf2;
 
     /* Perform the allocation in two steps, so that the guard page
@@ -657,7 +833,7 @@ static inline void *alloc_code_gen_buffer(void)
 {
     int flags = MAP_PRIVATE | MAP_ANONYMOUS;
     uintptr_t start = 0;
-    size_t size = tcg_ctx.code_gen_buffer_size;
+    size_t size = tcg_init_ctx.code_gen_buffer_size;
     void *buf;
 
     /* Constrain the position of the buffer based on the host cpu.
@@ -674,7 +850,7 @@ static inline void *alloc_code_gen_buffer(void)
     flags |= MAP_32BIT;
     /* Cannot expect to map more than 800MB in low memory.  */
     if (size > 800u * 1024 * 1024) {
-        tcg_ctx.code_gen_buffer_size = size = 800u * 1024 * 1024;
+        tcg_init_ctx.code_gen_buffer_size = size = 800u * 1024 * 1024;
     }
 # elif defined(__sparc__)
     start = 0x40000000ul;
@@ -714,7 +890,7 @@ static inline void *alloc_code_gen_buffer(void)
         default:
             /* Split the original buffer.  Free the smaller half.  */
             buf2 = split_cross_256mb(buf, size);
-            size2 = tcg_ctx.code_gen_buffer_size;
+            size2 = tcg_init_ctx.code_gen_buffer_size;
             if (buf == buf2) {
                 munmap(buf + size2 + qemu_real_host_page_size, size - size2);
             } else {
@@ -740,9 +916,9 @@ static inline void *alloc_code_gen_buffer(void)
 
 static inline void code_gen_alloc(size_t tb_size)
 {
-    tcg_ctx.code_gen_buffer_size = size_code_gen_buffer(tb_size);
-    tcg_ctx.code_gen_buffer = alloc_code_gen_buffer();
-    if (tcg_ctx.code_gen_buffer == NULL) {
+    tcg_init_ctx.code_gen_buffer_size = size_code_gen_buffer(tb_size);
+    tcg_init_ctx.code_gen_buffer = alloc_code_gen_buffer();
+    if (tcg_init_ctx.code_gen_buffer == NULL) {
         fprintf(stderr, "Could not allocate dynamic translator buffer\n");
         exit(1);
     }
@@ -750,18 +926,18 @@ static inline void code_gen_alloc(size_t tb_size)
     /* Estimate a good size for the number of TBs we can support.  We
        still haven't deducted the prologue from the buffer size here,
        but that's minimal and won't affect the estimate much.  */
-    tcg_ctx.code_gen_max_blocks
-        = tcg_ctx.code_gen_buffer_size / CODE_GEN_AVG_BLOCK_SIZE;
-    tcg_ctx.tb_ctx.tbs = g_new(TranslationBlock, tcg_ctx.code_gen_max_blocks);
+    tcg_init_ctx.code_gen_max_blocks
+        = tcg_init_ctx.code_gen_buffer_size / CODE_GEN_AVG_BLOCK_SIZE;
+    tb_ctx.tbs = g_new(TranslationBlock, tcg_init_ctx.code_gen_max_blocks);
 
-    qemu_mutex_init(&tcg_ctx.tb_ctx.tb_lock);
+    qemu_mutex_init(&tb_ctx.tb_lock);
 }
 
 static void tb_htable_init(void)
 {
     unsigned int mode = QHT_MODE_AUTO_RESIZE;
 
-    qht_init(&tcg_ctx.tb_ctx.htable, CODE_GEN_HTABLE_SIZE, mode);
+    qht_init(&tb_ctx.htable, CODE_GEN_HTABLE_SIZE, mode);
 }
 
 /* Must be called before using the QEMU cpus. 'tb_size' is the size
@@ -776,41 +952,75 @@ void tcg_exec_init(unsigned long tb_size)
 #if defined(CONFIG_SOFTMMU)
     /* There's no guest base to take into account, so go ahead and
        initialize the prologue now.  */
-    tcg_prologue_init(&tcg_ctx);
+    tcg_prologue_init(&tcg_init_ctx);
+    perf_report_prologue(tcg_init_ctx.code_gen_prologue,
+                         tcg_init_ctx.code_gen_buffer -
+                         tcg_init_ctx.code_gen_prologue);
 #endif
 }
 
 bool tcg_enabled(void)
 {
-    return tcg_ctx.code_gen_buffer != NULL;
+    return tcg_init_ctx.code_gen_buffer != NULL;
 }
 
-/* Allocate a new translation block. Flush the translation buffer if
-   too many translation blocks or too much generated code. */
+/* Allocate a new translation block in the region of this thread's
+   context.  Return NULL if there is no region or it has run out of TBs;
+   the caller then moves on to another region.  */
 static TranslationBlock *tb_alloc(target_ulong pc)
 {
+    TCGRegion *r = tcg_ctx->region;
     TranslationBlock *tb;
 
-    if (tcg_ctx.tb_ctx.nb_tbs >= tcg_ctx.code_gen_max_blocks) {
+    if (!r || r->nb_tbs >= tcg_regions.max_tbs) {
         return NULL;
     }
-    tb = &tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs++];
+    tb = &r->tbs[r->nb_tbs];
     tb->pc = pc;
+    tb->tc_ptr = tcg_ctx->code_gen_ptr;
     tb->cflags = 0;
-    tb->invalid = false;
+    /* Until tb_link_page makes it visible.  A translation that does not
+       complete leaves the TB behind, and nothing must invalidate it.  */
+    tb->invalid = true;
+    tb->exec_count = 0;
+    tb->taken_count = 0;
+    /* tb_find_pc may be searching the region from another thread.  */
+    atomic_mb_set(&r->nb_tbs, r->nb_tbs + 1);
+    atomic_inc(&tb_ctx.nb_tbs);
     return tb;
 }
 
 void tb_free(TranslationBlock *tb)
 {
+    TCGRegion *r = tcg_ctx->region;
+
     /* In practice this is mostly used for single use temporary TB
        Ignore the hard cases and just back up if this TB happens to
        be the last one generated.  */
-    if (tcg_ctx.tb_ctx.nb_tbs > 0 &&
-            tb == &tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs - 1]) {
-        tcg_ctx.code_gen_ptr = tb->tc_ptr;
-        tcg_ctx.tb_ctx.nb_tbs--;
+    if (r && r->nb_tbs > 0 && tb == &r->tbs[r->nb_tbs - 1]) {
+        tcg_ctx->code_gen_ptr = tb->tc_ptr;
+        atomic_set(&r->ptr, tb->tc_ptr);
+        atomic_set(&r->nb_tbs, r->nb_tbs - 1);
+        atomic_dec(&tb_ctx.nb_tbs);
+    }
+}
+
+static inline bool tb_region_is_empty(TCGRegion *r)
+{
+    return atomic_read(&r->ptr) == r->start;
+}
+
+/* Return the number of bytes of generated code in all regions.  */
+static inline size_t tb_code_size(void)
+{
+    size_t i, total = 0;
+
+    for (i = 0; i < tcg_regions.n; i++) {
+        TCGRegion *r = &tcg_regions.regions[i];
+
+        total += atomic_read(&r->ptr) - r->start;
     }
+    return total;
 }
 
 static inline void invalidate_page_bitmap(PageDesc *p)
@@ -859,45 +1069,44 @@ static void page_flush_tb(void)
 static void do_tb_flush(CPUState *cpu, void *data)
 {
     unsigned tb_flush_req = (unsigned) (uintptr_t) data;
+    size_t i;
 
     tb_lock();
 
     /* If it's already been done on request of another CPU,
      * just retry.
      */
-    if (tcg_ctx.tb_ctx.tb_flush_count != tb_flush_req) {
+    if (tb_ctx.tb_flush_count != tb_flush_req) {
         goto done;
     }
 
 #if defined(DEBUG_FLUSH)
-    printf("qemu: flush code_size=%ld nb_tbs=%d avg_tb_size=%ld\n",
-           (unsigned long)(tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer),
-           tcg_ctx.tb_ctx.nb_tbs, tcg_ctx.tb_ctx.nb_tbs > 0 ?
-           ((unsigned long)(tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer)) /
-           tcg_ctx.tb_ctx.nb_tbs : 0);
+    printf("qemu: flush code_size=%zu nb_tbs=%d avg_tb_size=%zu\n",
+           tb_code_size(), tb_ctx.nb_tbs, tb_ctx.nb_tbs > 0 ?
+           tb_code_size() / tb_ctx.nb_tbs : 0);
 #endif
-    if ((unsigned long)(tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer)
-        > tcg_ctx.code_gen_buffer_size) {
-        cpu_abort(cpu, "Internal error: code buffer overflow\n");
+    for (i = 0; i < tcg_regions.n; i++) {
+        if (tcg_regions.regions[i].ptr > tcg_regions.regions[i].end) {
+            cpu_abort(cpu, "Internal error: code buffer overflow\n");
+        }
     }
 
     CPU_FOREACH(cpu) {
-        int i;
-
         for (i = 0; i < TB_JMP_CACHE_SIZE; ++i) {
             atomic_set(&cpu->tb_jmp_cache[i], NULL);
         }
     }
 
-    tcg_ctx.tb_ctx.nb_tbs = 0;
-    qht_reset_size(&tcg_ctx.tb_ctx.htable, CODE_GEN_HTABLE_SIZE);
+    tcg_region_reset_all();
+    tb_ctx.nb_tbs = 0;
+    qht_reset_size(&tb_ctx.htable, CODE_GEN_HTABLE_SIZE);
     page_flush_tb();
 
-    tcg_ctx.code_gen_ptr = tcg_ctx.code_gen_buffer;
     /* XXX: flush processor icache at this point if cache flush is
        expensive */
-    atomic_mb_set(&tcg_ctx.tb_ctx.tb_flush_count,
-                  tcg_ctx.tb_ctx.tb_flush_count + 1);
+    atomic_mb_set(&tb_ctx.tb_flush_count,
+                  tb_ctx.tb_flush_count + 1);
+    perf_report_retire();
 
 done:
     tb_unlock();
@@ -906,7 +1115,7 @@ done:
 void tb_flush(CPUState *cpu)
 {
     if (tcg_enabled()) {
-        uintptr_t tb_flush_req = atomic_mb_read(&tcg_ctx.tb_ctx.tb_flush_count);
+        uintptr_t tb_flush_req = atomic_mb_read(&tb_ctx.tb_flush_count);
         async_safe_run_on_cpu(cpu, do_tb_flush, (void *) tb_flush_req);
     }
 }
@@ -928,7 +1137,7 @@ do_tb_invalidate_check(struct qht *ht, void *p, uint32_t hash, void *userp)
 static void tb_invalidate_check(target_ulong address)
 {
     address &= TARGET_PAGE_MASK;
-    qht_iter(&tcg_ctx.tb_ctx.htable, do_tb_invalidate_check, &address);
+    qht_iter(&tb_ctx.htable, do_tb_invalidate_check, &address);
 }
 
 static void
@@ -948,7 +1157,7 @@ do_tb_page_check(struct qht *ht, void *p, uint32_t hash, void *userp)
 /* verify that all the pages have correct rights for code */
 static void tb_page_check(void)
 {
-    qht_iter(&tcg_ctx.tb_ctx.htable, do_tb_page_check, NULL);
+    qht_iter(&tb_ctx.htable, do_tb_page_check, NULL);
 }
 
 #endif
@@ -1042,7 +1251,7 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     /* remove the TB from the hash list */
     phys_pc = tb->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK);
     h = tb_hash_func(phys_pc, tb->pc, tb->flags);
-    qht_remove(&tcg_ctx.tb_ctx.htable, tb, h);
+    qht_remove(&tb_ctx.htable, tb, h);
 
     /* remove the TB from the page list */
     if (tb->page_addr[0] != page_addr) {
@@ -1071,7 +1280,7 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     /* suppress any remaining jumps to this TB */
     tb_jmp_unlink(tb);
 
-    tcg_ctx.tb_ctx.tb_phys_invalidate_count++;
+    tb_ctx.tb_phys_invalidate_count++;
 }
 
 #ifdef CONFIG_SOFTMMU
@@ -1127,25 +1336,15 @@ static inline void tb_alloc_page(TranslationBlock *tb,
     invalidate_page_bitmap(p);
 
 #if defined(CONFIG_USER_ONLY)
-    if (p->flags & PAGE_WRITE) {
-        target_ulong addr;
-        PageDesc *p2;
+    if (page_get_flags(page_addr) & PAGE_WRITE) {
         int prot;
 
         /* force the host page as non writable (writes will have a
            page fault + mprotect overhead) */
         page_addr &= qemu_host_page_mask;
-        prot = 0;
-        for (addr = page_addr; addr < page_addr + qemu_host_page_size;
-            addr += TARGET_PAGE_SIZE) {
-
-            p2 = page_find(addr >> TARGET_PAGE_BITS);
-            if (!p2) {
-                continue;
-            }
-            prot |= p2->flags;
-            p2->flags &= ~PAGE_WRITE;
-          }
+        prot = pageflags_set_clear(page_addr,
+                                   page_addr + qemu_host_page_size - 1,
+                                   0, PAGE_WRITE);
         mprotect(g2h(page_addr), qemu_host_page_size,
                  (prot & PAGE_BITS) & ~PAGE_WRITE);
 #ifdef DEBUG_TB_INVALIDATE
@@ -1173,6 +1372,8 @@ static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
 {
     uint32_t h;
 
+    tb->invalid = false;
+
     /* add in the page list */
     tb_alloc_page(tb, 0, phys_pc & TARGET_PAGE_MASK);
     if (phys_page2 != -1) {
@@ -1183,20 +1384,104 @@ static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
 
     /* add in the hash table */
     h = tb_hash_func(phys_pc, tb->pc, tb->flags);
-    qht_insert(&tcg_ctx.tb_ctx.htable, tb, h);
+    qht_insert(&tb_ctx.htable, tb, h);
 
 #ifdef DEBUG_TB_CHECK
     tb_page_check();
 #endif
 }
 
-/* Called with mmap_lock held for user mode emulation.  */
+/* Return the oldest full region, which is the first one from
+   tcg_regions.next that no context owns.  Return NULL if there is an
+   empty region left, because the reclaim was already done on request
+   of another CPU or a full flush happened in the meantime, or if every
+   region is owned by a context.  */
+static TCGRegion *tb_region_oldest(bool *all_owned)
+{
+    TCGRegion *oldest = NULL;
+    size_t i;
+
+    *all_owned = true;
+    for (i = 0; i < tcg_regions.n; i++) {
+        TCGRegion *r = &tcg_regions.regions[(tcg_regions.next + i) %
+                                            tcg_regions.n];
+
+        if (r->owner) {
+            continue;
+        }
+        *all_owned = false;
+        if (tb_region_is_empty(r)) {
+            return NULL;
+        }
+        if (!oldest) {
+            oldest = r;
+        }
+    }
+    return oldest;
+}
+
+/* Reclaim the oldest full region.  Its TBs are invalidated, which also
+   unlinks any direct jumps into them from other regions, and it is
+   free again for the next context that runs out of space.  If every
+   region is owned by a context, there is nothing to reclaim and the
+   whole buffer is flushed instead.  */
+static void do_tb_region_reclaim(CPUState *cpu, void *data)
+{
+    TCGRegion *r;
+    bool all_owned;
+    int i;
+
+    tb_lock();
+
+    qemu_mutex_lock(&tcg_regions.lock);
+    r = tb_region_oldest(&all_owned);
+    qemu_mutex_unlock(&tcg_regions.lock);
+    if (!r) {
+        tb_unlock();
+        if (all_owned) {
+            do_tb_flush(cpu, (void *) (uintptr_t) tb_ctx.tb_flush_count);
+        }
+        return;
+    }
+
+    for (i = 0; i < r->nb_tbs; i++) {
+        TranslationBlock *tb = &r->tbs[i];
+
+        if (!atomic_read(&tb->invalid)) {
+            tb_phys_invalidate(tb, -1);
+        }
+    }
+    tb_ctx.nb_tbs -= r->nb_tbs;
+    r->nb_tbs = 0;
+    r->ptr = r->start;
+
+    atomic_mb_set(&tb_ctx.region_reclaim_count,
+                  tb_ctx.region_reclaim_count + 1);
+    perf_report_retire();
+
+    tb_unlock();
+}
+
+/* Called when this thread's context has no region left for new code.
+   As with tb_flush, the reclaim itself runs once all vCPUs have left
+   generated code and the translator.  */
+static void tb_region_reclaim(CPUState *cpu)
+{
+    async_safe_run_on_cpu(cpu, do_tb_region_reclaim, NULL);
+}
+
+/* Called with mmap_lock held for user mode emulation.  Without tb_lock,
+ * the code is generated in the region of this thread's context while
+ * other vCPUs translate into theirs, and tb_lock is only taken to link
+ * the new TB.
+ */
 TranslationBlock *tb_gen_code(CPUState *cpu,
                               target_ulong pc, target_ulong cs_base,
                               uint32_t flags, int cflags)
 {
     CPUArchState *env = cpu->env_ptr;
-    TranslationBlock *tb;
+    bool locked = have_tb_lock;
+    TranslationBlock *tb, *existing_tb;
     tb_page_addr_t phys_pc, phys_page2;
     target_ulong virt_page2;
     tcg_insn_unit *gen_code_buf;
@@ -1210,51 +1495,72 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         cflags |= CF_USE_ICOUNT;
     }
 
+ restart:
     tb = tb_alloc(pc);
     if (unlikely(!tb)) {
  buffer_overflow:
-        /* flush must be done */
-        tb_flush(cpu);
+        /* The region of this context is full.  Carry on in a free one
+           if there is any, otherwise a region must be reclaimed.  */
+        if (tb) {
+            tb_free(tb);
+        }
+        if (tcg_region_alloc(tcg_ctx)) {
+            goto restart;
+        }
+        tb_region_reclaim(cpu);
         mmap_unlock();
         cpu_loop_exit(cpu);
     }
 
-    gen_code_buf = tcg_ctx.code_gen_ptr;
-    tb->tc_ptr = gen_code_buf;
+    gen_code_buf = tb->tc_ptr;
     tb->cs_base = cs_base;
     tb->flags = flags;
     tb->cflags = cflags;
 
+#ifdef CONFIG_LINUX_USER
+    /* Reuse the code saved by an earlier run if possible.  */
+    gen_code_size = tb_cache_load(cpu, tb, tcg_ctx->code_gen_highwater -
+                                  (void *)gen_code_buf, &search_size);
+    if (gen_code_size) {
+        goto code_done;
+    }
+#endif
+
 #ifdef CONFIG_PROFILER
-    tcg_ctx.tb_count1++; /* includes aborted translations because of
+    tcg_ctx->prof.tb_count1++; /* includes aborted translations because of
                        exceptions */
     ti = profile_getclock();
 #endif
 
-    tcg_func_start(&tcg_ctx);
+    tcg_func_start(tcg_ctx);
 
-    tcg_ctx.cpu = ENV_GET_CPU(env);
+    tcg_ctx->cpu = ENV_GET_CPU(env);
+    tcg_ctx->tb_cflags = cflags;
     gen_intermediate_code(env, tb);
-    tcg_ctx.cpu = NULL;
+    tcg_ctx->cpu = NULL;
 
     trace_translate_block(tb, tb->pc, tb->tc_ptr);
 
     /* generate machine code */
     tb->jmp_reset_offset[0] = TB_JMP_RESET_OFFSET_INVALID;
     tb->jmp_reset_offset[1] = TB_JMP_RESET_OFFSET_INVALID;
-    tcg_ctx.tb_jmp_reset_offset = tb->jmp_reset_offset;
+    tcg_ctx->tb_jmp_reset_offset = tb->jmp_reset_offset;
 #ifdef USE_DIRECT_JUMP
-    tcg_ctx.tb_jmp_insn_offset = tb->jmp_insn_offset;
-    tcg_ctx.tb_jmp_target_addr = NULL;
+    tcg_ctx->tb_jmp_insn_offset = tb->jmp_insn_offset;
+    tcg_ctx->tb_jmp_target_addr = NULL;
 #else
-    tcg_ctx.tb_jmp_insn_offset = NULL;
-    tcg_ctx.tb_jmp_target_addr = tb->jmp_target_addr;
+    tcg_ctx->tb_jmp_insn_offset = NULL;
+    tcg_ctx->tb_jmp_target_addr = tb->jmp_target_addr;
 #endif
 
 #ifdef CONFIG_PROFILER
-    tcg_ctx.tb_count++;
-    tcg_ctx.interm_time += profile_getclock() - ti;
-    tcg_ctx.code_time -= profile_getclock();
+    tcg_ctx->prof.tb_count++;
+    tcg_ctx->prof.interm_time += profile_getclock() - ti;
+    tcg_ctx->prof.code_time -= profile_getclock();
+#endif
+
+#ifdef CONFIG_LINUX_USER
+    tcg_ctx->nb_code_relocs = tb_cache_wanted(cpu, tb) ? 0 : -1;
 #endif
 
     /* ??? Overflow could be handled better here.  In particular, we
@@ -1262,7 +1568,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
        the tcg optimization currently hidden inside tcg_gen_code.  All
        that should be required is to flush the TBs, allocate a new TB,
        re-initialize it per above, and re-do the actual code generation.  */
-    gen_code_size = tcg_gen_code(&tcg_ctx, tb);
+    gen_code_size = tcg_gen_code(tcg_ctx, tb);
     if (unlikely(gen_code_size < 0)) {
         goto buffer_overflow;
     }
@@ -1270,27 +1576,40 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     if (unlikely(search_size < 0)) {
         goto buffer_overflow;
     }
+#ifdef CONFIG_LINUX_USER
+    tb_cache_store(cpu, tb, gen_code_size, search_size);
+    tcg_ctx->nb_code_relocs = -1;
+#endif
 
 #ifdef CONFIG_PROFILER
-    tcg_ctx.code_time += profile_getclock();
-    tcg_ctx.code_in_len += tb->size;
-    tcg_ctx.code_out_len += gen_code_size;
-    tcg_ctx.search_out_len += search_size;
+    tcg_ctx->prof.code_time += profile_getclock();
+    tcg_ctx->prof.code_in_len += tb->size;
+    tcg_ctx->prof.code_out_len += gen_code_size;
+    if (tcg_ctx->data_gen_ptr) {
+        tcg_ctx->prof.data_out_len += (void *)gen_code_buf + gen_code_size
+                                      - tcg_ctx->data_gen_ptr;
+    }
+    tcg_ctx->prof.search_out_len += search_size;
 #endif
 
 #ifdef DEBUG_DISAS
     if (qemu_loglevel_mask(CPU_LOG_TB_OUT_ASM) &&
         qemu_log_in_addr_range(tb->pc)) {
         qemu_log("OUT: [size=%d]\n", gen_code_size);
-        log_disas(tb->tc_ptr, gen_code_size);
+        log_disas_code_and_data(tb->tc_ptr, gen_code_size,
+                                tcg_ctx->data_gen_ptr);
         qemu_log("\n");
         qemu_log_flush();
     }
 #endif
 
-    tcg_ctx.code_gen_ptr = (void *)
+#ifdef CONFIG_LINUX_USER
+ code_done:
+#endif
+    tcg_ctx->code_gen_ptr = (void *)
         ROUND_UP((uintptr_t)gen_code_buf + gen_code_size + search_size,
                  CODE_GEN_ALIGN);
+    atomic_set(&tcg_ctx->region->ptr, tcg_ctx->code_gen_ptr);
 
     /* init jump list */
     assert(((uintptr_t)tb & 3) == 0);
@@ -1312,12 +1631,29 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     if ((pc & TARGET_PAGE_MASK) != virt_page2) {
         phys_page2 = get_page_addr_code(env, virt_page2);
     }
-    /* As long as consistency of the TB stuff is provided by tb_lock in user
-     * mode and is implicit in single-threaded softmmu emulation, no explicit
-     * memory barrier is required before tb_link_page() makes the TB visible
-     * through the physical hash table and physical page list.
+    /* tb_lock orders the stores that initialised the TB before
+     * tb_link_page() makes it visible through the physical hash table
+     * and physical page list.
      */
+    if (!locked) {
+        tb_lock();
+
+        /* Another vCPU may have translated the same block meanwhile.
+         * Use its TB; ours is the last one of our region, so the space
+         * can be given back.
+         */
+        existing_tb = tb_htable_lookup(cpu, pc, cs_base, flags);
+        if (existing_tb) {
+            tb_free(tb);
+            tb_unlock();
+            return existing_tb;
+        }
+    }
+    perf_report_code(tb, gen_code_size);
     tb_link_page(tb, phys_pc, phys_page2);
+    if (!locked) {
+        tb_unlock();
+    }
     return tb;
 }
 
@@ -1333,6 +1669,14 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
 void tb_invalidate_phys_range(tb_page_addr_t start, tb_page_addr_t end)
 {
     while (start < end) {
+        tb_page_addr_t index = start >> TARGET_PAGE_BITS;
+
+        if (!page_find_next(&index, ((end - 1) >> TARGET_PAGE_BITS) + 1)) {
+            break;
+        }
+        if (index != start >> TARGET_PAGE_BITS) {
+            start = index << TARGET_PAGE_BITS;
+        }
         tb_invalidate_phys_page_range(start, end, 0);
         start &= TARGET_PAGE_MASK;
         start += TARGET_PAGE_SIZE;
@@ -1549,6 +1893,38 @@ static bool tb_invalidate_phys_page(tb_page_addr_t addr, uintptr_t pc)
 #endif
     return false;
 }
+
+#ifdef TARGET_HAS_PRECISE_SMC
+/* Called with mmap_lock held when the store at host PC PC faulted on a
+ * page that another thread has unprotected in the meantime.  If that
+ * invalidated the TB doing the store, do what tb_invalidate_phys_page
+ * would have done and return true: the caller must then exit the TB.
+ */
+static bool tb_invalidate_current(uintptr_t pc)
+{
+    TranslationBlock *tb;
+    CPUState *cpu = current_cpu;
+    target_ulong current_pc, current_cs_base;
+    uint32_t current_flags;
+
+    if (pc == 0 || cpu == NULL) {
+        return false;
+    }
+    tb_lock();
+    tb = tb_find_pc(pc);
+    if (!tb || !atomic_read(&tb->invalid) ||
+        (tb->cflags & CF_COUNT_MASK) == 1) {
+        tb_unlock();
+        return false;
+    }
+    cpu_restore_state_from_tb(cpu, tb, pc);
+    cpu_get_tb_cpu_state(cpu->env_ptr, &current_pc, &current_cs_base,
+                         &current_flags);
+    tb_gen_code(cpu, current_pc, current_cs_base, current_flags, 1);
+    tb_unlock();
+    return true;
+}
+#endif
 #endif
 
 /* find the TB 'tb' such that tb[0].tc_ptr <= tc_ptr <
@@ -1558,20 +1934,35 @@ static TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
     int m_min, m_max, m;
     uintptr_t v;
     TranslationBlock *tb;
+    TCGRegion *r;
+    size_t idx;
+    uintptr_t end;
+    int nb_tbs;
 
-    if (tcg_ctx.tb_ctx.nb_tbs <= 0) {
+    if (tc_ptr < (uintptr_t)tcg_init_ctx.code_gen_buffer) {
         return NULL;
     }
-    if (tc_ptr < (uintptr_t)tcg_ctx.code_gen_buffer ||
-        tc_ptr >= (uintptr_t)tcg_ctx.code_gen_ptr) {
+    idx = (tc_ptr - (uintptr_t)tcg_init_ctx.code_gen_buffer) /
+          tcg_regions.size;
+    if (idx >= tcg_regions.n) {
+        return NULL;
+    }
+    r = &tcg_regions.regions[idx];
+
+    /* The owner of the region may be adding TBs to it.  It counts a TB
+       before it moves ptr past its code, so read them the other way
+       round.  */
+    end = (uintptr_t)atomic_mb_read(&r->ptr);
+    nb_tbs = atomic_mb_read(&r->nb_tbs);
+    if (nb_tbs <= 0 || tc_ptr >= end) {
         return NULL;
     }
     /* binary search (cf Knuth) */
     m_min = 0;
-    m_max = tcg_ctx.tb_ctx.nb_tbs - 1;
+    m_max = nb_tbs - 1;
     while (m_min <= m_max) {
         m = (m_min + m_max) >> 1;
-        tb = &tcg_ctx.tb_ctx.tbs[m];
+        tb = &r->tbs[m];
         v = (uintptr_t)tb->tc_ptr;
         if (v == tc_ptr) {
             return tb;
@@ -1581,7 +1972,7 @@ static TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
             m_min = m + 1;
         }
     }
-    return &tcg_ctx.tb_ctx.tbs[m_max];
+    return &r->tbs[m_max];
 }
 
 #if !defined(CONFIG_USER_ONLY)
@@ -1599,11 +1990,14 @@ void tb_invalidate_phys_addr(AddressSpace *as, hwaddr addr)
         return;
     }
     ram_addr = memory_region_get_ram_addr(mr) + addr;
+    tb_lock();
     tb_invalidate_phys_page_range(ram_addr, ram_addr + 1, 0);
+    tb_unlock();
     rcu_read_unlock();
 }
 #endif /* !defined(CONFIG_USER_ONLY) */
 
+/* Called with tb_lock held.  */
 void tb_check_watchpoint(CPUState *cpu)
 {
     TranslationBlock *tb;
@@ -1640,6 +2034,8 @@ void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr)
     target_ulong pc, cs_base;
     uint32_t flags;
 
+    /* Released by cpu_loop_exit_noexc via tb_lock_reset.  */
+    tb_lock();
     tb = tb_find_pc(retaddr);
     if (!tb) {
         cpu_abort(cpu, "cpu_io_recompile: could not find TB for pc=%p",
@@ -1756,70 +2152,92 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
 {
     int i, target_code_size, max_target_code_size;
     int direct_jmp_count, direct_jmp2_count, cross_page;
+    size_t j, code_size, regions_used, regions_owned;
     TranslationBlock *tb;
     struct qht_stats hst;
 
+    tb_lock();
+
     target_code_size = 0;
     max_target_code_size = 0;
     cross_page = 0;
     direct_jmp_count = 0;
     direct_jmp2_count = 0;
-    for (i = 0; i < tcg_ctx.tb_ctx.nb_tbs; i++) {
-        tb = &tcg_ctx.tb_ctx.tbs[i];
-        target_code_size += tb->size;
-        if (tb->size > max_target_code_size) {
-            max_target_code_size = tb->size;
+    regions_used = 0;
+    regions_owned = 0;
+    for (j = 0; j < tcg_regions.n; j++) {
+        TCGRegion *r = &tcg_regions.regions[j];
+        int nb_tbs = atomic_read(&r->nb_tbs);
+
+        if (atomic_read(&r->owner)) {
+            regions_owned++;
         }
-        if (tb->page_addr[1] != -1) {
-            cross_page++;
+        if (!tb_region_is_empty(r)) {
+            regions_used++;
         }
-        if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
-            direct_jmp_count++;
-            if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
-                direct_jmp2_count++;
+        /* The last TB may still be under translation; its statistics
+           are only approximate.  */
+        for (i = 0; i < nb_tbs; i++) {
+            tb = &r->tbs[i];
+            target_code_size += tb->size;
+            if (tb->size > max_target_code_size) {
+                max_target_code_size = tb->size;
+            }
+            if (tb->page_addr[1] != -1) {
+                cross_page++;
+            }
+            if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
+                direct_jmp_count++;
+                if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
+                    direct_jmp2_count++;
+                }
             }
         }
     }
+    code_size = tb_code_size();
     /* XXX: avoid using doubles ? */
     cpu_fprintf(f, "Translation buffer state:\n");
-    cpu_fprintf(f, "gen code size       %td/%zd\n",
-                tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer,
-                tcg_ctx.code_gen_highwater - tcg_ctx.code_gen_buffer);
+    cpu_fprintf(f, "gen code size       %zu/%zu\n",
+                code_size, tcg_regions.n * tcg_regions.size);
+    cpu_fprintf(f, "code regions        %zu x %zu KiB (%zu in use, "
+                "%zu being filled)\n",
+                tcg_regions.n, tcg_regions.size / 1024,
+                regions_used, regions_owned);
     cpu_fprintf(f, "TB count            %d/%d\n",
-            tcg_ctx.tb_ctx.nb_tbs, tcg_ctx.code_gen_max_blocks);
+            tb_ctx.nb_tbs, tcg_init_ctx.code_gen_max_blocks);
     cpu_fprintf(f, "TB avg target size  %d max=%d bytes\n",
-            tcg_ctx.tb_ctx.nb_tbs ? target_code_size /
-                    tcg_ctx.tb_ctx.nb_tbs : 0,
+            tb_ctx.nb_tbs ? target_code_size /
+                    tb_ctx.nb_tbs : 0,
             max_target_code_size);
-    cpu_fprintf(f, "TB avg host size    %td bytes (expansion ratio: %0.1f)\n",
-            tcg_ctx.tb_ctx.nb_tbs ? (tcg_ctx.code_gen_ptr -
-                                     tcg_ctx.code_gen_buffer) /
-                                     tcg_ctx.tb_ctx.nb_tbs : 0,
-                target_code_size ? (double) (tcg_ctx.code_gen_ptr -
-                                             tcg_ctx.code_gen_buffer) /
-                                             target_code_size : 0);
+    cpu_fprintf(f, "TB avg host size    %zu bytes (expansion ratio: %0.1f)\n",
+            tb_ctx.nb_tbs ? code_size / tb_ctx.nb_tbs : 0,
+            target_code_size ? (double) code_size / target_code_size : 0);
     cpu_fprintf(f, "cross page TB count %d (%d%%)\n", cross_page,
-            tcg_ctx.tb_ctx.nb_tbs ? (cross_page * 100) /
-                                    tcg_ctx.tb_ctx.nb_tbs : 0);
+            tb_ctx.nb_tbs ? (cross_page * 100) /
+                                    tb_ctx.nb_tbs : 0);
     cpu_fprintf(f, "direct jump count   %d (%d%%) (2 jumps=%d %d%%)\n",
                 direct_jmp_count,
-                tcg_ctx.tb_ctx.nb_tbs ? (direct_jmp_count * 100) /
-                        tcg_ctx.tb_ctx.nb_tbs : 0,
+                tb_ctx.nb_tbs ? (direct_jmp_count * 100) /
+                        tb_ctx.nb_tbs : 0,
                 direct_jmp2_count,
-                tcg_ctx.tb_ctx.nb_tbs ? (direct_jmp2_count * 100) /
-                        tcg_ctx.tb_ctx.nb_tbs : 0);
+                tb_ctx.nb_tbs ? (direct_jmp2_count * 100) /
+                        tb_ctx.nb_tbs : 0);
 
-    qht_statistics_init(&tcg_ctx.tb_ctx.htable, &hst);
+    qht_statistics_init(&tb_ctx.htable, &hst);
     print_qht_statistics(f, cpu_fprintf, hst);
     qht_statistics_destroy(&hst);
 
     cpu_fprintf(f, "\nStatistics:\n");
     cpu_fprintf(f, "TB flush count      %u\n",
-            atomic_read(&tcg_ctx.tb_ctx.tb_flush_count));
+            atomic_read(&tb_ctx.tb_flush_count));
+    cpu_fprintf(f, "TB region reclaims  %u\n",
+            atomic_read(&tb_ctx.region_reclaim_count));
     cpu_fprintf(f, "TB invalidate count %d\n",
-            tcg_ctx.tb_ctx.tb_phys_invalidate_count);
+            tb_ctx.tb_phys_invalidate_count);
     cpu_fprintf(f, "TLB flush count     %d\n", tlb_flush_count);
     tcg_dump_info(f, cpu_fprintf);
+
+    tb_unlock();
 }
 
 void dump_opcount_info(FILE *f, fprintf_function cpu_fprintf)
@@ -1839,88 +2257,34 @@ void cpu_interrupt(CPUState *cpu, int mask)
  * Walks guest process memory "regions" one by one
  * and calls callback function 'fn' for each region.
  */
-struct walk_memory_regions_data {
-    walk_memory_regions_fn fn;
-    void *priv;
-    target_ulong start;
-    int prot;
-};
-
-static int walk_memory_regions_end(struct walk_memory_regions_data *data,
-                                   target_ulong end, int new_prot)
-{
-    if (data->start != -1u) {
-        int rc = data->fn(data->priv, data->start, end, data->prot);
-        if (rc != 0) {
-            return rc;
-        }
-    }
-
-    data->start = (new_prot ? end : -1u);
-    data->prot = new_prot;
-
-    return 0;
-}
-
-static int walk_memory_regions_1(struct walk_memory_regions_data *data,
-                                 target_ulong base, int level, void **lp)
+int walk_memory_regions(void *priv, walk_memory_regions_fn fn)
 {
-    target_ulong pa;
-    int i, rc;
-
-    if (*lp == NULL) {
-        return walk_memory_regions_end(data, base, 0);
-    }
-
-    if (level == 0) {
-        PageDesc *pd = *lp;
-
-        for (i = 0; i < V_L2_SIZE; ++i) {
-            int prot = pd[i].flags;
-
-            pa = base | (i << TARGET_PAGE_BITS);
-            if (prot != data->prot) {
-                rc = walk_memory_regions_end(data, pa, prot);
-                if (rc != 0) {
-                    return rc;
-                }
-            }
-        }
-    } else {
-        void **pp = *lp;
+    PageFlagsNode *p;
+    target_ulong start = 0, end = 0;
+    int prot = 0;
+    int rc = 0;
 
-        for (i = 0; i < V_L2_SIZE; ++i) {
-            pa = base | ((target_ulong)i <<
-                (TARGET_PAGE_BITS + V_L2_BITS * level));
-            rc = walk_memory_regions_1(data, pa, level - 1, pp + i);
+    mmap_lock();
+    for (p = pageflags_find(0, -1); p; p = pageflags_next(p, -1)) {
+        if (prot && (p->itree.start != end || p->flags != prot)) {
+            rc = fn(priv, start, end, prot);
             if (rc != 0) {
-                return rc;
+                break;
             }
+            prot = 0;
         }
-    }
-
-    return 0;
-}
-
-int walk_memory_regions(void *priv, walk_memory_regions_fn fn)
-{
-    struct walk_memory_regions_data data;
-    uintptr_t i, l1_sz = v_l1_size;
-
-    data.fn = fn;
-    data.priv = priv;
-    data.start = -1u;
-    data.prot = 0;
-
-    for (i = 0; i < l1_sz; i++) {
-        target_ulong base = i << (v_l1_shift + TARGET_PAGE_BITS);
-        int rc = walk_memory_regions_1(&data, base, v_l2_levels, l1_map + i);
-        if (rc != 0) {
-            return rc;
+        if (!prot) {
+            start = p->itree.start;
+            prot = p->flags;
         }
+        end = p->itree.last + 1;
     }
+    if (rc == 0 && prot) {
+        rc = fn(priv, start, end, prot);
+    }
+    mmap_unlock();
 
-    return walk_memory_regions_end(&data, 0, 0);
+    return rc;
 }
 
 static int dump_region(void *priv, target_ulong start,
@@ -1947,14 +2311,41 @@ void page_dump(FILE *f)
     walk_memory_regions(f, dump_region);
 }
 
+/* This does not need mmap_lock: the nodes are freed with RCU, and the
+   lookup is retried if it raced with an update of the tree.  Without the
+   lock, the result can of course be stale by the time the caller looks
+   at it.  */
 int page_get_flags(target_ulong address)
 {
-    PageDesc *p;
+    PageFlagsNode *p;
+    unsigned int seq;
+    int flags;
+
+    rcu_read_lock();
+    do {
+        seq = seqlock_read_begin(&pageflags_seq);
+        p = pageflags_node(interval_tree_lookup(&pageflags_root, address));
+        flags = p ? p->flags : 0;
+    } while (seqlock_read_retry(&pageflags_seq, seq));
+    rcu_read_unlock();
+
+    return flags;
+}
+
+/* Return the flags of the pages in [start, end) if they are all the
+   same, or -1.  The mmap_lock should already be held.  */
+int page_get_range_flags(target_ulong start, target_ulong end)
+{
+    PageFlagsNode *p;
+    target_ulong last = end - 1;
 
-    p = page_find(address >> TARGET_PAGE_BITS);
+    p = pageflags_find(start, last);
     if (!p) {
         return 0;
     }
+    if (p->itree.start > start || p->itree.last < last) {
+        return -1;
+    }
     return p->flags;
 }
 
@@ -1963,7 +2354,10 @@ int page_get_flags(target_ulong address)
    on PAGE_WRITE.  The mmap_lock should already be held.  */
 void page_set_flags(target_ulong start, target_ulong end, int flags)
 {
-    target_ulong addr, len;
+    PageFlagsNode *p, *next;
+    PageDesc *pd;
+    tb_page_addr_t index;
+    target_ulong last;
 
     /* This function should never be called with addresses outside the
        guest address space.  If this assert fires, it probably indicates
@@ -1974,33 +2368,51 @@ void page_set_flags(target_ulong start, target_ulong end, int flags)
     assert(start < end);
 
     start = start & TARGET_PAGE_MASK;
-    end = TARGET_PAGE_ALIGN(end);
+    last = TARGET_PAGE_ALIGN(end) - 1;
 
     if (flags & PAGE_WRITE) {
         flags |= PAGE_WRITE_ORG;
+
+        /* If the write protection bit is set, then we invalidate the
+           code inside.  Pages that are already writable contain no
+           code, so there is no need to look at the old flags.  */
+        index = start >> TARGET_PAGE_BITS;
+        while ((pd = page_find_next(&index, (last >> TARGET_PAGE_BITS) + 1))) {
+            if (pd->first_tb) {
+                tb_invalidate_phys_page(index << TARGET_PAGE_BITS, 0);
+            }
+            index++;
+        }
     }
 
-    for (addr = start, len = end - start;
-         len != 0;
-         len -= TARGET_PAGE_SIZE, addr += TARGET_PAGE_SIZE) {
-        PageDesc *p = page_find_alloc(addr >> TARGET_PAGE_BITS, 1);
+    seqlock_write_begin(&pageflags_seq);
+    for (p = pageflags_find(start, last); p; p = next) {
+        target_ulong p_start = p->itree.start;
+        target_ulong p_last = p->itree.last;
+        int p_flags = p->flags;
 
-        /* If the write protection bit is set, then we invalidate
-           the code inside.  */
-        if (!(p->flags & PAGE_WRITE) &&
-            (flags & PAGE_WRITE) &&
-            p->first_tb) {
-            tb_invalidate_phys_page(addr, 0);
+        next = pageflags_next(p, last);
+        pageflags_remove(p);
+        if (p_start < start) {
+            pageflags_create(p_start, start - 1, p_flags);
+        }
+        if (p_last > last) {
+            pageflags_create(last + 1, p_last, p_flags);
         }
-        p->flags = flags;
     }
+    if (flags) {
+        pageflags_create(start, last, flags);
+        pageflags_coalesce(start, last);
+    }
+    seqlock_write_end(&pageflags_seq);
 }
 
 int page_check_range(target_ulong start, target_ulong len, int flags)
 {
-    PageDesc *p;
-    target_ulong end;
-    target_ulong addr;
+    PageFlagsNode *p;
+    target_ulong last, p_last;
+    unsigned int seq;
+    int page_flags;
 
     /* This function should never be called with addresses outside the
        guest address space.  If this assert fires, it probably indicates
@@ -2017,38 +2429,43 @@ int page_check_range(target_ulong start, target_ulong len, int flags)
         return -1;
     }
 
-    /* must do before we loose bits in the next step */
-    end = TARGET_PAGE_ALIGN(start + len);
-    start = start & TARGET_PAGE_MASK;
+    last = start + len - 1;
+    for (;;) {
+        /* Look up the mapping containing START, then check it as a
+           whole.  */
+        rcu_read_lock();
+        do {
+            seq = seqlock_read_begin(&pageflags_seq);
+            p = pageflags_node(interval_tree_lookup(&pageflags_root, start));
+            page_flags = p ? p->flags : 0;
+            p_last = p ? p->itree.last : 0;
+        } while (seqlock_read_retry(&pageflags_seq, seq));
+        rcu_read_unlock();
 
-    for (addr = start, len = end - start;
-         len != 0;
-         len -= TARGET_PAGE_SIZE, addr += TARGET_PAGE_SIZE) {
-        p = page_find(addr >> TARGET_PAGE_BITS);
-        if (!p) {
-            return -1;
-        }
-        if (!(p->flags & PAGE_VALID)) {
+        if (!(page_flags & PAGE_VALID)) {
             return -1;
         }
-
-        if ((flags & PAGE_READ) && !(p->flags & PAGE_READ)) {
+        if ((flags & PAGE_READ) && !(page_flags & PAGE_READ)) {
             return -1;
         }
         if (flags & PAGE_WRITE) {
-            if (!(p->flags & PAGE_WRITE_ORG)) {
+            if (!(page_flags & PAGE_WRITE_ORG)) {
                 return -1;
             }
             /* unprotect the page if it was put read-only because it
-               contains translated code */
-            if (!(p->flags & PAGE_WRITE)) {
-                if (!page_unprotect(addr, 0)) {
+               contains translated code, and look at the flags again */
+            if (!(page_flags & PAGE_WRITE)) {
+                if (!page_unprotect(start, 0)) {
                     return -1;
                 }
+                continue;
             }
         }
+        if (p_last >= last) {
+            return 0;
+        }
+        start = p_last + 1;
     }
-    return 0;
 }
 
 /* called from signal handler: invalidate the code and unprotect the
@@ -2061,48 +2478,71 @@ int page_unprotect(target_ulong address, uintptr_t pc)
 {
     unsigned int prot;
     bool current_tb_invalidated;
-    PageDesc *p;
     target_ulong host_start, host_end, addr;
+    int flags;
+
+    /* When several threads store to the same page of translated code,
+       they all fault but only the first one has work to do.  The others
+       find the page writable again and can simply retry the store,
+       without waiting for mmap_lock.  With precise SMC, however, the
+       TB doing the store may have been invalidated meanwhile; that needs
+       the lock to sort out.  */
+    flags = page_get_flags(address);
+    if (!(flags & PAGE_WRITE_ORG)) {
+        return 0;
+    }
+#ifdef TARGET_HAS_PRECISE_SMC
+    if ((flags & PAGE_WRITE) && pc == 0) {
+        return 1;
+    }
+#else
+    if (flags & PAGE_WRITE) {
+        return 1;
+    }
+#endif
 
     /* Technically this isn't safe inside a signal handler.  However we
        know this only ever happens in a synchronous SEGV handler, so in
        practice it seems to be ok.  */
     mmap_lock();
 
-    p = page_find(address >> TARGET_PAGE_BITS);
-    if (!p) {
+    flags = page_get_flags(address);
+    if (!(flags & PAGE_WRITE_ORG)) {
         mmap_unlock();
         return 0;
     }
 
-    /* if the page was really writable, then we change its
-       protection back to writable */
-    if ((p->flags & PAGE_WRITE_ORG) && !(p->flags & PAGE_WRITE)) {
-        host_start = address & qemu_host_page_mask;
-        host_end = host_start + qemu_host_page_size;
-
-        prot = 0;
+    if (flags & PAGE_WRITE) {
+        /* Another thread got here first, made the page writable and
+           invalidated the TBs in it.  */
         current_tb_invalidated = false;
-        for (addr = host_start ; addr < host_end ; addr += TARGET_PAGE_SIZE) {
-            p = page_find(addr >> TARGET_PAGE_BITS);
-            p->flags |= PAGE_WRITE;
-            prot |= p->flags;
-
-            /* and since the content will be modified, we must invalidate
-               the corresponding translated code. */
-            current_tb_invalidated |= tb_invalidate_phys_page(addr, pc);
-#ifdef DEBUG_TB_CHECK
-            tb_invalidate_check(addr);
+#ifdef TARGET_HAS_PRECISE_SMC
+        current_tb_invalidated = tb_invalidate_current(pc);
 #endif
-        }
-        mprotect((void *)g2h(host_start), qemu_host_page_size,
-                 prot & PAGE_BITS);
-
         mmap_unlock();
-        /* If current TB was invalidated return to main loop */
         return current_tb_invalidated ? 2 : 1;
     }
+
+    /* the page was really writable, so we change its protection
+       back to writable */
+    host_start = address & qemu_host_page_mask;
+    host_end = host_start + qemu_host_page_size;
+
+    prot = pageflags_set_clear(host_start, host_end - 1, PAGE_WRITE, 0);
+    current_tb_invalidated = false;
+    for (addr = host_start ; addr < host_end ; addr += TARGET_PAGE_SIZE) {
+        /* and since the content will be modified, we must invalidate
+           the corresponding translated code. */
+        current_tb_invalidated |= tb_invalidate_phys_page(addr, pc);
+#ifdef DEBUG_TB_CHECK
+        tb_invalidate_check(addr);
+#endif
+    }
+    mprotect((void *)g2h(host_start), qemu_host_page_size,
+             prot & PAGE_BITS);
+
     mmap_unlock();
-    return 0;
+    /* If current TB was invalidated return to main loop */
+    return current_tb_invalidated ? 2 : 1;
 }
 #endif /* CONFIG_USER_ONLY */
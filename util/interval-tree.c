@@ -0,0 +1,183 @@
+/*
+ * interval-tree.c - Interval tree of disjoint ranges
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ *
+ * The tree is a treap: a binary search tree ordered by the start of the
+ * ranges, which is also a heap ordered by a pseudo-random priority.
+ * This keeps it balanced on average without storing any state besides
+ * the priority, and all the restructuring is done with rotations.
+ *
+ * Because the ranges are disjoint, ordering them by start also orders
+ * them by last, so that no per-node maximum is needed to search them.
+ *
+ * Concurrent readers only follow the child pointers.  These are updated
+ * with atomic_rcu_set, in an order that never makes a cycle visible, so
+ * a reader always reaches a leaf; it might however miss the node it is
+ * looking for, if it was moved by a concurrent rotation.
+ */
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/interval-tree.h"
+
+/* Nodes do not move in the address space, so derive their priority
+   from their start rather than keeping random number generator state.  */
+static uint32_t interval_tree_priority(uint64_t start)
+{
+    start ^= start >> 33;
+    start *= 0xff51afd7ed558ccdull;
+    start ^= start >> 33;
+    start *= 0xc4ceb9fe1a85ec53ull;
+    start ^= start >> 33;
+    return start;
+}
+
+/* Lift the left child of *LINK above it.  */
+static void rotate_right(IntervalTreeNode **link)
+{
+    IntervalTreeNode *p = *link;
+    IntervalTreeNode *l = p->left;
+
+    atomic_rcu_set(&p->left, l->right);
+    atomic_rcu_set(&l->right, p);
+    atomic_rcu_set(link, l);
+}
+
+/* Lift the right child of *LINK above it.  */
+static void rotate_left(IntervalTreeNode **link)
+{
+    IntervalTreeNode *p = *link;
+    IntervalTreeNode *r = p->right;
+
+    atomic_rcu_set(&p->right, r->left);
+    atomic_rcu_set(&r->left, p);
+    atomic_rcu_set(link, r);
+}
+
+void interval_tree_init(IntervalTree *tree)
+{
+    tree->root = NULL;
+}
+
+static void interval_tree_insert_1(IntervalTreeNode **link,
+                                   IntervalTreeNode *node)
+{
+    IntervalTreeNode *p = *link;
+
+    if (p == NULL) {
+        atomic_rcu_set(link, node);
+        return;
+    }
+
+    g_assert(node->last < p->start || node->start > p->last);
+    if (node->start < p->start) {
+        interval_tree_insert_1(&p->left, node);
+        if (p->left->priority > p->priority) {
+            rotate_right(link);
+        }
+    } else {
+        interval_tree_insert_1(&p->right, node);
+        if (p->right->priority > p->priority) {
+            rotate_left(link);
+        }
+    }
+}
+
+void interval_tree_insert(IntervalTree *tree, IntervalTreeNode *node)
+{
+    g_assert(node->start <= node->last);
+    node->left = NULL;
+    node->right = NULL;
+    node->priority = interval_tree_priority(node->start);
+    interval_tree_insert_1(&tree->root, node);
+}
+
+static void interval_tree_remove_1(IntervalTreeNode **link,
+                                   IntervalTreeNode *node)
+{
+    IntervalTreeNode *p = *link;
+
+    g_assert(p != NULL);
+    if (p != node) {
+        interval_tree_remove_1(node->start < p->start ? &p->left : &p->right,
+                               node);
+        return;
+    }
+
+    /* Rotate the node down until it has at most one child, then replace
+       it with that child.  The node keeps its child pointers, so that
+       readers that are looking at it can still go on.  */
+    if (p->left == NULL) {
+        atomic_rcu_set(link, p->right);
+    } else if (p->right == NULL) {
+        atomic_rcu_set(link, p->left);
+    } else if (p->left->priority > p->right->priority) {
+        rotate_right(link);
+        interval_tree_remove_1(&(*link)->right, node);
+    } else {
+        rotate_left(link);
+        interval_tree_remove_1(&(*link)->left, node);
+    }
+}
+
+void interval_tree_remove(IntervalTree *tree, IntervalTreeNode *node)
+{
+    interval_tree_remove_1(&tree->root, node);
+}
+
+IntervalTreeNode *interval_tree_lookup(IntervalTree *tree, uint64_t addr)
+{
+    IntervalTreeNode *p = atomic_rcu_read(&tree->root);
+
+    while (p != NULL) {
+        if (addr < p->start) {
+            p = atomic_rcu_read(&p->left);
+        } else if (addr > p->last) {
+            p = atomic_rcu_read(&p->right);
+        } else {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/* Return the node with the lowest start among those whose last is at
+   least ADDR, i.e. the node containing ADDR or else the one after it.  */
+static IntervalTreeNode *interval_tree_lower_bound(IntervalTree *tree,
+                                                   uint64_t addr)
+{
+    IntervalTreeNode *p = atomic_rcu_read(&tree->root);
+    IntervalTreeNode *ret = NULL;
+
+    while (p != NULL) {
+        if (p->last >= addr) {
+            ret = p;
+            if (p->start <= addr) {
+                break;
+            }
+            p = atomic_rcu_read(&p->left);
+        } else {
+            p = atomic_rcu_read(&p->right);
+        }
+    }
+    return ret;
+}
+
+IntervalTreeNode *interval_tree_iter_first(IntervalTree *tree,
+                                           uint64_t start, uint64_t last)
+{
+    IntervalTreeNode *p = interval_tree_lower_bound(tree, start);
+
+    return p && p->start <= last ? p : NULL;
+}
+
+IntervalTreeNode *interval_tree_iter_next(IntervalTree *tree,
+                                          IntervalTreeNode *node,
+                                          uint64_t last)
+{
+    if (node->last >= last) {
+        return NULL;
+    }
+    return interval_tree_iter_first(tree, node->last + 1, last);
+}
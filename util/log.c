@@ -272,6 +272,8 @@ const QEMULogItem qemu_log_items[] = {
     { CPU_LOG_TB_NOCHAIN, "nochain",
       "do not chain compiled TBs so that \"exec\" and \"cpu\" show\n"
       "complete traces" },
+    { CPU_LOG_TB_CACHE, "tb_cache",
+      "linux-user only: show how many blocks -tb-cache loaded and stored" },
     { 0, NULL, NULL },
 };
 